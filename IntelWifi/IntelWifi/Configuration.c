@@ -8,6 +8,8 @@
 
 #include "Configuration.h"
 
+#include <libkern/OSAtomic.h>
+
 struct pci_device_id {
     __u32 vendor, device;        /* Vendor and device ID or PCI_ANY_ID*/
     __u32 subvendor, subdevice;    /* Subsystem ID's or PCI_ANY_ID */
@@ -242,12 +244,75 @@ static const struct pci_device_id iwl_hw_card_ids[] = {
    
 };
 
+/*
+ * Lookup index over iwl_hw_card_ids, sorted by (device, subdevice). The
+ * table itself stays grouped by series so new IDs can be merged straight
+ * from the Linux driver. The sort is stable, so like the old linear scan
+ * the first entry of a duplicate wins. An entry with PCI_ANY_ID as the
+ * subdevice sorts last for its device and serves as the default cfg for
+ * subdevices that aren't listed.
+ */
+static u16 iwl_hw_card_index[ARRAY_SIZE(iwl_hw_card_ids)];
+static volatile UInt32 iwl_hw_card_index_state; /* 0 - empty, 1 - building, 2 - ready */
+
+static inline u64 iwl_hw_card_key(u32 device, u32 subdevice)
+{
+    return ((u64)device << 32) | subdevice;
+}
+
+static inline u64 iwl_hw_card_entry_key(int idx)
+{
+    return iwl_hw_card_key(iwl_hw_card_ids[idx].device, iwl_hw_card_ids[idx].subdevice);
+}
+
+static void iwl_hw_card_index_build(void)
+{
+    int i, j;
+    
+    /* insertion sort, runs once over a few hundred entries */
+    for (i = 0; i < ARRAY_SIZE(iwl_hw_card_ids); i++) {
+        u64 key = iwl_hw_card_entry_key(i);
+        
+        for (j = i; j > 0 && iwl_hw_card_entry_key(iwl_hw_card_index[j - 1]) > key; j--)
+            iwl_hw_card_index[j] = iwl_hw_card_index[j - 1];
+        iwl_hw_card_index[j] = i;
+    }
+}
+
+/* first entry matching @key, or NULL */
+static const struct pci_device_id *iwl_hw_card_find(u64 key)
+{
+    size_t l = 0, u = ARRAY_SIZE(iwl_hw_card_ids);
+    
+    while (l < u) {
+        size_t idx = (l + u) / 2;
+        
+        if (iwl_hw_card_entry_key(iwl_hw_card_index[idx]) < key)
+            l = idx + 1;
+        else
+            u = idx;
+    }
+    
+    if (l < ARRAY_SIZE(iwl_hw_card_ids) && iwl_hw_card_entry_key(iwl_hw_card_index[l]) == key)
+        return &iwl_hw_card_ids[iwl_hw_card_index[l]];
+    
+    return NULL;
+}
+
 struct iwl_cfg* getConfiguration(u16 deviceId, u16 subSystemId) {
-    for (int i = 0; i < ARRAY_SIZE(iwl_hw_card_ids); i++) {
-        if (iwl_hw_card_ids[i].device == deviceId && iwl_hw_card_ids[i].subdevice == subSystemId) {
-            return (struct iwl_cfg *)iwl_hw_card_ids[i].driver_data;
+    const struct pci_device_id *id;
+    
+    while (iwl_hw_card_index_state != 2) {
+        if (OSCompareAndSwap(0, 1, &iwl_hw_card_index_state)) {
+            iwl_hw_card_index_build();
+            OSMemoryBarrier();
+            iwl_hw_card_index_state = 2;
         }
     }
     
-    return NULL;
+    id = iwl_hw_card_find(iwl_hw_card_key(deviceId, subSystemId));
+    if (!id)
+        id = iwl_hw_card_find(iwl_hw_card_key(deviceId, (u32)PCI_ANY_ID));
+    
+    return id ? (struct iwl_cfg *)id->driver_data : NULL;
 }
@@ -10,6 +10,7 @@ extern "C" {
 #include "Mvm/IwlMvmOpMode.hpp"
 
 #include "os/log.h"
+#include <pexpert/pexpert.h>
 
 #include "IO80211WorkLoop.h"
 
@@ -27,10 +28,39 @@ static struct MediumTable
     {kIOMediumIEEE80211Auto, 0}
 };
 
+/*
+ * iwl_drv_stop() keeps the parsed firmware around for the next start of the
+ * driver, it's only released when the kext is unloaded.
+ */
+static struct FirmwareCacheReaper {
+    ~FirmwareCacheReaper() {
+        iwl_drv_fw_cache_flush();
+    }
+} sFirmwareCacheReaper;
+
 
 bool IntelWifi::init(OSDictionary *properties) {
     os_log(OS_LOG_DEFAULT, "Driver init()");
-    return super::init(properties);
+    if (!super::init(properties))
+        return false;
+    
+    parseModParams();
+    return true;
+}
+
+/*
+ * CUSTOM: the module parameters that can be tuned on macOS are read from
+ * the boot-args, as iwl_<name>=<value>.
+ */
+void IntelWifi::parseModParams() {
+    UInt32 val;
+    
+    if (PE_parse_boot_argn("iwl_rx_inline", &val, sizeof(val)))
+        iwlwifi_mod_params.rx_inline = val != 0;
+    if (PE_parse_boot_argn("iwl_rx_budget", &val, sizeof(val)))
+        iwlwifi_mod_params.rx_budget = val;
+    if (PE_parse_boot_argn("iwl_fw_load_plan", &val, sizeof(val)))
+        iwlwifi_mod_params.fw_load_plan = val != 0;
 }
 
 void IntelWifi::free() {
@@ -95,6 +125,12 @@ ret = opmode->set##REQ(interface, (struct DATA_TYPE* )data); \
             break;
         case APPLE80211_IOC_PHY_MODE: // 14
             IOCTL_GET(request_type, PHY_MODE, apple80211_phymode_data);
+        case APPLE80211_IOC_INT_MIT: // 18
+            if (isGet)
+                ret = getINT_MIT(interface, (struct apple80211_intmit_data *)data);
+            else
+                ret = setINT_MIT(interface, (struct apple80211_intmit_data *)data);
+            break;
         case APPLE80211_IOC_POWER: // 19
             IOCTL_GET(request_type, POWER, apple80211_power_data);
             IOCTL_SET(request_type, POWER, apple80211_power_data);
@@ -109,6 +145,33 @@ ret = opmode->set##REQ(interface, (struct DATA_TYPE* )data); \
     return ret;
 }
 
+IOReturn IntelWifi::getINT_MIT(IO80211Interface *interface, struct apple80211_intmit_data *md) {
+    if (!fTrans)
+        return kIOReturnNotReady;
+    
+    md->version = APPLE80211_VERSION;
+    md->int_mit = IWL_TRANS_GET_PCIE_TRANS(fTrans)->int_mit.adaptive ? APPLE80211_INT_MIT_AUTO : APPLE80211_INT_MIT_OFF;
+    return kIOReturnSuccess;
+}
+
+IOReturn IntelWifi::setINT_MIT(IO80211Interface *interface, struct apple80211_intmit_data *md) {
+    if (!fTrans || !md)
+        return kIOReturnError;
+    
+    if (md->int_mit != APPLE80211_INT_MIT_OFF && md->int_mit != APPLE80211_INT_MIT_AUTO)
+        return kIOReturnBadArgument;
+    
+    // The moderation state belongs to the interrupt workloop
+    return fIrqLoop->runAction(&IntelWifi::intMitAction, this, (void *)(uintptr_t)md->int_mit);
+}
+
+IOReturn IntelWifi::intMitAction(OSObject *owner, void *arg0, void *arg1, void *arg2, void *arg3) {
+    IntelWifi *me = (IntelWifi *)owner;
+    
+    me->iwl_pcie_int_mit_reset(me->fTrans, (uintptr_t)arg0 == APPLE80211_INT_MIT_AUTO);
+    return kIOReturnSuccess;
+}
+
 bool IntelWifi::createWorkLoop() {
     if (!fWorkLoop) {
         fWorkLoop = IO80211WorkLoop::workLoop();
@@ -159,13 +222,33 @@ bool IntelWifi::start(IOService *provider) {
     }
     gate->enable();
     
+    fTxBatchTimer = IOTimerEventSource::timerEventSource(this, &IntelWifi::txBatchTimeout);
+    if (!fTxBatchTimer || fWorkLoop->addEventSource(fTxBatchTimer) != kIOReturnSuccess) {
+        TraceLog("TX batch timer registration failed");
+        releaseAll();
+        return false;
+    }
+    
+    fIntMitPollTimer = IOTimerEventSource::timerEventSource(this, &IntelWifi::intMitPollTimeout);
+    if (!fIntMitPollTimer || fIrqLoop->addEventSource(fIntMitPollTimer) != kIOReturnSuccess) {
+        TraceLog("Interrupt moderation timer registration failed");
+        releaseAll();
+        return false;
+    }
+    
     fTrans = iwl_trans_pcie_alloc(fConfiguration);
     if (!fTrans) {
         TraceLog("iwl_trans_pcie_alloc failed");
         releaseAll();
         return false;
     }
-    fTrans->mbuf_cursor = IOMbufNaturalMemoryCursor::withSpecification(PAGE_SIZE, 1);
+    if (!createRxWorkers()) {
+        TraceLog("RX workers init failed, draining RX on the interrupt workloop");
+        releaseRxWorkers();
+    }
+    
+    /* a whole page doesn't fit in the 12 bit length of a legacy TB */
+    fTrans->tx_mbuf_cursor = IOMbufNaturalMemoryCursor::withSpecification(IWL_TFD_MAX_TB_LEN, fTrans->max_skb_frags);
     fTrans->dev = this;
     fTrans->gate = gate;
     
@@ -234,8 +317,6 @@ bool IntelWifi::start(IOService *provider) {
         setIdleTimerPeriod(iwlwifi_mod_params.d0i3_timeout);
     }
     
-    transOps = new IwlTransOps(this);
-    
     switch (fTrans->drv->fw.type) {
         case IWL_FW_DVM:
 //            opmode = new IwlDvmOpMode(transOps);
@@ -277,7 +358,17 @@ void IntelWifi::stop(IOService *provider) {
             fInterruptSource->disable();
             fWorkLoop->removeEventSource(fInterruptSource);
         }
+        if (fTxBatchTimer) {
+            fTxBatchTimer->cancelTimeout();
+            fWorkLoop->removeEventSource(fTxBatchTimer);
+        }
     }
+    if (fIrqLoop && fIntMitPollTimer) {
+        fIntMitPollTimer->cancelTimeout();
+        fIrqLoop->removeEventSource(fIntMitPollTimer);
+    }
+    
+    releaseRxWorkers();
     
 
 //    opmode->stop(hw->priv);
@@ -358,34 +449,6 @@ IOReturn IntelWifi::gateAction(OSObject *owner, void *arg0, void *arg1, void *ar
     return kIOReturnSuccess;
 }
 
-bool IntelWifi::interruptFilter(OSObject* owner, IOFilterInterruptEventSource * src) {
-    IntelWifi* me = (IntelWifi*)owner;
-
-    if (me == 0) {
-        TraceLog("Interrupt filter");
-        return false;
-    }
-
-    /* Disable (but don't clear!) interrupts here to avoid
-     * back-to-back ISRs and sporadic interrupts from our NIC.
-     * If we have something to service, the tasklet will re-enable ints.
-     * If we *don't* have something, we'll re-enable before leaving here.
-     */
-    iwl_write32(me->fTrans, CSR_INT_MASK, 0x00000000);
-    
-    return true;
-}
-
-void IntelWifi::interruptOccured(OSObject* owner, IOInterruptEventSource* sender, int count) {
-    IntelWifi* me = (IntelWifi*)owner;
-    
-    if (me == 0) {
-        return;
-    }
-    
-    me->iwl_pcie_irq_handler(0, me->fTrans);
-}
-
 IO80211Interface *IntelWifi::getNetworkInterface() {
     return netif;
 }
@@ -451,7 +514,10 @@ int IntelWifi::findMSIInterruptTypeIndex() {
  * Release all internal fields
  */
 void IntelWifi::releaseAll() {
+    releaseRxWorkers();
     RELEASE(fInterruptSource);
+    RELEASE(fTxBatchTimer);
+    RELEASE(fIntMitPollTimer);
     RELEASE(fWorkLoop);
     RELEASE(mediumDict);
     
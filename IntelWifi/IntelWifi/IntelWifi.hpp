@@ -37,6 +37,8 @@ extern "C" {
 #include "TransOps.h"
 #include "IwlOpModeOps.h"
 
+class IwlTransOps;
+
 
 // Configuration
 #define CONFIG_IWLMVM // Need NVM mode at least to see that code is compiling
@@ -64,6 +66,10 @@ class IntelWifi : public IO80211Controller
 {
     OSDeclareDefaultStructors(IntelWifi)
     
+    /* the specialized TX/RX paths call straight into the transport */
+    friend class IwlTransOps;
+    template <class TFD, class RBD> friend class IwlTransOpsT;
+    
 public:
     bool init(OSDictionary *properties) override;
     void free() override;
@@ -81,6 +87,7 @@ public:
     IO80211Interface *getNetworkInterface();
     IOReturn setPromiscuousMode(bool active) override;
     IOReturn setMulticastMode(bool active) override;
+    UInt32 outputPacket(mbuf_t m, void *param) override;
     SInt32 monitorModeSetEnabled(IO80211Interface*, bool, unsigned int) override {
         return kIOReturnSuccess;
     }
@@ -93,11 +100,46 @@ public:
     int iwl_trans_pcie_start_hw(struct iwl_trans *trans, bool low_power); // line 1675
     void iwl_trans_pcie_op_mode_leave(struct iwl_trans *trans); // line 1687
     IwlOpModeOps *opmode;
+    
+    /* CUSTOM: last firmware error dump, for the user client */
+    size_t readFwDump(void *buf, size_t size, u32 *seq) {
+        return fTrans ? iwl_trans_pcie_fw_dump_read(fTrans, buf, size, seq) : 0;
+    }
+    
+    /* CUSTOM: copy of the latency histograms if @buf is big enough, returns their size */
+    size_t readLatency(void *buf, size_t size, bool reset) {
+        struct iwl_lat_stats *lat = fTrans ? fTrans->lat : NULL;
+        
+        if (!lat)
+            return 0;
+        if (buf && size >= sizeof(*lat)) {
+            memcpy(buf, lat, sizeof(*lat));
+            if (reset)
+                iwl_lat_reset(lat);
+        }
+        return sizeof(*lat);
+    }
+    
+    /* CUSTOM: host command profile, up to @max records */
+    u32 readCmdProf(struct iwl_cmd_prof_rec *recs, u32 max, bool reset) {
+        return fTrans ? iwl_trans_cmd_prof_read(fTrans, recs, max, reset) : 0;
+    }
+    
+    /* CUSTOM: RX handler profile, up to @max records */
+    u32 readRxProf(struct iwl_rx_prof_rec *recs, u32 max, bool reset, u64 *elapsed_ns, u32 *copy_fails) {
+        *elapsed_ns = 0;
+        *copy_fails = 0;
+        return fTrans ? iwl_trans_rx_prof_read(fTrans, recs, max, reset, elapsed_ns, copy_fails) : 0;
+    }
 private:
     bool createMediumDict();
+    void parseModParams();
     inline void releaseAll();
     
     static void interruptOccured(OSObject* owner, IOInterruptEventSource* sender, int count);
+    static void rxWorkerOccured(OSObject* owner, IOInterruptEventSource* sender, int count);
+    bool createRxWorkers();
+    void releaseRxWorkers();
     static bool interruptFilter(OSObject* owner, IOFilterInterruptEventSource * src);
     static IOReturn gateAction(OSObject *owner, void *arg0, void *arg1, void *arg2, void *arg3);
     
@@ -144,7 +186,17 @@ private:
     void iwl_pcie_handle_rfkill_irq(struct iwl_trans *trans);
     void iwl_pcie_irq_handle_error(struct iwl_trans *trans);
 
-    void iwl_pcie_rx_handle(struct iwl_trans *trans, int queue);
+    template <class RBD>
+    bool iwl_pcie_rx_handle(struct iwl_trans *trans, int queue);
+    void iwl_pcie_rx_schedule(struct iwl_trans *trans, int queue);
+    void iwl_pcie_int_mit_mask_rx(struct iwl_trans *trans);
+    void iwl_pcie_int_mit_set_polling(struct iwl_trans *trans, bool polling);
+    void iwl_pcie_int_mit_sample(struct iwl_trans *trans, bool event);
+    void iwl_pcie_int_mit_reset(struct iwl_trans *trans, bool adaptive);
+    static void intMitPollTimeout(OSObject *owner, IOTimerEventSource *sender);
+    static IOReturn intMitAction(OSObject *owner, void *arg0, void *arg1, void *arg2, void *arg3);
+    IOReturn getINT_MIT(IO80211Interface *interface, struct apple80211_intmit_data *md);
+    IOReturn setINT_MIT(IO80211Interface *interface, struct apple80211_intmit_data *md);
     void iwl_pcie_rx_handle_rb(struct iwl_trans *trans, struct iwl_rxq *rxq,
                                struct iwl_rx_mem_buffer *rxb, bool emergency);
     
@@ -153,10 +205,20 @@ private:
     int iwl_pcie_txq_init(struct iwl_trans *trans, struct iwl_txq *txq, int slots_num, bool cmd_queue); // line 551
     int iwl_pcie_tx_alloc(struct iwl_trans *trans); // line 907
     int iwl_pcie_tx_init(struct iwl_trans *trans); // line 973
-    void iwl_pcie_txq_progress(struct iwl_txq *txq); // line 1034
+    enum iwl_txq_stuck_timer iwl_pcie_txq_progress(struct iwl_txq *txq); // line 1034
+    template <class TFD>
+    void iwl_trans_pcie_reclaim(struct iwl_trans *trans, int txq_id, int ssn, mbuf_t *skbs); // line 1052
+    bool iwl_pcie_txq_update_wr_ptr(struct iwl_trans *trans, struct iwl_txq *txq);
+    void iwl_trans_pcie_tx_batch_begin(struct iwl_trans *trans);
+    void iwl_trans_pcie_tx_batch_end(struct iwl_trans *trans);
+    void iwl_pcie_tx_batch_flush(struct iwl_trans *trans);
+    void iwl_pcie_tx_batch_arm_timer();
+    static void txBatchTimeout(OSObject *owner, IOTimerEventSource *sender);
+    static void txqStuckTimeout(OSObject *owner, IOTimerEventSource *sender);
     void iwl_pcie_cmdq_reclaim(struct iwl_trans *trans, int txq_id, int idx); // line 1211
 
     void iwl_pcie_hcmd_complete(struct iwl_trans *trans, struct iwl_rx_cmd_buffer *rxb); // line 1723
+    template <class TFD>
     int iwl_trans_pcie_tx(struct iwl_trans *trans, struct sk_buff *skb,
                           struct iwl_device_cmd *dev_cmd, int txq_id); // line 2256
     
@@ -178,13 +240,30 @@ private:
     IONetworkStats *fNetworkStats;
     IOEthernetStats *fEthernetStats;
     IOFilterInterruptEventSource* fInterruptSource;
+    IOTimerEventSource *fTxBatchTimer;
+    IOTimerEventSource *fIntMitPollTimer;
+    
+    /*
+     * One workloop per RX queue. The interrupt workloop only reads the
+     * causes and hands the queue over, the drain runs on the worker.
+     * There are as many workers as trans->num_rx_queues, which stays 1
+     * until MSI-X is ported; with none (rx_inline or a failed setup) the
+     * interrupt workloop drains the queues itself.
+     */
+    struct IwlRxWorker {
+        IOWorkLoop *workLoop;
+        IOInterruptEventSource *eventSource;
+        struct iwl_rx_work_ring ring;
+    };
+    IwlRxWorker fRxWorkers[IWL_MAX_RX_HW_QUEUES];
+    int fNumRxWorkers;
     
     IOMemoryMap *fMemoryMap;
     
     struct iwl_nvm_data *fNvmData;
     const struct iwl_cfg* fConfiguration;
     struct iwl_trans* fTrans;
-    TransOps *transOps;
+    IwlTransOps *transOps;
 };
 
 #endif
@@ -21,6 +21,46 @@ const IOExternalMethodDispatch IntelWifiUserClient::sMethods[kNumberOfMethods] =
         0,
         0,
         0
+    },
+    {
+        // kIwlClientFwDump
+        (IOExternalMethodAction) &IntelWifiUserClient::fwDump,
+        0,
+        0,
+        2,
+        kIOUCVariableStructureSize
+    },
+    {
+        // kIwlClientTrace
+        (IOExternalMethodAction) &IntelWifiUserClient::trace,
+        1,
+        0,
+        3,
+        kIOUCVariableStructureSize
+    },
+    {
+        // kIwlClientLatency
+        (IOExternalMethodAction) &IntelWifiUserClient::latency,
+        1,
+        0,
+        1,
+        kIOUCVariableStructureSize
+    },
+    {
+        // kIwlClientCmdProf
+        (IOExternalMethodAction) &IntelWifiUserClient::cmdProf,
+        1,
+        0,
+        1,
+        kIOUCVariableStructureSize
+    },
+    {
+        // kIwlClientRxProf
+        (IOExternalMethodAction) &IntelWifiUserClient::rxProf,
+        1,
+        0,
+        3,
+        kIOUCVariableStructureSize
     }
 };
 
@@ -70,6 +110,240 @@ IOReturn IntelWifiUserClient::scanImpl() {
     return kIOReturnSuccess;
 }
 
+IOReturn IntelWifiUserClient::fwDump(IntelWifiUserClient *target, void *reference, IOExternalMethodArguments *arguments) {
+    return target->fwDumpImpl(arguments);
+}
+
+/*
+ * Scalar outputs are the length and the number of the last firmware error
+ * dump. The dump itself is copied out only if the caller's buffer is big
+ * enough for it, so a call without one just asks for the size.
+ */
+IOReturn IntelWifiUserClient::fwDumpImpl(IOExternalMethodArguments *arguments) {
+    IOMemoryDescriptor *desc = arguments->structureOutputDescriptor;
+    size_t size = desc ? desc->getLength() : arguments->structureOutputSize;
+    u32 seq;
+    size_t len;
+    
+    if (!desc) {
+        len = fProvider->readFwDump(arguments->structureOutput, size, &seq);
+        arguments->structureOutputSize = len <= size ? (uint32_t)len : 0;
+    } else {
+        /* too big for the inline buffer, bounce it through a copy */
+        len = fProvider->readFwDump(NULL, 0, &seq);
+        if (len && len <= size) {
+            size_t cap = len;
+            void *buf = IOMalloc(cap);
+            IOReturn ret;
+            
+            if (!buf)
+                return kIOReturnNoMemory;
+            
+            /* a bigger dump may have landed in between */
+            len = fProvider->readFwDump(buf, cap, &seq);
+            if (len > cap) {
+                IOFree(buf, cap);
+                return kIOReturnOverrun;
+            }
+            
+            ret = desc->prepare(kIODirectionIn);
+            if (ret == kIOReturnSuccess) {
+                desc->writeBytes(0, buf, len);
+                desc->complete(kIODirectionIn);
+            }
+            IOFree(buf, cap);
+            if (ret != kIOReturnSuccess)
+                return ret;
+        }
+    }
+    
+    arguments->scalarOutput[0] = len;
+    arguments->scalarOutput[1] = seq;
+    
+    return kIOReturnSuccess;
+}
+
+IOReturn IntelWifiUserClient::trace(IntelWifiUserClient *target, void *reference, IOExternalMethodArguments *arguments) {
+    return target->traceImpl(arguments);
+}
 
+/*
+ * Reads the trace ring from the position given as the scalar input, as many
+ * records as fit in the caller's buffer. Scalar outputs are the number of
+ * records copied, the position to continue from and how many were lost.
+ */
+IOReturn IntelWifiUserClient::traceImpl(IOExternalMethodArguments *arguments) {
+    IOMemoryDescriptor *desc = arguments->structureOutputDescriptor;
+    size_t size = desc ? desc->getLength() : arguments->structureOutputSize;
+    u32 max = (u32)min_t(size_t, size / sizeof(struct iwl_trace_rec), IWL_TRACE_RECS);
+    u64 pos = arguments->scalarInput[0];
+    struct iwl_trace_rec *recs = NULL;
+    u32 n = 0, lost = 0;
+    IOReturn ret = kIOReturnSuccess;
+    
+    if (max && !desc) {
+        n = iwl_trace_read(&pos, (struct iwl_trace_rec *)arguments->structureOutput, max, &lost);
+        arguments->structureOutputSize = n * sizeof(*recs);
+    } else if (max) {
+        recs = (struct iwl_trace_rec *)IOMalloc(max * sizeof(*recs));
+        if (!recs)
+            return kIOReturnNoMemory;
+        
+        n = iwl_trace_read(&pos, recs, max, &lost);
+        
+        ret = desc->prepare(kIODirectionIn);
+        if (ret == kIOReturnSuccess) {
+            desc->writeBytes(0, recs, n * sizeof(*recs));
+            desc->complete(kIODirectionIn);
+        }
+        IOFree(recs, max * sizeof(*recs));
+        if (ret != kIOReturnSuccess)
+            return ret;
+    }
+    
+    arguments->scalarOutput[0] = n;
+    arguments->scalarOutput[1] = pos;
+    arguments->scalarOutput[2] = lost;
+    
+    return kIOReturnSuccess;
+}
 
+IOReturn IntelWifiUserClient::latency(IntelWifiUserClient *target, void *reference, IOExternalMethodArguments *arguments) {
+    return target->latencyImpl(arguments);
+}
 
+/*
+ * Copies the latency histograms out if the caller's buffer holds them, the
+ * scalar output is their size either way. A non-zero scalar input clears
+ * them once they are copied.
+ */
+IOReturn IntelWifiUserClient::latencyImpl(IOExternalMethodArguments *arguments) {
+    IOMemoryDescriptor *desc = arguments->structureOutputDescriptor;
+    size_t size = desc ? desc->getLength() : arguments->structureOutputSize;
+    bool reset = arguments->scalarInput[0] != 0;
+    size_t len;
+    
+    if (!desc) {
+        len = fProvider->readLatency(arguments->structureOutput, size, reset);
+        arguments->structureOutputSize = len <= size ? (uint32_t)len : 0;
+    } else {
+        len = fProvider->readLatency(NULL, 0, false);
+        if (len && len <= size) {
+            void *buf = IOMalloc(len);
+            IOReturn ret;
+            
+            if (!buf)
+                return kIOReturnNoMemory;
+            
+            fProvider->readLatency(buf, len, reset);
+            
+            ret = desc->prepare(kIODirectionIn);
+            if (ret == kIOReturnSuccess) {
+                desc->writeBytes(0, buf, len);
+                desc->complete(kIODirectionIn);
+            }
+            IOFree(buf, len);
+            if (ret != kIOReturnSuccess)
+                return ret;
+        }
+    }
+    
+    arguments->scalarOutput[0] = len;
+    
+    return kIOReturnSuccess;
+}
+
+IOReturn IntelWifiUserClient::cmdProf(IntelWifiUserClient *target, void *reference, IOExternalMethodArguments *arguments) {
+    return target->cmdProfImpl(arguments);
+}
+
+/*
+ * Copies out the profile of as many host command IDs as fit in the caller's
+ * buffer, the scalar output is how many. A non-zero scalar input clears the
+ * counters that were copied.
+ */
+IOReturn IntelWifiUserClient::cmdProfImpl(IOExternalMethodArguments *arguments) {
+    IOMemoryDescriptor *desc = arguments->structureOutputDescriptor;
+    size_t size = desc ? desc->getLength() : arguments->structureOutputSize;
+    u32 max = (u32)min_t(size_t, size / sizeof(struct iwl_cmd_prof_rec), IWL_CMD_PROF_MAX_RECS);
+    bool reset = arguments->scalarInput[0] != 0;
+    struct iwl_cmd_prof_rec *recs;
+    u32 n = 0;
+    IOReturn ret = kIOReturnSuccess;
+    
+    if (max && !desc) {
+        n = fProvider->readCmdProf((struct iwl_cmd_prof_rec *)arguments->structureOutput, max, reset);
+        arguments->structureOutputSize = n * sizeof(*recs);
+    } else if (max) {
+        recs = (struct iwl_cmd_prof_rec *)IOMalloc(max * sizeof(*recs));
+        if (!recs)
+            return kIOReturnNoMemory;
+        
+        n = fProvider->readCmdProf(recs, max, reset);
+        
+        ret = desc->prepare(kIODirectionIn);
+        if (ret == kIOReturnSuccess) {
+            desc->writeBytes(0, recs, n * sizeof(*recs));
+            desc->complete(kIODirectionIn);
+        }
+        IOFree(recs, max * sizeof(*recs));
+        if (ret != kIOReturnSuccess)
+            return ret;
+    }
+    
+    arguments->scalarOutput[0] = n;
+    
+    return kIOReturnSuccess;
+}
+
+IOReturn IntelWifiUserClient::rxProf(IntelWifiUserClient *target, void *reference, IOExternalMethodArguments *arguments) {
+    return target->rxProfImpl(arguments);
+}
+
+/*
+ * Like cmdProfImpl() for the op mode's RX handlers. The second scalar
+ * output is the time in ns the counters cover, the third the packets
+ * lost because their copy couldn't be allocated. The RX path only keeps
+ * the profile when built with CONFIG_IWLWIFI_RX_PROF.
+ */
+IOReturn IntelWifiUserClient::rxProfImpl(IOExternalMethodArguments *arguments) {
+#ifndef CONFIG_IWLWIFI_RX_PROF
+    return kIOReturnUnsupported;
+#else
+    IOMemoryDescriptor *desc = arguments->structureOutputDescriptor;
+    size_t size = desc ? desc->getLength() : arguments->structureOutputSize;
+    u32 max = (u32)min_t(size_t, size / sizeof(struct iwl_rx_prof_rec), IWL_CMD_PROF_MAX_RECS);
+    bool reset = arguments->scalarInput[0] != 0;
+    struct iwl_rx_prof_rec *recs;
+    u64 elapsed = 0;
+    u32 copy_fails = 0;
+    u32 n = 0;
+    IOReturn ret = kIOReturnSuccess;
+    
+    if (max && !desc) {
+        n = fProvider->readRxProf((struct iwl_rx_prof_rec *)arguments->structureOutput, max, reset, &elapsed, &copy_fails);
+        arguments->structureOutputSize = n * sizeof(*recs);
+    } else if (max) {
+        recs = (struct iwl_rx_prof_rec *)IOMalloc(max * sizeof(*recs));
+        if (!recs)
+            return kIOReturnNoMemory;
+        
+        n = fProvider->readRxProf(recs, max, reset, &elapsed, &copy_fails);
+        
+        ret = desc->prepare(kIODirectionIn);
+        if (ret == kIOReturnSuccess) {
+            desc->writeBytes(0, recs, n * sizeof(*recs));
+            desc->complete(kIODirectionIn);
+        }
+        IOFree(recs, max * sizeof(*recs));
+        if (ret != kIOReturnSuccess)
+            return ret;
+    }
+    
+    arguments->scalarOutput[0] = n;
+    arguments->scalarOutput[1] = elapsed;
+    arguments->scalarOutput[2] = copy_fails;
+    
+    return kIOReturnSuccess;
+#endif
+}
@@ -35,6 +35,21 @@ protected:
     
     static IOReturn scan(IntelWifiUserClient *target, void *reference, IOExternalMethodArguments *arguments);
     IOReturn scanImpl();
+    
+    static IOReturn fwDump(IntelWifiUserClient *target, void *reference, IOExternalMethodArguments *arguments);
+    IOReturn fwDumpImpl(IOExternalMethodArguments *arguments);
+    
+    static IOReturn trace(IntelWifiUserClient *target, void *reference, IOExternalMethodArguments *arguments);
+    IOReturn traceImpl(IOExternalMethodArguments *arguments);
+    
+    static IOReturn latency(IntelWifiUserClient *target, void *reference, IOExternalMethodArguments *arguments);
+    IOReturn latencyImpl(IOExternalMethodArguments *arguments);
+    
+    static IOReturn cmdProf(IntelWifiUserClient *target, void *reference, IOExternalMethodArguments *arguments);
+    IOReturn cmdProfImpl(IOExternalMethodArguments *arguments);
+    
+    static IOReturn rxProf(IntelWifiUserClient *target, void *reference, IOExternalMethodArguments *arguments);
+    IOReturn rxProfImpl(IOExternalMethodArguments *arguments);
 };
 
 
@@ -38,6 +38,8 @@
 //
 
 #include "IntelWifi.hpp"
+#include "IwlTransOps.h"
+#include "IwlTransLayout.h"
 
 #include <IOKit/IODMACommand.h>
 #include <sys/queue.h>
@@ -150,19 +152,95 @@ extern "C" {
 
 /*
  * CUSTOM
+ *
+ * RX buffers are not separate pages here. Each rxb in rx_pool owns a fixed
+ * RB inside one of a few physically contiguous slabs, which are mapped
+ * once. Attaching an RB to an RBD is a pointer assignment and the RB's bus
+ * address is cached in page_dma, so restocking never looks up a mapping.
  */
 
-static dma_addr_t iwl_dmamap_mbuf(struct iwl_trans *trans, mbuf_t m) {
-    IOMbufNaturalMemoryCursor *curs = static_cast<IOMbufNaturalMemoryCursor *>(trans->mbuf_cursor);
-    IOPhysicalSegment rxSeg;
-    curs->getPhysicalSegments(m, &rxSeg, 1);
-    return rxSeg.location;
+static void iwl_pcie_rx_free_slabs(struct iwl_trans *trans)
+{
+    struct iwl_trans_pcie *trans_pcie = IWL_TRANS_GET_PCIE_TRANS(trans);
+    int i;
+    
+    if (!trans_pcie->rx_slabs)
+        return;
+    
+    for (i = 0; i < trans_pcie->num_rx_slabs; i++)
+        if (trans_pcie->rx_slabs[i])
+            free_dma_buf(trans_pcie->rx_slabs[i]);
+    
+    iwh_free(trans_pcie->rx_slabs);
+    trans_pcie->rx_slabs = NULL;
+    trans_pcie->num_rx_slabs = 0;
+    trans_pcie->rx_slab_rb_size = 0;
+    
+    for (i = 0; i < RX_POOL_SIZE; i++) {
+        trans_pcie->rx_pool[i].page = NULL;
+        trans_pcie->rx_pool[i].rb_addr = NULL;
+        trans_pcie->rx_pool[i].page_dma = 0;
+    }
 }
 
-static void iwl_free_packet(struct iwl_trans *trans, mbuf_t p) {
-    IO80211Controller *dev = static_cast<IO80211Controller *>(trans->dev);
-//    dev->freePacket(p);
-    return;
+/*
+ * Allocate the RX slabs and carve them into RBs for the whole rx_pool.
+ * Nothing to do if they were already carved for the current RB size.
+ */
+static int iwl_pcie_rx_alloc_slabs(struct iwl_trans *trans)
+{
+    struct iwl_trans_pcie *trans_pcie = IWL_TRANS_GET_PCIE_TRANS(trans);
+    u32 rb_size = PAGE_SIZE << trans_pcie->rx_page_order;
+    int rbs_per_slab = max_t(int, 1, IWL_RX_SLAB_SIZE / rb_size);
+    int num_slabs = (RX_POOL_SIZE + rbs_per_slab - 1) / rbs_per_slab;
+    /* RBs must be 4K aligned (12 first bits of the RBD are used for the vid) */
+    mach_vm_address_t mask = DMA_BIT_MASK(trans_pcie->addr_size) & ~((mach_vm_address_t)PAGE_SIZE - 1);
+    int i;
+    
+    if (trans_pcie->rx_slabs && trans_pcie->rx_slab_rb_size == rb_size)
+        return 0;
+    
+    iwl_pcie_rx_free_slabs(trans);
+    
+    trans_pcie->rx_slabs = (struct iwl_dma_ptr **)iwh_zalloc(sizeof(struct iwl_dma_ptr *) * num_slabs);
+    if (!trans_pcie->rx_slabs)
+        return -ENOMEM;
+    trans_pcie->num_rx_slabs = num_slabs;
+    
+    for (i = 0; i < num_slabs; i++) {
+        trans_pcie->rx_slabs[i] = allocate_dma_buf(rbs_per_slab * rb_size, mask, true);
+        if (!trans_pcie->rx_slabs[i]) {
+            IWL_ERR(trans, "Failed to allocate RX slab %d\n", i);
+            iwl_pcie_rx_free_slabs(trans);
+            return -ENOMEM;
+        }
+    }
+    
+    for (i = 0; i < RX_POOL_SIZE; i++) {
+        struct iwl_rx_mem_buffer *rxb = &trans_pcie->rx_pool[i];
+        struct iwl_dma_ptr *slab = trans_pcie->rx_slabs[i / rbs_per_slab];
+        u32 offset = (i % rbs_per_slab) * rb_size;
+        
+        rxb->rb_addr = (u8 *)slab->addr + offset;
+        rxb->page_dma = slab->dma + offset;
+        rxb->page = NULL;
+    }
+    trans_pcie->rx_slab_rb_size = rb_size;
+    
+    return 0;
+}
+
+/*
+ * Attach the rxb's own RB to it. Replaces the page allocation + mapping the
+ * Linux driver does for every restocked RBD.
+ */
+static inline bool iwl_pcie_rx_attach_page(struct iwl_rx_mem_buffer *rxb)
+{
+    if (unlikely(!rxb->rb_addr))
+        return false;
+    
+    rxb->page = rxb->rb_addr;
+    return true;
 }
 
 /*
@@ -253,10 +331,10 @@ static void iwl_pcie_rxq_check_wrptr(struct iwl_trans *trans)
         
         if (!rxq->need_update)
             continue;
-        //IOSimpleLockLock(rxq->lock);
+        IOSimpleLockLock(rxq->lock);
         iwl_pcie_rxq_inc_wr_ptr(trans, rxq);
         rxq->need_update = false;
-        //IOSimpleLockUnlock(rxq->lock);
+        IOSimpleLockUnlock(rxq->lock);
     }
 }
 
@@ -278,7 +356,7 @@ static void iwl_pcie_rxmq_restock(struct iwl_trans *trans, struct iwl_rxq *rxq)
     if (!test_bit(STATUS_DEVICE_ENABLED, &trans->status))
         return;
     
-    //IOSimpleLockLock(rxq->lock);
+    IOSimpleLockLock(rxq->lock);
     while (rxq->free_count) {
         __le64 *bd = (__le64 *)rxq->bd;
         
@@ -296,16 +374,16 @@ static void iwl_pcie_rxmq_restock(struct iwl_trans *trans, struct iwl_rxq *rxq)
         rxq->write = (rxq->write + 1) & MQ_RX_TABLE_MASK;
         rxq->free_count--;
     }
-    //IOSimpleLockUnlock(rxq->lock);
+    IOSimpleLockUnlock(rxq->lock);
     
     /*
      * If we've added more space for the firmware to place data, tell it.
      * Increment device's write pointer in multiples of 8.
      */
     if (rxq->write_actual != (rxq->write & ~0x7)) {
-        //IOSimpleLockLock(rxq->lock);
+        IOSimpleLockLock(rxq->lock);
         iwl_pcie_rxq_inc_wr_ptr(trans, rxq);
-        //IOSimpleLockUnlock(rxq->lock);
+        IOSimpleLockUnlock(rxq->lock);
     }
 }
 
@@ -328,7 +406,7 @@ static void iwl_pcie_rxsq_restock(struct iwl_trans *trans, struct iwl_rxq *rxq)
         return;
     }
     
-    //IOSimpleLockLock(rxq->lock);
+    IOSimpleLockLock(rxq->lock);
     while ((iwl_rxq_space(rxq) > 0) && (rxq->free_count)) {
         __le32 *bd = (__le32 *)rxq->bd;
         /* The overwritten rxb must be a used one */
@@ -346,14 +424,14 @@ static void iwl_pcie_rxsq_restock(struct iwl_trans *trans, struct iwl_rxq *rxq)
         rxq->write = (rxq->write + 1) & RX_QUEUE_MASK;
         rxq->free_count--;
     }
-    //IOSimpleLockUnlock(rxq->lock);
+    IOSimpleLockUnlock(rxq->lock);
     
     /* If we've added more space for the firmware to place data, tell it.
      * Increment device's write pointer in multiples of 8. */
     if (rxq->write_actual != (rxq->write & ~0x7)) {
-        //IOSimpleLockLock(rxq->lock);
+        IOSimpleLockLock(rxq->lock);
         iwl_pcie_rxq_inc_wr_ptr(trans, rxq);
-        //IOSimpleLockUnlock(rxq->lock);
+        IOSimpleLockUnlock(rxq->lock);
     }
 }
 
@@ -377,17 +455,6 @@ static void iwl_pcie_rxq_restock(struct iwl_trans *trans, struct iwl_rxq *rxq)
         iwl_pcie_rxsq_restock(trans, rxq);
 }
 
-/* line 352
- * iwl_pcie_rx_alloc_page - allocates and returns a page.
- *
- */
-static mbuf_t iwl_pcie_rx_alloc_page(struct iwl_trans *trans)
-{
-    IO80211Controller *dev = static_cast<IO80211Controller *>(trans->dev);
-    mbuf_t m = dev->allocatePacket(PAGE_SIZE);
-    return m;
-}
-
 /* line 384
  * iwl_pcie_rxq_alloc_rbs - allocate a page for each used RBD
  *
@@ -399,57 +466,23 @@ static mbuf_t iwl_pcie_rx_alloc_page(struct iwl_trans *trans)
  */
 static void iwl_pcie_rxq_alloc_rbs(struct iwl_trans *trans, struct iwl_rxq *rxq)
 {
-    //struct iwl_trans_pcie *trans_pcie = IWL_TRANS_GET_PCIE_TRANS(trans);
     struct iwl_rx_mem_buffer *rxb;
-    mbuf_t page;
     
-    while (1) {
-        //IOSimpleLockLock(rxq->lock);
-        if (TAILQ_EMPTY(&rxq->rx_used)) {
-            //IOSimpleLockUnlock(rxq->lock);
-            return;
-        }
-        //IOSimpleLockUnlock(rxq->lock);
-        
-        /* Alloc a new receive buffer */
-        page = iwl_pcie_rx_alloc_page(trans);
-        if (!page)
-            return;
-        
-        //IOSimpleLockLock(rxq->lock);
-        
-        if (TAILQ_EMPTY(&rxq->rx_used)) {
-            //IOSimpleLockUnlock(rxq->lock);
-            //__free_pages(page, trans_pcie->rx_page_order);
-            iwl_free_packet(trans, page);
-            page = NULL;
-            return;
-        }
-
+    /* Attaching an RB can't block, so the whole list is moved in one go */
+    IOSimpleLockLock(rxq->lock);
+    while (!TAILQ_EMPTY(&rxq->rx_used)) {
         rxb = TAILQ_FIRST(&rxq->rx_used);
-        TAILQ_REMOVE(&rxq->rx_used, rxb, list);
-        //IOSimpleLockUnlock(rxq->lock);
-        
-        rxb->page = page;
-        /* Get physical address of the RB */
-        rxb->page_dma = iwl_dmamap_mbuf(trans, rxb->page);
         
-        if (!rxb->page_dma) {
-            
-            rxb->page = NULL;
-            
-            //IOSimpleLockLock(rxq->lock);
-            TAILQ_INSERT_HEAD(&rxq->rx_used, rxb, list);
-            //IOSimpleLockUnlock(rxq->lock);
-            iwl_free_packet(trans, page);
-            return;
+        if (!iwl_pcie_rx_attach_page(rxb)) {
+            IWL_ERR(trans, "rxb %u has no RB in the RX slabs\n", (u32)rxb->vid);
+            break;
         }
         
-        //IOSimpleLockLock(rxq->lock);
+        TAILQ_REMOVE(&rxq->rx_used, rxb, list);
         TAILQ_INSERT_TAIL(&rxq->rx_free, rxb, list);
         rxq->free_count++;
-        //IOSimpleLockUnlock(rxq->lock);
     }
+    IOSimpleLockUnlock(rxq->lock);
 }
 
 // line 450
@@ -458,13 +491,9 @@ static void iwl_pcie_free_rbs_pool(struct iwl_trans *trans)
     struct iwl_trans_pcie *trans_pcie = IWL_TRANS_GET_PCIE_TRANS(trans);
     int i;
     
-    for (i = 0; i < RX_POOL_SIZE; i++) {
-        if (!trans_pcie->rx_pool[i].page)
-            continue;
-        trans_pcie->rx_pool[i].page_dma = NULL;
-        iwl_free_packet(trans, trans_pcie->rx_pool[i].page);
+    /* RBs stay in the RX slabs (and keep their page_dma), just detach them */
+    for (i = 0; i < RX_POOL_SIZE; i++)
         trans_pcie->rx_pool[i].page = NULL;
-    }
 }
 
 /* line 467
@@ -477,22 +506,20 @@ static void iwl_pcie_rx_allocator(struct iwl_trans *trans)
 {
     struct iwl_trans_pcie *trans_pcie = IWL_TRANS_GET_PCIE_TRANS(trans);
     struct iwl_rb_allocator *rba = &trans_pcie->rba;
-    TAILQ_HEAD(, iwl_rx_mem_buffer) local_empty = TAILQ_HEAD_INITIALIZER(local_empty);
+    struct iwl_rx_mem_buffer *local_empty;
     
     // initial code: int pending = atomic_xchg(&rba->req_pending, 0);
-    int pending = OSAddAtomic(-rba->req_pending, &rba->req_pending);
+    int pending = iwl_atomic_take(&rba->req_pending);
     IWL_DEBUG_RX(trans, "Pending allocation requests = %d\n", pending);
     
     /* If we were scheduled - there is at least one request */
-    //IOSimpleLockLock(rba->lock);
     /* swap out the rba->rbd_empty to a local list */
-    TAILQ_SWAP(&rba->rbd_empty, &local_empty, iwl_rx_mem_buffer, list);
-    TAILQ_INIT(&rba->rbd_empty);
-    //IOSimpleLockUnlock(rba->lock);
+    local_empty = iwl_rba_take_all(&rba->rbd_empty);
     
     while (pending) {
         int i;
-        TAILQ_HEAD(, iwl_rx_mem_buffer) local_allocated = TAILQ_HEAD_INITIALIZER(local_allocated);
+        struct iwl_rx_mem_buffer *allocated_first = NULL, *allocated_last = NULL;
+        struct iwl_rx_mem_buffer *more_empty;
         
         /* Do not post a warning if there are only a few requests */
 //        if (pending < RX_PENDING_WATERMARK)
@@ -500,7 +527,6 @@ static void iwl_pcie_rx_allocator(struct iwl_trans *trans)
         
         for (i = 0; i < RX_CLAIM_REQ_ALLOC;) {
             struct iwl_rx_mem_buffer *rxb;
-            mbuf_t page;
             
             /* List should never be empty - each reused RBD is
              * returned to the list, and initial pool covers any
@@ -508,59 +534,64 @@ static void iwl_pcie_rx_allocator(struct iwl_trans *trans)
              * to the time the RBD is added.
              */
             //BUG_ON(list_empty(&local_empty));
-            if (TAILQ_EMPTY(&local_empty)) {
+            if (!local_empty) {
                 IWL_ERR(trans, "local_empty should never be empty!");
                 break;
             }
             /* Get the first rxb from the rbd list */
-            rxb = TAILQ_FIRST(&local_empty);
+            rxb = local_empty;
             //BUG_ON(rxb->page);
             
-            /* Alloc a new receive buffer */
-            page = iwl_pcie_rx_alloc_page(trans);
-            if (!page)
-                continue;
-            rxb->page = page;
-            
-            /* Get physical address of the RB */
-            rxb->page_dma = iwl_dmamap_mbuf(trans, rxb->page);
-            if (!rxb->page_dma) {
-                iwl_free_packet(trans, page);
-                rxb->page = NULL;
-                continue;
+            /* Attach its RB, the bus address is already in page_dma */
+            if (!iwl_pcie_rx_attach_page(rxb)) {
+                IWL_ERR(trans, "rxb %u has no RB in the RX slabs\n", (u32)rxb->vid);
+                break;
             }
             
             /* move the allocated entry to the out list */
-            TAILQ_REMOVE(&local_empty, rxb, list);
-            TAILQ_INSERT_TAIL(&local_allocated, rxb, list);
+            local_empty = rxb->rba_next;
+            rxb->rba_next = allocated_first;
+            allocated_first = rxb;
+            if (!allocated_last)
+                allocated_last = rxb;
             i++;
         }
         
         pending--;
         if (!pending) {
             // initial code: pending = atomic_xchg(&rba->req_pending, 0);
-            pending = OSAddAtomic(-rba->req_pending, &rba->req_pending);
+            pending = iwl_atomic_take(&rba->req_pending);
             IWL_DEBUG_RX(trans, "Pending allocation requests = %d\n", pending);
         }
-        //IOSimpleLockLock(rba->lock);
         /* add the allocated rbds to the allocator allocated list */
-        if (!TAILQ_EMPTY(&local_allocated))
-            TAILQ_CONCAT(&rba->rbd_allocated, &local_allocated, list);
+        if (allocated_first)
+            iwl_rba_push(&rba->rbd_allocated, allocated_first, allocated_last);
         
         /* get more empty RBDs for current pending requests */
-        if (!TAILQ_EMPTY(&rba->rbd_empty))
-            TAILQ_CONCAT(&local_empty, &rba->rbd_empty, list);
-
-        //IOSimpleLockUnlock(rba->lock);
+        more_empty = iwl_rba_take_all(&rba->rbd_empty);
+        while (more_empty) {
+            struct iwl_rx_mem_buffer *rxb = more_empty;
+            
+            more_empty = rxb->rba_next;
+            rxb->rba_next = local_empty;
+            local_empty = rxb;
+        }
         
+        /*
+         * Publish the request only after its RBDs are on rbd_allocated -
+         * the CAS in iwl_rba_push orders the two for the claimer.
+         */
         OSIncrementAtomic(&rba->req_ready);
     }
     
-    //IOSimpleLockLock(rba->lock);
     /* return unused rbds to the allocator empty list */
-    if (!TAILQ_EMPTY(&local_empty))
-        TAILQ_CONCAT(&rba->rbd_empty, &local_empty, list);
-    //IOSimpleLockUnlock(rba->lock);
+    if (local_empty) {
+        struct iwl_rx_mem_buffer *last = local_empty;
+        
+        while (last->rba_next)
+            last = last->rba_next;
+        iwl_rba_push(&rba->rbd_empty, local_empty, last);
+    }
 }
 
 /* line 557
@@ -570,12 +601,15 @@ static void iwl_pcie_rx_allocator(struct iwl_trans *trans)
  * has freed 8 RBDs in order to restock itself.
  * This function directly moves the allocated RBs to the queue's ownership
  * and updates the relevant counters.
+ *
+ * Called with rxq->lock held.
  */
 static void iwl_pcie_rx_allocator_get(struct iwl_trans *trans, struct iwl_rxq *rxq)
 {
     struct iwl_trans_pcie *trans_pcie = IWL_TRANS_GET_PCIE_TRANS(trans);
     struct iwl_rb_allocator *rba = &trans_pcie->rba;
-    int i;
+    struct iwl_rx_mem_buffer *rxbs[RX_CLAIM_REQ_ALLOC];
+    int i, n;
     
     /*
      * atomic_dec_if_positive returns req_ready - 1 for any scenario.
@@ -585,23 +619,41 @@ static void iwl_pcie_rx_allocator_get(struct iwl_trans *trans, struct iwl_rxq *r
      * req_ready > 0, i.e. - there are ready requests and the function
      * hands one request to the caller.
      */
-    if (OSDecrementAtomic(&rba->req_ready) < 0) {
-        rba->req_ready = 0;
+    if (iwl_atomic_dec_if_positive(&rba->req_ready) < 0)
         return;
-    }
     
-    //IOSimpleLockLock(rba->lock);
-    for (i = 0; i < RX_CLAIM_REQ_ALLOC; i++) {
-        /* Get next free Rx buffer, remove it from free list */
-        struct iwl_rx_mem_buffer *rxb = TAILQ_FIRST(&rba->rbd_allocated);
-        TAILQ_REMOVE(&rba->rbd_allocated, rxb, list);
-        TAILQ_INSERT_TAIL(&rxq->rx_free, rxb, list);
+    /* The allocator may have come up short on this request, see its IWL_ERR */
+    n = iwl_rba_claim(rba, rxbs, RX_CLAIM_REQ_ALLOC);
+    for (i = 0; i < n; i++)
+        TAILQ_INSERT_TAIL(&rxq->rx_free, rxbs[i], list);
+    
+    rxq->used_count -= n;
+    rxq->free_count += n;
+}
+
+/*
+ * CUSTOM
+ * Hand the queue's used RBDs over to the allocator's rbd_empty stack.
+ * Called with rxq->lock held.
+ */
+static void iwl_pcie_rx_give_used(struct iwl_rb_allocator *rba, struct iwl_rxq *rxq)
+{
+    struct iwl_rx_mem_buffer *first = TAILQ_FIRST(&rxq->rx_used);
+    struct iwl_rx_mem_buffer *last = NULL;
+    struct iwl_rx_mem_buffer *rxb;
+    
+    if (!first)
+        return;
+    
+    TAILQ_FOREACH(rxb, &rxq->rx_used, list) {
+        rxb->rba_next = TAILQ_NEXT(rxb, list);
+        last = rxb;
     }
-    //IOSimpleLockUnlock(rba->lock);
     
-    rxq->used_count -= RX_CLAIM_REQ_ALLOC;
-    rxq->free_count += RX_CLAIM_REQ_ALLOC;
+    iwl_rba_push(&rba->rbd_empty, first, last);
+    TAILQ_INIT(&rxq->rx_used);
 }
+/* CUSTOM END */
 
 // line 600
 //void iwl_pcie_rx_allocator_work(struct work_struct *data)
@@ -637,6 +689,7 @@ static int iwl_pcie_rx_alloc(struct iwl_trans *trans)
         struct iwl_rxq *rxq = &trans_pcie->rxq[i];
         
         rxq->lock = IOSimpleLockAlloc();
+        rxq->budget = iwlwifi_mod_params.rx_budget ? iwlwifi_mod_params.rx_budget : IWL_RX_POLL_BUDGET;
         if (trans->cfg->mq_rx_supported)
             rxq->queue_size = MQ_RX_TABLE_SIZE;
         else
@@ -761,7 +814,9 @@ static void iwl_pcie_rx_hw_init(struct iwl_trans *trans, struct iwl_rxq *rxq)
                 (rfdnlog << FH_RCSR_RX_CONFIG_RBDCB_SIZE_POS));
     
     /* Set interrupt coalescing timer to default (2048 usecs) */
-    iwl_write8(trans, CSR_INT_COALESCING, IWL_HOST_INT_TIMEOUT_DEF);
+    //iwl_write8(trans, CSR_INT_COALESCING, IWL_HOST_INT_TIMEOUT_DEF);
+    /* CUSTOM: keep whatever interrupt moderation settled on */
+    iwl_write8(trans, CSR_INT_COALESCING, trans_pcie->int_mit.coalescing);
     
     /* W/A for interrupt coalescing bug in 7260 and 3160 */
     if (trans->cfg->host_interrupt_operation_mode)
@@ -873,7 +928,9 @@ static void iwl_pcie_rx_mq_hw_init(struct iwl_trans *trans)
     iwl_trans_release_nic_access(trans, &state);
     
     /* Set interrupt coalescing timer to default (2048 usecs) */
-    iwl_write8(trans, CSR_INT_COALESCING, IWL_HOST_INT_TIMEOUT_DEF);
+    //iwl_write8(trans, CSR_INT_COALESCING, IWL_HOST_INT_TIMEOUT_DEF);
+    /* CUSTOM: keep whatever interrupt moderation settled on */
+    iwl_write8(trans, CSR_INT_COALESCING, trans_pcie->int_mit.coalescing);
     
     iwl_pcie_enable_rx_wake(trans, true);
 }
@@ -904,17 +961,21 @@ static int _iwl_pcie_rx_init(struct iwl_trans *trans)
     }
     def_rxq = trans_pcie->rxq;
 
-    //IOSimpleLockLock(rba->lock);
+    IOSimpleLockLock(rba->lock);
     rba->req_pending = 0;
     rba->req_ready = 0;
     
-    TAILQ_INIT(&rba->rbd_allocated);
-    TAILQ_INIT(&rba->rbd_empty);
-    //IOSimpleLockUnlock(rba->lock);
+    rba->rbd_allocated = NULL;
+    rba->rbd_empty = NULL;
+    IOSimpleLockUnlock(rba->lock);
     
     /* free all first - we might be reconfigured for a different size */
     iwl_pcie_free_rbs_pool(trans);
     
+    err = iwl_pcie_rx_alloc_slabs(trans);
+    if (err)
+        return err;
+    
     for (i = 0; i < RX_QUEUE_SIZE; i++)
         def_rxq->queue[i] = NULL;
     
@@ -923,7 +984,7 @@ static int _iwl_pcie_rx_init(struct iwl_trans *trans)
         
         rxq->id = i;
         
-        //IOSimpleLockLock(rxq->lock);
+        IOSimpleLockLock(rxq->lock);
         /*
          * Set read write pointer to reflect that we have processed
          * and used all buffers, but have not restocked the Rx queue
@@ -936,7 +997,7 @@ static int _iwl_pcie_rx_init(struct iwl_trans *trans)
         
         iwl_pcie_rx_init_rxb_lists(rxq);
         
-        //IOSimpleLockUnlock(rxq->lock);
+        IOSimpleLockUnlock(rxq->lock);
     }
     
     /* move the pool to the default queue and allocator ownerships */
@@ -947,7 +1008,7 @@ static int _iwl_pcie_rx_init(struct iwl_trans *trans)
         struct iwl_rx_mem_buffer *rxb = &trans_pcie->rx_pool[i];
         
         if (i < allocator_pool_size)
-            TAILQ_INSERT_HEAD(&rba->rbd_empty, rxb, list);
+            iwl_rba_push(&rba->rbd_empty, rxb, rxb);
         else
             TAILQ_INSERT_HEAD(&def_rxq->rx_used, rxb, list);
         
@@ -977,9 +1038,9 @@ int iwl_pcie_rx_init(struct iwl_trans *trans)
     
     iwl_pcie_rxq_restock(trans, trans_pcie->rxq);
     
-    //IOSimpleLockLock(trans_pcie->rxq->lock);
+    IOSimpleLockLock(trans_pcie->rxq->lock);
     iwl_pcie_rxq_inc_wr_ptr(trans, trans_pcie->rxq);
-    //IOSimpleLockUnlock(trans_pcie->rxq->lock);
+    IOSimpleLockUnlock(trans_pcie->rxq->lock);
     
     return 0;
 }
@@ -1014,6 +1075,7 @@ void iwl_pcie_rx_free(struct iwl_trans *trans)
     //cancel_work_sync(&rba->rx_alloc);
     
     iwl_pcie_free_rbs_pool(trans);
+    iwl_pcie_rx_free_slabs(trans);
     
     for (i = 0; i < trans->num_rx_queues; i++) {
         struct iwl_rxq *rxq = &trans_pcie->rxq[i];
@@ -1057,13 +1119,17 @@ static void iwl_pcie_rx_reuse_rbd(struct iwl_trans *trans, struct iwl_rx_mem_buf
 {
     struct iwl_trans_pcie *trans_pcie = IWL_TRANS_GET_PCIE_TRANS(trans);
     struct iwl_rb_allocator *rba = &trans_pcie->rba;
+    bool post = false;
     
+    IOSimpleLockLock(rxq->lock);
     /* Move the RBD to the used list, will be moved to allocator in batches
      * before claiming or posting a request*/
     TAILQ_INSERT_TAIL(&rxq->rx_used, rxb, list);
     
-    if (unlikely(emergency))
+    if (unlikely(emergency)) {
+        IOSimpleLockUnlock(rxq->lock);
         return;
+    }
     
     /* Count the allocator owned RBDs */
     rxq->used_count++;
@@ -1076,18 +1142,20 @@ static void iwl_pcie_rx_reuse_rbd(struct iwl_trans *trans, struct iwl_rx_mem_buf
     if ((rxq->used_count % RX_CLAIM_REQ_ALLOC) == RX_POST_REQ_ALLOC) {
         /* Move the 2 RBDs to the allocator ownership.
          Allocator has another 6 from pool for the request completion*/
-        //IOSimpleLockLock(rba->lock);
-        if (!TAILQ_EMPTY(&rxq->rx_used)) {
-            TAILQ_CONCAT(&rba->rbd_empty, &rxq->rx_used, list);
-            TAILQ_INIT(&rxq->rx_used);
-        }
-        //IOSimpleLockUnlock(rba->lock);
+        iwl_pcie_rx_give_used(rba, rxq);
         
         OSIncrementAtomic(&rba->req_pending);
-        // TODO: Implement
+        post = true;
+    }
+    IOSimpleLockUnlock(rxq->lock);
+    
+    /*
+     * The allocator only attaches RBs from the preallocated slabs, it
+     * doesn't block, so it runs right here instead of on a work queue.
+     */
+    if (post)
         iwl_pcie_rx_allocator(trans);
         //queue_work(rba->alloc_wq, &rba->rx_alloc);
-    }
 }
 
 // line 1090
@@ -1096,7 +1164,6 @@ void IntelWifi::iwl_pcie_rx_handle_rb(struct iwl_trans *trans, struct iwl_rxq *r
 {
     struct iwl_trans_pcie *trans_pcie = IWL_TRANS_GET_PCIE_TRANS(trans);
     struct iwl_txq *txq = trans_pcie->txq[trans_pcie->cmd_queue];
-    bool page_stolen = false;
     unsigned int max_len = PAGE_SIZE << trans_pcie->rx_page_order;
     u32 offset = 0;
     
@@ -1110,13 +1177,18 @@ void IntelWifi::iwl_pcie_rx_handle_rb(struct iwl_trans *trans, struct iwl_rxq *r
         u16 sequence;
         bool reclaim;
         int index, cmd_index, len;
+#ifdef CONFIG_IWLWIFI_RX_PROF
+        u32 id, allocs;
+        u64 ts;
+#endif
 
         struct iwl_rx_cmd_buffer rxcb = {
-            ._offset = (int)offset,
-            ._rx_page_order = trans_pcie->rx_page_order,
             ._page = rxb->page,
+            ._offset = (int)offset,
             ._page_stolen = false,
+            ._rx_page_order = trans_pcie->rx_page_order,
             .truesize = max_len,
+            ._copy_fails = &trans->rx_copy_fails,
         };
         
         pkt = (struct iwl_rx_packet *)rxb_addr(&rxcb);
@@ -1131,18 +1203,12 @@ void IntelWifi::iwl_pcie_rx_handle_rb(struct iwl_trans *trans, struct iwl_rxq *r
         if (frame_queue != rxq->id) {
             IWL_DEBUG_RX(trans, "frame on invalid queue - is on %d and indicates %d\n", rxq->id, frame_queue);
         }
-    
-        IWL_DEBUG_RX(trans,
-                     "Q %d: cmd at offset %d: %s (%.2x.%2x, seq 0x%x)\n",
-                     rxq->id, offset,
-                     iwl_get_cmd_string(trans, iwl_cmd_id(pkt->hdr.cmd, pkt->hdr.group_id, 0)),
-                     pkt->hdr.group_id, pkt->hdr.cmd,
-                     le16_to_cpu(pkt->hdr.sequence));
         
         len = iwl_rx_packet_len(pkt);
         len += sizeof(u32); /* account for status word */
 
-        //        trace_iwlwifi_dev_rx(trans->dev, trans, pkt, len);
+        /* CUSTOM: binary trace record instead of a per packet IWL_DEBUG_RX */
+        trace_iwlwifi_dev_rx(trans->dev, trans, pkt, len);
         //        trace_iwlwifi_dev_rx_data(trans->dev, trans, pkt, len);
         
         /* Reclaim a command buffer only if this packet is a response
@@ -1167,10 +1233,22 @@ void IntelWifi::iwl_pcie_rx_handle_rb(struct iwl_trans *trans, struct iwl_rxq *r
         index = SEQ_TO_INDEX(sequence);
         cmd_index = iwl_pcie_get_cmd_index(txq, index);
         
+#ifdef CONFIG_IWLWIFI_RX_PROF
+        /* CUSTOM: profile the op mode's handling, it may take the page */
+        id = iwl_cmd_id(pkt->hdr.cmd, pkt->hdr.group_id, 0);
+        allocs = rxq->allocs;
+        ts = mach_absolute_time();
+#endif
+        
         if (rxq->id == 0)
-            opmode->rx(NULL, NULL, &rxcb);
+            opmode->rx(NULL, &rxcb);
+        else
+            opmode->rx_rss(NULL, &rxcb, rxq->id);
+        
+#ifdef CONFIG_IWLWIFI_RX_PROF
+        iwl_trans_rx_prof_record(trans, id, len - sizeof(u32), ts, rxq->allocs - allocs);
+#endif
         
-        // TODO: Implement
         //if (rxq->id == 0)
         //    iwl_op_mode_rx(trans->op_mode, &rxq->napi, &rxcb);
         //else
@@ -1197,36 +1275,28 @@ void IntelWifi::iwl_pcie_rx_handle_rb(struct iwl_trans *trans, struct iwl_rxq *r
                 IWL_WARN(trans, "Claim null rxb?\n");
         }
         
-        page_stolen |= rxcb._page_stolen;
         offset += LNX_ALIGN(len, FH_RSCSR_FRAME_ALIGN);
     }
     
-//    IOBufferMemoryDescriptor *page = static_cast<IOBufferMemoryDescriptor *>(rxb->page);
-    
     /* page was stolen from us -- free our reference */
-    if (page_stolen) {
-        iwl_free_packet(trans, rxb->page);
-        rxb->page = NULL;
-    }
+    //if (page_stolen) {
+    //    __free_pages(rxb->page, trans_pcie->rx_page_order);
+    //    rxb->page = NULL;
+    //}
     
     /* Reuse the page if possible. For notification packets and
      * SKBs that fail to Rx correctly, add them back into the
      * rx_free list for reuse later. */
+    /*
+     * CUSTOM: a stolen page was handed up as a copy (rxb_steal_page) and
+     * the RB's mapping never changes, so the RB always goes straight back
+     * to rx_free without a trip through the allocator.
+     */
     if (rxb->page != NULL) {
-        rxb->page_dma = iwl_dmamap_mbuf(trans, rxb->page);
-        if (!rxb->page_dma) {
-            /*
-             * free the page(s) as well to not break
-             * the invariant that the items on the used
-             * list have no page(s)
-             */
-            //__free_pages(rxb->page, trans_pcie->rx_page_order);
-            rxb->page = NULL;
-            iwl_pcie_rx_reuse_rbd(trans, rxb, rxq, emergency);
-        } else {
-            TAILQ_INSERT_TAIL(&rxq->rx_free, rxb, list);
-            rxq->free_count++;
-        }
+        IOSimpleLockLock(rxq->lock);
+        TAILQ_INSERT_TAIL(&rxq->rx_free, rxb, list);
+        rxq->free_count++;
+        IOSimpleLockUnlock(rxq->lock);
     } else {
         iwl_pcie_rx_reuse_rbd(trans, rxb, rxq, emergency);
     }
@@ -1234,16 +1304,45 @@ void IntelWifi::iwl_pcie_rx_handle_rb(struct iwl_trans *trans, struct iwl_rxq *r
 
 /* line 1236
  * iwl_pcie_rx_handle - Main entry function for receiving responses from fw
+ *
+ * CUSTOM: handles at most rxq->budget RBs (0 - no limit), the way a NAPI
+ * poll does. Returns true if it stopped on the budget with RBs left, the
+ * caller is expected to reschedule the queue instead of looping.
  */
-void IntelWifi::iwl_pcie_rx_handle(struct iwl_trans *trans, int queue)
+template <class RBD>
+bool IntelWifi::iwl_pcie_rx_handle(struct iwl_trans *trans, int queue)
 {
     struct iwl_trans_pcie *trans_pcie = IWL_TRANS_GET_PCIE_TRANS(trans);
     struct iwl_rxq *rxq = &trans_pcie->rxq[queue];
-    u32 r, i, count = 0;
+    u32 r, i, count = 0, handled = 0;
     bool emergency = false;
+    bool more = false;
+#ifdef CONFIG_IWLWIFI_RX_PROF
+    bool tracked;
+#endif
+    u64 irq_ts = rxq->irq_ts;
+    
+    /*
+     * A queue has a single consumer: its worker, or the interrupt workloop
+     * when there is none. rxq->read is only written here, which is what
+     * lets the loop below keep it in a local across the unlocked
+     * handle_rb calls.
+     */
+    if (WARN_ON(!OSCompareAndSwap(0, 1, &rxq->draining))) {
+        IWL_ERR(trans, "Q %d: concurrent RX handling\n", queue);
+        return false;
+    }
+    
+#ifdef CONFIG_IWLWIFI_RX_PROF
+    /* CUSTOM: count the handlers' allocations against this queue only */
+    tracked = iwh_alloc_track(&rxq->allocs);
+#endif
+    
+    if (irq_ts && OSCompareAndSwap64(irq_ts, 0, &rxq->irq_ts))
+        iwl_lat_record(trans->lat, IWL_LAT_ISR_RX, irq_ts);
     
 restart:
-    //IOSimpleLockLock(rxq->lock);
+    IOSimpleLockLock(rxq->lock);
     /* uCode's read index (stored in shared DRAM) indicates the last Rx
      * buffer that the driver may process (last buffer filled by ucode). */
     r = le16_to_cpu(rxq->rb_stts->closed_rb_num) & 0x0FFF;
@@ -1262,32 +1361,19 @@ restart:
         if (rxq->used_count == rxq->queue_size / 2)
             emergency = true;
         
-        if (trans->cfg->mq_rx_supported) {
-            /*
-             * used_bd is a 32 bit but only 12 are used to retrieve
-             * the vid
-             */
-            u16 vid = le32_to_cpu(rxq->used_bd[i]) & 0x0FFF;
-            
-            if ((!vid || vid > ARRAY_SIZE(trans_pcie->global_table))) {
-                IWL_ERR(trans, "Invalid rxb index from HW %u\n", (u32)vid);
-                iwl_force_nmi(trans);
-                goto out;
-            }
-            rxb = trans_pcie->global_table[vid - 1];
-            if (rxb->invalid) {
-                IWL_ERR(trans, "Invalid rxb from HW %u\n", (u32)vid);
-                iwl_force_nmi(trans);
-                goto out;
-            }
-            rxb->invalid = true;
-        } else {
-            rxb = rxq->queue[i];
-            rxq->queue[i] = NULL;
-        }
+        rxb = RBD::take(trans, rxq, i);
+        if (!rxb)
+            goto out;
         
         IWL_DEBUG_RX(trans, "Q %d: HW = %d, SW = %d\n", rxq->id, r, i);
+        /*
+         * The op mode handlers may sleep and the allocator allocates
+         * pages, neither can run under a simple lock. rxb is off the
+         * ring already, handle_rb retakes rxq->lock for the lists.
+         */
+        IOSimpleLockUnlock(rxq->lock);
         iwl_pcie_rx_handle_rb(trans, rxq, rxb, emergency);
+        IOSimpleLockLock(rxq->lock);
         
         i = (i + 1) & (rxq->queue_size - 1);
         
@@ -1305,12 +1391,7 @@ restart:
             struct iwl_rb_allocator *rba = &trans_pcie->rba;
             
             /* Add the remaining empty RBDs for allocator use */
-            //IOSimpleLockLock(rba->lock);
-            if (!TAILQ_EMPTY(&rxq->rx_used)) {
-                TAILQ_CONCAT(&rba->rbd_empty, &rxq->rx_used, list);
-                TAILQ_INIT(&rxq->rx_used);
-            }
-            //IOSimpleLockUnlock(rba->lock);
+            iwl_pcie_rx_give_used(rba, rxq);
         } else if (emergency) {
             count++;
             if (count == 8) {
@@ -1319,17 +1400,23 @@ restart:
                     emergency = false;
                 
                 rxq->read = i;
-                //IOSimpleLockUnlock(rxq->lock);
+                IOSimpleLockUnlock(rxq->lock);
                 iwl_pcie_rxq_alloc_rbs(trans, rxq);
                 iwl_pcie_rxq_restock(trans, rxq);
                 goto restart;
             }
         }
+        
+        /* Budget is spent, leave the rest for the next pass */
+        if (rxq->budget && ++handled >= rxq->budget && i != r) {
+            more = true;
+            break;
+        }
     }
 out:
     /* Backtrack one entry */
     rxq->read = i;
-    //IOSimpleLockUnlock(rxq->lock);
+    IOSimpleLockUnlock(rxq->lock);
     
     /*
      * handle a case where in emergency there are some unallocated RBDs.
@@ -1347,6 +1434,119 @@ out:
         iwl_pcie_rxq_alloc_rbs(trans, rxq);
     
     iwl_pcie_rxq_restock(trans, rxq);
+    
+#ifdef CONFIG_IWLWIFI_RX_PROF
+    if (tracked)
+        iwh_alloc_untrack();
+#endif
+    OSCompareAndSwap(1, 0, &rxq->draining);
+    return more;
+}
+
+template bool IntelWifi::iwl_pcie_rx_handle<IwlRbdLegacy>(struct iwl_trans *, int);
+template bool IntelWifi::iwl_pcie_rx_handle<IwlRbdMq>(struct iwl_trans *, int);
+
+/*
+ * CUSTOM
+ * Hand an RX queue over to its worker instead of draining it on the
+ * interrupt workloop. A queue that is already waiting in the ring doesn't
+ * need a second entry - the worker reads closed_rb_num when it gets there.
+ */
+void IntelWifi::iwl_pcie_rx_schedule(struct iwl_trans *trans, int queue)
+{
+    IwlRxWorker *worker;
+    
+    /* No worker to yield to - drain it here, a budget at a time */
+    if (queue >= fNumRxWorkers) {
+        while (transOps->rx_handle(trans, queue))
+            ;
+        return;
+    }
+    
+    worker = &fRxWorkers[queue];
+    if (worker->ring.head != worker->ring.tail || iwl_rx_work_ring_push(&worker->ring, queue))
+        worker->eventSource->interruptOccurred(NULL, NULL, 0);
+}
+
+void IntelWifi::rxWorkerOccured(OSObject* owner, IOInterruptEventSource* sender, int count) {
+    IntelWifi* me = (IntelWifi*)owner;
+    u8 queue;
+    
+    if (me == 0 || me->fTrans == 0) {
+        return;
+    }
+    
+    for (int i = 0; i < me->fNumRxWorkers; i++) {
+        IwlRxWorker *worker = &me->fRxWorkers[i];
+        
+        if (worker->eventSource != sender)
+            continue;
+        
+        /*
+         * Only the interrupt workloop pushes to the ring, a queue that ran
+         * out of budget is drained again from here rather than requeued.
+         * The worker serves that queue alone, there's nobody to yield to.
+         */
+        while (iwl_rx_work_ring_pop(&worker->ring, &queue)) {
+            while (me->transOps->rx_handle(me->fTrans, queue))
+                ;
+        }
+        return;
+    }
+}
+
+/*
+ * CUSTOM: a worker per RX queue, so that the queues RSS spreads the frames
+ * over drain in parallel. With a single queue the worker would only add a
+ * handoff to the interrupt workloop's drain, so there is none.
+ */
+bool IntelWifi::createRxWorkers() {
+    int num = fTrans->num_rx_queues;
+    
+    if (iwlwifi_mod_params.rx_inline || num < 2)
+        return true;
+    if (num > IWL_MAX_RX_HW_QUEUES)
+        num = IWL_MAX_RX_HW_QUEUES;
+    
+    for (int i = 0; i < num; i++) {
+        IwlRxWorker *worker = &fRxWorkers[i];
+        
+        bzero(worker, sizeof(*worker));
+        worker->workLoop = IOWorkLoop::workLoop();
+        if (!worker->workLoop)
+            return false;
+        
+        worker->eventSource = IOInterruptEventSource::interruptEventSource(this,
+                                                                           (IOInterruptEventAction) &IntelWifi::rxWorkerOccured);
+        if (!worker->eventSource) {
+            RELEASE(worker->workLoop);
+            return false;
+        }
+        
+        if (worker->workLoop->addEventSource(worker->eventSource) != kIOReturnSuccess) {
+            RELEASE(worker->eventSource);
+            RELEASE(worker->workLoop);
+            return false;
+        }
+        worker->eventSource->enable();
+        fNumRxWorkers = i + 1;
+    }
+    
+    return true;
+}
+
+void IntelWifi::releaseRxWorkers() {
+    for (int i = 0; i < fNumRxWorkers; i++) {
+        IwlRxWorker *worker = &fRxWorkers[i];
+        
+        if (worker->eventSource) {
+            worker->eventSource->disable();
+            worker->workLoop->removeEventSource(worker->eventSource);
+        }
+        RELEASE(worker->eventSource);
+        RELEASE(worker->workLoop);
+    }
+    fNumRxWorkers = 0;
 }
 
 /* line 1404
@@ -1367,7 +1567,7 @@ void IntelWifi::iwl_pcie_irq_handle_error(struct iwl_trans *trans)
              // TODO: Implement
              //iwl_op_mode_wimax_active(trans->op_mode);
              IOLockLock(trans_pcie->wait_command_queue);
-             IOLockWakeup(trans_pcie->wait_command_queue, &trans->status, true);
+             IOLockWakeup(trans_pcie->wait_command_queue, &trans->status, false);
              IOLockUnlock(trans_pcie->wait_command_queue);
              return;
          }
@@ -1376,8 +1576,9 @@ void IntelWifi::iwl_pcie_irq_handle_error(struct iwl_trans *trans)
     for (i = 0; i < trans->cfg->base_params->num_of_queues; i++) {
         if (!trans_pcie->txq[i])
             continue;
-        // TODO: Implement
         //del_timer(&trans_pcie->txq[i]->stuck_timer);
+        if (trans_pcie->txq[i]->stuck_timer)
+            ((IOTimerEventSource *)trans_pcie->txq[i]->stuck_timer)->cancelTimeout();
     }
     
     /* The STATUS_FW_ERROR bit is set in this function. This must happen
@@ -1385,10 +1586,13 @@ void IntelWifi::iwl_pcie_irq_handle_error(struct iwl_trans *trans)
     // TODO: Implement. Inside trans->ops->op is used which is undefined and will cause kernel panic
     // iwl_trans_fw_error(trans);
     
+    /* CUSTOM: snapshot the device before anybody touches it */
+    iwl_pcie_fw_dump_collect(trans);
+    
     clear_bit(STATUS_SYNC_HCMD_ACTIVE, &trans->status);
     
     IOLockLock(trans_pcie->wait_command_queue);
-    IOLockWakeup(trans_pcie->wait_command_queue, &trans->status, true);
+    IOLockWakeup(trans_pcie->wait_command_queue, &trans->status, false);
     IOLockUnlock(trans_pcie->wait_command_queue);
 }
 
@@ -1434,7 +1638,7 @@ static u32 iwl_pcie_int_cause_ict(struct iwl_trans *trans)
      * This may be due to IRQ shared with another device,
      * or due to sporadic interrupts thrown from our NIC. */
     read = le32_to_cpu(trans_pcie->ict_tbl[trans_pcie->ict_index]);
-    //trace_iwlwifi_dev_ict_read(trans->dev, trans_pcie->ict_index, read);
+    trace_iwlwifi_dev_ict_read(trans->dev, trans_pcie->ict_index, read);
     if (!read)
         return 0;
     
@@ -1444,13 +1648,11 @@ static u32 iwl_pcie_int_cause_ict(struct iwl_trans *trans)
      */
     do {
         val |= read;
-        IWL_DEBUG_ISR(trans, "ICT index %d value 0x%08X\n", trans_pcie->ict_index, read);
         trans_pcie->ict_tbl[trans_pcie->ict_index] = 0;
         trans_pcie->ict_index = ((trans_pcie->ict_index + 1) & (ICT_COUNT - 1));
         
         read = le32_to_cpu(trans_pcie->ict_tbl[trans_pcie->ict_index]);
-        //        trace_iwlwifi_dev_ict_read(trans->dev, trans_pcie->ict_index,
-        //                                   read);
+        trace_iwlwifi_dev_ict_read(trans->dev, trans_pcie->ict_index, read);
     } while (read);
     
     /* We should not get this value, just ignore it. */
@@ -1503,7 +1705,7 @@ void IntelWifi::iwl_pcie_handle_rfkill_irq(struct iwl_trans *trans)
         if (test_and_clear_bit(STATUS_SYNC_HCMD_ACTIVE, &trans->status))
             IWL_DEBUG_RF_KILL(trans, "Rfkill while SYNC HCMD in flight\n");
         IOLockLock(trans_pcie->wait_command_queue);
-        IOLockWakeup(trans_pcie->wait_command_queue, &trans->status, true);
+        IOLockWakeup(trans_pcie->wait_command_queue, &trans->status, false);
         IOLockUnlock(trans_pcie->wait_command_queue);
     } else {
         clear_bit(STATUS_RFKILL_HW, &trans->status);
@@ -1512,6 +1714,36 @@ void IntelWifi::iwl_pcie_handle_rfkill_irq(struct iwl_trans *trans)
     }
 }
 
+bool IntelWifi::interruptFilter(OSObject* owner, IOFilterInterruptEventSource * src) {
+    IntelWifi* me = (IntelWifi*)owner;
+
+    if (me == 0) {
+        TraceLog("Interrupt filter");
+        return false;
+    }
+
+    /* Disable (but don't clear!) interrupts here to avoid
+     * back-to-back ISRs and sporadic interrupts from our NIC.
+     * If we have something to service, the tasklet will re-enable ints.
+     * If we *don't* have something, we'll re-enable before leaving here.
+     */
+    iwl_write32(me->fTrans, CSR_INT_MASK, 0x00000000);
+    
+    IWL_TRANS_GET_PCIE_TRANS(me->fTrans)->irq_ts = mach_absolute_time();
+    
+    return true;
+}
+
+void IntelWifi::interruptOccured(OSObject* owner, IOInterruptEventSource* sender, int count) {
+    IntelWifi* me = (IntelWifi*)owner;
+    
+    if (me == 0) {
+        return;
+    }
+    
+    me->iwl_pcie_irq_handler(0, me->fTrans);
+}
+
 // line 1559
 void IntelWifi::iwl_pcie_irq_handler(int irq, void *dev_id)
 {
@@ -1533,6 +1765,8 @@ void IntelWifi::iwl_pcie_irq_handler(int irq, void *dev_id)
     else
         inta = iwl_pcie_int_cause_non_ict(trans);
     
+    iwl_trace(IWL_TRACE_IRQ, inta, trans_pcie->inta_mask, 0, 0);
+    
     if (iwl_have_debug_level(IWL_DL_ISR)) {
         IWL_DEBUG_ISR(trans,
                       "ISR inta 0x%08x, enabled 0x%08x(sw), enabled(hw) 0x%08x, fh 0x%08x\n",
@@ -1556,8 +1790,10 @@ void IntelWifi::iwl_pcie_irq_handler(int irq, void *dev_id)
          * Re-enable interrupts here since we don't
          * have anything to service
          */
-        if (test_bit(STATUS_INT_ENABLED, &trans->status))
+        if (test_bit(STATUS_INT_ENABLED, &trans->status)) {
             _iwl_enable_interrupts(trans);
+            iwl_pcie_int_mit_mask_rx(trans);
+        }
         
         //IOSimpleLockUnlock(trans_pcie->irq_lock);
         //lock_map_release(&trans->sync_cmd_lockdep_map);
@@ -1702,9 +1938,18 @@ void IntelWifi::iwl_pcie_irq_handler(int irq, void *dev_id)
             iwl_write8(trans, CSR_INT_PERIODIC_REG, CSR_INT_PERIODIC_ENA);
         
         isr_stats->rx++;
+        iwl_pcie_int_mit_sample(trans, true);
         
         // local_bh_disable();
-        iwl_pcie_rx_handle(trans, 0);
+        /*
+         * There is no MSI-X vector per RX queue here, the single interrupt
+         * covers every queue the firmware may have steered frames to.
+         */
+        for (int i = 0; i < trans->num_rx_queues; i++) {
+            /* a queue that is still behind keeps the older interrupt */
+            OSCompareAndSwap64(0, trans_pcie->irq_ts, &trans_pcie->rxq[i].irq_ts);
+            iwl_pcie_rx_schedule(trans, i);
+        }
         //        local_bh_enable();
     }
     
@@ -1732,8 +1977,10 @@ void IntelWifi::iwl_pcie_irq_handler(int irq, void *dev_id)
     
     //IOSimpleLockLock(trans_pcie->irq_lock);
     /* only Re-enable all interrupt if disabled by irq */
-    if (test_bit(STATUS_INT_ENABLED, &trans->status))
+    if (test_bit(STATUS_INT_ENABLED, &trans->status)) {
         _iwl_enable_interrupts(trans);
+        iwl_pcie_int_mit_mask_rx(trans);
+    }
     /* we are loading the firmware, enable FH_TX interrupt only */
     else if (handled & CSR_INT_BIT_FH_TX)
         iwl_enable_fw_load_int(trans);
@@ -1748,6 +1995,180 @@ out:
     return;
 }
 
+/*
+ * CUSTOM
+ * Adaptive interrupt moderation, see struct iwl_int_mit. Everything below
+ * runs on the interrupt workloop (the poll timer lives there as well), so
+ * the moderation state needs no locking.
+ */
+static u64 iwl_pcie_uptime_ns(void)
+{
+    uint64_t abstime, ns;
+    
+    clock_get_uptime(&abstime);
+    absolutetime_to_nanoseconds(abstime, &ns);
+    return ns;
+}
+
+/* Keep the RX causes masked while the poll timer owns the RX queues */
+void IntelWifi::iwl_pcie_int_mit_mask_rx(struct iwl_trans *trans)
+{
+    struct iwl_trans_pcie *trans_pcie = IWL_TRANS_GET_PCIE_TRANS(trans);
+    
+    if (!trans_pcie->int_mit.polling || trans_pcie->msix_enabled)
+        return;
+    
+    iwl_write32(trans, CSR_INT_MASK, trans_pcie->inta_mask & ~IWL_INT_MIT_RX_INTS);
+}
+
+void IntelWifi::iwl_pcie_int_mit_set_polling(struct iwl_trans *trans, bool polling)
+{
+    struct iwl_trans_pcie *trans_pcie = IWL_TRANS_GET_PCIE_TRANS(trans);
+    
+    if (trans_pcie->int_mit.polling == polling)
+        return;
+    
+    IWL_DEBUG_ISR(trans, "%s RX polling\n", polling ? "Entering" : "Leaving");
+    trans_pcie->int_mit.polling = polling;
+    
+    if (polling) {
+        iwl_pcie_int_mit_mask_rx(trans);
+        fIntMitPollTimer->setTimeoutUS(IWL_INT_MIT_POLL_US);
+    } else {
+        fIntMitPollTimer->cancelTimeout();
+        if (test_bit(STATUS_INT_ENABLED, &trans->status))
+            _iwl_enable_interrupts(trans);
+    }
+}
+
+/*
+ * Account one RX event (@event) or just let the clock run, and retune the
+ * coalescing timer once the current window is over.
+ */
+void IntelWifi::iwl_pcie_int_mit_sample(struct iwl_trans *trans, bool event)
+{
+    struct iwl_trans_pcie *trans_pcie = IWL_TRANS_GET_PCIE_TRANS(trans);
+    struct iwl_int_mit *mit = &trans_pcie->int_mit;
+    u64 now, elapsed;
+    u32 rate;
+    u8 coalescing;
+    
+    if (!mit->adaptive)
+        return;
+    
+    if (event)
+        mit->events++;
+    
+    now = iwl_pcie_uptime_ns();
+    elapsed = now - mit->window_start;
+    if (elapsed < IWL_INT_MIT_WINDOW_MS * NSEC_PER_MSEC)
+        return;
+    
+    rate = (u32)((u64)mit->events * NSEC_PER_SEC / elapsed);
+    mit->events = 0;
+    mit->window_start = now;
+    
+    if (mit->polling) {
+        if (rate < IWL_INT_MIT_LOW_RATE)
+            iwl_pcie_int_mit_set_polling(trans, false);
+        return;
+    }
+    
+    coalescing = mit->coalescing;
+    if (rate > IWL_INT_MIT_HIGH_RATE) {
+        if (coalescing >= IWL_INT_MIT_COALESCING_MAX) {
+            /* Coalescing can't keep up any more */
+            if (rate > IWL_INT_MIT_POLL_RATE)
+                iwl_pcie_int_mit_set_polling(trans, true);
+            return;
+        }
+        coalescing = min_t(u8, coalescing * 2, IWL_INT_MIT_COALESCING_MAX);
+    } else if (rate < IWL_INT_MIT_LOW_RATE) {
+        coalescing = max_t(u8, coalescing / 2, IWL_INT_MIT_COALESCING_MIN);
+    }
+    
+    if (coalescing != mit->coalescing) {
+        IWL_DEBUG_ISR(trans, "RX rate %u/s, coalescing 0x%x -> 0x%x\n", rate, mit->coalescing, coalescing);
+        mit->coalescing = coalescing;
+        iwl_write8(trans, CSR_INT_COALESCING, coalescing);
+    }
+}
+
+/* Back to a fixed default coalescing timer, as programmed at RX init */
+void IntelWifi::iwl_pcie_int_mit_reset(struct iwl_trans *trans, bool adaptive)
+{
+    struct iwl_trans_pcie *trans_pcie = IWL_TRANS_GET_PCIE_TRANS(trans);
+    struct iwl_int_mit *mit = &trans_pcie->int_mit;
+    
+    iwl_pcie_int_mit_set_polling(trans, false);
+    
+    mit->adaptive = adaptive;
+    mit->events = 0;
+    mit->window_start = iwl_pcie_uptime_ns();
+    if (mit->coalescing != IWL_HOST_INT_TIMEOUT_DEF) {
+        mit->coalescing = IWL_HOST_INT_TIMEOUT_DEF;
+        iwl_write8(trans, CSR_INT_COALESCING, mit->coalescing);
+    }
+}
+
+static bool iwl_pcie_rx_pending(struct iwl_trans *trans)
+{
+    struct iwl_trans_pcie *trans_pcie = IWL_TRANS_GET_PCIE_TRANS(trans);
+    int i;
+    
+    for (i = 0; i < trans->num_rx_queues; i++) {
+        struct iwl_rxq *rxq = &trans_pcie->rxq[i];
+        u32 r;
+        
+        if (!rxq->rb_stts)
+            continue;
+        
+        r = le16_to_cpu(rxq->rb_stts->closed_rb_num) & 0x0FFF;
+        if ((r & (rxq->queue_size - 1)) != rxq->read)
+            return true;
+    }
+    
+    return false;
+}
+
+void IntelWifi::intMitPollTimeout(OSObject *owner, IOTimerEventSource *sender)
+{
+    IntelWifi *me = (IntelWifi *)owner;
+    struct iwl_trans *trans;
+    struct iwl_trans_pcie *trans_pcie;
+    
+    if (me == 0 || me->fTrans == 0)
+        return;
+    
+    trans = me->fTrans;
+    trans_pcie = IWL_TRANS_GET_PCIE_TRANS(trans);
+    
+    if (!trans_pcie->int_mit.polling)
+        return;
+    
+    /* Device is going down, nothing to poll */
+    if (!test_bit(STATUS_INT_ENABLED, &trans->status) || !trans_pcie->rxq) {
+        me->iwl_pcie_int_mit_set_polling(trans, false);
+        return;
+    }
+    
+    /* Ack the masked RX causes the device raised meanwhile */
+    iwl_write32(trans, CSR_INT, IWL_INT_MIT_RX_INTS);
+    iwl_write32(trans, CSR_FH_INT_STATUS, CSR_FH_INT_RX_MASK);
+    
+    if (iwl_pcie_rx_pending(trans)) {
+        for (int i = 0; i < trans->num_rx_queues; i++)
+            me->iwl_pcie_rx_schedule(trans, i);
+        me->iwl_pcie_int_mit_sample(trans, true);
+    } else {
+        me->iwl_pcie_int_mit_sample(trans, false);
+    }
+    
+    if (trans_pcie->int_mit.polling)
+        sender->setTimeoutUS(IWL_INT_MIT_POLL_US);
+}
+/* CUSTOM END */
+
 /******************************************************************************
  *
  * ICT functions
@@ -74,6 +74,12 @@
 //
 
 #include <IntelWifi.hpp>
+#include "IwlTransOps.h"
+#include "IwlTransLayout.h"
+
+extern "C" {
+#include "iwlwifi/pcie/fw-load-plan.h"
+}
 
 #include <kern/task.h>
 
@@ -413,7 +419,7 @@ int IntelWifi::iwl_pcie_nic_init(struct iwl_trans *trans)
     
     iwl_pcie_set_pwr(trans, false);
     
-    opmode->nic_config(0);
+    opmode->nic_config();
     
     /* Allocate the RX queue, or reset if it is already allocated */
     iwl_pcie_rx_init(trans);
@@ -522,12 +528,52 @@ static void iwl_pcie_load_firmware_chunk_fh(struct iwl_trans *trans, u32 dst_add
                 FH_TCSR_TX_CONFIG_REG_VAL_CIRQ_HOST_ENDTFD);
 }
 
+/* CUSTOM
+ * Firmware sections are streamed through IWL_FW_LOAD_BUFS chunk sized DMA
+ * buffers that are kept for the lifetime of the transport, so a restart
+ * doesn't allocate anything. While the FH service channel DMAs one chunk the
+ * next one is copied into the other buffer.
+ */
+static int iwl_pcie_alloc_fw_load_bufs(struct iwl_trans *trans)
+{
+    struct iwl_trans_pcie *trans_pcie = IWL_TRANS_GET_PCIE_TRANS(trans);
+    int i;
+    
+    for (i = 0; i < IWL_FW_LOAD_BUFS; i++) {
+        if (trans_pcie->fw_load_bufs[i])
+            continue;
+        
+        /* only written by the CPU and read by the device, keep it cached */
+        trans_pcie->fw_load_bufs[i] = allocate_dma_buf(FH_MEM_TB_MAX_LENGTH, DMA_BIT_MASK(32), true);
+        if (!trans_pcie->fw_load_bufs[i]) {
+            IWL_ERR(trans, "Failed to allocate firmware load buffer %d\n", i);
+            return -ENOMEM;
+        }
+    }
+    
+    return 0;
+}
+
+static void iwl_pcie_free_fw_load_bufs(struct iwl_trans *trans)
+{
+    struct iwl_trans_pcie *trans_pcie = IWL_TRANS_GET_PCIE_TRANS(trans);
+    int i;
+    
+    for (i = 0; i < IWL_FW_LOAD_BUFS; i++) {
+        if (!trans_pcie->fw_load_bufs[i])
+            continue;
+        
+        free_dma_buf(trans_pcie->fw_load_bufs[i]);
+        trans_pcie->fw_load_bufs[i] = NULL;
+    }
+}
+/* CUSTOM END */
+
 // line 631
-static int iwl_pcie_load_firmware_chunk(struct iwl_trans *trans, u32 dst_addr, dma_addr_t phy_addr, u32 byte_cnt)
+static int iwl_pcie_load_firmware_chunk_start(struct iwl_trans *trans, u32 dst_addr, dma_addr_t phy_addr, u32 byte_cnt)
 {
     struct iwl_trans_pcie *trans_pcie = IWL_TRANS_GET_PCIE_TRANS(trans);
     IOInterruptState state;
-    int ret;
     
     trans_pcie->ucode_write_complete = false;
     
@@ -537,6 +583,14 @@ static int iwl_pcie_load_firmware_chunk(struct iwl_trans *trans, u32 dst_addr, d
     iwl_pcie_load_firmware_chunk_fh(trans, dst_addr, phy_addr, byte_cnt);
     iwl_trans_release_nic_access(trans, &state);
     
+    return 0;
+}
+
+static int iwl_pcie_load_firmware_chunk_wait(struct iwl_trans *trans)
+{
+    struct iwl_trans_pcie *trans_pcie = IWL_TRANS_GET_PCIE_TRANS(trans);
+    int ret;
+    
     IOLockLock(trans_pcie->ucode_write_waitq);
     if (trans_pcie->ucode_write_complete) {
         IOLockUnlock(trans_pcie->ucode_write_waitq);
@@ -558,32 +612,23 @@ static int iwl_pcie_load_firmware_chunk(struct iwl_trans *trans, u32 dst_addr, d
 // line 658
 static int iwl_pcie_load_section(struct iwl_trans *trans, u8 section_num, const struct fw_desc *section)
 {
+    struct iwl_trans_pcie *trans_pcie = IWL_TRANS_GET_PCIE_TRANS(trans);
     u32 offset, chunk_sz = min(FH_MEM_TB_MAX_LENGTH, (u32)section->len);
+    int buf = 0;
     int ret = 0;
     
     IWL_DEBUG_FW(trans, "[%d] uCode section being loaded...\n", section_num);
     
-    IOBufferMemoryDescriptor *bmd =
-            IOBufferMemoryDescriptor::inTaskWithPhysicalMask(kernel_task, 0, section->len, 0x00000000ffffffffULL);
-    
-    bmd->prepare();
-    
-    IODMACommand *cmd = IODMACommand::withSpecification(kIODMACommandOutputHost32, 32, 0, IODMACommand::kMapped, 0, 1);
-    cmd->setMemoryDescriptor(bmd);
-    cmd->prepare();
-    
-    IODMACommand::Segment32 seg;
-    UInt64 ofs = 0;
-    UInt32 numSegs = 1;
+    ret = iwl_pcie_alloc_fw_load_bufs(trans);
+    if (ret)
+        return ret;
     
-    if (cmd->gen32IOVMSegments(&ofs, &seg, &numSegs) != kIOReturnSuccess) {
-        TraceLog("EVERYTHING IS VEEEERY BAAAD :(");
-        return -1;
-    }
+    memcpy(trans_pcie->fw_load_bufs[buf]->addr, section->data, chunk_sz);
     
     for (offset = 0; offset < section->len; offset += chunk_sz) {
         DebugLog("Writing [%d] with offset %d", section_num, offset);
-        u32 copy_size, dst_addr;
+        struct iwl_dma_ptr *dma = trans_pcie->fw_load_bufs[buf];
+        u32 copy_size, dst_addr, next = offset + chunk_sz;
         bool extended_addr = false;
         
         copy_size = min(chunk_sz, (u32)(section->len - offset));
@@ -595,9 +640,16 @@ static int iwl_pcie_load_section(struct iwl_trans *trans, u8 section_num, const
         if (extended_addr)
             iwl_set_bits_prph(trans, LMPM_CHICK, LMPM_CHICK_EXTENDED_ADDR_SPACE);
         
-        cmd->writeBytes(0, (u8 *)section->data + offset, copy_size);
-        
-        ret = iwl_pcie_load_firmware_chunk(trans, dst_addr, seg.fIOVMAddr, copy_size);
+        ret = iwl_pcie_load_firmware_chunk_start(trans, dst_addr, dma->dma, copy_size);
+        if (!ret) {
+            /* stage the next chunk while the FH is busy with this one */
+            buf = (buf + 1) % IWL_FW_LOAD_BUFS;
+            if (next < section->len)
+                memcpy(trans_pcie->fw_load_bufs[buf]->addr, (u8 *)section->data + next,
+                       min(chunk_sz, (u32)(section->len - next)));
+            
+            ret = iwl_pcie_load_firmware_chunk_wait(trans);
+        }
         
         if (extended_addr)
             iwl_clear_bits_prph(trans, LMPM_CHICK, LMPM_CHICK_EXTENDED_ADDR_SPACE);
@@ -607,13 +659,31 @@ static int iwl_pcie_load_section(struct iwl_trans *trans, u8 section_num, const
             break;
         }
     }
-    cmd->complete();
-    cmd->clearMemoryDescriptor();
-    cmd->release();
     
     return ret;
 }
 
+/*
+ * Tell the ucode that all sections of a CPU are in. Interrupts are enabled
+ * again for the ALIVE notification.
+ */
+static void iwl_pcie_load_cpu_done_8000(struct iwl_trans *trans, int cpu)
+{
+    iwl_enable_interrupts(trans);
+    
+    if (trans->cfg->use_tfh) {
+        if (cpu == 1)
+            iwl_write_prph(trans, UREG_UCODE_LOAD_STATUS, 0xFFFF);
+        else
+            iwl_write_prph(trans, UREG_UCODE_LOAD_STATUS, 0xFFFFFFFF);
+    } else {
+        if (cpu == 1)
+            iwl_write_direct32(trans, FH_UCODE_LOAD_STATUS, 0xFFFF);
+        else
+            iwl_write_direct32(trans, FH_UCODE_LOAD_STATUS, 0xFFFFFFFF);
+    }
+}
+
 // line 715
 static int iwl_pcie_load_cpu_sections_8000(struct iwl_trans *trans, const struct fw_img *image, int cpu,
                                            int *first_ucode_section)
@@ -660,22 +730,93 @@ static int iwl_pcie_load_cpu_sections_8000(struct iwl_trans *trans, const struct
     
     *first_ucode_section = last_read_idx;
     
-    iwl_enable_interrupts(trans);
+    iwl_pcie_load_cpu_done_8000(trans, cpu);
     
-    if (trans->cfg->use_tfh) {
-        if (cpu == 1)
-            iwl_write_prph(trans, UREG_UCODE_LOAD_STATUS, 0xFFFF);
-        else
-            iwl_write_prph(trans, UREG_UCODE_LOAD_STATUS, 0xFFFFFFFF);
-    } else {
-        if (cpu == 1)
-            iwl_write_direct32(trans, FH_UCODE_LOAD_STATUS, 0xFFFF);
-        else
-            iwl_write_direct32(trans, FH_UCODE_LOAD_STATUS, 0xFFFFFFFF);
+    return 0;
+}
+
+/* CUSTOM
+ * Planned 8000 family load, only with iwlwifi_mod_params.fw_load_plan set.
+ * The sections of both CPUs are collected up front, see fw-load-plan.h, and
+ * streamed back to back through the load buffers, so the next chunk is
+ * staged while the FH service channel is busy with the current one, across
+ * section and CPU boundaries too. Nothing runs in parallel: a chunk is only
+ * started once the one before is in, so CPU2 still follows CPU1. The
+ * firmware sees FH_UCODE_LOAD_STATUS updated after every section, the way
+ * iwl_pcie_load_cpu_sections_8000() does it; not validated on hardware yet.
+ */
+static int iwl_pcie_load_plan_8000(struct iwl_trans *trans, const struct iwl_fw_load_step *plan, int n)
+{
+    struct iwl_trans_pcie *trans_pcie = IWL_TRANS_GET_PCIE_TRANS(trans);
+    int step = 0, buf = 0, done_cpu = 0;
+    u32 offset = 0, val;
+    int ret;
+    
+    ret = iwl_pcie_alloc_fw_load_bufs(trans);
+    if (ret)
+        return ret;
+    
+    if (n)
+        memcpy(trans_pcie->fw_load_bufs[buf]->addr, plan[0].sec->data,
+               min(FH_MEM_TB_MAX_LENGTH, (u32)plan[0].sec->len));
+    
+    while (step < n) {
+        int next_step;
+        u32 next_offset;
+        u32 copy_size = iwl_pcie_plan_chunk_8000(plan, step, offset, FH_MEM_TB_MAX_LENGTH,
+                                                 &next_step, &next_offset);
+        u32 dst_addr = plan[step].sec->offset + offset;
+        bool extended_addr = false;
+        
+        /* a CPU without sections still has to be marked as done */
+        while (done_cpu < plan[step].cpu - 1)
+            iwl_pcie_load_cpu_done_8000(trans, ++done_cpu);
+        
+        if (dst_addr >= IWL_FW_MEM_EXTENDED_START && dst_addr <= IWL_FW_MEM_EXTENDED_END)
+            extended_addr = true;
+        
+        if (extended_addr)
+            iwl_set_bits_prph(trans, LMPM_CHICK, LMPM_CHICK_EXTENDED_ADDR_SPACE);
+        
+        ret = iwl_pcie_load_firmware_chunk_start(trans, dst_addr, trans_pcie->fw_load_bufs[buf]->dma, copy_size);
+        if (!ret) {
+            buf = (buf + 1) % IWL_FW_LOAD_BUFS;
+            if (next_step < n)
+                memcpy(trans_pcie->fw_load_bufs[buf]->addr, (u8 *)plan[next_step].sec->data + next_offset,
+                       min(FH_MEM_TB_MAX_LENGTH, (u32)(plan[next_step].sec->len - next_offset)));
+            
+            ret = iwl_pcie_load_firmware_chunk_wait(trans);
+        }
+        
+        if (extended_addr)
+            iwl_clear_bits_prph(trans, LMPM_CHICK, LMPM_CHICK_EXTENDED_ADDR_SPACE);
+        
+        if (ret) {
+            IWL_ERR(trans, "Could not load the [%d] uCode section\n", plan[step].sec_idx);
+            return ret;
+        }
+        
+        if (next_step != step) {
+            /* Notify ucode of loaded section number and status */
+            val = iwl_read_direct32(trans, FH_UCODE_LOAD_STATUS);
+            iwl_write_direct32(trans, FH_UCODE_LOAD_STATUS, val | plan[step].status);
+            
+            if (next_step == n || plan[next_step].cpu != plan[step].cpu) {
+                iwl_pcie_load_cpu_done_8000(trans, plan[step].cpu);
+                done_cpu = plan[step].cpu;
+            }
+        }
+        
+        step = next_step;
+        offset = next_offset;
     }
     
+    while (done_cpu < 2)
+        iwl_pcie_load_cpu_done_8000(trans, ++done_cpu);
+    
     return 0;
 }
+/* CUSTOM END */
 
 // line 785
 static int iwl_pcie_load_cpu_sections(struct iwl_trans *trans, const struct fw_img *image, int cpu,
@@ -852,6 +993,21 @@ static int iwl_pcie_load_given_ucode_8000(struct iwl_trans *trans, const struct
     /* release CPU reset */
     iwl_write_prph(trans, RELEASE_CPU_RESET, RELEASE_CPU_RESET_BIT);
     
+    if (iwlwifi_mod_params.fw_load_plan) {
+        struct iwl_fw_load_step *plan;
+        int n;
+        
+        plan = (struct iwl_fw_load_step *)iwh_malloc(sizeof(*plan) * (image->num_sec ? image->num_sec : 1));
+        if (!plan)
+            return -ENOMEM;
+        
+        n = iwl_pcie_plan_sections_8000(image, plan);
+        IWL_DEBUG_FW(trans, "loading %d sections in one pass\n", n);
+        ret = iwl_pcie_load_plan_8000(trans, plan, n);
+        iwh_free(plan);
+        return ret;
+    }
+    
     /* load to FW the binary Secured sections of CPU1 */
     ret = iwl_pcie_load_cpu_sections_8000(trans, image, 1, &first_ucode_section);
     if (ret)
@@ -1429,6 +1585,335 @@ void iwl_trans_pcie_configure(struct iwl_trans *trans, const struct iwl_trans_co
     //     init_dummy_netdev(&trans_pcie->napi_dev);
 }
 
+int iwl_trans_pcie_rxq_dma_data(struct iwl_trans *trans, int queue,
+                                struct iwl_trans_rxq_dma_data *data)
+{
+    struct iwl_trans_pcie *trans_pcie = IWL_TRANS_GET_PCIE_TRANS(trans);
+    
+    if (queue >= trans->num_rx_queues || !trans_pcie->rxq)
+        return -EINVAL;
+    
+    data->fr_bd_cb = trans_pcie->rxq[queue].bd_dma;
+    data->urbd_stts_wrptr = trans_pcie->rxq[queue].rb_stts_dma;
+    data->ur_bd_cb = trans_pcie->rxq[queue].used_bd_dma;
+    data->fr_bd_wid = 0;
+    
+    return 0;
+}
+
+/*
+ * CUSTOM
+ * Firmware error dump. Linux hands this to the op mode (iwl_trans_fw_error ->
+ * iwl_fw_dbg_collect -> iwl_trans_pcie_dump_data), here the transport takes
+ * the snapshot itself from iwl_pcie_irq_handle_error and keeps the last
+ * IWL_FW_DUMP_SLOTS of them for the user client. The layout is the
+ * iwl_fw_error_dump_file one, so the usual tools can read it.
+ */
+
+/* subset of the periphery ranges Linux dumps, inclusive */
+static const struct {
+    u32 start;
+    u32 end;
+} iwl_prph_dump_addr[] = {
+    { .start = 0x00a00000, .end = 0x00a00000 },
+    { .start = 0x00a0000c, .end = 0x00a00024 },
+    { .start = 0x00a0002c, .end = 0x00a0003c },
+    { .start = 0x00a00410, .end = 0x00a00418 },
+    { .start = 0x00a00420, .end = 0x00a00420 },
+    { .start = 0x00a00428, .end = 0x00a00428 },
+    { .start = 0x00a00430, .end = 0x00a0043c },
+    { .start = 0x00a00444, .end = 0x00a00444 },
+    /* scheduler */
+    { .start = SCD_BASE, .end = SCD_BASE + 0x1b4 },
+};
+
+#define IWL_FW_DUMP_FH_LEN  max_t(u32, FH_MEM_UPPER_BOUND - FH_MEM_LOWER_BOUND, \
+                                  FH_MEM_UPPER_BOUND_GEN2 - FH_MEM_LOWER_BOUND_GEN2)
+
+static u32 iwl_pcie_fw_dump_size(void)
+{
+    u32 len = sizeof(struct iwl_fw_error_dump_file);
+    int i;
+    
+    len += sizeof(struct iwl_fw_error_dump_data) + IWL_CSR_TO_DUMP;
+    len += sizeof(struct iwl_fw_error_dump_data) + IWL_FW_DUMP_FH_LEN;
+    
+    for (i = 0; i < ARRAY_SIZE(iwl_prph_dump_addr); i++)
+        len += sizeof(struct iwl_fw_error_dump_data) + sizeof(struct iwl_fw_error_dump_prph) +
+            iwl_prph_dump_addr[i].end - iwl_prph_dump_addr[i].start + 4;
+    
+    len += sizeof(struct iwl_fw_error_dump_data) +
+        TFD_CMD_SLOTS * (sizeof(struct iwl_fw_error_dump_txcmd) + TFD_MAX_PAYLOAD_SIZE);
+    
+    len += IWL_FW_DUMP_MAX_RBS * (sizeof(struct iwl_fw_error_dump_data) +
+                                  sizeof(struct iwl_fw_error_dump_rb) + IWL_FW_DUMP_RB_CAPLEN);
+    
+    return len;
+}
+
+static int iwl_pcie_alloc_fw_dump(struct iwl_trans *trans)
+{
+    struct iwl_trans_pcie *trans_pcie = IWL_TRANS_GET_PCIE_TRANS(trans);
+    u32 size = iwl_pcie_fw_dump_size();
+    int i;
+    
+    for (i = 0; i < IWL_FW_DUMP_SLOTS; i++) {
+        trans_pcie->fw_dump_slots[i] = (u8 *)iwh_malloc(size);
+        if (!trans_pcie->fw_dump_slots[i])
+            return -ENOMEM;
+        trans_pcie->fw_dump_len[i] = 0;
+    }
+    
+    trans_pcie->fw_dump_slot_size = size;
+    trans_pcie->fw_dump_seq = 0;
+    trans_pcie->fw_dump_lock = IOLockAlloc();
+    if (!trans_pcie->fw_dump_lock)
+        return -ENOMEM;
+    
+    return 0;
+}
+
+static void iwl_pcie_free_fw_dump(struct iwl_trans *trans)
+{
+    struct iwl_trans_pcie *trans_pcie = IWL_TRANS_GET_PCIE_TRANS(trans);
+    int i;
+    
+    for (i = 0; i < IWL_FW_DUMP_SLOTS; i++) {
+        if (!trans_pcie->fw_dump_slots[i])
+            continue;
+        
+        iwh_free(trans_pcie->fw_dump_slots[i]);
+        trans_pcie->fw_dump_slots[i] = NULL;
+    }
+    
+    if (trans_pcie->fw_dump_lock) {
+        IOLockFree(trans_pcie->fw_dump_lock);
+        trans_pcie->fw_dump_lock = NULL;
+    }
+}
+
+static struct iwl_fw_error_dump_data *
+iwl_pcie_fw_dump_seg(struct iwl_fw_error_dump_data *data, u32 type, u32 len)
+{
+    data->type = cpu_to_le32(type);
+    data->len = cpu_to_le32(len);
+    
+    return iwl_fw_error_next_data(data);
+}
+
+// line 2577
+static struct iwl_fw_error_dump_data *
+iwl_pcie_fw_dump_fh(struct iwl_trans *trans, struct iwl_fw_error_dump_data *data)
+{
+    __le32 *val = (__le32 *)data->data;
+    u32 i;
+    
+    /* the caller holds NIC access */
+    if (trans->cfg->gen2) {
+        for (i = FH_MEM_LOWER_BOUND_GEN2; i < FH_MEM_UPPER_BOUND_GEN2; i += sizeof(u32))
+            *val++ = cpu_to_le32(iwl_read_prph_no_grab(trans, i));
+        
+        return iwl_pcie_fw_dump_seg(data, IWL_FW_ERROR_DUMP_FH_REGS,
+                                    FH_MEM_UPPER_BOUND_GEN2 - FH_MEM_LOWER_BOUND_GEN2);
+    }
+    
+    for (i = FH_MEM_LOWER_BOUND; i < FH_MEM_UPPER_BOUND; i += sizeof(u32))
+        *val++ = cpu_to_le32(iwl_read32(trans, i));
+    
+    return iwl_pcie_fw_dump_seg(data, IWL_FW_ERROR_DUMP_FH_REGS, FH_MEM_UPPER_BOUND - FH_MEM_LOWER_BOUND);
+}
+
+// line 2511
+static struct iwl_fw_error_dump_data *
+iwl_pcie_fw_dump_prph(struct iwl_trans *trans, struct iwl_fw_error_dump_data *data)
+{
+    int i;
+    
+    /* the caller holds NIC access */
+    for (i = 0; i < ARRAY_SIZE(iwl_prph_dump_addr); i++) {
+        struct iwl_fw_error_dump_prph *prph = (struct iwl_fw_error_dump_prph *)data->data;
+        u32 num_bytes = iwl_prph_dump_addr[i].end - iwl_prph_dump_addr[i].start + 4;
+        u32 reg;
+        
+        prph->prph_start = cpu_to_le32(iwl_prph_dump_addr[i].start);
+        for (reg = iwl_prph_dump_addr[i].start; reg <= iwl_prph_dump_addr[i].end; reg += 4)
+            prph->data[(reg - iwl_prph_dump_addr[i].start) / 4] =
+                cpu_to_le32(iwl_read_prph_no_grab(trans, reg));
+        
+        data = iwl_pcie_fw_dump_seg(data, IWL_FW_ERROR_DUMP_PRPH, sizeof(*prph) + num_bytes);
+    }
+    
+    return data;
+}
+
+// line 2556
+template <class TFD>
+static u32 iwl_pcie_fw_dump_cmdlen(void *tfd)
+{
+    u32 cmdlen = 0;
+    u8 i;
+    
+    for (i = 0; i < TFD::num_tbs(tfd); i++)
+        cmdlen += TFD::tb_len(tfd, i);
+    
+    return cmdlen;
+}
+
+// line 2735
+static struct iwl_fw_error_dump_data *
+iwl_pcie_fw_dump_txcmd(struct iwl_trans *trans, struct iwl_fw_error_dump_data *data)
+{
+    struct iwl_trans_pcie *trans_pcie = IWL_TRANS_GET_PCIE_TRANS(trans);
+    struct iwl_txq *cmdq = trans_pcie->txq[trans_pcie->cmd_queue];
+    struct iwl_fw_error_dump_txcmd *txcmd;
+    u32 len = 0;
+    int i, ptr;
+    
+    if (!cmdq || !cmdq->entries)
+        return data;
+    
+    txcmd = (struct iwl_fw_error_dump_txcmd *)data->data;
+    
+    IOSimpleLockLock(cmdq->lock);
+    ptr = cmdq->write_ptr;
+    for (i = 0; i < min_t(int, cmdq->n_window, TFD_CMD_SLOTS); i++) {
+        u8 idx = iwl_pcie_get_cmd_index(cmdq, ptr);
+        void *tfd = iwl_pcie_get_tfd(trans_pcie, cmdq, ptr);
+        u32 caplen, cmdlen;
+        
+        cmdlen = trans->cfg->use_tfh ? iwl_pcie_fw_dump_cmdlen<IwlTfdTfh>(tfd) :
+            iwl_pcie_fw_dump_cmdlen<IwlTfdGen1>(tfd);
+        caplen = min_t(u32, TFD_MAX_PAYLOAD_SIZE, cmdlen);
+        
+        if (cmdlen && cmdq->entries[idx].cmd) {
+            len += sizeof(*txcmd) + caplen;
+            txcmd->cmdlen = cpu_to_le32(cmdlen);
+            txcmd->caplen = cpu_to_le32(caplen);
+            memcpy(txcmd->data, cmdq->entries[idx].cmd, caplen);
+            txcmd = (struct iwl_fw_error_dump_txcmd *)((u8 *)txcmd->data + caplen);
+        }
+        
+        ptr = iwl_queue_dec_wrap(ptr);
+    }
+    IOSimpleLockUnlock(cmdq->lock);
+    
+    return iwl_pcie_fw_dump_seg(data, IWL_FW_ERROR_DUMP_TXCMD, len);
+}
+
+// line 2531
+static struct iwl_fw_error_dump_data *
+iwl_pcie_fw_dump_rbs(struct iwl_trans *trans, struct iwl_fw_error_dump_data *data)
+{
+    struct iwl_trans_pcie *trans_pcie = IWL_TRANS_GET_PCIE_TRANS(trans);
+    struct iwl_rxq *rxq = trans_pcie->rxq;
+    u32 i, r, n, caplen;
+    
+    /* with MQ RX the RBs aren't tracked by their ring position, skip them */
+    if (trans->cfg->mq_rx_supported || !rxq || !rxq->rb_stts)
+        return data;
+    
+    caplen = min_t(u32, PAGE_SIZE << trans_pcie->rx_page_order, IWL_FW_DUMP_RB_CAPLEN);
+    
+    IOSimpleLockLock(rxq->lock);
+    r = le16_to_cpu(rxq->rb_stts->closed_rb_num) & 0x0FFF;
+    r &= (rxq->queue_size - 1);
+    
+    for (i = rxq->read, n = 0; i != r && n < IWL_FW_DUMP_MAX_RBS; i = (i + 1) & (rxq->queue_size - 1), n++) {
+        struct iwl_rx_mem_buffer *rxb = rxq->queue[i];
+        struct iwl_fw_error_dump_rb *rb;
+        
+        if (!rxb || !rxb->page)
+            continue;
+        
+        rb = (struct iwl_fw_error_dump_rb *)data->data;
+        rb->index = cpu_to_le32(i);
+        rb->rxq = cpu_to_le32(rxq->id);
+        rb->reserved = 0;
+        memcpy(rb->data, rxb->page, caplen);
+        
+        data = iwl_pcie_fw_dump_seg(data, IWL_FW_ERROR_DUMP_RB, sizeof(*rb) + caplen);
+    }
+    IOSimpleLockUnlock(rxq->lock);
+    
+    return data;
+}
+
+void iwl_pcie_fw_dump_collect(struct iwl_trans *trans)
+{
+    struct iwl_trans_pcie *trans_pcie = IWL_TRANS_GET_PCIE_TRANS(trans);
+    struct iwl_fw_error_dump_file *file;
+    struct iwl_fw_error_dump_data *data;
+    __le32 *val;
+    IOInterruptState state;
+    u32 seq, slot, len, i;
+    
+    if (!trans_pcie->fw_dump_lock)
+        return;
+    
+    IOLockLock(trans_pcie->fw_dump_lock);
+    seq = trans_pcie->fw_dump_seq + 1;
+    slot = seq % IWL_FW_DUMP_SLOTS;
+    
+    file = (struct iwl_fw_error_dump_file *)trans_pcie->fw_dump_slots[slot];
+    file->barker = cpu_to_le32(IWL_FW_ERROR_DUMP_BARKER);
+    data = (struct iwl_fw_error_dump_data *)file->data;
+    
+    /* CSRs are readable with the NIC asleep */
+    val = (__le32 *)data->data;
+    for (i = 0; i < IWL_CSR_TO_DUMP; i += sizeof(u32))
+        *val++ = cpu_to_le32(iwl_read32(trans, i));
+    data = iwl_pcie_fw_dump_seg(data, IWL_FW_ERROR_DUMP_CSR, IWL_CSR_TO_DUMP);
+    
+    if (iwl_trans_grab_nic_access(trans, &state)) {
+        data = iwl_pcie_fw_dump_fh(trans, data);
+        if (!trans->cfg->gen2)
+            data = iwl_pcie_fw_dump_prph(trans, data);
+        iwl_trans_release_nic_access(trans, &state);
+    } else {
+        IWL_WARN(trans, "No NIC access, FH and PRPH not dumped\n");
+    }
+    
+    data = iwl_pcie_fw_dump_txcmd(trans, data);
+    data = iwl_pcie_fw_dump_rbs(trans, data);
+    
+    len = (u32)((u8 *)data - (u8 *)file);
+    file->file_len = cpu_to_le32(len);
+    
+    trans_pcie->fw_dump_len[slot] = len;
+    trans_pcie->fw_dump_seq = seq;
+    IOLockUnlock(trans_pcie->fw_dump_lock);
+    
+    IWL_ERR(trans, "Firmware error dump #%u collected (%u bytes)\n", seq, len);
+}
+
+/*
+ * Copy the last dump to @buf if it fits in @size. Returns the length of the
+ * dump either way, 0 if there is none yet.
+ */
+size_t iwl_trans_pcie_fw_dump_read(struct iwl_trans *trans, void *buf, size_t size, u32 *seq)
+{
+    struct iwl_trans_pcie *trans_pcie = IWL_TRANS_GET_PCIE_TRANS(trans);
+    size_t len = 0;
+    
+    if (!trans_pcie->fw_dump_lock)
+        return 0;
+    
+    IOLockLock(trans_pcie->fw_dump_lock);
+    if (trans_pcie->fw_dump_seq) {
+        u32 slot = trans_pcie->fw_dump_seq % IWL_FW_DUMP_SLOTS;
+        
+        len = trans_pcie->fw_dump_len[slot];
+        if (buf && size >= len)
+            memcpy(buf, trans_pcie->fw_dump_slots[slot], len);
+    }
+    if (seq)
+        *seq = trans_pcie->fw_dump_seq;
+    IOLockUnlock(trans_pcie->fw_dump_lock);
+    
+    return len;
+}
+/* CUSTOM END */
+
 // line 1776
 void IntelWifi::iwl_trans_pcie_free(struct iwl_trans *trans)
 {
@@ -1470,9 +1955,17 @@ void IntelWifi::iwl_trans_pcie_free(struct iwl_trans *trans)
 //    }
     
     //    free_percpu(trans_pcie->tso_hdr_page);
+    iwl_pcie_free_fw_load_bufs(trans);
+    iwl_pcie_free_fw_dump(trans);
+    iwl_trace_free();
+    if (trans->lat)
+        iwh_free(trans->lat);
+    
     IOSimpleLockFree(trans_pcie->irq_lock);
     IOSimpleLockFree(trans_pcie->reg_lock);
     IOLockFree(trans_pcie->mutex);
+    if (trans_pcie->hcmd_lock)
+        IOLockFree(trans_pcie->hcmd_lock);
     iwl_trans_free(trans);
 }
 
@@ -1503,6 +1996,10 @@ struct iwl_trans* IntelWifi::iwl_trans_pcie_alloc(const struct iwl_cfg *cfg) {
     trans_pcie->mutex = IOLockAlloc();
     
     trans_pcie->ucode_write_waitq = IOLockAlloc();
+    
+    trans_pcie->int_mit.adaptive = true;
+    trans_pcie->int_mit.coalescing = IWL_HOST_INT_TIMEOUT_DEF;
+    absolutetime_to_nanoseconds(mach_absolute_time(), &trans_pcie->int_mit.window_start);
     // TODO: Implement
     //trans_pcie->tso_hdr_page = alloc_percpu(struct iwl_tso_hdr_page);
     //if (!trans_pcie->tso_hdr_page) {
@@ -1536,6 +2033,13 @@ struct iwl_trans* IntelWifi::iwl_trans_pcie_alloc(const struct iwl_cfg *cfg) {
     }
     trans->max_skb_frags = IWL_PCIE_MAX_FRAGS(trans_pcie);
     
+    /* CUSTOM: the TX/RX paths are instantiated per TFD/RBD layout, pick ours once */
+    transOps = IwlTransOps::create(this, cfg);
+    if (!transOps)
+        return NULL;
+    
+    mbuf_tag_id_find("net.rpeshkov.IntelWifi", &trans_pcie->dev_cmd_tag);
+    
     // original linux code: pci_set_master(pdev);
     pciDevice->setBusMasterEnable(true);
 
@@ -1654,6 +2158,24 @@ struct iwl_trans* IntelWifi::iwl_trans_pcie_alloc(const struct iwl_cfg *cfg) {
     /* Initialize the wait queue for commands */
     trans_pcie->wait_command_queue = IOLockAlloc();
     trans_pcie->d0i3_waitq = IOLockAlloc();
+    trans_pcie->hcmd_lock = IOLockAlloc();
+    
+    if (iwl_pcie_alloc_fw_dump(trans)) {
+        IWL_ERR(trans, "Failed to allocate firmware dump buffers\n");
+        iwl_pcie_free_fw_dump(trans);
+        return NULL;
+    }
+    
+    /* not fatal, the trace points just don't record anything */
+    if (iwl_trace_init())
+        IWL_WARN(trans, "Failed to allocate the trace ring\n");
+    
+    /* same for the latency histograms */
+    trans->lat = (struct iwl_lat_stats *)iwh_zalloc(sizeof(*trans->lat));
+    if (trans->lat)
+        iwl_lat_init(trans->lat);
+    else
+        IWL_WARN(trans, "Failed to allocate the latency histograms\n");
     
     // TODO: Implement
     int ret;
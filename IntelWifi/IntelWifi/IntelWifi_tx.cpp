@@ -38,6 +38,7 @@
 //
 
 #include "IntelWifi.hpp"
+#include "IwlTransLayout.h"
 #include "iwlwifi/fw/api/tx.h"
 
 #include "iwlwifi/iwl-trans.h"
@@ -67,6 +68,72 @@
  *
  ***************************************************/
 
+/*
+ * CUSTOM
+ */
+
+static IwlOpModeOps *iwl_pcie_get_op_mode(struct iwl_trans *trans) {
+    return static_cast<IntelWifi *>(trans->dev)->opmode;
+}
+
+// internal.h line 634
+static void iwl_wake_queue(struct iwl_trans *trans, struct iwl_txq *txq)
+{
+    struct iwl_trans_pcie *trans_pcie = IWL_TRANS_GET_PCIE_TRANS(trans);
+    
+    if (test_and_clear_bit(txq->id, trans_pcie->queue_stopped)) {
+        IWL_DEBUG_TX_QUEUES(trans, "Wake hwq %d\n", txq->id);
+        iwl_pcie_get_op_mode(trans)->queue_not_full(txq->id);
+    }
+}
+
+// internal.h line 645
+static void iwl_stop_queue(struct iwl_trans *trans, struct iwl_txq *txq)
+{
+    struct iwl_trans_pcie *trans_pcie = IWL_TRANS_GET_PCIE_TRANS(trans);
+    
+    if (!test_and_set_bit(txq->id, trans_pcie->queue_stopped)) {
+        iwl_pcie_get_op_mode(trans)->queue_full(txq->id);
+        IWL_DEBUG_TX_QUEUES(trans, "Stop hwq %d\n", txq->id);
+    } else
+        IWL_DEBUG_TX_QUEUES(trans, "hwq %d already stopped\n", txq->id);
+}
+
+/*
+ * The stuck timer is an IOTimerEventSource on the main workloop. Setting
+ * and cancelling its timeout take the thread call lock, which must not
+ * nest inside txq->lock (a simple lock, spun on by the TX and reclaim
+ * paths). Where upstream calls mod_timer()/del_timer() under the queue
+ * lock, the decision is made under it and applied once it's dropped.
+ */
+static void iwl_pcie_txq_set_stuck_timer(struct iwl_txq *txq, enum iwl_txq_stuck_timer op)
+{
+    IOTimerEventSource *stuck_timer = (IOTimerEventSource *)txq->stuck_timer;
+    
+    if (op == IWL_TXQ_TIMER_ARM)
+        stuck_timer->setTimeoutMS((UInt32)jiffies_to_msecs(txq->wd_timeout));
+    else if (op == IWL_TXQ_TIMER_CANCEL)
+        stuck_timer->cancelTimeout();
+}
+
+static void iwl_pcie_txq_free_stuck_timer(struct iwl_txq *txq)
+{
+    IOTimerEventSource *stuck_timer = (IOTimerEventSource *)txq->stuck_timer;
+    
+    if (!stuck_timer)
+        return;
+    
+    stuck_timer->cancelTimeout();
+    if (stuck_timer->getWorkLoop())
+        stuck_timer->getWorkLoop()->removeEventSource(stuck_timer);
+    stuck_timer->release();
+    txq->stuck_timer = NULL;
+}
+
+/*
+ * CUSTOM END
+ */
+
 int iwl_queue_space(const struct iwl_txq *q)
 {
     unsigned int max;
@@ -147,6 +214,48 @@ void iwl_pcie_free_dma_ptr(struct iwl_trans *trans, struct iwl_dma_ptr *ptr)
 }
 
 
+/* line 172
+ * iwl_pcie_txq_update_byte_cnt_tbl - Set up entry in Tx byte-count array
+ */
+static void iwl_pcie_txq_update_byte_cnt_tbl(struct iwl_trans *trans, struct iwl_txq *txq,
+                                             u16 byte_cnt, int num_tbs)
+{
+    struct iwl_trans_pcie *trans_pcie = IWL_TRANS_GET_PCIE_TRANS(trans);
+    struct iwlagn_scd_bc_tbl *scd_bc_tbl = (struct iwlagn_scd_bc_tbl *)trans_pcie->scd_bc_tbls->addr;
+    int write_ptr = txq->write_ptr;
+    int txq_id = txq->id;
+    u8 sec_ctl = 0;
+    u16 len = byte_cnt + IWL_TX_CRC_SIZE + IWL_TX_DELIMITER_SIZE;
+    __le16 bc_ent;
+    struct iwl_tx_cmd *tx_cmd = (struct iwl_tx_cmd *)txq->entries[write_ptr].cmd->payload;
+    u8 sta_id = tx_cmd->sta_id;
+    
+    sec_ctl = tx_cmd->sec_ctl;
+    
+    switch (sec_ctl & TX_CMD_SEC_MSK) {
+        case TX_CMD_SEC_CCM:
+            len += IEEE80211_CCMP_MIC_LEN;
+            break;
+        case TX_CMD_SEC_TKIP:
+            len += IEEE80211_TKIP_ICV_LEN;
+            break;
+        case TX_CMD_SEC_WEP:
+            len += IEEE80211_WEP_IV_LEN + IEEE80211_WEP_ICV_LEN;
+            break;
+    }
+    if (trans_pcie->bc_table_dword)
+        len = DIV_ROUND_UP(len, 4);
+    
+    if (WARN_ON(len > 0xFFF || write_ptr >= TFD_QUEUE_SIZE_MAX))
+        return;
+    
+    bc_ent = cpu_to_le16(len | (sta_id << 12));
+    
+    scd_bc_tbl[txq_id].tfd_offset[write_ptr] = bc_ent;
+    
+    if (write_ptr < TFD_QUEUE_SIZE_BC_DUP)
+        scd_bc_tbl[txq_id].tfd_offset[TFD_QUEUE_SIZE_MAX + write_ptr] = bc_ent;
+}
 
 // line 217
 static void iwl_pcie_txq_inval_byte_cnt_tbl(struct iwl_trans *trans, struct iwl_txq *txq)
@@ -233,76 +342,122 @@ void iwl_pcie_txq_check_wrptrs(struct iwl_trans *trans)
             continue;
 
         //spin_lock_bh(&txq->lock);
-        //IOSimpleLockLock(txq->lock);
+        IOSimpleLockLock(txq->lock);
         if (txq->need_update) {
             iwl_pcie_txq_inc_wr_ptr(trans, txq);
             txq->need_update = false;
         }
+        txq->wr_ptr_deferred = 0;
         //spin_unlock_bh(&txq->lock);
-        //IOSimpleLockUnlock(txq->lock);
+        IOSimpleLockUnlock(txq->lock);
     }
 }
 
-// line 312
-static dma_addr_t iwl_pcie_tfd_tb_get_addr(struct iwl_trans *trans, void *_tfd, u8 idx)
+/*
+ * CUSTOM
+ * Deferred TX doorbell. Data frames enqueued while a batch is open only mark
+ * their queue with need_update; a single HBUS_TARG_WRPTR write then covers
+ * everything queued so far. Host commands always ring the doorbell at once.
+ *
+ * Returns true if the caller has to arm the batch timer, which it does
+ * after dropping txq->lock.
+ */
+bool IntelWifi::iwl_pcie_txq_update_wr_ptr(struct iwl_trans *trans, struct iwl_txq *txq)
 {
-    if (trans->cfg->use_tfh) {
-        struct iwl_tfh_tfd *tfd = (struct iwl_tfh_tfd *)_tfd;
-        struct iwl_tfh_tb *tb = &tfd->tbs[idx];
-        
-        return (dma_addr_t)(le64_to_cpu(tb->addr));
-    } else {
-        struct iwl_tfd *tfd = (struct iwl_tfd *)_tfd;
-        struct iwl_tfd_tb *tb = &tfd->tbs[idx];
-        dma_addr_t addr = get_unaligned_le32(&tb->lo);
-        dma_addr_t hi_len;
-        
-        if (sizeof(dma_addr_t) <= sizeof(u32))
-            return addr;
-        
-        hi_len = le16_to_cpu(tb->hi_n_len) & 0xF;
-        
-        /*
-         * shift by 16 twice to avoid warnings on 32-bit
-         * (where this code never runs anyway due to the
-         * if statement above)
-         */
-        return addr | ((hi_len << 16) << 16);
+    struct iwl_trans_pcie *trans_pcie = IWL_TRANS_GET_PCIE_TRANS(trans);
+    
+    //lockdep_assert_held(&txq->lock);
+    
+    if (!trans_pcie->tx_batch_depth || ++txq->wr_ptr_deferred >= IWL_TX_BATCH_MAX_FRAMES) {
+        /* this covers the deferred frames too, don't ring again on flush */
+        txq->wr_ptr_deferred = 0;
+        txq->need_update = false;
+        iwl_pcie_txq_inc_wr_ptr(trans, txq);
+        return false;
     }
+    
+    txq->need_update = true;
+    
+    /* bound the latency of the first deferred frame */
+    return OSCompareAndSwap(0, 1, &trans_pcie->tx_batch_timer_armed);
 }
 
+void IntelWifi::iwl_pcie_tx_batch_arm_timer()
+{
+    fTxBatchTimer->setTimeoutUS(IWL_TX_BATCH_MAX_LATENCY_US);
+}
 
-// line 341
-static void iwl_pcie_tfd_set_tb(struct iwl_trans *trans, void *tfd, u8 idx, dma_addr_t addr, u16 len)
+void IntelWifi::iwl_trans_pcie_tx_batch_begin(struct iwl_trans *trans)
 {
-    struct iwl_tfd *tfd_fh = (struct iwl_tfd *)tfd;
-    struct iwl_tfd_tb *tb = &tfd_fh->tbs[idx];
+    struct iwl_trans_pcie *trans_pcie = IWL_TRANS_GET_PCIE_TRANS(trans);
     
-    u16 hi_n_len = len << 4;
+    OSIncrementAtomic(&trans_pcie->tx_batch_depth);
+}
+
+void IntelWifi::iwl_trans_pcie_tx_batch_end(struct iwl_trans *trans)
+{
+    struct iwl_trans_pcie *trans_pcie = IWL_TRANS_GET_PCIE_TRANS(trans);
     
-    put_unaligned_le32((u32)addr, &tb->lo);
-    hi_n_len |= iwl_get_dma_hi_addr(addr);
+    if (OSDecrementAtomic(&trans_pcie->tx_batch_depth) == 1)
+        iwl_pcie_tx_batch_flush(trans);
+}
+
+/* must not be called with a txq->lock held */
+void IntelWifi::iwl_pcie_tx_batch_flush(struct iwl_trans *trans)
+{
+    struct iwl_trans_pcie *trans_pcie = IWL_TRANS_GET_PCIE_TRANS(trans);
     
-    tb->hi_n_len = cpu_to_le16(hi_n_len);
+    if (OSCompareAndSwap(1, 0, &trans_pcie->tx_batch_timer_armed))
+        fTxBatchTimer->cancelTimeout();
     
-    tfd_fh->num_tbs = idx + 1;
+    iwl_pcie_txq_check_wrptrs(trans);
 }
 
-// line 357
-static u8 iwl_pcie_tfd_get_num_tbs(struct iwl_trans *trans, void *_tfd)
+void IntelWifi::txBatchTimeout(OSObject *owner, IOTimerEventSource *sender)
 {
-    if (trans->cfg->use_tfh) {
-        struct iwl_tfh_tfd *tfd = (struct iwl_tfh_tfd *)_tfd;
-        
-        return le16_to_cpu(tfd->num_tbs) & 0x1f;
-    } else {
-        struct iwl_tfd *tfd = (struct iwl_tfd *)_tfd;
-        
-        return tfd->num_tbs & 0x1f;
+    IntelWifi *me = OSDynamicCast(IntelWifi, owner);
+    
+    if (!me || !me->fTrans)
+        return;
+    
+    OSCompareAndSwap(1, 0, &IWL_TRANS_GET_PCIE_TRANS(me->fTrans)->tx_batch_timer_armed);
+    iwl_pcie_txq_check_wrptrs(me->fTrans);
+}
+
+// iwl_pcie_txq_stuck_timer
+void IntelWifi::txqStuckTimeout(OSObject *owner, IOTimerEventSource *sender)
+{
+    IntelWifi *me = OSDynamicCast(IntelWifi, owner);
+    struct iwl_txq *txq = (struct iwl_txq *)sender->getRefcon();
+    
+    if (!me || !me->fTrans || !txq)
+        return;
+    
+    IOSimpleLockLock(txq->lock);
+    /* check if triggered erroneously */
+    if (txq->read_ptr == txq->write_ptr) {
+        IOSimpleLockUnlock(txq->lock);
+        return;
     }
+    IOSimpleLockUnlock(txq->lock);
+    
+    IWL_ERR(me->fTrans, "Queue %d stuck for %u ms.\n", txq->id,
+            (unsigned int)jiffies_to_msecs(txq->wd_timeout));
+    
+    //iwl_trans_pcie_log_scd_error(trans, txq);
+    
+    iwl_force_nmi(me->fTrans);
 }
 
+/*
+ * CUSTOM END
+ */
+
+// line 312
+// CUSTOM: the TB accessors of tx.c are IwlTfdGen1 / IwlTfdTfh in IwlTransLayout.h
+
 // line 370
+template <class TFD>
 static void iwl_pcie_tfd_unmap(struct iwl_trans *trans, struct iwl_cmd_meta *meta, struct iwl_txq *txq, int index)
 {
     struct iwl_trans_pcie *trans_pcie = IWL_TRANS_GET_PCIE_TRANS(trans);
@@ -310,7 +465,7 @@ static void iwl_pcie_tfd_unmap(struct iwl_trans *trans, struct iwl_cmd_meta *met
     void *tfd = iwl_pcie_get_tfd(trans_pcie, txq, index);
     
     /* Sanity check on number of chunks */
-    num_tbs = iwl_pcie_tfd_get_num_tbs(trans, tfd);
+    num_tbs = TFD::num_tbs(tfd);
     
     if (num_tbs >= trans_pcie->max_tbs) {
         IWL_ERR(trans, "Too many chunks: %i\n", num_tbs);
@@ -341,16 +496,15 @@ static void iwl_pcie_tfd_unmap(struct iwl_trans *trans, struct iwl_cmd_meta *met
 //                             DMA_TO_DEVICE);
 //    }
     
-    if (trans->cfg->use_tfh) {
-        struct iwl_tfh_tfd *tfd_fh = (struct iwl_tfh_tfd *)tfd;
-        
-        tfd_fh->num_tbs = 0;
-    } else {
-        struct iwl_tfd *tfd_fh = (struct iwl_tfd *)tfd;
-        
-        tfd_fh->num_tbs = 0;
-    }
-    
+    TFD::clear_tbs(tfd);
+}
+
+static void iwl_pcie_tfd_unmap(struct iwl_trans *trans, struct iwl_cmd_meta *meta, struct iwl_txq *txq, int index)
+{
+    if (trans->cfg->use_tfh)
+        iwl_pcie_tfd_unmap<IwlTfdTfh>(trans, meta, txq, index);
+    else
+        iwl_pcie_tfd_unmap<IwlTfdGen1>(trans, meta, txq, index);
 }
 
 /* line 416
@@ -362,7 +516,8 @@ static void iwl_pcie_tfd_unmap(struct iwl_trans *trans, struct iwl_cmd_meta *met
  * Does NOT advance any TFD circular buffer read/write indexes
  * Does NOT free the TFD itself (which is within circular buffer)
  */
-void iwl_pcie_txq_free_tfd(struct iwl_trans *trans, struct iwl_txq *txq)
+template <class TFD>
+static void iwl_pcie_txq_free_tfd(struct iwl_trans *trans, struct iwl_txq *txq)
 {
     /* rd_ptr is bounded by TFD_QUEUE_SIZE_MAX and
      * idx is bounded by n_window
@@ -375,7 +530,7 @@ void iwl_pcie_txq_free_tfd(struct iwl_trans *trans, struct iwl_txq *txq)
     /* We have only q->n_window txq->entries, but we use
      * TFD_QUEUE_SIZE_MAX tfds
      */
-    iwl_pcie_tfd_unmap(trans, &txq->entries[idx].meta, txq, rd_ptr);
+    iwl_pcie_tfd_unmap<TFD>(trans, &txq->entries[idx].meta, txq, rd_ptr);
     
     /* free SKB */
     if (txq->entries) {
@@ -388,14 +543,22 @@ void iwl_pcie_txq_free_tfd(struct iwl_trans *trans, struct iwl_txq *txq)
          * freed and that the queue is not empty - free the skb
          */
         if (skb) {
-            // TODO: Implement
-            // iwl_op_mode_free_skb(trans->op_mode, skb);
+            iwl_pcie_get_op_mode(trans)->free_skb(skb);
             txq->entries[idx].skb = NULL;
         }
     }
 }
 
+void iwl_pcie_txq_free_tfd(struct iwl_trans *trans, struct iwl_txq *txq)
+{
+    if (trans->cfg->use_tfh)
+        iwl_pcie_txq_free_tfd<IwlTfdTfh>(trans, txq);
+    else
+        iwl_pcie_txq_free_tfd<IwlTfdGen1>(trans, txq);
+}
+
 // line 457
+template <class TFD>
 static int iwl_pcie_txq_build_tfd(struct iwl_trans *trans, struct iwl_txq *txq, dma_addr_t addr, u16 len, bool reset)
 {
     struct iwl_trans_pcie *trans_pcie = IWL_TRANS_GET_PCIE_TRANS(trans);
@@ -407,7 +570,7 @@ static int iwl_pcie_txq_build_tfd(struct iwl_trans *trans, struct iwl_txq *txq,
     if (reset)
         memset(tfd, 0, trans_pcie->tfd_size);
     
-    num_tbs = iwl_pcie_tfd_get_num_tbs(trans, tfd);
+    num_tbs = TFD::num_tbs(tfd);
     
     /* Each TFD can point to a maximum max_tbs Tx buffers */
     if (num_tbs >= trans_pcie->max_tbs) {
@@ -418,11 +581,19 @@ static int iwl_pcie_txq_build_tfd(struct iwl_trans *trans, struct iwl_txq *txq,
     if (addr & ~IWL_TX_DMA_MASK)
         return -EINVAL;
     
-    iwl_pcie_tfd_set_tb(trans, tfd, num_tbs, addr, len);
+    if (TFD::set_tb(tfd, num_tbs, addr, len))
+        return -EINVAL;
     
     return num_tbs;
 }
 
+static int iwl_pcie_txq_build_tfd(struct iwl_trans *trans, struct iwl_txq *txq, dma_addr_t addr, u16 len, bool reset)
+{
+    if (trans->cfg->use_tfh)
+        return iwl_pcie_txq_build_tfd<IwlTfdTfh>(trans, txq, addr, len, reset);
+    return iwl_pcie_txq_build_tfd<IwlTfdGen1>(trans, txq, addr, len, reset);
+}
+
 
 // line 487
 int IntelWifi::iwl_pcie_txq_alloc(struct iwl_trans *trans, struct iwl_txq *txq, int slots_num, bool cmd_queue)
@@ -434,12 +605,21 @@ int IntelWifi::iwl_pcie_txq_alloc(struct iwl_trans *trans, struct iwl_txq *txq,
     int ret;
     struct iwl_dma_ptr *tfds_dma = NULL;
     struct iwl_dma_ptr *first_tb_bufs_dma = NULL;
+    struct iwl_dma_ptr *tx_cmd_bufs_dma = NULL;
 
     if (WARN_ON(txq->entries || txq->tfds))
         return -EINVAL;
 
-    // TODO: Implement
 //    setup_timer(&txq->stuck_timer, iwl_pcie_txq_stuck_timer, (unsigned long)txq);
+    IOTimerEventSource *stuck_timer = IOTimerEventSource::timerEventSource(this, &IntelWifi::txqStuckTimeout);
+    if (!stuck_timer)
+        return -ENOMEM;
+    stuck_timer->setRefcon(txq);
+    if (fWorkLoop->addEventSource(stuck_timer) != kIOReturnSuccess) {
+        stuck_timer->release();
+        return -ENOMEM;
+    }
+    txq->stuck_timer = stuck_timer;
     txq->trans_pcie = trans_pcie;
     
     txq->n_window = slots_num;
@@ -478,7 +658,20 @@ int IntelWifi::iwl_pcie_txq_alloc(struct iwl_trans *trans, struct iwl_txq *txq,
     txq->first_tb_bufs = (struct iwl_pcie_first_tb_buf *)first_tb_bufs_dma->addr;
     txq->first_tb_dma = first_tb_bufs_dma->dma;
     
+    if (!cmd_queue) {
+        ret = iwl_pcie_alloc_dma_ptr(trans, &tx_cmd_bufs_dma, sizeof(*txq->tx_cmd_bufs) * slots_num);
+        if (ret) {
+            goto err_free_first_tb;
+        }
+        
+        txq->tx_cmd_dma_ptr = tx_cmd_bufs_dma;
+        txq->tx_cmd_bufs = (struct iwl_pcie_tx_cmd_buf *)tx_cmd_bufs_dma->addr;
+        txq->tx_cmd_dma = tx_cmd_bufs_dma->dma;
+    }
+    
     return 0;
+err_free_first_tb:
+    free_dma_buf(txq->first_tb_dma_ptr);
 err_free_tfds:
     free_dma_buf(txq->tfds_dma_ptr);
 error:
@@ -488,6 +681,7 @@ error:
 
     iwh_free(txq->entries);
     txq->entries = NULL;
+    iwl_pcie_txq_free_stuck_timer(txq);
     return -ENOMEM;
     
 }
@@ -517,8 +711,8 @@ int IntelWifi::iwl_pcie_txq_init(struct iwl_trans *trans, struct iwl_txq *txq, i
 //        lockdep_set_class(&txq->lock, &iwl_pcie_cmd_queue_lock_class);
     }
     
-    // TODO: Implement
-    //__skb_queue_head_init(&txq->overflow_q);
+    txq->overflow_q = NULL;
+    txq->overflow_tail = NULL;
     
     return 0;
 }
@@ -584,18 +778,19 @@ static void iwl_pcie_txq_unmap(struct iwl_trans *trans, int txq_id)
         }
     }
 
-    // TODO: Implement
-//    while (!skb_queue_empty(&txq->overflow_q)) {
-//        struct sk_buff *skb = __skb_dequeue(&txq->overflow_q);
-//
-//        iwl_op_mode_free_skb(trans->op_mode, skb);
-//    }
+    while (txq->overflow_q) {
+        mbuf_t m = txq->overflow_q;
+        
+        txq->overflow_q = mbuf_nextpkt(m);
+        mbuf_setnextpkt(m, NULL);
+        iwl_pcie_get_op_mode(trans)->free_skb((struct sk_buff *)m);
+    }
+    txq->overflow_tail = NULL;
     
     //spin_unlock_bh(&txq->lock);
     
     /* just in case - this queue may have been stopped */
-    // TODO: Implement
-    // iwl_wake_queue(trans, txq);
+    iwl_wake_queue(trans, txq);
 }
 
 
@@ -634,12 +829,16 @@ static void iwl_pcie_txq_free(struct iwl_trans *trans, int txq_id)
         txq->tfds = NULL;
         
         free_dma_buf(txq->first_tb_dma_ptr);
+        
+        if (txq->tx_cmd_dma_ptr)
+            free_dma_buf(txq->tx_cmd_dma_ptr);
     }
     
     iwh_free(txq->entries);
     txq->entries = NULL;
     
     //del_timer_sync(&txq->stuck_timer);
+    iwl_pcie_txq_free_stuck_timer(txq);
     
     /* 0-fill queue descriptor structure */
     bzero(txq, sizeof(*txq));
@@ -915,31 +1114,170 @@ error:
 }
 
 // line 1034
-void IntelWifi::iwl_pcie_txq_progress(struct iwl_txq *txq)
+// CUSTOM: returns what to do with the stuck timer, see iwl_pcie_txq_set_stuck_timer()
+enum iwl_txq_stuck_timer IntelWifi::iwl_pcie_txq_progress(struct iwl_txq *txq)
 {
     //lockdep_assert_held(&txq->lock);
     
     if (!txq->wd_timeout)
-        return;
+        return IWL_TXQ_TIMER_KEEP;
     
     /*
      * station is asleep and we send data - that must
      * be uAPSD or PS-Poll. Don't rearm the timer.
      */
     if (txq->frozen)
-        return;
+        return IWL_TXQ_TIMER_KEEP;
     
     /*
      * if empty delete timer, otherwise move timer forward
      * since we're making progress on this queue
      */
-    // TODO: Implement
 //    if (txq->read_ptr == txq->write_ptr)
 //        del_timer(&txq->stuck_timer);
 //    else
 //        mod_timer(&txq->stuck_timer, jiffies + txq->wd_timeout);
+    if (txq->read_ptr == txq->write_ptr)
+        return IWL_TXQ_TIMER_CANCEL;
+    return IWL_TXQ_TIMER_ARM;
 }
 
+/* line 1052
+ * Frees buffers until index _not_ inclusive. The reclaimed frames are
+ * returned to the caller as a packet list (linked with mbuf_nextpkt) in
+ * @skbs, which must be empty on entry.
+ */
+template <class TFD>
+void IntelWifi::iwl_trans_pcie_reclaim(struct iwl_trans *trans, int txq_id, int ssn, mbuf_t *skbs)
+{
+    struct iwl_trans_pcie *trans_pcie = IWL_TRANS_GET_PCIE_TRANS(trans);
+    struct iwl_txq *txq = trans_pcie->txq[txq_id];
+    int tfd_num = ssn & (TFD_QUEUE_SIZE_MAX - 1);
+    int last_to_free;
+    mbuf_t tail = NULL;
+    enum iwl_txq_stuck_timer stuck_timer = IWL_TXQ_TIMER_KEEP;
+    
+    /* This function is not meant to release cmd queue*/
+    if (WARN_ON(txq_id == trans_pcie->cmd_queue))
+        return;
+    
+    IOSimpleLockLock(txq->lock);
+    
+    if (!test_bit(txq_id, trans_pcie->queue_used)) {
+        IWL_DEBUG_TX_QUEUES(trans, "Q %d inactive - ignoring idx %d\n", txq_id, ssn);
+        goto out;
+    }
+    
+    if (txq->read_ptr == tfd_num)
+        goto out;
+    
+    IWL_DEBUG_TX_REPLY(trans, "[Q %d] %d -> %d (%d)\n", txq_id, txq->read_ptr, tfd_num, ssn);
+    
+    /*Since we free until index _not_ inclusive, the one before index is
+     * the last we will free. This one must be used */
+    last_to_free = iwl_queue_dec_wrap(tfd_num);
+    
+    if (!iwl_queue_used(txq, last_to_free)) {
+        IWL_ERR(trans,
+                "%s: Read index for DMA queue txq id (%d), last_to_free %d is out of range [0-%d] %d %d.\n",
+                __func__, txq_id, last_to_free, TFD_QUEUE_SIZE_MAX,
+                txq->write_ptr, txq->read_ptr);
+        goto out;
+    }
+    
+    if (WARN_ON(*skbs))
+        goto out;
+    
+    iwl_trace(IWL_TRACE_TX_RECLAIM, txq_id, ssn, (tfd_num - txq->read_ptr) & (TFD_QUEUE_SIZE_MAX - 1), 0);
+    
+    for (;
+         txq->read_ptr != tfd_num;
+         txq->read_ptr = iwl_queue_inc_wrap(txq->read_ptr)) {
+        mbuf_t m = (mbuf_t)txq->entries[txq->read_ptr].skb;
+        
+        if (WARN_ON_ONCE(!m))
+            continue;
+        
+        iwl_lat_record(trans->lat, IWL_LAT_TX, txq->entries[txq->read_ptr].ts);
+        
+        //iwl_pcie_free_tso_page(trans_pcie, skb);
+        
+        if (tail)
+            mbuf_setnextpkt(tail, m);
+        else
+            *skbs = m;
+        tail = m;
+        
+        txq->entries[txq->read_ptr].skb = NULL;
+        
+        if (!TFD::use_tfh)
+            iwl_pcie_txq_inval_byte_cnt_tbl(trans, txq);
+        
+        iwl_pcie_txq_free_tfd<TFD>(trans, txq);
+    }
+    
+    stuck_timer = iwl_pcie_txq_progress(txq);
+    
+    if (iwl_queue_space(txq) > txq->low_mark && test_bit(txq_id, trans_pcie->queue_stopped)) {
+        mbuf_t overflow_skbs = txq->overflow_q;
+        
+        txq->overflow_q = NULL;
+        txq->overflow_tail = NULL;
+        
+        /*
+         * This is tricky: we are in reclaim path which is non
+         * re-entrant, so noone will try to take the access the
+         * txq data from that path. We stopped tx, so we can't
+         * have tx as well. Bottom line, we can unlock and re-lock
+         * later.
+         */
+        IOSimpleLockUnlock(txq->lock);
+        
+        /* the backlog goes out with a single doorbell */
+        iwl_trans_pcie_tx_batch_begin(trans);
+        while (overflow_skbs) {
+            mbuf_t m = overflow_skbs;
+            struct iwl_device_cmd **dev_cmd_ptr;
+            size_t dev_cmd_len;
+            
+            overflow_skbs = mbuf_nextpkt(m);
+            mbuf_setnextpkt(m, NULL);
+            
+            if (mbuf_tag_find(m, trans_pcie->dev_cmd_tag, 0, &dev_cmd_len, (void **)&dev_cmd_ptr)) {
+                iwl_pcie_get_op_mode(trans)->free_skb((struct sk_buff *)m);
+                continue;
+            }
+            struct iwl_device_cmd *dev_cmd = *dev_cmd_ptr;
+            mbuf_tag_free(m, trans_pcie->dev_cmd_tag, 0);
+            
+            /*
+             * Note that we can very well be overflowing again.
+             * In that case, iwl_queue_space will be small again
+             * and we won't wake mac80211's queue.
+             */
+            iwl_trans_pcie_tx<TFD>(trans, (struct sk_buff *)m, dev_cmd, txq_id);
+        }
+        iwl_trans_pcie_tx_batch_end(trans);
+        IOSimpleLockLock(txq->lock);
+        
+        if (iwl_queue_space(txq) > txq->low_mark)
+            iwl_wake_queue(trans, txq);
+    }
+    
+    if (txq->read_ptr == txq->write_ptr) {
+        IWL_DEBUG_RPM(trans, "Q %d - last tx reclaimed\n", txq->id);
+        iwl_trans_unref(trans);
+    }
+    
+out:
+    IOSimpleLockUnlock(txq->lock);
+    
+    iwl_pcie_txq_set_stuck_timer(txq, stuck_timer);
+}
+
+template void IntelWifi::iwl_trans_pcie_reclaim<IwlTfdGen1>(struct iwl_trans *, int, int, mbuf_t *);
+template void IntelWifi::iwl_trans_pcie_reclaim<IwlTfdTfh>(struct iwl_trans *, int, int, mbuf_t *);
+
 
 
 // line 1168
@@ -1022,7 +1360,8 @@ void IntelWifi::iwl_pcie_cmdq_reclaim(struct iwl_trans *trans, int txq_id, int i
         IOSimpleLockUnlockEnableInterrupt(trans_pcie->reg_lock, state);
     }
     
-    iwl_pcie_txq_progress(txq);
+    /* the command queue is serialized by hcmd_lock, there's no simple lock held */
+    iwl_pcie_txq_set_stuck_timer(txq, iwl_pcie_txq_progress(txq));
 }
 
 // line 1254
@@ -1214,6 +1553,42 @@ void iwl_trans_pcie_txq_disable(struct iwl_trans *trans, int txq_id, bool config
 
 /*************** HOST COMMAND QUEUE FUNCTIONS   *****/
 
+/*
+ * CUSTOM
+ * Host command profile. Commands are queued and completed under hcmd_lock,
+ * which serializes every update of the counters.
+ */
+static void iwl_pcie_cmd_prof_sent(struct iwl_trans *trans, u32 id, u16 len)
+{
+    int idx = iwl_cmd_table_idx(trans, id);
+    
+    if (!trans->cmd_prof || idx < 0)
+        return;
+    
+    trans->cmd_prof[idx].count++;
+    trans->cmd_prof[idx].bytes += len;
+}
+
+static void iwl_pcie_cmd_prof_done(struct iwl_trans *trans, u32 id, u32 resp_len, u64 ts)
+{
+    struct iwl_cmd_prof *prof;
+    int idx = iwl_cmd_table_idx(trans, id);
+    u64 ns;
+    
+    if (!trans->cmd_prof || idx < 0)
+        return;
+    
+    absolutetime_to_nanoseconds(mach_absolute_time() - ts, &ns);
+    
+    prof = &trans->cmd_prof[idx];
+    prof->done++;
+    prof->resp_bytes += resp_len;
+    prof->time_ns += ns;
+    if (ns > prof->max_ns)
+        prof->max_ns = ns;
+}
+/* CUSTOM END */
+
 /* line 1440
  * iwl_pcie_enqueue_hcmd - enqueue a uCode command
  * @priv: device private data point
@@ -1319,9 +1694,11 @@ static int iwl_pcie_enqueue_hcmd(struct iwl_trans *trans, struct iwl_host_cmd *c
     }
     
     //IOSimpleLockLock(txq->lock);
+    IOLockLock(trans_pcie->hcmd_lock);
     
     if (iwl_queue_space(txq) < ((cmd->flags & CMD_ASYNC) ? 2 : 1)) {
         //IOSimpleLockUnlock(txq->lock);
+        IOLockUnlock(trans_pcie->hcmd_lock);
         
         IWL_ERR(trans, "No space in command queue\n");
         // TODO: Implement
@@ -1338,6 +1715,15 @@ static int iwl_pcie_enqueue_hcmd(struct iwl_trans *trans, struct iwl_host_cmd *c
     if (cmd->flags & CMD_WANT_SKB)
         out_meta->source = cmd;
     
+    /* CUSTOM */
+    if (!(cmd->flags & CMD_ASYNC)) {
+        cmd->_idx = idx;
+        cmd->_seq = ++trans_pcie->hcmd_seq;
+        txq->entries[idx].hcmd_seq = cmd->_seq;
+    }
+    txq->entries[idx].ts = mach_absolute_time();
+    /* CUSTOM END */
+    
     /* set up the header */
     if (group_id != 0) {
         out_cmd->hdr_wide.cmd = iwl_cmd_opcode(cmd->id);
@@ -1451,12 +1837,12 @@ static int iwl_pcie_enqueue_hcmd(struct iwl_trans *trans, struct iwl_host_cmd *c
     
     txq->entries[idx].free_buf = dup_buf;
     
-    //trace_iwlwifi_dev_hcmd(trans->dev, cmd, cmd_size, &out_cmd->hdr_wide);
+    trace_iwlwifi_dev_hcmd(trans->dev, cmd, cmd_size, &out_cmd->hdr_wide);
     
     /* start timer if queue currently empty */
     if (txq->read_ptr == txq->write_ptr && txq->wd_timeout) {
-        // TODO: Implement
         // mod_timer(&txq->stuck_timer, jiffies + txq->wd_timeout);
+        iwl_pcie_txq_set_stuck_timer(txq, IWL_TXQ_TIMER_ARM);
     }
 
     flags = IOSimpleLockLockDisableInterrupt(trans_pcie->reg_lock);
@@ -1474,8 +1860,11 @@ static int iwl_pcie_enqueue_hcmd(struct iwl_trans *trans, struct iwl_host_cmd *c
     
     IOSimpleLockUnlockEnableInterrupt(trans_pcie->reg_lock, flags);
     
+    iwl_pcie_cmd_prof_sent(trans, cmd->id, cmd_size);
+    
 out:
     //IOSimpleLockUnlock(txq->lock);
+    IOLockUnlock(trans_pcie->hcmd_lock);
 free_dup_buf:
 //    if (idx < 0)
 //        kfree(dup_buf);
@@ -1528,8 +1917,13 @@ void IntelWifi::iwl_pcie_hcmd_complete(struct iwl_trans *trans,
         return;
     }
     
+    /*
+     * CUSTOM: hcmd_lock stands in for txq->lock on the command queue, on
+     * both the enqueue and the completion side, so the reclaim below
+     * can't race iwl_pcie_enqueue_hcmd for read_ptr and the slot's meta.
+     */
     //spin_lock_bh(&txq->lock);
-    //IOSimpleLockLock(txq->lock);
+    IOLockLock(trans_pcie->hcmd_lock);
     
     cmd_index = iwl_pcie_get_cmd_index(txq, index);
     cmd = txq->entries[cmd_index].cmd;
@@ -1539,17 +1933,28 @@ void IntelWifi::iwl_pcie_hcmd_complete(struct iwl_trans *trans,
     
     iwl_pcie_tfd_unmap(trans, meta, txq, index);
     
+    iwl_pcie_cmd_prof_done(trans, cmd_id, iwl_rx_packet_len(pkt), txq->entries[cmd_index].ts);
+    
     /* Input error checking is done when commands are added to queue. */
     if (meta->flags & CMD_WANT_SKB) {
         mbuf_t p = rxb_steal_page(rxb);
         
-        meta->source->resp_pkt = pkt;
+        /* pkt points into the RB, which is reused right after we return */
+        meta->source->resp_pkt = p ? (struct iwl_rx_packet *)mbuf_data(p) : NULL;
         meta->source->_rx_page_addr = (unsigned long)p;
         meta->source->_rx_page_order = trans_pcie->rx_page_order;
     }
     
-    if (meta->flags & CMD_WANT_ASYNC_CALLBACK)
+    /*
+     * CUSTOM: the callback may send a command of its own, which takes
+     * hcmd_lock, so it runs with the lock dropped. The slot stays taken
+     * until the reclaim below, nothing can reuse cmd meanwhile.
+     */
+    if (meta->flags & CMD_WANT_ASYNC_CALLBACK) {
+        IOLockUnlock(trans_pcie->hcmd_lock);
         iwl_op_mode_async_cb(trans->op_mode, cmd);
+        IOLockLock(trans_pcie->hcmd_lock);
+    }
     
     iwl_pcie_cmdq_reclaim(trans, txq_id, index);
     
@@ -1557,11 +1962,16 @@ void IntelWifi::iwl_pcie_hcmd_complete(struct iwl_trans *trans,
         if (!test_bit(STATUS_SYNC_HCMD_ACTIVE, &trans->status)) {
             IWL_WARN(trans, "HCMD_ACTIVE already clear for command %s\n", iwl_get_cmd_string(trans, cmd_id));
         }
-        clear_bit(STATUS_SYNC_HCMD_ACTIVE, &trans->status);
-        IWL_DEBUG_INFO(trans, "Clearing HCMD_ACTIVE for command %s\n", iwl_get_cmd_string(trans, cmd_id));
+        IWL_DEBUG_INFO(trans, "Completing slot %d for command %s\n", cmd_index, iwl_get_cmd_string(trans, cmd_id));
+        iwl_lat_record_hcmd(trans->lat, cmd_id, txq->entries[cmd_index].ts);
 
+        /*
+         * Several SYNC commands may be waiting, each one checks its own
+         * slot, so wake them all up.
+         */
         IOLockLock(trans_pcie->wait_command_queue);
-        IOLockWakeup(trans_pcie->wait_command_queue, &trans->status, true);
+        txq->entries[cmd_index].hcmd_done = txq->entries[cmd_index].hcmd_seq;
+        IOLockWakeup(trans_pcie->wait_command_queue, &trans->status, false);
         IOLockUnlock(trans_pcie->wait_command_queue);
     }
     
@@ -1580,24 +1990,55 @@ void IntelWifi::iwl_pcie_hcmd_complete(struct iwl_trans *trans,
     meta->flags = 0;
     
     //spin_unlock_bh(&txq->lock);
-    //IOSimpleLockUnlock(txq->lock);
+    IOLockUnlock(trans_pcie->hcmd_lock);
 }
 
 
 #define HOST_COMPLETE_TIMEOUT 2000
 
+/* CUSTOM
+ * SYNC host commands are no longer serialized by STATUS_SYNC_HCMD_ACTIVE.
+ * Each command queue slot records the sequence of the SYNC command it holds
+ * and the sequence of the last completion, so any number of SYNC commands
+ * can be in flight and a caller may queue a batch with
+ * iwl_trans_pcie_send_hcmd_start() and collect it with
+ * iwl_trans_pcie_wait_hcmds(). STATUS_SYNC_HCMD_ACTIVE now means "at least
+ * one SYNC command is in flight"; the error and RF-kill paths still clear it
+ * to abort every waiter.
+ */
+static bool iwl_pcie_hcmd_done(struct iwl_txq *txq, struct iwl_host_cmd *cmd)
+{
+    /* the slot can only be reused after our command completed */
+    return (s32)(txq->entries[cmd->_idx].hcmd_done - cmd->_seq) >= 0;
+}
+
+static bool iwl_pcie_hcmd_aborted(struct iwl_trans *trans, struct iwl_host_cmd *cmd)
+{
+    if (!test_bit(STATUS_SYNC_HCMD_ACTIVE, &trans->status) ||
+        test_bit(STATUS_FW_ERROR, &trans->status))
+        return true;
+    
+    return !(cmd->flags & CMD_SEND_IN_RFKILL) &&
+        test_bit(STATUS_RFKILL_OPMODE, &trans->status);
+}
+
 // line 1829
-static int iwl_pcie_send_hcmd_sync(struct iwl_trans *trans, struct iwl_host_cmd *cmd)
+int iwl_trans_pcie_send_hcmd_start(struct iwl_trans *trans, struct iwl_host_cmd *cmd)
 {
     struct iwl_trans_pcie *trans_pcie = IWL_TRANS_GET_PCIE_TRANS(trans);
-    struct iwl_txq *txq = trans_pcie->txq[trans_pcie->cmd_queue];
     int cmd_idx;
-    int ret;
     
     IWL_DEBUG_INFO(trans, "Attempting to send sync command %s\n", iwl_get_cmd_string(trans, cmd->id));
     
-    if (test_and_set_bit(STATUS_SYNC_HCMD_ACTIVE, &trans->status))
-        return -EIO;
+    if (!(cmd->flags & CMD_SEND_IN_RFKILL) && test_bit(STATUS_RFKILL_OPMODE, &trans->status)) {
+        IWL_DEBUG_RF_KILL(trans, "Dropping CMD 0x%x: RF KILL\n", cmd->id);
+        return -ERFKILL;
+    }
+    
+    IOLockLock(trans_pcie->wait_command_queue);
+    trans_pcie->sync_hcmds++;
+    set_bit(STATUS_SYNC_HCMD_ACTIVE, &trans->status);
+    IOLockUnlock(trans_pcie->wait_command_queue);
     
     IWL_DEBUG_INFO(trans, "Setting HCMD_ACTIVE for command %s\n", iwl_get_cmd_string(trans, cmd->id));
     
@@ -1613,29 +2054,55 @@ static int iwl_pcie_send_hcmd_sync(struct iwl_trans *trans, struct iwl_host_cmd
     
     cmd_idx = iwl_pcie_enqueue_hcmd(trans, cmd);
     if (cmd_idx < 0) {
-        ret = cmd_idx;
-        clear_bit(STATUS_SYNC_HCMD_ACTIVE, &trans->status);
-        IWL_ERR(trans, "Error sending %s: enqueue_hcmd failed: %d\n", iwl_get_cmd_string(trans, cmd->id), ret);
-        return ret;
+        IOLockLock(trans_pcie->wait_command_queue);
+        if (!--trans_pcie->sync_hcmds)
+            clear_bit(STATUS_SYNC_HCMD_ACTIVE, &trans->status);
+        IOLockUnlock(trans_pcie->wait_command_queue);
+        IWL_ERR(trans, "Error sending %s: enqueue_hcmd failed: %d\n", iwl_get_cmd_string(trans, cmd->id), cmd_idx);
+        return cmd_idx;
     }
     
+    return 0;
+}
+
+/*
+ * Wait for one command queued by iwl_trans_pcie_send_hcmd_start() until
+ * deadline. Always drops the command's HCMD_ACTIVE reference.
+ */
+static int iwl_pcie_wait_hcmd(struct iwl_trans *trans, struct iwl_host_cmd *cmd,
+                              AbsoluteTime deadline, bool *nmi_sent)
+{
+    struct iwl_trans_pcie *trans_pcie = IWL_TRANS_GET_PCIE_TRANS(trans);
+    struct iwl_txq *txq = trans_pcie->txq[trans_pcie->cmd_queue];
+    bool done, timed_out = false;
+    int ret = 0;
+    
     IOLockLock(trans_pcie->wait_command_queue);
-    AbsoluteTime deadline;
-    clock_interval_to_deadline(HOST_COMPLETE_TIMEOUT * 2, kMillisecondScale, (UInt64 *) &deadline);
-    ret = IOLockSleepDeadline(trans_pcie->wait_command_queue, &trans->status, deadline, THREAD_INTERRUPTIBLE);
+    while (!(done = iwl_pcie_hcmd_done(txq, cmd)) && !iwl_pcie_hcmd_aborted(trans, cmd)) {
+        if (IOLockSleepDeadline(trans_pcie->wait_command_queue, &trans->status,
+                                deadline, THREAD_INTERRUPTIBLE) != THREAD_AWAKENED) {
+            done = iwl_pcie_hcmd_done(txq, cmd);
+            timed_out = !done;
+            break;
+        }
+    }
+    if (trans_pcie->sync_hcmds && !--trans_pcie->sync_hcmds)
+        clear_bit(STATUS_SYNC_HCMD_ACTIVE, &trans->status);
     IOLockUnlock(trans_pcie->wait_command_queue);
     
-    if (ret != THREAD_AWAKENED) {
+    if (timed_out) {
         IWL_ERR(trans, "Error sending %s: time out after %dms.\n", iwl_get_cmd_string(trans, cmd->id),
                 HOST_COMPLETE_TIMEOUT);
 
         IWL_ERR(trans, "Current CMD queue read_ptr %d write_ptr %d\n", txq->read_ptr, txq->write_ptr);
 
-        clear_bit(STATUS_SYNC_HCMD_ACTIVE, &trans->status);
-        IWL_DEBUG_INFO(trans, "Clearing HCMD_ACTIVE for command %s\n", iwl_get_cmd_string(trans, cmd->id));
         ret = -ETIMEDOUT;
 
-        iwl_force_nmi(trans);
+        /* one NMI per batch is enough, the rest timed out for the same reason */
+        if (!*nmi_sent) {
+            iwl_force_nmi(trans);
+            *nmi_sent = true;
+        }
         // TODO: Implement
         // iwl_trans_fw_error(trans);
 
@@ -1657,6 +2124,12 @@ static int iwl_pcie_send_hcmd_sync(struct iwl_trans *trans, struct iwl_host_cmd
         goto cancel;
     }
     
+    if (!done) {
+        IWL_ERR(trans, "SYNC CMD %s aborted\n", iwl_get_cmd_string(trans, cmd->id));
+        ret = -EIO;
+        goto cancel;
+    }
+    
     if ((cmd->flags & CMD_WANT_SKB) && !cmd->resp_pkt) {
         IWL_ERR(trans, "Error: Response NULL in '%s'\n",
                 iwl_get_cmd_string(trans, cmd->id));
@@ -1667,14 +2140,14 @@ static int iwl_pcie_send_hcmd_sync(struct iwl_trans *trans, struct iwl_host_cmd
     return 0;
     
 cancel:
-    if (cmd->flags & CMD_WANT_SKB) {
+    if ((cmd->flags & CMD_WANT_SKB) && !done) {
         /*
          * Cancel the CMD_WANT_SKB flag for the cmd in the
          * TX cmd queue. Otherwise in case the cmd comes
          * in later, it will possibly set an invalid
          * address (cmd->meta.source).
          */
-        txq->entries[cmd_idx].meta.flags &= ~CMD_WANT_SKB;
+        txq->entries[cmd->_idx].meta.flags &= ~CMD_WANT_SKB;
     }
     
     if (cmd->resp_pkt) {
@@ -1685,6 +2158,37 @@ cancel:
     return ret;
 }
 
+int iwl_trans_pcie_wait_hcmds(struct iwl_trans *trans, struct iwl_host_cmd **cmds, int n_cmds)
+{
+    AbsoluteTime deadline;
+    bool nmi_sent = false;
+    int i, ret = 0;
+    
+    /* the batch shares one deadline, it isn't restarted per command */
+    clock_interval_to_deadline(HOST_COMPLETE_TIMEOUT * 2, kMillisecondScale, (UInt64 *) &deadline);
+    
+    for (i = 0; i < n_cmds; i++) {
+        int err = iwl_pcie_wait_hcmd(trans, cmds[i], deadline, &nmi_sent);
+        
+        if (err && !ret)
+            ret = err;
+    }
+    
+    return ret;
+}
+
+static int iwl_pcie_send_hcmd_sync(struct iwl_trans *trans, struct iwl_host_cmd *cmd)
+{
+    int ret;
+    
+    ret = iwl_trans_pcie_send_hcmd_start(trans, cmd);
+    if (ret)
+        return ret;
+    
+    return iwl_trans_pcie_wait_hcmds(trans, &cmd, 1);
+}
+/* CUSTOM END */
+
 
 
 // line 1935
@@ -1704,208 +2208,271 @@ int iwl_trans_pcie_send_hcmd(struct iwl_trans *trans, struct iwl_host_cmd *cmd)
 
 
 
-// line 2256
-int iwl_trans_pcie_tx(struct iwl_trans *trans, struct sk_buff *skb,
-                      struct iwl_device_cmd *dev_cmd, int txq_id)
+/* line 2073
+ * Map the payload of an mbuf chain straight into the TFD, one TB per
+ * physical segment. The 802.11 header was already copied into TB1 with the
+ * TX command, so the first hdr_len bytes of the chain are skipped. The NIC
+ * reads the frame from the mbuf clusters themselves; the cursor only falls
+ * back to coalescing when the chain has more segments than free TBs.
+ */
+template <class TFD>
+static int iwl_fill_data_tbs(struct iwl_trans *trans, mbuf_t m, struct iwl_txq *txq, u8 hdr_len)
 {
-    // TODO: Implement...
+    struct iwl_trans_pcie *trans_pcie = IWL_TRANS_GET_PCIE_TRANS(trans);
+    IOMbufNaturalMemoryCursor *curs = static_cast<IOMbufNaturalMemoryCursor *>(trans->tx_mbuf_cursor);
+    IOPhysicalSegment segs[IWL_TFH_NUM_TBS];
+    UInt32 nsegs, i;
+    u32 skip = hdr_len;
+    
+    nsegs = curs->getPhysicalSegmentsWithCoalesce(m, segs, IWL_PCIE_MAX_FRAGS(trans_pcie));
+    if (!nsegs) {
+        IWL_ERR(trans, "Failed to map TX mbuf\n");
+        return -ENOMEM;
+    }
     
-    return 0;
+    for (i = 0; i < nsegs; i++) {
+        dma_addr_t tb_phys = segs[i].location;
+        u32 tb_len = (u32)segs[i].length;
+        int tb_idx;
+        
+        if (skip) {
+            u32 n = skip < tb_len ? skip : tb_len;
+            
+            tb_phys += n;
+            tb_len -= n;
+            skip -= n;
+        }
+        
+        if (!tb_len)
+            continue;
+        
+        tb_idx = iwl_pcie_txq_build_tfd<TFD>(trans, txq, tb_phys, tb_len, false);
+        if (tb_idx < 0)
+            return tb_idx;
+    }
     
-//    mbuf_t mb;
-//    
-//    
-//    struct iwl_trans_pcie *trans_pcie = IWL_TRANS_GET_PCIE_TRANS(trans);
-////    struct ieee80211_hdr *hdr;
-//    struct iwl_tx_cmd *tx_cmd = (struct iwl_tx_cmd *)dev_cmd->payload;
-//    struct iwl_cmd_meta *out_meta;
-//    struct iwl_txq *txq;
-//    dma_addr_t tb0_phys, tb1_phys, scratch_phys;
-//    void *tb1_addr;
-//    void *tfd;
-//    u16 len, tb1_len;
-//    bool wait_write_ptr;
-//    __le16 fc;
-//    u8 hdr_len;
-//    u16 wifi_seq;
-//    bool amsdu;
-//    
-//    txq = trans_pcie->txq[txq_id];
-//
-//    if (!test_bit(txq_id, trans_pcie->queue_used))
-//        return -EINVAL;
-
-//    if (unlikely(trans_pcie->sw_csum_tx && skb->ip_summed == CHECKSUM_PARTIAL)) {
-//        int offs = skb_checksum_start_offset(skb);
-//        int csum_offs = offs + skb->csum_offset;
-//        __wsum csum;
-//
-//        if (skb_ensure_writable(skb, csum_offs + sizeof(__sum16)))
-//            return -1;
-//
-//        csum = skb_checksum(skb, offs, skb->len - offs, 0);
-//        *(__sum16 *)(skb->data + csum_offs) = csum_fold(csum);
-//
-//        skb->ip_summed = CHECKSUM_UNNECESSARY;
-//    }
+    return 0;
+}
 
-//    if (skb_is_nonlinear(skb) &&
-//        skb_shinfo(skb)->nr_frags > IWL_PCIE_MAX_FRAGS(trans_pcie) &&
-//        __skb_linearize(skb))
-//        return -ENOMEM;
-//
+// line 2256
+template <class TFD>
+int IntelWifi::iwl_trans_pcie_tx(struct iwl_trans *trans, struct sk_buff *skb,
+                                 struct iwl_device_cmd *dev_cmd, int txq_id)
+{
+    struct iwl_trans_pcie *trans_pcie = IWL_TRANS_GET_PCIE_TRANS(trans);
+    mbuf_t m = (mbuf_t)skb;
+    struct ieee80211_hdr *hdr;
+    struct iwl_tx_cmd *tx_cmd = (struct iwl_tx_cmd *)dev_cmd->payload;
+    struct iwl_cmd_meta *out_meta;
+    struct iwl_txq *txq;
+    dma_addr_t tb0_phys, tb1_phys, scratch_phys;
+    void *tfd;
+    u16 len, tb1_len;
+    bool wait_write_ptr;
+    bool arm_batch_timer = false;
+    enum iwl_txq_stuck_timer stuck_timer = IWL_TXQ_TIMER_KEEP;
+    __le16 fc;
+    u8 hdr_len;
+    u16 wifi_seq;
+    bool amsdu;
+    
+    txq = trans_pcie->txq[txq_id];
+    
+    if (!test_bit(txq_id, trans_pcie->queue_used))
+        return -EINVAL;
+    
+    // Checksum offload is never advertised to the network stack, so the
+    // sw_csum_tx path of the original driver has nothing to do here.
+    
     /* mac80211 always puts the full header into the SKB's head,
      * so there's no need to check if it's readable there
      */
+    hdr = (struct ieee80211_hdr *)mbuf_data(m);
+    fc = hdr->frame_control;
+    hdr_len = ieee80211_hdrlen(fc);
     
-//    hdr = (struct ieee80211_hdr *)skb->data;
-//    fc = hdr->frame_control;
-//    hdr_len = ieee80211_hdrlen(fc);
-//
-//    spin_lock(&txq->lock);
-//
-//    if (iwl_queue_space(txq) < txq->high_mark) {
-//        iwl_stop_queue(trans, txq);
-//
-//        /* don't put the packet on the ring, if there is no room */
-//        if (unlikely(iwl_queue_space(txq) < 3)) {
-//            struct iwl_device_cmd **dev_cmd_ptr;
-//
-//            dev_cmd_ptr = (void *)((u8 *)skb->cb +
-//                                   trans_pcie->dev_cmd_offs);
-//
-//            *dev_cmd_ptr = dev_cmd;
-//            __skb_queue_tail(&txq->overflow_q, skb);
-//
-//            spin_unlock(&txq->lock);
-//            return 0;
-//        }
-//    }
-
-//    /* In AGG mode, the index in the ring must correspond to the WiFi
-//     * sequence number. This is a HW requirements to help the SCD to parse
-//     * the BA.
-//     * Check here that the packets are in the right place on the ring.
-//     */
-//    wifi_seq = IEEE80211_SEQ_TO_SN(le16_to_cpu(hdr->seq_ctrl));
-//    WARN_ONCE(txq->ampdu &&
-//              (wifi_seq & 0xff) != txq->write_ptr,
-//              "Q: %d WiFi Seq %d tfdNum %d",
-//              txq_id, wifi_seq, txq->write_ptr);
-//
-//    /* Set up driver data for this TFD */
-//    txq->entries[txq->write_ptr].skb = skb;
-//    txq->entries[txq->write_ptr].cmd = dev_cmd;
-//
-//    dev_cmd->hdr.sequence =
-//    cpu_to_le16((u16)(QUEUE_TO_SEQ(txq_id) |
-//                      INDEX_TO_SEQ(txq->write_ptr)));
-//
-//    tb0_phys = iwl_pcie_get_first_tb_dma(txq, txq->write_ptr);
-//    scratch_phys = tb0_phys + sizeof(struct iwl_cmd_header) +
-//    offsetof(struct iwl_tx_cmd, scratch);
-//
-//    tx_cmd->dram_lsb_ptr = cpu_to_le32(scratch_phys);
-//    tx_cmd->dram_msb_ptr = iwl_get_dma_hi_addr(scratch_phys);
-//
-//    /* Set up first empty entry in queue's array of Tx/cmd buffers */
-//    out_meta = &txq->entries[txq->write_ptr].meta;
-//    out_meta->flags = 0;
-//
-//    /*
-//     * The second TB (tb1) points to the remainder of the TX command
-//     * and the 802.11 header - dword aligned size
-//     * (This calculation modifies the TX command, so do it before the
-//     * setup of the first TB)
-//     */
-//    len = sizeof(struct iwl_tx_cmd) + sizeof(struct iwl_cmd_header) +
-//    hdr_len - IWL_FIRST_TB_SIZE;
-//    /* do not align A-MSDU to dword as the subframe header aligns it */
-//    amsdu = ieee80211_is_data_qos(fc) &&
-//    (*ieee80211_get_qos_ctl(hdr) &
-//     IEEE80211_QOS_CTL_A_MSDU_PRESENT);
-//    if (trans_pcie->sw_csum_tx || !amsdu) {
-//        tb1_len = ALIGN(len, 4);
-//        /* Tell NIC about any 2-byte padding after MAC header */
-//        if (tb1_len != len)
-//            tx_cmd->tx_flags |= cpu_to_le32(TX_CMD_FLG_MH_PAD);
-//    } else {
-//        tb1_len = len;
-//    }
-//
-//    /*
-//     * The first TB points to bi-directional DMA data, we'll
-//     * memcpy the data into it later.
-//     */
-//    iwl_pcie_txq_build_tfd(trans, txq, tb0_phys,
-//                           IWL_FIRST_TB_SIZE, true);
-//
-//    /* there must be data left over for TB1 or this code must be changed */
-//    BUILD_BUG_ON(sizeof(struct iwl_tx_cmd) < IWL_FIRST_TB_SIZE);
-//
-//    /* map the data for TB1 */
-//    tb1_addr = ((u8 *)&dev_cmd->hdr) + IWL_FIRST_TB_SIZE;
-//    tb1_phys = dma_map_single(trans->dev, tb1_addr, tb1_len, DMA_TO_DEVICE);
-//    if (unlikely(dma_mapping_error(trans->dev, tb1_phys)))
-//        goto out_err;
-//    iwl_pcie_txq_build_tfd(trans, txq, tb1_phys, tb1_len, false);
-//
-//    if (amsdu) {
-//        if (unlikely(iwl_fill_data_tbs_amsdu(trans, skb, txq, hdr_len,
-//                                             out_meta, dev_cmd,
-//                                             tb1_len)))
-//            goto out_err;
-//    } else if (unlikely(iwl_fill_data_tbs(trans, skb, txq, hdr_len,
-//                                          out_meta, dev_cmd, tb1_len))) {
-//        goto out_err;
-//    }
-//
-//    /* building the A-MSDU might have changed this data, so memcpy it now */
-//    memcpy(&txq->first_tb_bufs[txq->write_ptr], &dev_cmd->hdr,
-//           IWL_FIRST_TB_SIZE);
-//
-//    tfd = iwl_pcie_get_tfd(trans_pcie, txq, txq->write_ptr);
-//    /* Set up entry for this TFD in Tx byte-count array */
-//    iwl_pcie_txq_update_byte_cnt_tbl(trans, txq, le16_to_cpu(tx_cmd->len),
-//                                     iwl_pcie_tfd_get_num_tbs(trans, tfd));
-//
-//    wait_write_ptr = ieee80211_has_morefrags(fc);
-//
-//    /* start timer if queue currently empty */
-//    if (txq->read_ptr == txq->write_ptr) {
-//        if (txq->wd_timeout) {
-//            /*
-//             * If the TXQ is active, then set the timer, if not,
-//             * set the timer in remainder so that the timer will
-//             * be armed with the right value when the station will
-//             * wake up.
-//             */
-//            if (!txq->frozen)
-//                mod_timer(&txq->stuck_timer,
-//                          jiffies + txq->wd_timeout);
-//            else
-//                txq->frozen_expiry_remainder = txq->wd_timeout;
-//        }
-//        IWL_DEBUG_RPM(trans, "Q: %d first tx - take ref\n", txq->id);
-//        iwl_trans_ref(trans);
-//    }
-//
-//    /* Tell device the write index *just past* this latest filled TFD */
-//    txq->write_ptr = iwl_queue_inc_wrap(txq->write_ptr);
-//    if (!wait_write_ptr)
-//        iwl_pcie_txq_inc_wr_ptr(trans, txq);
-//
-//    /*
-//     * At this point the frame is "transmitted" successfully
-//     * and we will get a TX status notification eventually.
-//     */
-//    spin_unlock(&txq->lock);
-//    return 0;
-//out_err:
-//    spin_unlock(&txq->lock);
-//    return -1;
+    IOSimpleLockLock(txq->lock);
+    
+    if (iwl_queue_space(txq) < txq->high_mark) {
+        iwl_stop_queue(trans, txq);
+        
+        /* don't put the packet on the ring, if there is no room */
+        if (unlikely(iwl_queue_space(txq) < 3)) {
+            struct iwl_device_cmd **dev_cmd_ptr;
+            
+            if (mbuf_tag_allocate(m, trans_pcie->dev_cmd_tag, 0, sizeof(*dev_cmd_ptr),
+                                  MBUF_DONTWAIT, (void **)&dev_cmd_ptr)) {
+                IOSimpleLockUnlock(txq->lock);
+                return -ENOMEM;
+            }
+            
+            *dev_cmd_ptr = dev_cmd;
+            mbuf_setnextpkt(m, NULL);
+            if (txq->overflow_tail)
+                mbuf_setnextpkt(txq->overflow_tail, m);
+            else
+                txq->overflow_q = m;
+            txq->overflow_tail = m;
+            
+            IOSimpleLockUnlock(txq->lock);
+            return 0;
+        }
+    }
+    
+    /* In AGG mode, the index in the ring must correspond to the WiFi
+     * sequence number. This is a HW requirements to help the SCD to parse
+     * the BA.
+     * Check here that the packets are in the right place on the ring.
+     */
+    wifi_seq = IEEE80211_SEQ_TO_SN(le16_to_cpu(hdr->seq_ctrl));
+    if (txq->ampdu && (wifi_seq & 0xff) != txq->write_ptr)
+        IWL_WARN(trans, "Q: %d WiFi Seq %d tfdNum %d", txq_id, wifi_seq, txq->write_ptr);
+    
+    /* Set up driver data for this TFD */
+    txq->entries[txq->write_ptr].skb = skb;
+    txq->entries[txq->write_ptr].cmd = dev_cmd;
+    
+    dev_cmd->hdr.sequence = cpu_to_le16((u16)(QUEUE_TO_SEQ(txq_id) | INDEX_TO_SEQ(txq->write_ptr)));
+    
+    tb0_phys = iwl_pcie_get_first_tb_dma(txq, txq->write_ptr);
+    scratch_phys = tb0_phys + sizeof(struct iwl_cmd_header) + offsetof(struct iwl_tx_cmd, scratch);
+    
+    tx_cmd->dram_lsb_ptr = cpu_to_le32(scratch_phys);
+    tx_cmd->dram_msb_ptr = iwl_get_dma_hi_addr(scratch_phys);
+    
+    /* Set up first empty entry in queue's array of Tx/cmd buffers */
+    out_meta = &txq->entries[txq->write_ptr].meta;
+    out_meta->flags = 0;
+    
+    /*
+     * The second TB (tb1) points to the remainder of the TX command
+     * and the 802.11 header - dword aligned size
+     * (This calculation modifies the TX command, so do it before the
+     * setup of the first TB)
+     */
+    len = sizeof(struct iwl_tx_cmd) + sizeof(struct iwl_cmd_header) + hdr_len - IWL_FIRST_TB_SIZE;
+    /* do not align A-MSDU to dword as the subframe header aligns it */
+    amsdu = ieee80211_is_data_qos(fc) && (*ieee80211_get_qos_ctl(hdr) & IEEE80211_QOS_CTL_A_MSDU_PRESENT);
+    if (trans_pcie->sw_csum_tx || !amsdu) {
+        tb1_len = LNX_ALIGN(len, 4);
+        /* Tell NIC about any 2-byte padding after MAC header */
+        if (tb1_len != len)
+            tx_cmd->tx_flags |= cpu_to_le32(TX_CMD_FLG_MH_PAD);
+    } else {
+        tb1_len = len;
+    }
+    
+    if (WARN_ON(tb1_len > sizeof(struct iwl_pcie_tx_cmd_buf)))
+        goto out_err;
+    
+    /*
+     * The first TB points to bi-directional DMA data, we'll
+     * memcpy the data into it later.
+     */
+    iwl_pcie_txq_build_tfd<TFD>(trans, txq, tb0_phys, IWL_FIRST_TB_SIZE, true);
+    
+    /* there must be data left over for TB1 or this code must be changed */
+    BUILD_BUG_ON(sizeof(struct iwl_tx_cmd) < IWL_FIRST_TB_SIZE);
+    
+    /* the data for TB1 goes into this slot's preallocated DMA buffer */
+    memcpy(&txq->tx_cmd_bufs[txq->write_ptr], ((u8 *)&dev_cmd->hdr) + IWL_FIRST_TB_SIZE, tb1_len);
+    tb1_phys = iwl_pcie_get_tx_cmd_dma(txq, txq->write_ptr);
+    iwl_pcie_txq_build_tfd<TFD>(trans, txq, tb1_phys, tb1_len, false);
+    
+    // A-MSDUs are built by the firmware from the subframes that are already
+    // in the mbuf, so both cases map the payload the same way
+    if (unlikely(iwl_fill_data_tbs<TFD>(trans, m, txq, hdr_len)))
+        goto out_err;
+    
+    /* building the A-MSDU might have changed this data, so memcpy it now */
+    memcpy(&txq->first_tb_bufs[txq->write_ptr], &dev_cmd->hdr, IWL_FIRST_TB_SIZE);
+    
+    tfd = iwl_pcie_get_tfd(trans_pcie, txq, txq->write_ptr);
+    /* Set up entry for this TFD in Tx byte-count array */
+    iwl_pcie_txq_update_byte_cnt_tbl(trans, txq, le16_to_cpu(tx_cmd->len),
+                                     TFD::num_tbs(tfd));
+    
+    wait_write_ptr = ieee80211_has_morefrags(fc);
+    
+    /* start timer if queue currently empty */
+    if (txq->read_ptr == txq->write_ptr) {
+        if (txq->wd_timeout) {
+            /*
+             * If the TXQ is active, then set the timer, if not,
+             * set the timer in remainder so that the timer will
+             * be armed with the right value when the station will
+             * wake up.
+             */
+            if (!txq->frozen)
+                stuck_timer = IWL_TXQ_TIMER_ARM;
+            else
+                txq->frozen_expiry_remainder = txq->wd_timeout;
+        }
+        IWL_DEBUG_RPM(trans, "Q: %d first tx - take ref\n", txq->id);
+        iwl_trans_ref(trans);
+    }
+    
+    iwl_trace(IWL_TRACE_TX, txq_id, txq->write_ptr, (u32)mbuf_pkthdr_len(m), 0);
+    txq->entries[txq->write_ptr].ts = mach_absolute_time();
+    
+    /* Tell device the write index *just past* this latest filled TFD */
+    txq->write_ptr = iwl_queue_inc_wrap(txq->write_ptr);
+    if (!wait_write_ptr)
+        arm_batch_timer = iwl_pcie_txq_update_wr_ptr(trans, txq);
+    
+    /*
+     * At this point the frame is "transmitted" successfully
+     * and we will get a TX status notification eventually.
+     */
+    IOSimpleLockUnlock(txq->lock);
+    
+    iwl_pcie_txq_set_stuck_timer(txq, stuck_timer);
+    if (arm_batch_timer)
+        iwl_pcie_tx_batch_arm_timer();
+    return 0;
+out_err:
+    iwl_pcie_tfd_unmap<TFD>(trans, out_meta, txq, txq->write_ptr);
+    txq->entries[txq->write_ptr].skb = NULL;
+    IOSimpleLockUnlock(txq->lock);
+    return -1;
 }
 
+template int IntelWifi::iwl_trans_pcie_tx<IwlTfdGen1>(struct iwl_trans *, struct sk_buff *, struct iwl_device_cmd *, int);
+template int IntelWifi::iwl_trans_pcie_tx<IwlTfdTfh>(struct iwl_trans *, struct sk_buff *, struct iwl_device_cmd *, int);
 
-
-
+/*
+ * CUSTOM: frames from the interface's output queue. The op mode builds the
+ * TX command and picks the hardware queue, like mac80211's tx op upstream.
+ * IOOutputQueue is stopped and started by queue_full/queue_not_full, so
+ * there's no kIOReturnOutputStall here, a refused frame is dropped.
+ * A list of packets (linked with mbuf_nextpkt) goes out as one TX batch,
+ * with a doorbell per queue at the end rather than one per frame; the
+ * result is kIOReturnOutputDropped if any of them was.
+ */
+UInt32 IntelWifi::outputPacket(mbuf_t m, void *param)
+{
+    bool batch = m && mbuf_nextpkt(m);
+    bool dropped = false;
+    
+    if (!fTrans || !opmode) {
+        mbuf_freem_list(m);
+        return kIOReturnOutputDropped;
+    }
+    
+    if (batch)
+        iwl_trans_pcie_tx_batch_begin(fTrans);
+    while (m) {
+        mbuf_t next = mbuf_nextpkt(m);
+        
+        mbuf_setnextpkt(m, NULL);
+        if (opmode->tx((struct sk_buff *)m)) {
+            mbuf_freem(m);
+            dropped = true;
+        }
+        m = next;
+    }
+    if (batch)
+        iwl_trans_pcie_tx_batch_end(fTrans);
+    
+    return dropped ? kIOReturnOutputDropped : kIOReturnOutputSuccess;
+}
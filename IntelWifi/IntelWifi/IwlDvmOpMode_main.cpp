@@ -976,6 +976,8 @@ void IwlDvmOpMode::iwl_op_mode_dvm_stop(struct iwl_priv* priv)
 
     _ops->op_mode_leave(priv->trans);
     
+    iwl_notification_wait_free(&priv->notif_wait);
+    
     //ieee80211_free_hw(priv->hw);
 }
 
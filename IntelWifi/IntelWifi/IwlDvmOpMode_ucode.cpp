@@ -299,6 +299,7 @@ int IwlDvmOpMode::iwl_load_ucode_wait_alive(struct iwl_priv *priv, enum iwl_ucod
     int ret;
     enum iwl_ucode_type old_type;
     static const u16 alive_cmd[] = { REPLY_ALIVE };
+    u64 ts;
     
     fw = iwl_get_ucode_image(priv->fw, ucode_type);
     if (!fw)
@@ -312,12 +313,15 @@ int IwlDvmOpMode::iwl_load_ucode_wait_alive(struct iwl_priv *priv, enum iwl_ucod
                                &alive_data);
 
     //ret = iwl_trans_start_fw(priv->trans, fw, false);
+    ts = mach_absolute_time();
     ret = _ops->start_fw(priv->trans, fw, false);
     if (ret) {
         priv->cur_ucode = old_type;
         iwl_remove_notification(&priv->notif_wait, &alive_wait);
         return ret;
     }
+    iwl_lat_record(priv->trans->lat, IWL_LAT_FW_LOAD, ts);
+    ts = mach_absolute_time();
     
     /*
      * Some things may run in the background now, but we
@@ -336,6 +340,8 @@ int IwlDvmOpMode::iwl_load_ucode_wait_alive(struct iwl_priv *priv, enum iwl_ucod
     }
     
     IWL_DEBUG_FW(priv, "IT IS ALIVE!\n");
+    iwl_lat_record(priv->trans->lat, IWL_LAT_FW_ALIVE, ts);
+    ts = mach_absolute_time();
     
     priv->ucode_loaded = true;
     
@@ -350,6 +356,7 @@ int IwlDvmOpMode::iwl_load_ucode_wait_alive(struct iwl_priv *priv, enum iwl_ucod
         priv->cur_ucode = old_type;
         return ret;
     }
+    iwl_lat_record(priv->trans->lat, IWL_LAT_FW_ALIVE_NOTIFY, ts);
     
     return 0;
 }
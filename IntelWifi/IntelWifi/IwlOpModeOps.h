@@ -40,6 +40,16 @@ public:
     virtual void nic_config() = 0;
     virtual void stop() = 0;
     virtual void rx(struct napi_struct *napi, struct iwl_rx_cmd_buffer *rxb) = 0;
+    virtual void rx_rss(struct napi_struct *napi, struct iwl_rx_cmd_buffer *rxb, unsigned int queue) = 0;
+    virtual void queue_full(int queue) = 0;
+    virtual void queue_not_full(int queue) = 0;
+    virtual void free_skb(struct sk_buff *skb) = 0;
+    /*
+     * ieee80211_ops.tx: build the TX command for a frame from the interface
+     * and hand it to the transport. 0 means the transport (or the op mode)
+     * owns @skb now, on error the caller still does.
+     */
+    virtual int tx(struct sk_buff *skb) = 0;
     
     
     // IOCTLs
@@ -57,14 +67,9 @@ public:
 //    virtual void add_interface(struct ieee80211_vif *vif) = 0;
 //    virtual void channel_switch(struct ieee80211_vif *vif, struct ieee80211_channel_switch *chsw) = 0;
 
-//    void (*rx_rss)(struct iwl_op_mode *op_mode, struct napi_struct *napi,
-//                   struct iwl_rx_cmd_buffer *rxb, unsigned int queue);
 //    void (*async_cb)(struct iwl_op_mode *op_mode,
 //                     const struct iwl_device_cmd *cmd);
-//    void (*queue_full)(struct iwl_op_mode *op_mode, int queue);
-//    void (*queue_not_full)(struct iwl_op_mode *op_mode, int queue);
 //    bool (*hw_rf_kill)(struct iwl_op_mode *op_mode, bool state);
-//    void (*free_skb)(struct iwl_op_mode *op_mode, struct sk_buff *skb);
 //    void (*nic_error)(struct iwl_op_mode *op_mode);
 //    void (*cmd_queue_full)(struct iwl_op_mode *op_mode);
 //    void (*nic_config)(struct iwl_op_mode *op_mode);
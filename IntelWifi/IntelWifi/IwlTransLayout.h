@@ -0,0 +1,177 @@
+//
+//  IwlTransLayout.h
+//  IntelWifi
+//
+//  TFD and RBD layouts of the PCIe transport as types. The per-packet TX
+//  and RX paths are templates over them, so they don't look at
+//  trans->cfg->use_tfh / mq_rx_supported for every descriptor. The
+//  instantiation is picked once, when the transport is allocated (see
+//  IwlTransOps::create).
+//
+//  Only the transport's C headers are needed, checks/trans-layout.cpp runs
+//  the layouts against a fake device on the host.
+//
+
+#ifndef IwlTransLayout_h
+#define IwlTransLayout_h
+
+extern "C" {
+#include "iwl-trans.h"
+#include "iwl-fh.h"
+#include "iwl-io.h"
+#include "iwlwifi/pcie/internal.h"
+}
+
+/* legacy TFD, up to IWL_NUM_OF_TBS TBs with 36 bit addresses */
+struct IwlTfdGen1 {
+    static const bool use_tfh = false;
+
+    // tx.c line 312
+    static inline dma_addr_t tb_addr(void *_tfd, u8 idx)
+    {
+        struct iwl_tfd *tfd = (struct iwl_tfd *)_tfd;
+        struct iwl_tfd_tb *tb = &tfd->tbs[idx];
+        dma_addr_t addr = get_unaligned_le32(&tb->lo);
+        dma_addr_t hi_len;
+
+        if (sizeof(dma_addr_t) <= sizeof(u32))
+            return addr;
+
+        hi_len = le16_to_cpu(tb->hi_n_len) & 0xF;
+
+        /*
+         * shift by 16 twice to avoid warnings on 32-bit
+         * (where this code never runs anyway due to the
+         * if statement above)
+         */
+        return addr | ((hi_len << 16) << 16);
+    }
+
+    static inline u16 tb_len(void *_tfd, u8 idx)
+    {
+        struct iwl_tfd *tfd = (struct iwl_tfd *)_tfd;
+
+        return le16_to_cpu(tfd->tbs[idx].hi_n_len) >> 4;
+    }
+
+    // tx.c line 341
+    static inline int set_tb(void *_tfd, u8 idx, dma_addr_t addr, u16 len)
+    {
+        struct iwl_tfd *tfd = (struct iwl_tfd *)_tfd;
+        struct iwl_tfd_tb *tb = &tfd->tbs[idx];
+        u16 hi_n_len = len << 4;
+
+        /* a longer TB would wrap in the 12 bit length field */
+        if (WARN_ON(len > IWL_TFD_MAX_TB_LEN))
+            return -EINVAL;
+
+        put_unaligned_le32((u32)addr, &tb->lo);
+        hi_n_len |= iwl_get_dma_hi_addr(addr);
+
+        tb->hi_n_len = cpu_to_le16(hi_n_len);
+
+        tfd->num_tbs = idx + 1;
+
+        return 0;
+    }
+
+    // tx.c line 357
+    static inline u8 num_tbs(void *_tfd)
+    {
+        return ((struct iwl_tfd *)_tfd)->num_tbs & 0x1f;
+    }
+
+    static inline void clear_tbs(void *_tfd)
+    {
+        ((struct iwl_tfd *)_tfd)->num_tbs = 0;
+    }
+};
+
+/* TFH TFD, up to IWL_TFH_NUM_TBS TBs with 64 bit addresses */
+struct IwlTfdTfh {
+    static const bool use_tfh = true;
+
+    static inline dma_addr_t tb_addr(void *_tfd, u8 idx)
+    {
+        struct iwl_tfh_tfd *tfd = (struct iwl_tfh_tfd *)_tfd;
+
+        return (dma_addr_t)le64_to_cpu(tfd->tbs[idx].addr);
+    }
+
+    static inline u16 tb_len(void *_tfd, u8 idx)
+    {
+        struct iwl_tfh_tfd *tfd = (struct iwl_tfh_tfd *)_tfd;
+
+        return le16_to_cpu(tfd->tbs[idx].tb_len);
+    }
+
+    // tx-gen2.c line 190
+    static inline int set_tb(void *_tfd, u8 idx, dma_addr_t addr, u16 len)
+    {
+        struct iwl_tfh_tfd *tfd = (struct iwl_tfh_tfd *)_tfd;
+        struct iwl_tfh_tb *tb = &tfd->tbs[idx];
+
+        put_unaligned_le64(addr, &tb->addr);
+        tb->tb_len = cpu_to_le16(len);
+
+        tfd->num_tbs = cpu_to_le16(idx + 1);
+
+        return 0;
+    }
+
+    static inline u8 num_tbs(void *_tfd)
+    {
+        return le16_to_cpu(((struct iwl_tfh_tfd *)_tfd)->num_tbs) & 0x1f;
+    }
+
+    static inline void clear_tbs(void *_tfd)
+    {
+        ((struct iwl_tfh_tfd *)_tfd)->num_tbs = 0;
+    }
+};
+
+/* single RX queue, the RBs are tracked by their position in the ring */
+struct IwlRbdLegacy {
+    static const bool mq_rx = false;
+
+    static inline struct iwl_rx_mem_buffer *take(struct iwl_trans *trans, struct iwl_rxq *rxq, u32 i)
+    {
+        struct iwl_rx_mem_buffer *rxb = rxq->queue[i];
+
+        rxq->queue[i] = NULL;
+        return rxb;
+    }
+};
+
+/* multi-queue RX, the used BD ring carries the vid of the RB */
+struct IwlRbdMq {
+    static const bool mq_rx = true;
+
+    /* NULL if the HW handed back an RB we don't own, an NMI is forced then */
+    static inline struct iwl_rx_mem_buffer *take(struct iwl_trans *trans, struct iwl_rxq *rxq, u32 i)
+    {
+        struct iwl_trans_pcie *trans_pcie = IWL_TRANS_GET_PCIE_TRANS(trans);
+        struct iwl_rx_mem_buffer *rxb;
+        /*
+         * used_bd is a 32 bit but only 12 are used to retrieve
+         * the vid
+         */
+        u16 vid = le32_to_cpu(rxq->used_bd[i]) & 0x0FFF;
+
+        if ((!vid || vid > ARRAY_SIZE(trans_pcie->global_table))) {
+            IWL_ERR(trans, "Invalid rxb index from HW %u\n", (u32)vid);
+            iwl_force_nmi(trans);
+            return NULL;
+        }
+        rxb = trans_pcie->global_table[vid - 1];
+        if (rxb->invalid) {
+            IWL_ERR(trans, "Invalid rxb from HW %u\n", (u32)vid);
+            iwl_force_nmi(trans);
+            return NULL;
+        }
+        rxb->invalid = true;
+        return rxb;
+    }
+};
+
+#endif /* IwlTransLayout_h */
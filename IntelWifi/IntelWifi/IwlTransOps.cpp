@@ -7,12 +7,25 @@
 //
 
 #include "IwlTransOps.h"
+#include "IwlTransLayout.h"
 
 IwlTransOps::IwlTransOps(IntelWifi *iw)
     : iw(iw) {
     
 }
 
+IwlTransOps *IwlTransOps::create(IntelWifi *iw, const struct iwl_cfg *cfg) {
+    if (cfg->use_tfh) {
+        if (cfg->mq_rx_supported)
+            return new IwlTransOpsT<IwlTfdTfh, IwlRbdMq>(iw);
+        return new IwlTransOpsT<IwlTfdTfh, IwlRbdLegacy>(iw);
+    }
+    
+    if (cfg->mq_rx_supported)
+        return new IwlTransOpsT<IwlTfdGen1, IwlRbdMq>(iw);
+    return new IwlTransOpsT<IwlTfdGen1, IwlRbdLegacy>(iw);
+}
+
 int IwlTransOps::start_hw(struct iwl_trans *trans, bool low_power) {
     return iw->iwl_trans_pcie_start_hw(trans, low_power);
 }
@@ -31,3 +44,43 @@ void IwlTransOps::stop_device(struct iwl_trans *trans, bool low_power) {
     iw->iwl_trans_pcie_stop_device(trans, low_power);
     trans->state = IWL_TRANS_NO_FW;
 }
+
+void IwlTransOps::tx_batch_begin(struct iwl_trans *trans) {
+    iw->iwl_trans_pcie_tx_batch_begin(trans);
+}
+
+void IwlTransOps::tx_batch_end(struct iwl_trans *trans) {
+    iw->iwl_trans_pcie_tx_batch_end(trans);
+}
+
+int IwlTransOps::rxq_dma_data(struct iwl_trans *trans, int queue, struct iwl_trans_rxq_dma_data *data) {
+    return iwl_trans_pcie_rxq_dma_data(trans, queue, data);
+}
+
+template <class TFD, class RBD>
+int IwlTransOpsT<TFD, RBD>::tx(struct iwl_trans *trans, struct sk_buff *skb, struct iwl_device_cmd *dev_cmd, int queue) {
+    if (unlikely(test_bit(STATUS_FW_ERROR, &trans->status)))
+        return -EIO;
+    
+    if (WARN_ON_ONCE(trans->state != IWL_TRANS_FW_ALIVE)) {
+        IWL_ERR(trans, "%s bad state = %d\n", __func__, trans->state);
+        return -EIO;
+    }
+    
+    return iw->iwl_trans_pcie_tx<TFD>(trans, skb, dev_cmd, queue);
+}
+
+template <class TFD, class RBD>
+void IwlTransOpsT<TFD, RBD>::reclaim(struct iwl_trans *trans, int queue, int ssn, mbuf_t *skbs) {
+    if (WARN_ON_ONCE(trans->state != IWL_TRANS_FW_ALIVE)) {
+        IWL_ERR(trans, "%s bad state = %d\n", __func__, trans->state);
+        return;
+    }
+    
+    iw->iwl_trans_pcie_reclaim<TFD>(trans, queue, ssn, skbs);
+}
+
+template <class TFD, class RBD>
+bool IwlTransOpsT<TFD, RBD>::rx_handle(struct iwl_trans *trans, int queue) {
+    return iw->iwl_pcie_rx_handle<RBD>(trans, queue);
+}
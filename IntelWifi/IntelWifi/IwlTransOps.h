@@ -17,13 +17,36 @@ class IwlTransOps: public TransOps {
 public:
     IwlTransOps(IntelWifi *iw);
     
+    /*
+     * Ops specialized for the TFD and RBD layouts of @cfg, so the TX and
+     * RX paths don't check the cfg per descriptor.
+     */
+    static IwlTransOps *create(IntelWifi *iw, const struct iwl_cfg *cfg);
+    
     int start_hw(struct iwl_trans *trans, bool low_power) override;
     void op_mode_leave(struct iwl_trans *trans) override;
     void stop_device(struct iwl_trans *trans, bool low_power) override;
     int start_fw(struct iwl_trans *trans, const struct fw_img *fw, bool run_in_rfkill) override;
+    void tx_batch_begin(struct iwl_trans *trans) override;
+    void tx_batch_end(struct iwl_trans *trans) override;
+    int rxq_dma_data(struct iwl_trans *trans, int queue, struct iwl_trans_rxq_dma_data *data) override;
+    
+    /* drain an RX queue, true if the budget ran out with RBs left */
+    virtual bool rx_handle(struct iwl_trans *trans, int queue) = 0;
     
-private:
+protected:
     IntelWifi *iw;
 };
 
+template <class TFD, class RBD>
+class IwlTransOpsT: public IwlTransOps {
+    
+public:
+    IwlTransOpsT(IntelWifi *iw) : IwlTransOps(iw) {}
+    
+    int tx(struct iwl_trans *trans, struct sk_buff *skb, struct iwl_device_cmd *dev_cmd, int queue) override;
+    void reclaim(struct iwl_trans *trans, int queue, int ssn, mbuf_t *skbs) override;
+    bool rx_handle(struct iwl_trans *trans, int queue) override;
+};
+
 #endif /* IntelWifiTransOps_h */
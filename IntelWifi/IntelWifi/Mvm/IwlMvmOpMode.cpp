@@ -10,6 +10,13 @@
 
 IwlMvmOpMode::IwlMvmOpMode(TransOps *ops) {
     _ops = ops;
+    queueStopLock = IOSimpleLockAlloc();
+    stoppedQueues = 0;
+}
+
+IwlMvmOpMode::~IwlMvmOpMode() {
+    if (queueStopLock)
+        IOSimpleLockFree(queueStopLock);
 }
 
 
@@ -31,6 +38,72 @@ void IwlMvmOpMode::rx(struct napi_struct *napi, struct iwl_rx_cmd_buffer *rxb) {
 //    iwl_rx_dispatch(this->priv, napi, rxb);
 }
 
+/*
+ * CUSTOM: never called, there is only the default RX queue and RSS isn't
+ * programmed (see iwl_mvm_init_rss). Loudly drop anything that shows up.
+ */
+void IwlMvmOpMode::rx_rss(struct napi_struct *napi, struct iwl_rx_cmd_buffer *rxb, unsigned int queue) {
+    struct iwl_rx_packet *pkt = (struct iwl_rx_packet *)rxb_addr(rxb);
+    
+    IWL_WARN(priv, "Dropping packet 0x%x from RX queue %u, RSS is not supported\n",
+             WIDE_ID(pkt->hdr.group_id, pkt->hdr.cmd), queue);
+//    struct iwl_rx_packet *pkt = rxb_addr(rxb);
+//    u16 cmd = WIDE_ID(pkt->hdr.group_id, pkt->hdr.cmd);
+//
+//    if (unlikely(cmd == WIDE_ID(LEGACY_GROUP, FRAME_RELEASE)))
+//        iwl_mvm_rx_frame_release(mvm, napi, rxb, queue);
+//    else if (unlikely(cmd == WIDE_ID(DATA_PATH_GROUP,
+//                                     RX_QUEUES_NOTIFICATION)))
+//        iwl_mvm_rx_queue_notif(mvm, rxb, queue);
+//    else if (likely(cmd == WIDE_ID(LEGACY_GROUP, REPLY_RX_MPDU_CMD)))
+//        iwl_mvm_rx_mpdu_mq(mvm, napi, rxb, queue);
+}
+
+/*
+ * CUSTOM: there is no mac80211 queue per hardware queue, the interface has
+ * a single output queue. It is stopped when the first hardware queue fills
+ * up and started again once the last stopped one drains. The transport
+ * only calls these once per hardware queue transition (queue_stopped), so
+ * a count of the stopped queues is enough.
+ * Both are called with the TX queue's simple lock held; stopping and
+ * starting an IOOutputQueue doesn't block.
+ */
+void IwlMvmOpMode::queue_full(int queue) {
+//    iwl_mvm_stop_sw_queue(op_mode, queue);
+    IO80211Interface *netif = (IO80211Interface *)priv->trans->intf;
+    
+    IOSimpleLockLock(queueStopLock);
+    if (stoppedQueues++ == 0 && netif && netif->getOutputQueue())
+        netif->getOutputQueue()->stop();
+    IOSimpleLockUnlock(queueStopLock);
+}
+
+void IwlMvmOpMode::queue_not_full(int queue) {
+//    iwl_mvm_wake_sw_queue(op_mode, queue);
+    IO80211Interface *netif = (IO80211Interface *)priv->trans->intf;
+    
+    IOSimpleLockLock(queueStopLock);
+    if (!WARN_ON(stoppedQueues == 0) && --stoppedQueues == 0 &&
+        netif && netif->getOutputQueue())
+        netif->getOutputQueue()->start();
+    IOSimpleLockUnlock(queueStopLock);
+}
+
+void IwlMvmOpMode::free_skb(struct sk_buff *skb) {
+//    iwl_mvm_free_skb(op_mode, skb);
+    mbuf_freem((mbuf_t)skb);
+}
+
+/*
+ * CUSTOM: iwl_mvm_mac_tx(). Data frames go out through the station's queue
+ * (iwl_mvm_tx_skb_sta()), and there are no stations until association is
+ * ported, so every frame is refused and the controller drops it.
+ */
+int IwlMvmOpMode::tx(struct sk_buff *skb) {
+//    iwl_mvm_mac_tx(hw, control, skb);
+    return -ENOLINK;
+}
+
 int IwlMvmOpMode::iwl_up(){
 //    struct iwl_rxon_context *ctx;
 //    int ret;
@@ -52,6 +52,7 @@ IWL_MVM_D0I3_OPS                    \
 .stop = iwl_op_mode_mvm_stop
 
 #include <IOKit/IOBufferMemoryDescriptor.h>
+#include <IOKit/network/IOGatedOutputQueue.h>
 
 #include "IwlOpModeOps.h"
 #include "TransOps.h"
@@ -69,6 +70,7 @@ extern "C" {
 class IwlMvmOpMode : public IwlOpModeOps {
 public:
     IwlMvmOpMode(TransOps *ops);
+    ~IwlMvmOpMode();
     
     struct ieee80211_hw *start(struct iwl_trans *trans, const struct iwl_cfg *cfg,
                                const struct iwl_fw *fw) override;
@@ -78,6 +80,11 @@ public:
     
     void stop() override;
     void rx(struct napi_struct *napi, struct iwl_rx_cmd_buffer *rxb) override;
+    void rx_rss(struct napi_struct *napi, struct iwl_rx_cmd_buffer *rxb, unsigned int queue) override;
+    void queue_full(int queue) override;
+    void queue_not_full(int queue) override;
+    void free_skb(struct sk_buff *skb) override;
+    int tx(struct sk_buff *skb) override;
     
     
     IOReturn getCARD_CAPABILITIES(IO80211Interface *interface, struct apple80211_capability_data *cd) override;
@@ -106,6 +113,8 @@ private:
     
     
     int iwl_mvm_load_rt_fw();
+    int iwl_configure_rxq();
+    int iwl_mvm_init_rss();
     int iwl_run_init_mvm_ucode(bool read_nvm);
     int iwl_send_tx_ant_cfg(u8 valid_tx_ant);
     
@@ -135,6 +144,10 @@ private:
     TransOps *_ops;
     
     struct iwl_mvm *priv;
+    
+    /* hardware queues stopped by the transport, guarded by queueStopLock */
+    IOSimpleLock *queueStopLock;
+    int stoppedQueues;
 };
 
 
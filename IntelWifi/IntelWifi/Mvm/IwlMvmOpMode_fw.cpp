@@ -10,8 +10,11 @@
 #include "IwlMvmOpMode.hpp"
 #include "IwlMvmOpMode_fw.hpp"
 #include "../porting/linux/err.h"
+#include "../iwlwifi/dma-utils.h"
+#include <sys/random.h>
 extern "C"{
     #include "iwl-io.h"
+    #include "fw/paging-pool.h"
     #include "mvm.h"
 }
 
@@ -145,6 +148,7 @@ int IwlMvmOpMode::iwl_mvm_load_ucode_wait_alive(enum iwl_ucode_type ucode_type)
     int ret, i;
     enum iwl_ucode_type old_type = mvm->fwrt.cur_fw_img;
     static const u16 alive_cmd[] = { MVM_ALIVE };
+    u64 ts;
     
     set_bit(IWL_FWRT_STATUS_WAIT_ALIVE, &mvm->fwrt.status);
     if (ucode_type == IWL_UCODE_REGULAR &&
@@ -163,12 +167,15 @@ int IwlMvmOpMode::iwl_mvm_load_ucode_wait_alive(enum iwl_ucode_type ucode_type)
 //                               alive_cmd, ARRAY_SIZE(alive_cmd),
 //                               iwl_alive_fn, &alive_data);
     
+    ts = mach_absolute_time();
     ret = iwl_trans_start_fw(mvm->trans, fw, ucode_type == IWL_UCODE_INIT);
     if (ret) {
         iwl_fw_set_current_image(&mvm->fwrt, old_type);
         iwl_remove_notification(&mvm->notif_wait, &alive_wait);
         return ret;
     }
+    iwl_lat_record(mvm->trans->lat, IWL_LAT_FW_LOAD, ts);
+    ts = mach_absolute_time();
     
     /*
      * Some things may run in the background now, but we
@@ -199,6 +206,9 @@ int IwlMvmOpMode::iwl_mvm_load_ucode_wait_alive(enum iwl_ucode_type ucode_type)
         return -EIO;
     }
     
+    iwl_lat_record(mvm->trans->lat, IWL_LAT_FW_ALIVE, ts);
+    ts = mach_absolute_time();
+    
     iwl_trans_fw_alive(mvm->trans, alive_data.scd_base_addr);
     
     /*
@@ -226,10 +236,258 @@ int IwlMvmOpMode::iwl_mvm_load_ucode_wait_alive(enum iwl_ucode_type ucode_type)
     set_bit(IWL_MVM_STATUS_FIRMWARE_RUNNING, &mvm->status);
     clear_bit(IWL_FWRT_STATUS_WAIT_ALIVE, &mvm->fwrt.status);
     
+    iwl_lat_record(mvm->trans->lat, IWL_LAT_FW_ALIVE_NOTIFY, ts);
+    
     return 0;
 }
 
 
+// paging.c line 68
+/*
+ * Drop the paging layout. The pool stays allocated, a firmware restart
+ * refills the same blocks instead of allocating them again.
+ */
+void iwl_free_fw_paging(struct iwl_fw_runtime *fwrt)
+{
+    memset(fwrt->fw_paging_db, 0, sizeof(fwrt->fw_paging_db));
+    fwrt->num_of_paging_blk = 0;
+    fwrt->num_of_pages_in_last_blk = 0;
+}
+
+void iwl_free_fw_paging_pool(struct iwl_fw_runtime *fwrt)
+{
+    iwl_free_fw_paging(fwrt);
+    
+    if (fwrt->fw_paging_pool) {
+        free_dma_buf(fwrt->fw_paging_pool);
+        fwrt->fw_paging_pool = NULL;
+    }
+}
+
+// paging.c line 92
+static int iwl_alloc_fw_paging_mem(struct iwl_fw_runtime *fwrt,
+                                   const struct fw_img *image)
+{
+    struct iwl_dma_ptr *pool;
+    size_t size;
+    
+    if (fwrt->fw_paging_db[0].fw_paging_block)
+        return 0;
+    
+    /* ensure BLOCK_2_EXP_SIZE is power of 2 of PAGING_BLOCK_SIZE */
+    BUILD_BUG_ON(BIT(BLOCK_2_EXP_SIZE) != PAGING_BLOCK_SIZE);
+    
+    size = iwl_fw_paging_pool_size(image->paging_mem_size, &fwrt->num_of_paging_blk,
+                                   &fwrt->num_of_pages_in_last_blk);
+    
+    IWL_DEBUG_FW(fwrt, "Paging: allocating mem for %d paging blocks, each block holds 8 pages, last block holds %d pages\n",
+                 fwrt->num_of_paging_blk, fwrt->num_of_pages_in_last_blk);
+    
+    /*
+     * CUSTOM: instead of one alloc_pages() per block, the CSS block (4KB)
+     * and all paging blocks (32KB each) are carved out of one physically
+     * contiguous, 4KB aligned buffer. It is only reallocated when an image
+     * needs more paging memory than the previous one, see paging-pool.h.
+     */
+    pool = fwrt->fw_paging_pool;
+    if (pool && pool->size < size) {
+        free_dma_buf(pool);
+        pool = fwrt->fw_paging_pool = NULL;
+    }
+    
+    if (!pool) {
+        pool = allocate_dma_buf(size, DMA_BIT_MASK(32) & ~(mach_vm_address_t)(FW_PAGING_SIZE - 1), true);
+        if (!pool) {
+            iwl_free_fw_paging(fwrt);
+            return -ENOMEM;
+        }
+        fwrt->fw_paging_pool = pool;
+    }
+    
+    iwl_fw_paging_carve(fwrt->fw_paging_db, fwrt->num_of_paging_blk, (u8 *)pool->addr, pool->dma);
+    IWL_DEBUG_FW(fwrt, "Paging: carved 4K(CSS) and %d 32K blocks out of a %zu byte pool\n",
+                 fwrt->num_of_paging_blk, pool->size);
+    
+    return 0;
+}
+
+// paging.c line 151
+static int iwl_fill_paging_mem(struct iwl_fw_runtime *fwrt,
+                               const struct fw_img *image)
+{
+    int sec_idx, idx, ret;
+    u32 offset = 0;
+    
+    /*
+     * find where is the paging image start point:
+     * if CPU2 exist and it's in paging format, then the image looks like:
+     * CPU1 sections (2 or more)
+     * CPU1_CPU2_SEPARATOR_SECTION delimiter - separate between CPU1 to CPU2
+     * CPU2 sections (not paged)
+     * PAGING_SEPARATOR_SECTION delimiter - separate between CPU2
+     * non paged to CPU2 paging sec
+     * CPU2 paging CSS
+     * CPU2 paging image (including instruction and data)
+     */
+    for (sec_idx = 0; sec_idx < image->num_sec; sec_idx++) {
+        if (image->sec[sec_idx].offset == PAGING_SEPARATOR_SECTION) {
+            sec_idx++;
+            break;
+        }
+    }
+    
+    /*
+     * If paging is enabled there should be at least 2 more sections left
+     * (one for CSS and one for Paging data)
+     */
+    if (sec_idx >= image->num_sec - 1) {
+        IWL_ERR(fwrt, "Paging: Missing CSS and/or paging sections\n");
+        ret = -EINVAL;
+        goto err;
+    }
+    
+    /* copy the CSS block to the dram */
+    IWL_DEBUG_FW(fwrt, "Paging: load paging CSS to FW, sec = %d\n", sec_idx);
+    
+    if (image->sec[sec_idx].len > fwrt->fw_paging_db[0].fw_paging_size) {
+        IWL_ERR(fwrt, "CSS block is larger than paging size\n");
+        ret = -EINVAL;
+        goto err;
+    }
+    
+    memcpy(fwrt->fw_paging_db[0].fw_paging_block,
+           image->sec[sec_idx].data,
+           image->sec[sec_idx].len);
+    
+    IWL_DEBUG_FW(fwrt, "Paging: copied %d CSS bytes to first block\n",
+                 fwrt->fw_paging_db[0].fw_paging_size);
+    
+    sec_idx++;
+    
+    /*
+     * Copy the paging blocks to the dram.  The loop index starts
+     * from 1 since the CSS block (index 0) was already copied to
+     * dram.  We use num_of_paging_blk + 1 to account for that.
+     */
+    for (idx = 1; idx < fwrt->num_of_paging_blk + 1; idx++) {
+        struct iwl_fw_paging *block = &fwrt->fw_paging_db[idx];
+        int remaining = image->sec[sec_idx].len - offset;
+        int len = block->fw_paging_size;
+        
+        /*
+         * For the last block, we copy all that is remaining,
+         * for all other blocks, we copy fw_paging_size at a
+         * time. */
+        if (idx == fwrt->num_of_paging_blk) {
+            len = remaining;
+            if (remaining != fwrt->num_of_pages_in_last_blk * FW_PAGING_SIZE) {
+                IWL_ERR(fwrt, "Paging: last block contains more data than expected %d\n",
+                        remaining);
+                ret = -EINVAL;
+                goto err;
+            }
+        } else if (block->fw_paging_size > remaining) {
+            IWL_ERR(fwrt, "Paging: not enough data in other in block %d (%d)\n",
+                    idx, remaining);
+            ret = -EINVAL;
+            goto err;
+        }
+        
+        memcpy(block->fw_paging_block,
+               (const u8 *)image->sec[sec_idx].data + offset, len);
+        
+        IWL_DEBUG_FW(fwrt, "Paging: copied %d paging bytes to block %d\n",
+                     len, idx);
+        
+        offset += block->fw_paging_size;
+    }
+    
+    return 0;
+    
+err:
+    iwl_free_fw_paging(fwrt);
+    return ret;
+}
+
+// paging.c line 250
+static int iwl_save_fw_paging(struct iwl_fw_runtime *fwrt,
+                              const struct fw_img *fw)
+{
+    int ret;
+    
+    ret = iwl_alloc_fw_paging_mem(fwrt, fw);
+    if (ret)
+        return ret;
+    
+    return iwl_fill_paging_mem(fwrt, fw);
+}
+
+// paging.c line 263
+/* send paging cmd to FW in case CPU2 has paging image */
+static int iwl_send_paging_cmd(struct iwl_fw_runtime *fwrt,
+                               const struct fw_img *fw)
+{
+    struct iwl_fw_paging_cmd paging_cmd = {
+        .flags = cpu_to_le32(PAGING_CMD_IS_SECURED |
+                             PAGING_CMD_IS_ENABLED |
+                             (fwrt->num_of_pages_in_last_blk <<
+                              PAGING_CMD_NUM_OF_PAGES_IN_LAST_GRP_POS)),
+        .block_size = cpu_to_le32(BLOCK_2_EXP_SIZE),
+        .block_num = cpu_to_le32(fwrt->num_of_paging_blk),
+    };
+    struct iwl_host_cmd hcmd = {
+        .id = iwl_cmd_id(FW_PAGING_BLOCK_CMD, IWL_ALWAYS_LONG_GROUP, 0),
+        .len = { sizeof(paging_cmd), },
+        .data = { &paging_cmd, },
+    };
+    int blk_idx;
+    
+    /* loop for for all paging blocks + CSS block */
+    for (blk_idx = 0; blk_idx < fwrt->num_of_paging_blk + 1; blk_idx++) {
+        dma_addr_t addr = fwrt->fw_paging_db[blk_idx].fw_paging_phys;
+        __le32 phy_addr;
+        
+        addr = addr >> PAGE_2_EXP_SIZE;
+        phy_addr = cpu_to_le32(addr);
+        paging_cmd.device_phy_addr[blk_idx] = phy_addr;
+    }
+    
+    return iwl_trans_send_cmd(fwrt->trans, &hcmd);
+}
+
+// paging.c line 295
+int iwl_init_paging(struct iwl_fw_runtime *fwrt, enum iwl_ucode_type type)
+{
+    const struct fw_img *fw = &fwrt->fw->img[type];
+    int ret;
+    
+    if (fwrt->trans->cfg->gen2)
+        return 0;
+    
+    /*
+     * Configure and operate fw paging mechanism.
+     * The driver configures the paging flow only once.
+     * The CPU2 paging image is included in the IWL_UCODE_INIT image.
+     */
+    if (!fw->paging_mem_size)
+        return 0;
+    
+    ret = iwl_save_fw_paging(fwrt, fw);
+    if (ret) {
+        IWL_ERR(fwrt, "failed to save the FW paging image\n");
+        return ret;
+    }
+    
+    ret = iwl_send_paging_cmd(fwrt, fw);
+    if (ret) {
+        IWL_ERR(fwrt, "failed to send the paging cmd\n");
+        iwl_free_fw_paging(fwrt);
+        return ret;
+    }
+    
+    return 0;
+}
+
 int IwlMvmOpMode::iwl_mvm_load_rt_fw()
 {
     struct iwl_mvm *mvm = this->priv;
@@ -262,7 +520,110 @@ int IwlMvmOpMode::iwl_mvm_load_rt_fw()
     if (ret)
         return ret;
     
-    return iwl_init_paging(&mvm->fwrt, mvm->fwrt.cur_fw_img);
+    ret = iwl_init_paging(&mvm->fwrt, mvm->fwrt.cur_fw_img);
+    if (ret)
+        return ret;
+    
+    return iwl_mvm_init_rss();
+}
+
+// fw.c line 101
+static int iwl_send_rss_cfg_cmd(struct iwl_mvm *mvm)
+{
+    int i;
+    struct iwl_rss_config_cmd cmd = {
+        .flags = cpu_to_le32(IWL_RSS_ENABLE),
+        .hash_mask = IWL_RSS_HASH_TYPE_IPV4_TCP |
+        IWL_RSS_HASH_TYPE_IPV4_UDP |
+        IWL_RSS_HASH_TYPE_IPV4_PAYLOAD |
+        IWL_RSS_HASH_TYPE_IPV6_TCP |
+        IWL_RSS_HASH_TYPE_IPV6_UDP |
+        IWL_RSS_HASH_TYPE_IPV6_PAYLOAD,
+    };
+    
+    if (mvm->trans->num_rx_queues == 1)
+        return 0;
+    
+    /* Do not direct RSS traffic to Q 0 which is our fallback queue */
+    for (i = 0; i < ARRAY_SIZE(cmd.indirection_table); i++)
+        cmd.indirection_table[i] = 1 + (i % (mvm->trans->num_rx_queues - 1));
+    // original linux code: netdev_rss_key_fill(cmd.secret_key, sizeof(cmd.secret_key));
+    read_random(cmd.secret_key, sizeof(cmd.secret_key));
+    
+    return iwl_mvm_send_cmd_pdu(mvm, RSS_CONFIG_CMD, 0, sizeof(cmd), &cmd);
+}
+
+// fw.c line 126
+int IwlMvmOpMode::iwl_configure_rxq()
+{
+    struct iwl_mvm *mvm = this->priv;
+    int i, num_queues, size, ret;
+    struct iwl_rfh_queue_config *cmd;
+    
+    /* Do not configure default queue, it is configured via context info */
+    num_queues = mvm->trans->num_rx_queues - 1;
+    
+    size = sizeof(*cmd) + num_queues * sizeof(struct iwl_rfh_queue_data);
+    
+    cmd = (struct iwl_rfh_queue_config *)iwh_zalloc(size);
+    if (!cmd)
+        return -ENOMEM;
+    
+    cmd->num_queues = num_queues;
+    
+    for (i = 0; i < num_queues; i++) {
+        struct iwl_trans_rxq_dma_data data;
+        
+        cmd->data[i].q_num = i + 1;
+        ret = _ops->rxq_dma_data(mvm->trans, i + 1, &data);
+        if (ret) {
+            iwh_free(cmd);
+            return ret;
+        }
+        
+        cmd->data[i].fr_bd_cb = cpu_to_le64(data.fr_bd_cb);
+        cmd->data[i].urbd_stts_wrptr = cpu_to_le64(data.urbd_stts_wrptr);
+        cmd->data[i].ur_bd_cb = cpu_to_le64(data.ur_bd_cb);
+        cmd->data[i].fr_bd_wid = cpu_to_le32(data.fr_bd_wid);
+    }
+    
+    ret = iwl_mvm_send_cmd_pdu(mvm, WIDE_ID(DATA_PATH_GROUP, RFH_QUEUE_CONFIG_CMD), 0, size, cmd);
+    iwh_free(cmd);
+    return ret;
+}
+
+// fw.c line 1081, taken out of iwl_mvm_up
+int IwlMvmOpMode::iwl_mvm_init_rss()
+{
+    struct iwl_mvm *mvm = this->priv;
+    int ret;
+    
+    /*
+     * CUSTOM: the transport runs a single RX queue until MSI-X is ported
+     * (iwl_pcie_set_interrupt_capa) and rx_rss() has no MPDU path behind
+     * it yet, so RSS isn't programmed and all frames land on queue 0.
+     */
+    if (mvm->trans->num_rx_queues == 1)
+        return 0;
+    
+    /* Init RSS configuration */
+    if (mvm->trans->cfg->device_family >= IWL_DEVICE_FAMILY_22000) {
+        ret = iwl_configure_rxq();
+        if (ret) {
+            IWL_ERR(mvm, "Failed to configure RX queues: %d\n", ret);
+            return ret;
+        }
+    }
+    
+    if (iwl_mvm_has_new_rx_api(mvm)) {
+        ret = iwl_send_rss_cfg_cmd(mvm);
+        if (ret) {
+            IWL_ERR(mvm, "Failed to configure RSS queues: %d\n", ret);
+            return ret;
+        }
+    }
+    
+    return 0;
 }
 
 bool IwlMvmOpMode::iwl_alive_fn(struct iwl_notif_wait_data *notif_wait,
@@ -655,6 +655,8 @@ struct iwl_mvm *IwlMvmOpMode::iwl_op_mode_mvm_start(struct iwl_trans *trans, con
     mvm->hw = hw;
     
 //    iwl_fw_runtime_init(&mvm->fwrt, trans, fw, &iwl_mvm_fwrt_ops, mvm, dbgfs_dir);
+    mvm->fwrt.trans = trans;
+    mvm->fwrt.fw = fw;
     
     mvm->init_status = 0;
     
@@ -888,6 +890,7 @@ out_unregister:
     iwl_mvm_thermal_exit(mvm);
 out_free:
 //    iwl_fw_flush_dump(&mvm->fwrt);
+    iwl_free_fw_paging_pool(&mvm->fwrt);
     iwl_fw_runtime_free(&mvm->fwrt);
     
     if (iwlmvm_mod_params.init_dbg)
@@ -930,6 +933,8 @@ void IwlMvmOpMode::iwl_op_mode_mvm_stop()
 #endif
     iwl_trans_op_mode_leave(mvm->trans);
     
+    iwl_notification_wait_free(&mvm->notif_wait);
+    
     iwl_phy_db_free(mvm->phy_db);
     mvm->phy_db = NULL;
     
@@ -941,6 +946,7 @@ void IwlMvmOpMode::iwl_op_mode_mvm_stop()
     
     iwl_mvm_tof_clean(mvm);
     
+    iwl_free_fw_paging_pool(&mvm->fwrt);
     iwl_fw_runtime_free(&mvm->fwrt);
 //    mutex_destroy(&mvm->mutex);
 //    mutex_destroy(&mvm->d0i3_suspend_mutex);
@@ -17,6 +17,11 @@ public:
     virtual void op_mode_leave(struct iwl_trans *trans) = 0;
     virtual void stop_device(struct iwl_trans *trans, bool low_power) = 0;
     virtual int start_fw(struct iwl_trans *trans, const struct fw_img *fw, bool run_in_rfkill) = 0;
+    virtual int tx(struct iwl_trans *trans, struct sk_buff *skb, struct iwl_device_cmd *dev_cmd, int queue) = 0;
+    virtual void reclaim(struct iwl_trans *trans, int queue, int ssn, mbuf_t *skbs) = 0;
+    virtual void tx_batch_begin(struct iwl_trans *trans) = 0;
+    virtual void tx_batch_end(struct iwl_trans *trans) = 0;
+    virtual int rxq_dma_data(struct iwl_trans *trans, int queue, struct iwl_trans_rxq_dma_data *data) = 0;
     
     
 //    int (*start_fw)(struct iwl_trans *trans, const struct fw_img *fw,
@@ -32,11 +37,6 @@ public:
 //
 //    int (*send_cmd)(struct iwl_trans *trans, struct iwl_host_cmd *cmd);
 //
-//    int (*tx)(struct iwl_trans *trans, struct sk_buff *skb,
-//              struct iwl_device_cmd *dev_cmd, int queue);
-//    void (*reclaim)(struct iwl_trans *trans, int queue, int ssn,
-//                    struct sk_buff_head *skbs);
-//
 //    bool (*txq_enable)(struct iwl_trans *trans, int queue, u16 ssn,
 //                       const struct iwl_trans_txq_scd_cfg *cfg,
 //                       unsigned int queue_wdg_timeout);
@@ -8,11 +8,42 @@
 
 #include "allocation.h"
 
+#include <libkern/OSAtomic.h>
+
+/*
+ * Threads whose iwh_malloc() calls are counted, see iwh_alloc_track().
+ * Each RX queue has a single consumer, so a slot per queue is enough.
+ */
+#define IWH_ALLOC_TRACK_MAX 16
+
+static struct {
+    void * volatile thread;
+    UInt32 *count;
+} trackers[IWH_ALLOC_TRACK_MAX];
+
+static volatile SInt32 nr_trackers;
+
+static void iwh_alloc_count(void) {
+    IOThread self = IOThreadSelf();
+    int i;
+    
+    for (i = 0; i < IWH_ALLOC_TRACK_MAX; i++) {
+        if (trackers[i].thread == self) {
+            /* only this thread writes it */
+            (*trackers[i].count)++;
+            return;
+        }
+    }
+}
+
 void* iwh_malloc(vm_size_t len) {
     void *addr = IOMalloc(len + sizeof(vm_size_t));
     if (addr == NULL)
         return NULL;
     
+    if (nr_trackers)
+        iwh_alloc_count();
+    
     *((vm_size_t*)addr) = len;
     return (void*)((uint8_t*)addr + sizeof(vm_size_t));
 }
@@ -34,3 +65,31 @@ void iwh_free(void* ptr) {
     vm_size_t block_size = *((vm_size_t*)start_addr) + sizeof(vm_size_t);
     IOFree(start_addr, block_size);
 }
+
+bool iwh_alloc_track(UInt32 *count) {
+    IOThread self = IOThreadSelf();
+    int i;
+    
+    for (i = 0; i < IWH_ALLOC_TRACK_MAX; i++) {
+        if (OSCompareAndSwapPtr(NULL, self, &trackers[i].thread)) {
+            trackers[i].count = count;
+            OSIncrementAtomic(&nr_trackers);
+            return true;
+        }
+    }
+    return false;
+}
+
+void iwh_alloc_untrack(void) {
+    IOThread self = IOThreadSelf();
+    int i;
+    
+    for (i = 0; i < IWH_ALLOC_TRACK_MAX; i++) {
+        if (trackers[i].thread == self) {
+            OSDecrementAtomic(&nr_trackers);
+            trackers[i].count = NULL;
+            OSCompareAndSwapPtr(self, NULL, &trackers[i].thread);
+            return;
+        }
+    }
+}
@@ -34,4 +34,16 @@ void *iwh_zalloc(vm_size_t len);
  */
 void iwh_free(void* ptr);
 
+/**
+ * Count the calling thread's iwh_malloc() calls in *count until
+ * iwh_alloc_untrack(), for profiling. Returns false if too many threads
+ * are tracked already.
+ */
+bool iwh_alloc_track(UInt32 *count);
+
+/**
+ * Stop counting the calling thread's iwh_malloc() calls
+ */
+void iwh_alloc_untrack(void);
+
 #endif /* allocation_h */
@@ -10,8 +10,12 @@
 
 #include "../iw_utils/allocation.h"
 
-struct iwl_dma_ptr* allocate_dma_buf(size_t size, mach_vm_address_t physical_mask) {
-    IOOptionBits options = kIODirectionInOut | kIOMemoryPhysicallyContiguous | kIOMapInhibitCache;
+struct iwl_dma_ptr* allocate_dma_buf(size_t size, mach_vm_address_t physical_mask, bool cached) {
+    IOOptionBits options = kIODirectionInOut | kIOMemoryPhysicallyContiguous;
+    
+    // Rings and command buffers are mostly written by the host, RX buffers are read by the CPU
+    if (!cached)
+        options |= kIOMapInhibitCache;
     
     IOBufferMemoryDescriptor *bmd;
     bmd = IOBufferMemoryDescriptor::inTaskWithPhysicalMask(kernel_task, options, size, physical_mask);
@@ -16,7 +16,7 @@ extern "C" {
 #include <IOKit/IOBufferMemoryDescriptor.h>
 #include <IOKit/IODMACommand.h>
 
-struct iwl_dma_ptr* allocate_dma_buf(size_t size, mach_vm_address_t physical_mask);
+struct iwl_dma_ptr* allocate_dma_buf(size_t size, mach_vm_address_t physical_mask, bool cached = false);
 void free_dma_buf(struct iwl_dma_ptr *dma_ptr);
 
 #endif /* dma_utils_h */
@@ -125,11 +125,25 @@ fw_has_capa(const struct iwl_ucode_capabilities *capabilities,
 	return test_bit(capa, capabilities->_capa);
 }
 
+/**
+ * struct iwl_fw_blob - retained, read-only copy of a firmware file
+ * @refcount: one reference for every &struct fw_desc pointing into @data,
+ *	plus one held by the loader while the file is parsed
+ * @size: size of @data in bytes
+ * @data: the file contents
+ */
+struct iwl_fw_blob {
+	volatile s32 refcount;
+	size_t size;
+	u8 data[0];
+};
+
 /* one for each uCode image (inst/data, init/runtime/wowlan) */
 struct fw_desc {
-	void *data;	/* vmalloc'ed data */
+	void *data;	/* slice of @blob, or vmalloc'ed data if @blob is NULL */
 	size_t len;		/* size in bytes */
 	u32 offset;		/* offset in the device */
+	struct iwl_fw_blob *blob;
 };
 
 struct fw_img {
@@ -177,12 +191,12 @@ struct iwl_sf_region {
 /**
  * struct iwl_fw_paging
  * @fw_paging_phys: page phy pointer
- * @fw_paging_block: pointer to the allocated block
+ * @fw_paging_block: pointer to the block, inside &iwl_fw_runtime.fw_paging_pool
  * @fw_paging_size: page size
  */
 struct iwl_fw_paging {
 	dma_addr_t fw_paging_phys;
-	struct page *fw_paging_block;
+	u8 *fw_paging_block; // CUSTOM: was struct page *
 	u32 fw_paging_size;
 };
 
@@ -68,51 +68,72 @@
 
 void iwl_notification_wait_init(struct iwl_notif_wait_data *notif_wait)
 {
-    notif_wait->notif_wait_lock = IOSimpleLockAlloc();
-    STAILQ_INIT(&notif_wait->notif_waits);
+    notif_wait->notif_wait_lock = IOLockAlloc();
+    TAILQ_INIT(&notif_wait->notif_waits);
     notif_wait->notif_waitq = IOLockAlloc();
+    memset((void *)notif_wait->cmd_refs, 0, sizeof(notif_wait->cmd_refs));
 }
 IWL_EXPORT_SYMBOL(iwl_notification_wait_init);
 
+/* CUSTOM: the locks outlive the op mode's stop otherwise, no waiter may be left */
+void iwl_notification_wait_free(struct iwl_notif_wait_data *notif_wait)
+{
+    WARN_ON(!TAILQ_EMPTY(&notif_wait->notif_waits));
+
+    if (notif_wait->notif_wait_lock) {
+        IOLockFree(notif_wait->notif_wait_lock);
+        notif_wait->notif_wait_lock = NULL;
+    }
+    if (notif_wait->notif_waitq) {
+        IOLockFree(notif_wait->notif_waitq);
+        notif_wait->notif_waitq = NULL;
+    }
+}
+IWL_EXPORT_SYMBOL(iwl_notification_wait_free);
+
 bool iwl_notification_wait(struct iwl_notif_wait_data *notif_wait, struct iwl_rx_packet *pkt)
 {
 	bool triggered = false;
-
-	if (!STAILQ_EMPTY(&notif_wait->notif_waits)) {
-		struct iwl_notification_wait *w;
-
-        //IOSimpleLockLock(notif_wait->notif_wait_lock);
-        STAILQ_FOREACH(w, &notif_wait->notif_waits, list) {
-			int i;
-			bool found = false;
-
-			/*
-			 * If it already finished (triggered) or has been
-			 * aborted then don't evaluate it again to avoid races,
-			 * Otherwise the function could be called again even
-			 * though it returned true before
-			 */
-			if (w->triggered || w->aborted)
-				continue;
-
-			for (i = 0; i < w->n_cmds; i++) {
-				u16 rec_id = WIDE_ID(pkt->hdr.group_id, pkt->hdr.cmd);
-
-				if (w->cmds[i] == rec_id || (!iwl_cmd_groupid(w->cmds[i]) && DEF_ID(w->cmds[i]) == rec_id)) {
-					found = true;
-					break;
-				}
+	struct iwl_notification_wait *w;
+	u16 rec_id = WIDE_ID(pkt->hdr.group_id, pkt->hdr.cmd);
+
+	/*
+	 * Nobody waits for this opcode - the common case. A waiter is
+	 * registered before the command that triggers its notification
+	 * is sent, so an unlocked read can't miss it.
+	 */
+	if (!notif_wait->cmd_refs[pkt->hdr.cmd])
+		return false;
+
+	IOLockLock(notif_wait->notif_wait_lock);
+	TAILQ_FOREACH(w, &notif_wait->notif_waits, list) {
+		int i;
+		bool found = false;
+
+		/*
+		 * If it already finished (triggered) or has been
+		 * aborted then don't evaluate it again to avoid races,
+		 * Otherwise the function could be called again even
+		 * though it returned true before
+		 */
+		if (w->triggered || w->aborted)
+			continue;
+
+		for (i = 0; i < w->n_cmds; i++) {
+			if (w->cmds[i] == rec_id || (!iwl_cmd_groupid(w->cmds[i]) && DEF_ID(w->cmds[i]) == rec_id)) {
+				found = true;
+				break;
 			}
-			if (!found)
-				continue;
+		}
+		if (!found)
+			continue;
 
-			if (!w->fn || w->fn(notif_wait, pkt, w->fn_data)) {
-				w->triggered = true;
-				triggered = true;
-			}
+		if (!w->fn || w->fn(notif_wait, pkt, w->fn_data)) {
+			w->triggered = true;
+			triggered = true;
 		}
-        //IOSimpleLockUnlock(notif_wait->notif_wait_lock);
 	}
+	IOLockUnlock(notif_wait->notif_wait_lock);
 
 	return triggered;
 }
@@ -122,16 +143,17 @@ void iwl_abort_notification_waits(struct iwl_notif_wait_data *notif_wait)
 {
 	struct iwl_notification_wait *wait_entry;
 
-    //IOSimpleLockLock(notif_wait->notif_wait_lock);
-    STAILQ_FOREACH(wait_entry, &notif_wait->notif_waits, list)
+    IOLockLock(notif_wait->notif_wait_lock);
+    TAILQ_FOREACH(wait_entry, &notif_wait->notif_waits, list)
 		wait_entry->aborted = true;
-    //IOSimpleLockUnlock(notif_wait->notif_wait_lock);
+    IOLockUnlock(notif_wait->notif_wait_lock);
     
-    // TODO: Implement
 	//wake_up_all(&notif_wait->notif_waitq);
     IOLockLock(notif_wait->notif_waitq);
-    STAILQ_FOREACH(wait_entry, &notif_wait->notif_waits, list)
+    IOLockLock(notif_wait->notif_wait_lock);
+    TAILQ_FOREACH(wait_entry, &notif_wait->notif_waits, list)
         IOLockWakeup(notif_wait->notif_waitq, wait_entry, true);
+    IOLockUnlock(notif_wait->notif_wait_lock);
     IOLockUnlock(notif_wait->notif_waitq);
 }
 IWL_EXPORT_SYMBOL(iwl_abort_notification_waits);
@@ -152,18 +174,22 @@ iwl_init_notification_wait(struct iwl_notif_wait_data *notif_wait, struct iwl_no
 	wait_entry->triggered = false;
 	wait_entry->aborted = false;
 
-    //IOSimpleLockLock(notif_wait->notif_wait_lock);
-    STAILQ_INSERT_HEAD(&notif_wait->notif_waits, wait_entry, list);
-    //IOSimpleLockUnlock(notif_wait->notif_wait_lock);
+    IOLockLock(notif_wait->notif_wait_lock);
+    TAILQ_INSERT_HEAD(&notif_wait->notif_waits, wait_entry, list);
+    for (int i = 0; i < n_cmds; i++)
+        notif_wait->cmd_refs[iwl_cmd_opcode(cmds[i])]++;
+    IOLockUnlock(notif_wait->notif_wait_lock);
 }
 IWL_EXPORT_SYMBOL(iwl_init_notification_wait);
 
 void iwl_remove_notification(struct iwl_notif_wait_data *notif_wait,
 			     struct iwl_notification_wait *wait_entry)
 {
-    //IOSimpleLockLock(notif_wait->notif_wait_lock);
-    STAILQ_REMOVE_HEAD(&notif_wait->notif_waits, list);
-    //IOSimpleLockUnlock(notif_wait->notif_wait_lock);
+    IOLockLock(notif_wait->notif_wait_lock);
+    TAILQ_REMOVE(&notif_wait->notif_waits, wait_entry, list);
+    for (int i = 0; i < wait_entry->n_cmds; i++)
+        notif_wait->cmd_refs[iwl_cmd_opcode(wait_entry->cmds[i])]--;
+    IOLockUnlock(notif_wait->notif_wait_lock);
 }
 IWL_EXPORT_SYMBOL(iwl_remove_notification);
 
@@ -176,7 +202,11 @@ int iwl_wait_notification(struct iwl_notif_wait_data *notif_wait, struct iwl_not
     AbsoluteTime deadline;
     clock_interval_to_deadline((u32)timeout, kMillisecondScale, (UInt64 *) &deadline);
     
-    ret = IOLockSleepDeadline(notif_wait->notif_waitq, wait_entry, deadline, THREAD_INTERRUPTIBLE);
+    /* The notification may have beaten us here, don't sleep through it */
+    if (wait_entry->triggered || wait_entry->aborted)
+        ret = THREAD_AWAKENED;
+    else
+        ret = IOLockSleepDeadline(notif_wait->notif_waitq, wait_entry, deadline, THREAD_INTERRUPTIBLE);
     iwl_remove_notification(notif_wait, wait_entry);
     IOLockUnlock(notif_wait->notif_waitq);
 
@@ -70,10 +70,23 @@
 
 struct iwl_notification_wait;
 
+/* one slot per opcode, the low byte of a (wide) command ID */
+#define IWL_NOTIF_WAIT_SLOTS	256
+
+/**
+ * struct iwl_notif_wait_data - notification wait registry
+ * @notif_waits: registered waiters
+ * @notif_wait_lock: protects @notif_waits and @cmd_refs updates
+ * @notif_waitq: waiters sleep on this lock
+ * @cmd_refs: number of registered cmds[] entries per opcode. A packet
+ *	whose opcode has no entry can't match a waiter, so dispatch checks
+ *	this without taking the lock and skips the list walk.
+ */
 struct iwl_notif_wait_data {
-    STAILQ_HEAD(, iwl_notification_wait) notif_waits;
-	IOSimpleLock *notif_wait_lock;
+    TAILQ_HEAD(, iwl_notification_wait) notif_waits;
+	IOLock *notif_wait_lock;
 	IOLock *notif_waitq;
+	volatile u16 cmd_refs[IWL_NOTIF_WAIT_SLOTS];
 };
 
 #define MAX_NOTIF_CMDS	5
@@ -103,7 +116,7 @@ struct iwl_notif_wait_data {
  * the code for them.
  */
 struct iwl_notification_wait {
-    STAILQ_ENTRY(iwl_notification_wait) list;
+    TAILQ_ENTRY(iwl_notification_wait) list;
 
 	bool (*fn)(struct iwl_notif_wait_data *notif_data,
 		   struct iwl_rx_packet *pkt, void *data);
@@ -117,6 +130,7 @@ struct iwl_notification_wait {
 
 /* caller functions */
 void iwl_notification_wait_init(struct iwl_notif_wait_data *notif_data);
+void iwl_notification_wait_free(struct iwl_notif_wait_data *notif_data);
 bool iwl_notification_wait(struct iwl_notif_wait_data *notif_data, struct iwl_rx_packet *pkt);
 void iwl_abort_notification_waits(struct iwl_notif_wait_data *notif_data);
 
@@ -125,8 +139,11 @@ iwl_notification_notify(struct iwl_notif_wait_data *notif_data)
 {
     struct iwl_notification_wait *wait_entry;
     IOLockLock(notif_data->notif_waitq);
-    STAILQ_FOREACH(wait_entry, &notif_data->notif_waits, list)
-        IOLockWakeup(notif_data->notif_waitq, wait_entry, true);
+    IOLockLock(notif_data->notif_wait_lock);
+    TAILQ_FOREACH(wait_entry, &notif_data->notif_waits, list)
+        if (wait_entry->triggered)
+            IOLockWakeup(notif_data->notif_waitq, wait_entry, true);
+    IOLockUnlock(notif_data->notif_wait_lock);
     IOLockUnlock(notif_data->notif_waitq);
 }
 
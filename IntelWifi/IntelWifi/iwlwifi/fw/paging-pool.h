@@ -0,0 +1,56 @@
+//
+//  paging-pool.h
+//  IntelWifi
+//
+//  Layout of the firmware paging blocks in the one DMA buffer they share,
+//  see iwl_alloc_fw_paging_mem(). It only looks at sizes and addresses, so
+//  it is also checked on the host by checks/paging-pool.c.
+//
+
+#ifndef __iwl_fw_paging_pool_h__
+#define __iwl_fw_paging_pool_h__
+
+#include <linux/types.h>
+
+#include "img.h"
+
+/*
+ * Number of paging blocks @paging_mem_size takes and the pages in the last
+ * one. Returns the size of the pool that holds the CSS block (4KB) and all
+ * of the paging blocks (32KB each), back to back.
+ */
+static inline size_t iwl_fw_paging_pool_size(u32 paging_mem_size, u16 *num_of_paging_blk,
+					     u16 *num_of_pages_in_last_blk)
+{
+	int num_of_pages = paging_mem_size / FW_PAGING_SIZE;
+	int num_blk = DIV_ROUND_UP(num_of_pages, NUM_OF_PAGE_PER_GROUP);
+
+	*num_of_paging_blk = (u16)num_blk;
+	*num_of_pages_in_last_blk = (u16)(num_of_pages - NUM_OF_PAGE_PER_GROUP * (num_blk - 1));
+
+	return FW_PAGING_SIZE + (size_t)num_blk * PAGING_BLOCK_SIZE;
+}
+
+/*
+ * Point the CSS block and @num_of_paging_blk paging blocks of @db into the
+ * pool at @addr / @dma. The pool has to be iwl_fw_paging_pool_size() bytes
+ * at least and 4KB aligned, every block then is too.
+ */
+static inline void iwl_fw_paging_carve(struct iwl_fw_paging *db, int num_of_paging_blk,
+				       u8 *addr, dma_addr_t dma)
+{
+	size_t offset = 0;
+	int blk_idx;
+
+	for (blk_idx = 0; blk_idx < num_of_paging_blk + 1; blk_idx++) {
+		/* For CSS allocate 4KB, for others PAGING_BLOCK_SIZE (32K) */
+		u32 blk_size = blk_idx ? PAGING_BLOCK_SIZE : FW_PAGING_SIZE;
+
+		db[blk_idx].fw_paging_block = addr + offset;
+		db[blk_idx].fw_paging_phys = dma + offset;
+		db[blk_idx].fw_paging_size = blk_size;
+		offset += blk_size;
+	}
+}
+
+#endif /* __iwl_fw_paging_pool_h__ */
@@ -103,6 +103,8 @@ enum iwl_fw_runtime_status {
  * @fw_paging_db: paging database
  * @num_of_paging_blk: number of paging blocks
  * @num_of_pages_in_last_blk: number of pages in the last block
+ * @fw_paging_pool: DMA memory backing all paging blocks, kept across
+ *    firmware restarts and only released with the op mode
  * @smem_cfg: saved firmware SMEM configuration
  * @cur_fw_img: current firmware image, must be maintained by
  *    the driver by calling &iwl_fw_set_current_image()
@@ -122,6 +124,7 @@ struct iwl_fw_runtime {
     struct iwl_fw_paging fw_paging_db[NUM_OF_FW_PAGING_BLOCKS];
     u16 num_of_paging_blk;
     u16 num_of_pages_in_last_blk;
+    struct iwl_dma_ptr *fw_paging_pool;
     
     enum iwl_ucode_type cur_fw_img;
     
@@ -172,6 +175,7 @@ static inline void iwl_fw_set_current_image(struct iwl_fw_runtime *fwrt,
 
 int iwl_init_paging(struct iwl_fw_runtime *fwrt, enum iwl_ucode_type type);
 void iwl_free_fw_paging(struct iwl_fw_runtime *fwrt);
+void iwl_free_fw_paging_pool(struct iwl_fw_runtime *fwrt);
 
 void iwl_get_shared_mem_conf(struct iwl_fw_runtime *fwrt);
 
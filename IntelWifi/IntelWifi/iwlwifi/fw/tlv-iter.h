@@ -0,0 +1,140 @@
+//
+//  tlv-iter.h
+//  IntelWifi
+//
+//  Walker for the TLV part of a .ucode file. It only depends on the file
+//  layout: no driver state, no allocation and no logging, so it can be fed
+//  arbitrary input outside of the kext.
+//
+
+#ifndef __iwl_fw_tlv_iter_h__
+#define __iwl_fw_tlv_iter_h__
+
+#include <linux/types.h>
+
+#include "img.h"
+
+enum iwl_tlv_iter_err {
+	IWL_TLV_ITER_OK,
+	IWL_TLV_ITER_TRUNCATED,		/* TLV length runs past the end of the file */
+	IWL_TLV_ITER_TRAILING,		/* bytes left over that can't hold a TLV */
+	IWL_TLV_ITER_BAD_SECTION,	/* section TLV too short for its offset */
+};
+
+/**
+ * struct iwl_tlv_iter - TLV stream iterator
+ * @pos: next TLV header
+ * @left: bytes left in the stream, starting at @pos
+ * @type: type of the current TLV
+ * @len: payload length of the current TLV, always within the stream
+ * @data: payload of the current TLV
+ * @err: why the iteration stopped, %IWL_TLV_ITER_OK at the end of the stream
+ */
+struct iwl_tlv_iter {
+	const u8 *pos;
+	size_t left;
+	u32 type;
+	u32 len;
+	const u8 *data;
+	enum iwl_tlv_iter_err err;
+};
+
+static inline void iwl_tlv_iter_init(struct iwl_tlv_iter *it,
+				     const u8 *data, size_t len)
+{
+	it->pos = data;
+	it->left = len;
+	it->type = 0;
+	it->len = 0;
+	it->data = NULL;
+	it->err = IWL_TLV_ITER_OK;
+}
+
+/*
+ * Step to the next TLV. Returns false at the end of the stream or on a
+ * malformed TLV, @err tells them apart. The padding of the last TLV may be
+ * missing.
+ */
+static inline bool iwl_tlv_iter_next(struct iwl_tlv_iter *it)
+{
+	const struct iwl_ucode_tlv *tlv = (const struct iwl_ucode_tlv *)it->pos;
+	size_t avail, padded;
+
+	if (it->err != IWL_TLV_ITER_OK || !it->left)
+		return false;
+
+	if (it->left < sizeof(*tlv)) {
+		it->err = IWL_TLV_ITER_TRAILING;
+		return false;
+	}
+
+	avail = it->left - sizeof(*tlv);
+	it->type = le32_to_cpu(tlv->type);
+	it->len = le32_to_cpu(tlv->length);
+	it->data = tlv->data;
+
+	if (it->len > avail) {
+		it->err = IWL_TLV_ITER_TRUNCATED;
+		return false;
+	}
+
+	padded = LNX_ALIGN((size_t)it->len, 4);
+	if (padded > avail)
+		padded = avail;
+
+	it->pos += sizeof(*tlv) + padded;
+	it->left -= sizeof(*tlv) + padded;
+	return true;
+}
+
+/* image a section TLV belongs to, or -1 for anything else */
+static inline int iwl_tlv_sec_image(u32 type)
+{
+	switch (type) {
+	case IWL_UCODE_TLV_SEC_RT:
+	case IWL_UCODE_TLV_SECURE_SEC_RT:
+		return IWL_UCODE_REGULAR;
+	case IWL_UCODE_TLV_SEC_INIT:
+	case IWL_UCODE_TLV_SECURE_SEC_INIT:
+		return IWL_UCODE_INIT;
+	case IWL_UCODE_TLV_SEC_WOWLAN:
+	case IWL_UCODE_TLV_SECURE_SEC_WOWLAN:
+		return IWL_UCODE_WOWLAN;
+	case IWL_UCODE_TLV_SEC_RT_USNIFFER:
+		return IWL_UCODE_REGULAR_USNIFFER;
+	default:
+		return -1;
+	}
+}
+
+/*
+ * Validate a whole TLV stream before any of it is parsed and count the
+ * sections of every image, so that the caller can size its section tables
+ * once instead of growing them TLV by TLV.
+ */
+static inline enum iwl_tlv_iter_err
+iwl_tlv_count_secs(const u8 *data, size_t len, int n_secs[IWL_UCODE_TYPE_MAX])
+{
+	struct iwl_tlv_iter it;
+	int i;
+
+	for (i = 0; i < IWL_UCODE_TYPE_MAX; i++)
+		n_secs[i] = 0;
+
+	iwl_tlv_iter_init(&it, data, len);
+	while (iwl_tlv_iter_next(&it)) {
+		int img = iwl_tlv_sec_image(it.type);
+
+		if (img < 0)
+			continue;
+
+		if (it.len < sizeof(__le32))
+			return IWL_TLV_ITER_BAD_SECTION;
+
+		n_secs[img]++;
+	}
+
+	return it.err;
+}
+
+#endif /* __iwl_fw_tlv_iter_h__ */
@@ -0,0 +1,64 @@
+//
+//  iwl-cmd-table.h
+//  IntelWifi
+//
+//  Command names of the op modes and the flat per command ID tables the
+//  transport builds from them, see iwl_trans_init_cmd_tables(). It only
+//  depends on the command ID layout, so it is also checked on the host by
+//  checks/cmd-table.c.
+//
+
+#ifndef __iwl_cmd_table_h__
+#define __iwl_cmd_table_h__
+
+#include <linux/types.h>
+
+#include "fw/api/cmdhdr.h"
+
+struct iwl_hcmd_names {
+	u8 cmd_id;
+	const char *const cmd_name;
+};
+
+#define HCMD_NAME(x)	\
+	{ .cmd_id = x, .cmd_name = #x }
+
+struct iwl_hcmd_arr {
+	const struct iwl_hcmd_names *arr;
+	int size;
+};
+
+#define HCMD_ARR(x)	\
+	{ .arr = x, .size = ARRAY_SIZE(x) }
+
+/* a slot for every opcode of every group, the version doesn't matter */
+static inline u32 iwl_cmd_table_size(int n_groups)
+{
+	return (u32)(n_groups > 1 ? n_groups : 1) << 8;
+}
+
+/* slot of a command ID in a table of @size slots, -1 if it has none */
+static inline int iwl_cmd_table_slot(u32 size, u32 id)
+{
+	u32 idx = ((u32)iwl_cmd_groupid(id) << 8) | iwl_cmd_opcode(id);
+
+	return idx < size ? (int)idx : -1;
+}
+
+/* point the slots of @names, iwl_cmd_table_size() of them, at the group names */
+static inline void iwl_cmd_table_fill_names(const struct iwl_hcmd_arr *groups,
+					    int n_groups, const char **names)
+{
+	int i, j;
+
+	for (i = 0; i < n_groups; i++) {
+		const struct iwl_hcmd_arr *arr = &groups[i];
+
+		if (!arr->arr)
+			continue;
+		for (j = 0; j < arr->size; j++)
+			names[(i << 8) | arr->arr[j].cmd_id] = arr->arr[j].cmd_name;
+	}
+}
+
+#endif /* __iwl_cmd_table_h__ */
@@ -0,0 +1,87 @@
+//
+//  iwl-devtrace.c
+//  IntelWifi
+//
+
+#include "iwl-devtrace.h"
+#include "../iw_utils/allocation.h"
+
+struct iwl_trace_ring iwl_trace_ring;
+
+int iwl_trace_init(void)
+{
+    struct iwl_trace_rec *recs;
+    
+    if (iwl_trace_ring.recs)
+        return 0;
+    
+    recs = iwh_zalloc(IWL_TRACE_RECS * sizeof(*recs));
+    if (!recs)
+        return -ENOMEM;
+    
+    iwl_trace_ring.head = 0;
+    OSMemoryBarrier();
+    iwl_trace_ring.recs = recs;
+    
+    return 0;
+}
+
+void iwl_trace_free(void)
+{
+    struct iwl_trace_rec *recs = iwl_trace_ring.recs;
+    
+    iwl_trace_ring.recs = NULL;
+    OSMemoryBarrier();
+    iwh_free(recs);
+}
+
+/*
+ * Copy up to @max records starting at position @pos to @out, oldest first,
+ * and advance @pos past them. Records that were overwritten before they
+ * could be read, either before @pos was reached or while copying, are
+ * counted in @lost. Stops at a record that is still being written.
+ * Returns the number of records copied.
+ */
+u32 iwl_trace_read(u64 *pos, struct iwl_trace_rec *out, u32 max, u32 *lost)
+{
+    struct iwl_trace_rec *recs = iwl_trace_ring.recs;
+    u64 head, first, p;
+    u32 n = 0;
+    
+    *lost = 0;
+    if (!recs)
+        return 0;
+    
+    head = (u64)iwl_trace_ring.head;
+    first = head > IWL_TRACE_RECS ? head - IWL_TRACE_RECS : 0;
+    if (*pos > head)
+        *pos = head;
+    if (*pos < first) {
+        *lost = (u32)(first - *pos);
+        *pos = first;
+    }
+    
+    for (p = *pos; p < head && n < max; p++) {
+        struct iwl_trace_rec *rec = &recs[p & (IWL_TRACE_RECS - 1)];
+        u32 seq = rec->seq, want = iwl_trace_seq(p);
+        
+        OSMemoryBarrier();
+        out[n] = *rec;
+        OSMemoryBarrier();
+        
+        /* the writer holding this position hasn't finished, retry next time */
+        if (!seq || (s32)(seq - want) < 0)
+            break;
+        
+        /* already reused for a newer event */
+        if (seq != want || rec->seq != seq) {
+            (*lost)++;
+            continue;
+        }
+        
+        n++;
+    }
+    *pos = p;
+    
+    return n;
+}
@@ -0,0 +1,77 @@
+//
+//  iwl-devtrace.h
+//  IntelWifi
+//
+//  The trace_iwlwifi_dev_* tracepoints of the Linux driver, backed by a
+//  ring of fixed size binary records instead of ftrace. Recording an event
+//  is an atomic increment and a few stores, nothing is formatted, so the
+//  trace stays on in release builds. iwmc reads the ring through the user
+//  client and renders it.
+//
+
+#ifndef __iwl_devtrace_h__
+#define __iwl_devtrace_h__
+
+#include <linux/types.h>
+#include <libkern/OSAtomic.h>
+#include <kern/clock.h>
+
+#include "trace_shared.h"
+
+/* number of records, must be a power of 2 */
+#define IWL_TRACE_RECS  4096
+
+struct iwl_trace_ring {
+    volatile SInt64 head;   /* position of the next record */
+    struct iwl_trace_rec *recs;
+};
+
+extern struct iwl_trace_ring iwl_trace_ring;
+
+int iwl_trace_init(void);
+void iwl_trace_free(void);
+u32 iwl_trace_read(u64 *pos, struct iwl_trace_rec *out, u32 max, u32 *lost);
+
+/* @seq of the record at @pos, 0 is kept for a record being written */
+static inline u32 iwl_trace_seq(u64 pos)
+{
+    u32 seq = (u32)(pos + 1);
+    
+    return seq ? seq : 1;
+}
+
+static inline void iwl_trace(u16 event, u32 a0, u32 a1, u32 a2, u32 a3)
+{
+    struct iwl_trace_rec *rec;
+    u64 pos;
+    
+    if (!iwl_trace_ring.recs)
+        return;
+    
+    pos = (u64)OSIncrementAtomic64(&iwl_trace_ring.head);
+    rec = &iwl_trace_ring.recs[pos & (IWL_TRACE_RECS - 1)];
+    
+    rec->seq = 0;
+    OSMemoryBarrier();
+    rec->ts = mach_absolute_time();
+    rec->event = event;
+    rec->args[0] = a0;
+    rec->args[1] = a1;
+    rec->args[2] = a2;
+    rec->args[3] = a3;
+    OSMemoryBarrier();
+    rec->seq = iwl_trace_seq(pos);
+}
+
+#define IWL_TRACE_CMD_ID(hdr) (((u32)(hdr)->group_id << 8) | (hdr)->cmd)
+
+/* the Linux tracepoints that map onto records, the device argument isn't used */
+#define trace_iwlwifi_dev_ict_read(dev, index, value) \
+    iwl_trace(IWL_TRACE_ICT_READ, index, value, 0, 0)
+#define trace_iwlwifi_dev_rx(dev, trans, pkt, len) \
+    iwl_trace(IWL_TRACE_RX, (le32_to_cpu((pkt)->len_n_flags) & FH_RSCSR_RXQ_MASK) >> FH_RSCSR_RXQ_POS, \
+              IWL_TRACE_CMD_ID(&(pkt)->hdr), le16_to_cpu((pkt)->hdr.sequence), len)
+#define trace_iwlwifi_dev_hcmd(dev, cmd, len, hdr) \
+    iwl_trace(IWL_TRACE_HCMD, IWL_TRACE_CMD_ID(hdr), le16_to_cpu((hdr)->sequence), len, (cmd)->flags)
+
+#endif /* __iwl_devtrace_h__ */
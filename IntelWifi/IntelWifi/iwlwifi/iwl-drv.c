@@ -75,7 +75,9 @@
 
 #include "iwl-config.h"
 #include "iwl-modparams.h"
+#include "fw/tlv-iter.h"
 #include <os/log.h>
+#include <libkern/OSAtomic.h>
 
 struct firmware {
     size_t size;
@@ -132,10 +134,38 @@ struct fw_sec {
 	u32 offset;			/* offset of writing in the device */
 };
 
+static struct iwl_fw_blob *iwl_fw_blob_alloc(const void *data, size_t size)
+{
+    struct iwl_fw_blob *blob = iwh_malloc(sizeof(*blob) + size);
+
+    if (!blob)
+        return NULL;
+
+    blob->refcount = 1;
+    blob->size = size;
+    memcpy(blob->data, data, size);
+    return blob;
+}
+
+static void iwl_fw_blob_get(struct iwl_fw_blob *blob)
+{
+    OSIncrementAtomic(&blob->refcount);
+}
+
+static void iwl_fw_blob_put(struct iwl_fw_blob *blob)
+{
+    if (OSDecrementAtomic(&blob->refcount) == 1)
+        iwh_free(blob);
+}
+
 static void iwl_free_fw_desc(struct iwl_drv *drv, struct fw_desc *desc)
 {
-    iwh_free(desc->data);
+    if (desc->blob)
+        iwl_fw_blob_put(desc->blob);
+    else
+        iwh_free(desc->data);
 	desc->data = NULL;
+	desc->blob = NULL;
 	desc->len = 0;
 }
 
@@ -147,60 +177,170 @@ static void iwl_free_fw_img(struct iwl_drv *drv, struct fw_img *img)
     iwh_free(img->sec);
 }
 
-static void iwl_dealloc_ucode(struct iwl_drv *drv)
+static void iwl_dealloc_fw(struct iwl_fw *fw)
 {
 	int i;
 
-    iwh_free(drv->fw.dbg_dest_tlv);
-    for (i = 0; i < ARRAY_SIZE(drv->fw.dbg_conf_tlv); i++){
-        iwh_free(drv->fw.dbg_conf_tlv[i]);
+    iwh_free(fw->dbg_dest_tlv);
+    for (i = 0; i < ARRAY_SIZE(fw->dbg_conf_tlv); i++){
+        iwh_free(fw->dbg_conf_tlv[i]);
     }
 		
-    for (i = 0; i < ARRAY_SIZE(drv->fw.dbg_trigger_tlv); i++){
-        iwh_free(drv->fw.dbg_trigger_tlv[i]);
+    for (i = 0; i < ARRAY_SIZE(fw->dbg_trigger_tlv); i++){
+        iwh_free(fw->dbg_trigger_tlv[i]);
     }
 
-    iwh_free(drv->fw.dbg_mem_tlv);
+    iwh_free(fw->dbg_mem_tlv);
 
 	for (i = 0; i < IWL_UCODE_TYPE_MAX; i++)
-		iwl_free_fw_img(drv, drv->fw.img + i);
+		iwl_free_fw_img(NULL, fw->img + i);
 }
 
-static int iwl_alloc_fw_desc(struct iwl_drv *drv, struct fw_desc *desc,
-			     struct fw_sec *sec)
+static void iwl_dealloc_ucode(struct iwl_drv *drv)
+{
+    iwl_dealloc_fw(&drv->fw);
+}
+
+/*
+ * Parsed firmware cache.
+ *
+ * When a device goes away its parsed &struct iwl_fw is parked here instead
+ * of being freed, and the next start for the same firmware name takes it
+ * back without requesting or parsing the file again. The image is a kext
+ * resource, so it can't change while the kext is loaded; @hash is kept to
+ * identify the image in the logs. A single entry is enough, there is one
+ * device per machine.
+ */
+struct iwl_fw_cache_entry {
+    const char *fw_pre_name;
+    char firmware_name[64];
+    int fw_index;
+    struct iwl_fw fw;
+};
+
+static struct iwl_fw_cache_entry * volatile iwl_fw_cache;
+
+static bool iwl_fw_cache_take(struct iwl_drv *drv, const char *fw_pre_name)
 {
-	void *data;
+    const struct iwl_cfg *cfg = drv->trans->cfg;
+    struct iwl_fw_cache_entry *entry = iwl_fw_cache;
+
+    if (!entry || !OSCompareAndSwapPtr(entry, NULL, (void * volatile *)&iwl_fw_cache))
+        return false;
+
+    if (strcmp(entry->fw_pre_name, fw_pre_name) ||
+        entry->fw_index < cfg->ucode_api_min ||
+        entry->fw_index > cfg->ucode_api_max) {
+        IWL_DEBUG_INFO(drv, "Cached firmware '%s' doesn't fit, dropping it\n",
+                       entry->firmware_name);
+        iwl_dealloc_fw(&entry->fw);
+        iwh_free(entry);
+        return false;
+    }
+
+    drv->fw = entry->fw;
+    drv->fw_index = entry->fw_index;
+    strlcpy(drv->firmware_name, entry->firmware_name, sizeof(drv->firmware_name));
+    iwh_free(entry);
 
+    IWL_INFO(drv, "using cached firmware '%s'\n", drv->firmware_name);
+    return true;
+}
+
+static bool iwl_fw_cache_put(struct iwl_drv *drv)
+{
+    struct iwl_fw_cache_entry *entry;
+
+    /* firmware loading failed, nothing worth keeping */
+    if (!drv->fw_pre_name || !drv->fw.img[IWL_UCODE_REGULAR].sec)
+        return false;
+
+    entry = iwh_zalloc(sizeof(*entry));
+    if (!entry)
+        return false;
+
+    entry->fw_pre_name = drv->fw_pre_name;
+    strlcpy(entry->firmware_name, drv->firmware_name, sizeof(entry->firmware_name));
+    entry->fw_index = drv->fw_index;
+    entry->fw = drv->fw;
+
+    if (!OSCompareAndSwapPtr(NULL, entry, (void * volatile *)&iwl_fw_cache)) {
+        iwh_free(entry);
+        return false;
+    }
+
+    memset(&drv->fw, 0, sizeof(drv->fw));
+    return true;
+}
+
+void iwl_drv_fw_cache_flush(void)
+{
+    struct iwl_fw_cache_entry *entry = iwl_fw_cache;
+
+    if (!entry || !OSCompareAndSwapPtr(entry, NULL, (void * volatile *)&iwl_fw_cache))
+        return;
+
+    iwl_dealloc_fw(&entry->fw);
+    iwh_free(entry);
+}
+
+/*
+ * Sections are not copied out of the firmware file, the descriptor points
+ * into the retained blob and holds a reference on it.
+ */
+static int iwl_alloc_fw_desc(struct iwl_drv *drv, struct fw_desc *desc,
+			     struct fw_sec *sec, struct iwl_fw_blob *blob)
+{
 	desc->data = NULL;
+	desc->blob = NULL;
 
 	if (!sec || !sec->size)
 		return -EINVAL;
 
-    data = iwh_malloc(sec->size);
-	if (!data)
-		return -ENOMEM;
+	if (WARN_ON((const u8 *)sec->data < blob->data ||
+		    (const u8 *)sec->data + sec->size > blob->data + blob->size))
+		return -EINVAL;
 
+	iwl_fw_blob_get(blob);
+	desc->blob = blob;
 	desc->len = sec->size;
 	desc->offset = sec->offset;
-	memcpy(data, sec->data, desc->len);
-	desc->data = data;
+	desc->data = (void *)sec->data;
 
 	return 0;
 }
 
 static void iwl_req_fw_callback(const struct firmware *ucode_raw, void *context);
+static void iwl_req_fw_done(struct iwl_drv *drv);
 
 static void firmwareLoadComplete(OSKextRequestTag requestTag, OSReturn result,
                                  const void *resourceData,
                                  uint32_t resourceDataLength,
                                  void *context) {
     
-    struct firmware* fw = (struct firmware *)iwh_malloc(sizeof(struct firmware));
-    fw->size = resourceDataLength;
-    fw->data = iwh_malloc(fw->size);
-    memcpy((void*)fw->data, resourceData, fw->size);
+    struct firmware fw;
+    struct iwl_fw_blob *blob = NULL;
+    
+    /*
+     * resourceData is only valid during this callback, so this is the one
+     * copy of the file that is made. Sections reference it from now on.
+     */
+    if (result == kOSReturnSuccess && resourceData)
+        blob = iwl_fw_blob_alloc(resourceData, resourceDataLength);
+    
+    if (!blob) {
+        iwl_req_fw_callback(NULL, context);
+        return;
+    }
+    
+    fw.size = blob->size;
+    fw.data = blob->data;
+    fw.priv = blob;
+    
+    iwl_req_fw_callback(&fw, context);
     
-    iwl_req_fw_callback(fw, context);
+    /* drop the loader's reference, the parsed sections keep their own */
+    iwl_fw_blob_put(blob);
 }
 
 static int iwl_request_firmware(struct iwl_drv *drv, bool first)
@@ -221,6 +361,13 @@ static int iwl_request_firmware(struct iwl_drv *drv, bool first)
 		fw_pre_name = cfg->fw_name_pre;
 
 	if (first) {
+		drv->fw_pre_name = fw_pre_name;
+		if (iwl_fw_cache_take(drv, fw_pre_name)) {
+			/* parsed already, pick up where iwl_req_fw_callback() would */
+			iwl_req_fw_done(drv);
+			return kIOReturnSuccess;
+		}
+
 		drv->fw_index = cfg->ucode_api_max;
 		snprintf(tag, 8, "%d", drv->fw_index);
 	} else {
@@ -272,6 +419,7 @@ static int iwl_request_firmware(struct iwl_drv *drv, bool first)
 struct fw_img_parsing {
 	struct fw_sec *sec;
 	int sec_counter;
+	int sec_capacity;
 };
 
 /*
@@ -307,6 +455,9 @@ struct iwl_firmware_pieces {
 	size_t dbg_trigger_tlv_len[FW_DBG_TRIGGER_MAX];
 	struct iwl_fw_dbg_mem_seg_tlv *dbg_mem_tlv;
 	size_t n_dbg_mem_tlv;
+
+	/* the firmware file the sections point into */
+	struct iwl_fw_blob *blob;
 };
 
 /*
@@ -320,28 +471,49 @@ static struct fw_sec *get_sec(struct iwl_firmware_pieces *pieces,
 	return &pieces->img[type].sec[sec];
 }
 
+/*
+ * Make room for n sections of an image. The TLV parser reserves the exact
+ * number up front, so the table only has to grow for v1/v2 files.
+ */
+static int reserve_sec_data(struct iwl_firmware_pieces *pieces,
+			    enum iwl_ucode_type type,
+			    int n)
+{
+    struct fw_img_parsing *img = &pieces->img[type];
+    struct fw_sec *sec_memory;
+
+    if (n <= img->sec_capacity)
+        return 0;
+
+    sec_memory = iwh_zalloc(sizeof(struct fw_sec) * n);
+    if (!sec_memory)
+        return -ENOMEM;
+
+    if (img->sec) {
+        memcpy(sec_memory, img->sec, sizeof(struct fw_sec) * img->sec_counter);
+        iwh_free(img->sec);
+    }
+
+    img->sec = sec_memory;
+    img->sec_capacity = n;
+    return 0;
+}
+
 static void alloc_sec_data(struct iwl_firmware_pieces *pieces,
 			   enum iwl_ucode_type type,
 			   int sec)
 {
     struct fw_img_parsing *img = &pieces->img[type];
     int size = sec + 1;
-    size_t alloc_size = sizeof(struct fw_sec) * size;
 
-    if (img->sec && img->sec_counter >= size)
+    if (img->sec_counter >= size)
         return;
 
-    struct fw_sec *sec_memory = iwh_malloc(alloc_size);
-
-    if (!sec_memory) {
+    if (reserve_sec_data(pieces, type, size)) {
         IOLog("ALLOC FAILED!!!!");
         return;
     }
-    
-    if (img->sec && img->sec_counter > 0)
-        memcpy(sec_memory, img->sec, sec * sizeof(struct fw_sec));
 
-    img->sec = sec_memory;
     img->sec_counter = size;
 }
 
@@ -441,22 +613,20 @@ static int iwl_store_ucode_sec(struct iwl_firmware_pieces *pieces,
 	struct fw_img_parsing *img;
 	struct fw_sec *sec;
 	struct fw_sec_parsing *sec_parse;
-	size_t alloc_size;
 
 	if (WARN_ON(!pieces || !data || type >= IWL_UCODE_TYPE_MAX))
 		return -1;
 
+	if (size < (int)sizeof(sec_parse->offset))
+		return -EINVAL;
+
 	sec_parse = (struct fw_sec_parsing *)data;
 
 	img = &pieces->img[type];
 
-    alloc_size = sizeof(*img->sec) * (img->sec_counter + 1);
-    sec = iwh_malloc(alloc_size);
-    memcpy(sec, img->sec, sizeof(*img->sec) * img->sec_counter);
-
-    if (!sec)
-        return -ENOMEM;
-    img->sec = sec;
+	/* normally reserved by iwl_parse_tlv_firmware() already */
+	if (reserve_sec_data(pieces, type, img->sec_counter + 1))
+		return -ENOMEM;
 
 	sec = &img->sec[img->sec_counter];
 
@@ -635,9 +805,12 @@ static int iwl_parse_tlv_firmware(struct iwl_drv *drv,
 				bool *usniffer_images)
 {
 	struct iwl_tlv_ucode_header *ucode = (void *)ucode_raw->data;
-	struct iwl_ucode_tlv *tlv;
+	struct iwl_tlv_iter iter;
+	enum iwl_tlv_iter_err iter_err;
+	int n_secs[IWL_UCODE_TYPE_MAX];
 	size_t len = ucode_raw->size;
 	const u8 *data;
+	int i;
 	u32 tlv_len;
 	u32 usniffer_img;
 	enum iwl_ucode_tlv_type tlv_type;
@@ -682,21 +855,23 @@ static int iwl_parse_tlv_firmware(struct iwl_drv *drv,
 
 	len -= sizeof(*ucode);
 
-	while (len >= sizeof(*tlv)) {
-		len -= sizeof(*tlv);
-		tlv = (void *)data;
+	/* reject a malformed file before anything is parsed out of it */
+	iter_err = iwl_tlv_count_secs(data, len, n_secs);
+	if (iter_err != IWL_TLV_ITER_OK) {
+		IWL_ERR(drv, "invalid TLV stream (error %d)\n", iter_err);
+		return -EINVAL;
+	}
 
-		tlv_len = le32_to_cpu(tlv->length);
-		tlv_type = le32_to_cpu(tlv->type);
-		tlv_data = tlv->data;
+	for (i = 0; i < IWL_UCODE_TYPE_MAX; i++) {
+		if (reserve_sec_data(pieces, i, n_secs[i]))
+			return -ENOMEM;
+	}
 
-		if (len < tlv_len) {
-			IWL_ERR(drv, "invalid TLV len: %zd/%u\n",
-				len, tlv_len);
-			return -EINVAL;
-		}
-		len -= LNX_ALIGN(tlv_len, 4);
-		data += sizeof(*tlv) + LNX_ALIGN(tlv_len, 4);
+	iwl_tlv_iter_init(&iter, data, len);
+	while (iwl_tlv_iter_next(&iter)) {
+		tlv_len = iter.len;
+		tlv_type = iter.type;
+		tlv_data = iter.data;
 
 		switch (tlv_type) {
 		case IWL_UCODE_TLV_INST:
@@ -1116,9 +1291,9 @@ static int iwl_parse_tlv_firmware(struct iwl_drv *drv,
 		return -EINVAL;
 	}
 
-	if (len) {
-		IWL_ERR(drv, "invalid TLV after parsing: %zd\n", len);
-//        iwl_print_hex_dump(drv, IWL_DL_FW, (u8 *)data, len);
+	if (iter.err != IWL_TLV_ITER_OK) {
+		IWL_ERR(drv, "invalid TLV after parsing: %zd\n", iter.left);
+//        iwl_print_hex_dump(drv, IWL_DL_FW, iter.pos, iter.left);
 		return -EINVAL;
 	}
 
@@ -1161,7 +1336,7 @@ static int iwl_alloc_ucode(struct iwl_drv *drv,
 	drv->fw.img[type].num_sec = pieces->img[type].sec_counter;
 
     for (i = 0; i < pieces->img[type].sec_counter; i++) {
-        if (iwl_alloc_fw_desc(drv, &sec[i], get_sec(pieces, type, i))) {
+        if (iwl_alloc_fw_desc(drv, &sec[i], get_sec(pieces, type, i), pieces->blob)) {
             IOLog("alloc fw_desc fail");
             return -ENOMEM;
         }
@@ -1262,7 +1437,6 @@ static void iwl_req_fw_callback(const struct firmware *ucode_raw, void *context)
 	struct iwl_drv *drv = context;
 	struct iwl_fw *fw = &drv->fw;
 	struct iwl_ucode_header *ucode;
-	struct iwlwifi_opmode_table *op;
 	int err;
 	struct iwl_firmware_pieces *pieces;
 	const unsigned int api_max = drv->trans->cfg->ucode_api_max;
@@ -1270,7 +1444,6 @@ static void iwl_req_fw_callback(const struct firmware *ucode_raw, void *context)
 	size_t trigger_tlv_sz[FW_DBG_TRIGGER_MAX];
 	u32 api_ver;
 	int i;
-	bool load_module = false;
 	bool usniffer_images = false;
 
 	fw->ucode_capa.max_probe_length = IWL_DEFAULT_MAX_PROBE_LENGTH;
@@ -1284,6 +1457,8 @@ static void iwl_req_fw_callback(const struct firmware *ucode_raw, void *context)
 
     if (!ucode_raw)
         goto try_again;
+    
+    pieces->blob = ucode_raw->priv;
 
     IWL_DEBUG_INFO(drv, "Loaded firmware file '%s' (%zd bytes).\n",
                    drv->firmware_name, ucode_raw->size);
@@ -1424,10 +1599,49 @@ static void iwl_req_fw_callback(const struct firmware *ucode_raw, void *context)
     if (fw->ucode_capa.standard_phy_calibration_size > IWL_MAX_PHY_CALIBRATE_TBL_SIZE)
         fw->ucode_capa.standard_phy_calibration_size = IWL_MAX_STANDARD_PHY_CALIBRATE_TBL_SIZE;
 
-    /* We have our copies now, allow OS release its copies */
+    /* The sections hold references on the file now, the loader drops its own */
     //release_firmware(ucode_raw);
     //iwh_free(ucode_raw);
 
+    iwl_req_fw_done(drv);
+	goto free;
+
+ try_again:
+	/* try next, if any */
+    
+//    release_firmware(ucode_raw);
+//    iwh_free(ucode_raw);
+//    if (iwl_request_firmware(drv, false))
+//        goto out_unbind;
+	goto free;
+
+ out_free_fw:
+    IOLog("out_free_fw");
+    iwl_dealloc_ucode(drv);
+	//release_firmware(ucode_raw);
+//    iwh_free(ucode_raw);
+ free:
+	if (pieces) {
+        for (i = 0; i < ARRAY_SIZE(pieces->img); i++) {
+            iwh_free(pieces->img[i].sec);
+        }
+			
+        iwh_free(pieces->dbg_mem_tlv);
+        iwh_free(pieces);
+	}
+}
+
+/*
+ * The part of iwl_req_fw_callback() after the firmware is parsed, also run
+ * when iwl_request_firmware() takes it from the cache: start the op mode
+ * and let the request complete.
+ */
+static void iwl_req_fw_done(struct iwl_drv *drv)
+{
+    struct iwl_fw *fw = &drv->fw;
+    struct iwlwifi_opmode_table *op;
+    bool load_module = false;
+
     IOLockLock(iwlwifi_opmode_table_mtx);
     
     switch (fw->type) {
@@ -1453,7 +1667,9 @@ static void iwl_req_fw_callback(const struct firmware *ucode_raw, void *context)
 
         if (!drv->op_mode) {
             IOLockUnlock(iwlwifi_opmode_table_mtx);
-            goto out_unbind;
+            //complete(&drv->request_firmware_complete);
+            //device_release_driver(drv->trans->dev);
+            return;
         }
     } else {
         load_module = true;
@@ -1480,40 +1696,14 @@ static void iwl_req_fw_callback(const struct firmware *ucode_raw, void *context)
         IOLog("Try to load MODULE %s",op->name);
 		//request_module("%s", op->name);
 #ifdef CONFIG_IWLWIFI_OPMODE_MODULAR
+        int err = 0;
+
         if (err)
             IWL_ERR(drv,
                 "failed to load module %s (error %d), is dynamic loading enabled?\n",
                 op->name, err);
 #endif
 	}
-	goto free;
-
- try_again:
-	/* try next, if any */
-    
-//    release_firmware(ucode_raw);
-//    iwh_free(ucode_raw);
-//    if (iwl_request_firmware(drv, false))
-//        goto out_unbind;
-	goto free;
-
- out_free_fw:
-    IOLog("out_free_fw");
-    iwl_dealloc_ucode(drv);
-	//release_firmware(ucode_raw);
-//    iwh_free(ucode_raw);
- out_unbind:
-	//complete(&drv->request_firmware_complete);
-	//device_release_driver(drv->trans->dev);
- free:
-	if (pieces) {
-        for (i = 0; i < ARRAY_SIZE(pieces->img); i++) {
-            iwh_free(pieces->img[i].sec);
-        }
-			
-        iwh_free(pieces->dbg_mem_tlv);
-        iwh_free(pieces);
-	}
 }
 
 struct iwl_drv *iwl_drv_start(struct iwl_trans *trans)
@@ -1594,7 +1784,8 @@ void iwl_drv_stop(struct iwl_drv *drv)
 
 	//_iwl_op_mode_stop(drv);
 
-	iwl_dealloc_ucode(drv);
+	if (!iwl_fw_cache_put(drv))
+		iwl_dealloc_ucode(drv);
 
     IOLockLock(iwlwifi_opmode_table_mtx);
 	/*
@@ -1628,7 +1819,9 @@ struct iwl_mod_params iwlwifi_mod_params = {
 	.d0i3_disable = true,
 	.d0i3_timeout = 1000,
 	.uapsd_disable = IWL_DISABLE_UAPSD_BSS | IWL_DISABLE_UAPSD_P2P_CLIENT,
+#ifdef CONFIG_IWLWIFI_DEBUG
     .debug_level = 0xFFFFFFFF,
+#endif
 	/* the rest are 0 by default */
 };
 IWL_EXPORT_SYMBOL(iwlwifi_mod_params);
@@ -1709,6 +1902,8 @@ static void __unused iwl_drv_exit(void)
 {
     IOLockFree(iwlwifi_opmode_table_mtx);
     
+    /* the firmware cache is freed by IntelWifi's FirmwareCacheReaper */
+    
 	iwl_pci_unregister_driver();
 
 #ifdef CONFIG_IWLWIFI_DEBUGFS
@@ -143,6 +143,7 @@ struct iwl_drv {
     
     int fw_index;                   /* firmware we're trying to load */
     char firmware_name[64];         /* name of firmware file to load */
+    const char *fw_pre_name;        /* firmware name without the API index */
     
     IOLock* request_firmware_complete;
     
@@ -179,6 +180,14 @@ struct iwl_drv *iwl_drv_start(struct iwl_trans *trans);
  */
 void iwl_drv_stop(struct iwl_drv *drv);
 
+/**
+ * iwl_drv_fw_cache_flush - free the parsed firmware kept by iwl_drv_stop()
+ *
+ * iwl_drv_stop() parks the parsed firmware so the next iwl_drv_start() can
+ * skip requesting and parsing it. Called once, when the kext is unloaded.
+ */
+void iwl_drv_fw_cache_flush(void);
+
 /*
  * exported symbol management
  *
@@ -652,6 +652,8 @@ struct iwl_rb_status {
 #define IWL_TX_DMA_MASK        DMA_BIT_MASK(36)
 #define IWL_NUM_OF_TBS		20
 #define IWL_TFH_NUM_TBS		25
+/* CUSTOM: the legacy TB length is the top 12 bits of hi_n_len */
+#define IWL_TFD_MAX_TB_LEN	0xFFF
 
 static inline u8 iwl_get_dma_hi_addr(dma_addr_t addr)
 {
@@ -0,0 +1,86 @@
+//
+//  iwl-lat.h
+//  IntelWifi
+//
+//  Recording side of the latency histograms in lat_shared.h. A sample is
+//  a couple of atomic adds, no lock is taken, so it may be recorded from
+//  any of the paths it measures. The stats hang off iwl_trans and may be
+//  missing, every helper takes NULL.
+//
+
+#ifndef __iwl_lat_h__
+#define __iwl_lat_h__
+
+#include <linux/types.h>
+#include <libkern/OSAtomic.h>
+#include <kern/clock.h>
+
+#include "lat_shared.h"
+
+static inline void iwl_lat_init(struct iwl_lat_stats *lat)
+{
+    int i;
+
+    for (i = 0; i < IWL_LAT_NUM; i++)
+        lat->fixed[i].id = i;
+    lat->hcmd[IWL_LAT_HCMD_SLOTS - 1].id = IWL_LAT_HCMD_OTHER;
+}
+
+/* drop the samples, the host command slots keep their IDs */
+static inline void iwl_lat_reset(struct iwl_lat_stats *lat)
+{
+    int i;
+
+    for (i = 0; i < IWL_LAT_NUM; i++)
+        bzero(&lat->fixed[i].count, sizeof(lat->fixed[i]) - offsetof(struct iwl_lat_hist, count));
+    for (i = 0; i < IWL_LAT_HCMD_SLOTS; i++)
+        bzero(&lat->hcmd[i].count, sizeof(lat->hcmd[i]) - offsetof(struct iwl_lat_hist, count));
+}
+
+/* record the time from @start, a mach_absolute_time() stamp, until now */
+static inline void iwl_lat_hist_record(struct iwl_lat_hist *h, u64 start)
+{
+    u64 ns, max;
+
+    absolutetime_to_nanoseconds(mach_absolute_time() - start, &ns);
+
+    OSIncrementAtomic((volatile SInt32 *)&h->buckets[iwl_lat_bucket(ns)]);
+    OSIncrementAtomic64((volatile SInt64 *)&h->count);
+    OSAddAtomic64(ns, (volatile SInt64 *)&h->sum);
+    do {
+        max = h->max;
+    } while (ns > max && !OSCompareAndSwap64(max, ns, (volatile UInt64 *)&h->max));
+}
+
+static inline void iwl_lat_record(struct iwl_lat_stats *lat, enum iwl_lat_id id, u64 start)
+{
+    if (lat && start)
+        iwl_lat_hist_record(&lat->fixed[id], start);
+}
+
+/*
+ * Host commands get a slot per command ID, the first time the ID shows
+ * up. Once the slots run out the rest share the last one.
+ */
+static inline void iwl_lat_record_hcmd(struct iwl_lat_stats *lat, u32 cmd_id, u64 start)
+{
+    u32 id = cmd_id | IWL_LAT_HCMD_USED;
+    int i;
+
+    if (!lat || !start)
+        return;
+
+    for (i = 0; i < IWL_LAT_HCMD_SLOTS - 1; i++) {
+        struct iwl_lat_hist *h = &lat->hcmd[i];
+
+        /* whoever loses the race for a free slot looks at what won it */
+        if (!h->id)
+            OSCompareAndSwap(0, id, (volatile UInt32 *)&h->id);
+        if (h->id == id)
+            break;
+    }
+
+    iwl_lat_hist_record(&lat->hcmd[i], start);
+}
+
+#endif /* __iwl_lat_h__ */
@@ -124,6 +124,14 @@ enum iwl_uapsd_disable {
  * @lar_disable: disable LAR (regulatory), default = 0
  * @fw_monitor: allow to use firmware monitor
  * @disable_11ac: disable VHT capabilities, default = false.
+ * @rx_budget: RBs an RX queue handles per pass, the queue is restocked
+ *	between passes, default = 0 (IWL_RX_POLL_BUDGET)
+ * @fw_load_plan: 8000 family and up, stream the sections of both CPUs back
+ *	to back through the load buffers, still one chunk at a time,
+ *	default = false
+ * @rx_inline: drain the RX queues on the interrupt workloop even when there
+ *	are several, with a single queue there is no worker anyway,
+ *	default = false
  */
 struct iwl_mod_params {
 	int swcrypto;
@@ -145,6 +153,9 @@ struct iwl_mod_params {
 	bool lar_disable;
 	bool fw_monitor;
 	bool disable_11ac;
+	unsigned int rx_budget;
+	bool fw_load_plan;
+	bool rx_inline;
 };
 
 #endif /* #__iwl_modparams_h__ */
@@ -193,7 +193,7 @@ void iwl_phy_db_free(struct iwl_phy_db *phy_db)
         iwl_phy_db_free_section(phy_db, IWL_PHY_DB_CALIB_CHG_TXP, i);
     iwh_free(phy_db->calib_ch_group_txp);
     
-    mbuf_free(phy_db);
+    iwh_free(phy_db);
 }
 IWL_EXPORT_SYMBOL(iwl_phy_db_free);
 
@@ -217,7 +217,7 @@ int iwl_phy_db_set_section(struct iwl_phy_db *phy_db,
              * Firmware sends the largest index first, so we can use
              * it to know how much we should allocate.
              */
-            phy_db->calib_ch_group_papd = iwh_malloc(sizeof(struct iwl_phy_db_entry) * (chg_id + 1));
+            phy_db->calib_ch_group_papd = iwh_zalloc(sizeof(struct iwl_phy_db_entry) * (chg_id + 1));
             
             if (!phy_db->calib_ch_group_papd)
                 return -ENOMEM;
@@ -230,7 +230,7 @@ int iwl_phy_db_set_section(struct iwl_phy_db *phy_db,
              * Firmware sends the largest index first, so we can use
              * it to know how much we should allocate.
              */
-            phy_db->calib_ch_group_txp = iwh_malloc(sizeof(struct iwl_phy_db_entry) * (chg_id + 1));
+            phy_db->calib_ch_group_txp = iwh_zalloc(sizeof(struct iwl_phy_db_entry) * (chg_id + 1));
             
             if (!phy_db->calib_ch_group_txp)
                 return -ENOMEM;
@@ -243,11 +243,14 @@ int iwl_phy_db_set_section(struct iwl_phy_db *phy_db,
         return -EINVAL;
     
     iwh_free(entry->data);
+    /* the sections are sent NOCOPY later on, keep our own copy */
 //    entry->data =  kmemdup(phy_db_notif->data, size, GFP_ATOMIC);
-//    if (!entry->data) {
-//        entry->size = 0;
-//        return -ENOMEM;
-//    }
+    entry->data = iwh_malloc(size);
+    if (!entry->data) {
+        entry->size = 0;
+        return -ENOMEM;
+    }
+    memcpy(entry->data, phy_db_notif->data, size);
     
     entry->size = size;
     
@@ -375,8 +378,76 @@ static int iwl_send_phy_db_cmd(struct iwl_phy_db *phy_db, u16 type,
     return iwl_trans_send_cmd(phy_db->trans, &cmd);
 }
 
+/*
+ * CUSTOM
+ * The sections used to go out one SYNC command at a time, a full round trip
+ * each. They are now queued back to back with iwl_trans_send_cmd_start()
+ * and waited for together. At most IWL_PHY_DB_BATCH are in flight so that
+ * the command queue can't fill up. The payloads stay NOCOPY, pointing into
+ * the phy_db entries, which outlive the batch.
+ */
+struct iwl_phy_db_batch {
+    struct iwl_phy_db_cmd hdr[IWL_PHY_DB_BATCH];
+    struct iwl_host_cmd cmd[IWL_PHY_DB_BATCH];
+    struct iwl_host_cmd *cmds[IWL_PHY_DB_BATCH];
+    int n;
+};
+
+static int iwl_phy_db_batch_flush(struct iwl_phy_db *phy_db,
+                                  struct iwl_phy_db_batch *batch)
+{
+    int err = iwl_trans_wait_cmds(phy_db->trans, batch->cmds, batch->n);
+    
+    batch->n = 0;
+    return err;
+}
+
+static int iwl_phy_db_batch_add(struct iwl_phy_db *phy_db,
+                                struct iwl_phy_db_batch *batch,
+                                u16 type, u16 length, void *data)
+{
+    struct iwl_phy_db_cmd *phy_db_cmd;
+    struct iwl_host_cmd *cmd;
+    int err;
+    
+    if (batch->n == IWL_PHY_DB_BATCH) {
+        err = iwl_phy_db_batch_flush(phy_db, batch);
+        if (err)
+            return err;
+    }
+    
+    IWL_DEBUG_INFO(phy_db->trans,
+                   "Queueing PHY-DB hcmd of type %d, of length %d\n",
+                   type, length);
+    
+    phy_db_cmd = &batch->hdr[batch->n];
+    phy_db_cmd->type = cpu_to_le16(type);
+    phy_db_cmd->length = cpu_to_le16(length);
+    
+    cmd = &batch->cmd[batch->n];
+    memset(cmd, 0, sizeof(*cmd));
+    cmd->id = PHY_DB_CMD;
+    cmd->data[0] = phy_db_cmd;
+    cmd->len[0] = sizeof(struct iwl_phy_db_cmd);
+    cmd->data[1] = data;
+    cmd->len[1] = length;
+    cmd->dataflags[1] = IWL_HCMD_DFL_NOCOPY;
+    
+    err = iwl_trans_send_cmd_start(phy_db->trans, cmd);
+    
+    /* the transport can't pipeline SYNC commands, send it the old way */
+    if (err == -EOPNOTSUPP)
+        return iwl_send_phy_db_cmd(phy_db, type, length, data);
+    if (err)
+        return err;
+    
+    batch->cmds[batch->n++] = cmd;
+    return 0;
+}
+
 static int iwl_phy_db_send_all_channel_groups(
                                               struct iwl_phy_db *phy_db,
+                                              struct iwl_phy_db_batch *batch,
                                               enum iwl_phy_db_section_type type,
                                               u8 max_ch_groups)
 {
@@ -396,10 +467,10 @@ static int iwl_phy_db_send_all_channel_groups(
             continue;
         
         /* Send the requested PHY DB section */
-        err = iwl_send_phy_db_cmd(phy_db,
-                                  type,
-                                  entry->size,
-                                  entry->data);
+        err = iwl_phy_db_batch_add(phy_db, batch,
+                                   type,
+                                   entry->size,
+                                   entry->data);
         if (err) {
             IWL_ERR(phy_db->trans,
                     "Can't SEND phy_db section %d (%d), err %d\n",
@@ -408,22 +479,20 @@ static int iwl_phy_db_send_all_channel_groups(
         }
         
         IWL_DEBUG_INFO(phy_db->trans,
-                       "Sent PHY_DB HCMD, type = %d num = %d\n",
+                       "Queued PHY_DB HCMD, type = %d num = %d\n",
                        type, i);
     }
     
     return 0;
 }
 
-int iwl_send_phy_db_data(struct iwl_phy_db *phy_db)
+static int iwl_phy_db_queue_data(struct iwl_phy_db *phy_db,
+                                 struct iwl_phy_db_batch *batch)
 {
     u8 *data = NULL;
     u16 size = 0;
     int err;
     
-    IWL_DEBUG_INFO(phy_db->trans,
-                   "Sending phy db data and configuration to runtime image\n");
-    
     /* Send PHY DB CFG section */
     err = iwl_phy_db_get_section_data(phy_db, IWL_PHY_DB_CFG,
                                       &data, &size, 0);
@@ -432,7 +501,7 @@ int iwl_send_phy_db_data(struct iwl_phy_db *phy_db)
         return err;
     }
     
-    err = iwl_send_phy_db_cmd(phy_db, IWL_PHY_DB_CFG, size, data);
+    err = iwl_phy_db_batch_add(phy_db, batch, IWL_PHY_DB_CFG, size, data);
     if (err) {
         IWL_ERR(phy_db->trans,
                 "Cannot send HCMD of  Phy DB cfg section\n");
@@ -447,7 +516,7 @@ int iwl_send_phy_db_data(struct iwl_phy_db *phy_db)
         return err;
     }
     
-    err = iwl_send_phy_db_cmd(phy_db, IWL_PHY_DB_CALIB_NCH, size, data);
+    err = iwl_phy_db_batch_add(phy_db, batch, IWL_PHY_DB_CALIB_NCH, size, data);
     if (err) {
         IWL_ERR(phy_db->trans,
                 "Cannot send HCMD of Phy DB non specific channel section\n");
@@ -455,7 +524,7 @@ int iwl_send_phy_db_data(struct iwl_phy_db *phy_db)
     }
     
     /* Send all the TXP channel specific data */
-    err = iwl_phy_db_send_all_channel_groups(phy_db,
+    err = iwl_phy_db_send_all_channel_groups(phy_db, batch,
                                              IWL_PHY_DB_CALIB_CHG_PAPD,
                                              phy_db->n_group_papd);
     if (err) {
@@ -465,7 +534,7 @@ int iwl_send_phy_db_data(struct iwl_phy_db *phy_db)
     }
     
     /* Send all the TXP channel specific data */
-    err = iwl_phy_db_send_all_channel_groups(phy_db,
+    err = iwl_phy_db_send_all_channel_groups(phy_db, batch,
                                              IWL_PHY_DB_CALIB_CHG_TXP,
                                              phy_db->n_group_txp);
     if (err) {
@@ -474,8 +543,37 @@ int iwl_send_phy_db_data(struct iwl_phy_db *phy_db)
         return err;
     }
     
+    return 0;
+}
+
+int iwl_send_phy_db_data(struct iwl_phy_db *phy_db)
+{
+    struct iwl_phy_db_batch *batch;
+    int err, wait_err;
+    
+    IWL_DEBUG_INFO(phy_db->trans,
+                   "Sending phy db data and configuration to runtime image\n");
+    
+    batch = iwh_zalloc(sizeof(*batch));
+    if (!batch)
+        return -ENOMEM;
+    
+    err = iwl_phy_db_queue_data(phy_db, batch);
+    
+    /* whatever made it to the queue has to be waited for, even on error */
+    wait_err = iwl_phy_db_batch_flush(phy_db, batch);
+    iwh_free(batch);
+    if (err)
+        return err;
+    if (wait_err) {
+        IWL_ERR(phy_db->trans, "Failed sending phy db data, err %d\n",
+                wait_err);
+        return wait_err;
+    }
+    
     IWL_DEBUG_INFO(phy_db->trans,
                    "Finished sending phy db non channel data\n");
     return 0;
 }
+/* CUSTOM END */
 IWL_EXPORT_SYMBOL(iwl_send_phy_db_data);
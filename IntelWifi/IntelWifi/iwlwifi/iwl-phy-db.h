@@ -74,4 +74,9 @@ int iwl_phy_db_set_section(struct iwl_phy_db *phy_db,
 
 int iwl_send_phy_db_data(struct iwl_phy_db *phy_db);
 
+/* CUSTOM */
+/* the most PHY_DB_CMDs iwl_send_phy_db_data() has in flight */
+#define IWL_PHY_DB_BATCH    16
+/* CUSTOM END */
+
 #endif /* __IWL_PHYDB_H__ */
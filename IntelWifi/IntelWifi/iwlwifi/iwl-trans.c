@@ -147,6 +147,12 @@ void iwl_trans_free(struct iwl_trans *trans)
 	kmem_cache_destroy(trans->dev_cmd_pool);
 #endif
     
+    if (trans->cmd_names)
+        iwh_free(trans->cmd_names);
+    if (trans->cmd_prof)
+        iwh_free(trans->cmd_prof);
+    if (trans->rx_prof)
+        iwh_free(trans->rx_prof);
     iwh_free(trans);
 }
 
@@ -192,6 +198,58 @@ int iwl_trans_send_cmd(struct iwl_trans *trans, struct iwl_host_cmd *cmd)
 }
 IWL_EXPORT_SYMBOL(iwl_trans_send_cmd);
 
+/*
+ * Pipelined variant of iwl_trans_send_cmd() for SYNC commands: queue a
+ * command and return right away, then collect any number of them with
+ * iwl_trans_wait_cmds().
+ */
+int iwl_trans_send_cmd_start(struct iwl_trans *trans, struct iwl_host_cmd *cmd)
+{
+	if (unlikely(!(cmd->flags & CMD_SEND_IN_RFKILL) &&
+		     test_bit(STATUS_RFKILL_OPMODE, &trans->status)))
+		return -ERFKILL;
+
+	if (unlikely(test_bit(STATUS_FW_ERROR, &trans->status)))
+		return -EIO;
+
+	if (unlikely(trans->state != IWL_TRANS_FW_ALIVE)) {
+		IWL_ERR(trans, "%s bad state = %d\n", __func__, trans->state);
+		return -EIO;
+	}
+
+	if (WARN_ON(cmd->flags & (CMD_ASYNC | CMD_WANT_ASYNC_CALLBACK)))
+		return -EINVAL;
+
+	if (!trans->ops->send_cmd_start)
+		return -EOPNOTSUPP;
+
+	if (trans->wide_cmd_header && !iwl_cmd_groupid(cmd->id))
+		cmd->id = DEF_ID(cmd->id);
+
+	return trans->ops->send_cmd_start(trans, cmd);
+}
+IWL_EXPORT_SYMBOL(iwl_trans_send_cmd_start);
+
+int iwl_trans_wait_cmds(struct iwl_trans *trans, struct iwl_host_cmd **cmds,
+			int n_cmds)
+{
+	int i, ret;
+
+	if (!n_cmds)
+		return 0;
+
+	ret = trans->ops->wait_cmds(trans, cmds, n_cmds);
+
+	for (i = 0; i < n_cmds && !ret; i++) {
+		if (WARN_ON((cmds[i]->flags & CMD_WANT_SKB) &&
+			    !cmds[i]->resp_pkt))
+			ret = -EIO;
+	}
+
+	return ret;
+}
+IWL_EXPORT_SYMBOL(iwl_trans_wait_cmds);
+
 /* Comparator for struct iwl_hcmd_names.
  * Used in the binary search over a list of host commands.
  *
@@ -216,6 +274,16 @@ const char *iwl_get_cmd_string(struct iwl_trans *trans, u32 id)
 	const struct iwl_hcmd_arr *arr;
 	size_t size = sizeof(struct iwl_hcmd_names);
 
+	/* CUSTOM */
+	if (trans->cmd_names) {
+		int idx = iwl_cmd_table_idx(trans, id);
+
+		if (idx < 0 || !trans->cmd_names[idx])
+			return "UNKNOWN";
+		return trans->cmd_names[idx];
+	}
+	/* CUSTOM END */
+
 	grp = iwl_cmd_groupid(id);
 	cmd = iwl_cmd_opcode(id);
 
@@ -246,3 +314,132 @@ int iwl_cmd_groups_verify_sorted(const struct iwl_trans_config *trans)
 	return 0;
 }
 IWL_EXPORT_SYMBOL(iwl_cmd_groups_verify_sorted);
+
+/*
+ * CUSTOM
+ * Flatten the command groups into tables with a slot for every opcode of
+ * every group, so a name or a profile is found by indexing. The profile is
+ * kept if the op mode configures the transport again with the same groups.
+ */
+int iwl_trans_init_cmd_tables(struct iwl_trans *trans)
+{
+	u32 size = iwl_cmd_table_size(trans->command_groups_size);
+	const char **names;
+
+	names = iwh_zalloc(size * sizeof(*names));
+	if (!names)
+		return -ENOMEM;
+
+	iwl_cmd_table_fill_names(trans->command_groups, trans->command_groups_size, names);
+
+	if (trans->cmd_prof && trans->cmd_table_size != size) {
+		iwh_free(trans->cmd_prof);
+		iwh_free(trans->rx_prof);
+		trans->cmd_prof = NULL;
+		trans->rx_prof = NULL;
+	}
+	if (!trans->cmd_prof) {
+		trans->cmd_prof = iwh_zalloc(size * sizeof(*trans->cmd_prof));
+#ifdef CONFIG_IWLWIFI_RX_PROF
+		trans->rx_prof = iwh_zalloc(size * sizeof(*trans->rx_prof));
+		if (!trans->cmd_prof || !trans->rx_prof) {
+#else
+		if (!trans->cmd_prof) {
+#endif
+			iwh_free(trans->cmd_prof);
+			iwh_free(trans->rx_prof);
+			trans->cmd_prof = NULL;
+			trans->rx_prof = NULL;
+			iwh_free(names);
+			return -ENOMEM;
+		}
+		trans->rx_prof_since = mach_absolute_time();
+	}
+
+	if (trans->cmd_names)
+		iwh_free(trans->cmd_names);
+	trans->cmd_names = names;
+	trans->cmd_table_size = size;
+
+	return 0;
+}
+
+/*
+ * Copy the profile of every command ID that was sent, up to @max of them,
+ * and clear the counters if @reset is set. Returns the number of records.
+ */
+u32 iwl_trans_cmd_prof_read(struct iwl_trans *trans, struct iwl_cmd_prof_rec *recs,
+			    u32 max, bool reset)
+{
+	u32 i, n = 0;
+
+	if (!trans->cmd_prof)
+		return 0;
+
+	for (i = 0; i < trans->cmd_table_size && n < max; i++) {
+		struct iwl_cmd_prof *prof = &trans->cmd_prof[i];
+		struct iwl_cmd_prof_rec *rec = &recs[n];
+
+		if (!prof->count)
+			continue;
+
+		rec->id = i;
+		rec->reserved = 0;
+		rec->prof = *prof;
+		strlcpy(rec->name, trans->cmd_names[i] ? trans->cmd_names[i] : "UNKNOWN",
+			sizeof(rec->name));
+		n++;
+
+		if (reset)
+			bzero(prof, sizeof(*prof));
+	}
+
+	return n;
+}
+
+/*
+ * Same for the RX handler profile. @elapsed_ns is the time the counters
+ * cover, since they were allocated or last reset, @copy_fails the packets
+ * lost to a failed rxb_steal_page() copy. Without CONFIG_IWLWIFI_RX_PROF
+ * there is no profile and only @copy_fails is filled in.
+ */
+u32 iwl_trans_rx_prof_read(struct iwl_trans *trans, struct iwl_rx_prof_rec *recs,
+			   u32 max, bool reset, u64 *elapsed_ns, u32 *copy_fails)
+{
+	u64 now = mach_absolute_time();
+	u32 i, n = 0;
+
+	*copy_fails = (u32)trans->rx_copy_fails;
+	if (reset)
+		OSAddAtomic(-(SInt32)*copy_fails, &trans->rx_copy_fails);
+
+	*elapsed_ns = 0;
+	if (!trans->rx_prof)
+		return 0;
+
+	absolutetime_to_nanoseconds(now - trans->rx_prof_since, elapsed_ns);
+
+	for (i = 0; i < trans->cmd_table_size && n < max; i++) {
+		struct iwl_rx_prof *prof = &trans->rx_prof[i];
+		struct iwl_rx_prof_rec *rec = &recs[n];
+
+		if (!prof->count)
+			continue;
+
+		rec->id = i;
+		rec->reserved = 0;
+		rec->prof = *prof;
+		strlcpy(rec->name, trans->cmd_names[i] ? trans->cmd_names[i] : "UNKNOWN",
+			sizeof(rec->name));
+		n++;
+	}
+
+	/* the whole table, a reset covers a single window */
+	if (reset) {
+		bzero(trans->rx_prof, trans->cmd_table_size * sizeof(*trans->rx_prof));
+		trans->rx_prof_since = now;
+	}
+
+	return n;
+}
+/* CUSTOM END */
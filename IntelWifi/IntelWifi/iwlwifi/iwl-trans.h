@@ -79,8 +79,11 @@
 #include "iwl-op-mode.h"
 #include "fw/api/cmdhdr.h"
 #include "fw/api/txq.h"
+#include "iwl-cmd-table.h"
 
 #include "../iw_utils/allocation.h"
+#include "iwl-lat.h"
+#include "cmd_prof_shared.h"
 
 // TODO: Remove stubs
 struct sk_buff { int something; };
@@ -247,6 +250,8 @@ enum iwl_hcmd_dataflag {
  * @resp_pkt: response packet, if %CMD_WANT_SKB was set
  * @_rx_page_order: (internally used to free response packet)
  * @_rx_page_addr: (internally used to free response packet)
+ * @_idx: (internally used, command queue slot of a SYNC command)
+ * @_seq: (internally used, completion sequence of a SYNC command)
  * @flags: can be CMD_*
  * @len: array of the lengths of the chunks in data
  * @dataflags: IWL_HCMD_DFL_*
@@ -259,6 +264,8 @@ struct iwl_host_cmd {
     
     unsigned long _rx_page_addr;
     u32 _rx_page_order;
+    int _idx;
+    u32 _seq;
 
 	u32 flags;
 	u32 id;
@@ -272,16 +279,18 @@ static inline void iwl_free_resp(struct iwl_host_cmd *cmd)
 }
 
 struct iwl_rx_cmd_buffer {
-	mbuf_t _page;
+	void *_page;
 	int _offset;
 	bool _page_stolen;
 	u32 _rx_page_order;
 	unsigned int truesize;
+	/* CUSTOM: counts the packets rxb_steal_page() couldn't copy, may be NULL */
+	volatile SInt32 *_copy_fails;
 };
 
 static inline void *rxb_addr(struct iwl_rx_cmd_buffer *r)
 {
-    return (void *)((u8*)mbuf_data(r->_page) + r->_offset);
+    return (void *)((u8*)r->_page + r->_offset);
 }
 
 static inline int rxb_offset(struct iwl_rx_cmd_buffer *r)
@@ -289,10 +298,32 @@ static inline int rxb_offset(struct iwl_rx_cmd_buffer *r)
 	return r->_offset;
 }
 
+/*
+ * RBs live in the transport's pre-mapped RX slabs and go straight back to
+ * the ring, so the caller gets its own mbuf holding a copy of the packet.
+ * The copy can't wait for memory, a failed one is counted in
+ * r->_copy_fails and the packet is lost.
+ */
 static inline mbuf_t rxb_steal_page(struct iwl_rx_cmd_buffer *r)
 {
+    struct iwl_rx_packet *pkt = (struct iwl_rx_packet *)rxb_addr(r);
+    size_t len = iwl_rx_packet_len(pkt) + sizeof(u32);
+    unsigned int chunks = 1;
+    mbuf_t m;
+    
 	r->_page_stolen = true;
-    return r->_page;
+    
+    if (mbuf_allocpacket(MBUF_DONTWAIT, len, &chunks, &m))
+        goto fail;
+    if (mbuf_copyback(m, 0, len, pkt, MBUF_DONTWAIT)) {
+        mbuf_freem(m);
+        goto fail;
+    }
+    return m;
+fail:
+    if (r->_copy_fails)
+        OSIncrementAtomic(r->_copy_fails);
+    return NULL;
 }
 
 static inline void iwl_free_rxb(struct iwl_rx_cmd_buffer *r)
@@ -371,22 +402,6 @@ iwl_trans_get_rb_size_order(enum iwl_amsdu_size rb_size)
 	}
 }
 
-struct iwl_hcmd_names {
-	u8 cmd_id;
-	const char *const cmd_name;
-};
-
-#define HCMD_NAME(x)	\
-	{ .cmd_id = x, .cmd_name = #x }
-
-struct iwl_hcmd_arr {
-	const struct iwl_hcmd_names *arr;
-	int size;
-};
-
-#define HCMD_ARR(x)	\
-	{ .arr = x, .size = ARRAY_SIZE(x) }
-
 /**
  * struct iwl_trans_config - transport configuration
  *
@@ -442,6 +457,20 @@ struct iwl_trans_dump_data {
 
 struct iwl_trans;
 
+/**
+ * struct iwl_trans_rxq_dma_data - RX queue DMA data
+ * @fr_bd_cb: DMA address of free BD cyclic buffer
+ * @fr_bd_wid: Initial write index of the free BD cyclic buffer
+ * @urbd_stts_wrptr: DMA address of urbd_stts_wrptr
+ * @ur_bd_cb: DMA address of used BD cyclic buffer
+ */
+struct iwl_trans_rxq_dma_data {
+	u64 fr_bd_cb;
+	u32 fr_bd_wid;
+	u64 urbd_stts_wrptr;
+	u64 ur_bd_cb;
+};
+
 struct iwl_trans_txq_scd_cfg {
 	u8 fifo;
 	u8 sta_id;
@@ -482,6 +511,11 @@ struct iwl_trans_txq_scd_cfg {
  *	If RFkill is asserted in the middle of a SYNC host command, it must
  *	return -ERFKILL straight away.
  *	May sleep only if CMD_ASYNC is not set
+ * @send_cmd_start: queue a SYNC host command without waiting for it to
+ *	complete. Several commands may be in flight at once, every one of them
+ *	must be passed to @wait_cmds afterwards. May sleep.
+ * @wait_cmds: wait for commands queued with @send_cmd_start. Returns the
+ *	first error, but always waits for (or cancels) all of them. May sleep.
  * @tx: send an skb. The transport relies on the op_mode to zero the
  *	the ieee80211_tx_info->driver_data. If the MPDU is an A-MSDU, all
  *	the CSUM will be taken care of (TCP CSUM and IP header in case of
@@ -552,6 +586,9 @@ struct iwl_trans_ops {
 			 bool test, bool reset);
 
 	int (*send_cmd)(struct iwl_trans *trans, struct iwl_host_cmd *cmd);
+	int (*send_cmd_start)(struct iwl_trans *trans, struct iwl_host_cmd *cmd);
+	int (*wait_cmds)(struct iwl_trans *trans, struct iwl_host_cmd **cmds,
+			 int n_cmds);
 
 	int (*tx)(struct iwl_trans *trans, struct sk_buff *skb,
 		  struct iwl_device_cmd *dev_cmd, int queue);
@@ -725,7 +762,7 @@ enum iwl_plat_pm_mode {
  *	supposed to change during runtime.
  */
 struct iwl_trans {
-    void *mbuf_cursor; // IOMbufNaturalMemoryCursor
+    void *tx_mbuf_cursor; // IOMbufNaturalMemoryCursor, up to max_skb_frags segments
     
 	const struct iwl_trans_ops *ops;
 	struct iwl_op_mode *op_mode;
@@ -787,6 +824,23 @@ struct iwl_trans {
     void *dev;
     void *intf;
     void *gate;
+    
+    /* CUSTOM: hot path latency histograms, NULL if they couldn't be allocated */
+    struct iwl_lat_stats *lat;
+    
+    /*
+     * CUSTOM: name and profile of every (group, opcode) the command groups
+     * can address, indexed by iwl_cmd_table_idx(). Built by
+     * iwl_trans_configure(), NULL until then.
+     */
+    const char **cmd_names;
+    struct iwl_cmd_prof *cmd_prof;
+    struct iwl_rx_prof *rx_prof;    /* only with CONFIG_IWLWIFI_RX_PROF */
+    u64 rx_prof_since;
+    u32 cmd_table_size;
+    
+    /* CUSTOM: RX packets lost because their copy couldn't be allocated */
+    volatile SInt32 rx_copy_fails;
 
 	/* pointer to trans specific struct */
 	/*Ensure that this pointer will always be aligned to sizeof pointer */
@@ -795,6 +849,45 @@ struct iwl_trans {
 
 const char *iwl_get_cmd_string(struct iwl_trans *trans, u32 id);
 int iwl_cmd_groups_verify_sorted(const struct iwl_trans_config *trans);
+int iwl_trans_init_cmd_tables(struct iwl_trans *trans);
+u32 iwl_trans_cmd_prof_read(struct iwl_trans *trans, struct iwl_cmd_prof_rec *recs,
+			    u32 max, bool reset);
+u32 iwl_trans_rx_prof_read(struct iwl_trans *trans, struct iwl_rx_prof_rec *recs,
+			   u32 max, bool reset, u64 *elapsed_ns, u32 *copy_fails);
+
+/* slot of a command ID in the cmd_names / cmd_prof tables, -1 if it has none */
+static inline int iwl_cmd_table_idx(struct iwl_trans *trans, u32 id)
+{
+	return iwl_cmd_table_slot(trans->cmd_table_size, id);
+}
+
+/*
+ * CUSTOM: account a packet of @len bytes to the op mode's handling of
+ * @id, which started at @ts and made @allocs iwh_malloc() calls. Only the
+ * default RX queue carries packets (RSS isn't programmed), so there is a
+ * single writer. Only called with CONFIG_IWLWIFI_RX_PROF, it costs two
+ * timestamps and the allocation tracking on every packet.
+ */
+static inline void iwl_trans_rx_prof_record(struct iwl_trans *trans, u32 id, u32 len,
+					    u64 ts, u32 allocs)
+{
+	struct iwl_rx_prof *prof;
+	int idx = iwl_cmd_table_idx(trans, id);
+	u64 ns;
+
+	if (!trans->rx_prof || idx < 0)
+		return;
+
+	absolutetime_to_nanoseconds(mach_absolute_time() - ts, &ns);
+
+	prof = &trans->rx_prof[idx];
+	prof->count++;
+	prof->allocs += allocs;
+	prof->bytes += len;
+	prof->time_ns += ns;
+	if (ns > prof->max_ns)
+		prof->max_ns = ns;
+}
 
 static inline void iwl_trans_configure(struct iwl_trans *trans,
 				       const struct iwl_trans_config *trans_cfg)
@@ -803,6 +896,9 @@ static inline void iwl_trans_configure(struct iwl_trans *trans,
 
 	trans->ops->configure(trans, trans_cfg);
 	WARN_ON(iwl_cmd_groups_verify_sorted(trans_cfg));
+	/* CUSTOM: without the tables names fall back to a bsearch */
+	if (iwl_trans_init_cmd_tables(trans))
+		IWL_WARN(trans, "Failed to allocate the command tables\n");
 }
 
 static inline int _iwl_trans_start_hw(struct iwl_trans *trans, bool low_power)
@@ -937,6 +1033,9 @@ iwl_trans_alloc_tx_cmd(struct iwl_trans *trans)
 }
 
 int iwl_trans_send_cmd(struct iwl_trans *trans, struct iwl_host_cmd *cmd);
+int iwl_trans_send_cmd_start(struct iwl_trans *trans, struct iwl_host_cmd *cmd);
+int iwl_trans_wait_cmds(struct iwl_trans *trans, struct iwl_host_cmd **cmds,
+			int n_cmds);
 
 static inline void iwl_trans_free_tx_cmd(struct iwl_trans *trans, struct iwl_device_cmd *dev_cmd)
 {
@@ -1032,8 +1131,8 @@ static inline void iwl_trans_txq_enable(struct iwl_trans *trans, int queue,
         .fifo = (u8)fifo,
         .sta_id = (u8)sta_id,
         .tid = (u8)tid,
-        .frame_limit = frame_limit,
         .aggregate = sta_id >= 0,
+        .frame_limit = frame_limit,
     };
 
     iwl_trans_txq_enable_cfg(trans, queue, ssn, &cfg, queue_wdg_timeout);
@@ -1047,8 +1146,8 @@ void iwl_trans_ac_txq_enable(struct iwl_trans *trans, int queue, int fifo,
         .fifo = (u8)fifo,
         .sta_id = (u8)-1,
         .tid = IWL_MAX_TID_COUNT,
-        .frame_limit = IWL_FRAME_LIMIT,
         .aggregate = false,
+        .frame_limit = IWL_FRAME_LIMIT,
     };
 
     iwl_trans_txq_enable_cfg(trans, queue, 0, &cfg, queue_wdg_timeout);
@@ -0,0 +1,92 @@
+//
+//  fw-load-plan.h
+//  IntelWifi
+//
+//  Section plan of the planned 8000 family firmware load, see
+//  iwl_pcie_load_plan_8000(). It only looks at the image layout, so it is
+//  also checked on the host by checks/fw-load-plan.c.
+//
+
+#ifndef __iwl_pcie_fw_load_plan_h__
+#define __iwl_pcie_fw_load_plan_h__
+
+#include <linux/types.h>
+
+#include "fw/img.h"
+
+/**
+ * struct iwl_fw_load_step - one section of the plan
+ * @sec: the section
+ * @sec_idx: index of @sec in the image, for the logs
+ * @cpu: CPU the section belongs to, 1 or 2
+ * @status: bits of FH_UCODE_LOAD_STATUS that report the section as loaded
+ */
+struct iwl_fw_load_step {
+	const struct fw_desc *sec;
+	int sec_idx;
+	int cpu;
+	u32 status;
+};
+
+/*
+ * Collect the sections of both CPUs in load order. Each CPU's list ends at
+ * the first separator or empty section, like iwl_pcie_load_cpu_sections_8000()
+ * does, and @plan must have room for image->num_sec steps. Returns the
+ * number of steps.
+ */
+static inline int iwl_pcie_plan_sections_8000(const struct fw_img *image,
+					      struct iwl_fw_load_step *plan)
+{
+	int i = 0, n = 0, cpu;
+
+	for (cpu = 1; cpu <= 2; cpu++) {
+		int shift_param = cpu == 1 ? 0 : 16;
+		u32 sec_num = 0x1;
+
+		for (; i < image->num_sec; i++) {
+			const struct fw_desc *sec = &image->sec[i];
+
+			if (!sec->data ||
+			    sec->offset == CPU1_CPU2_SEPARATOR_SECTION ||
+			    sec->offset == PAGING_SEPARATOR_SECTION)
+				break;
+
+			plan[n].sec = sec;
+			plan[n].sec_idx = i;
+			plan[n].cpu = cpu;
+			plan[n].status = sec_num << shift_param;
+			n++;
+
+			sec_num = (sec_num << 1) | 0x1;
+		}
+
+		/* skip the separator */
+		i++;
+	}
+
+	return n;
+}
+
+/*
+ * Size of the chunk at @offset of step @step, at most @max bytes, and where
+ * the chunk after it starts. Chunks run back to back across sections, a
+ * section that is done moves on to offset 0 of the next step.
+ */
+static inline u32 iwl_pcie_plan_chunk_8000(const struct iwl_fw_load_step *plan,
+					   int step, u32 offset, u32 max,
+					   int *next_step, u32 *next_offset)
+{
+	u32 left = (u32)plan[step].sec->len - offset;
+	u32 size = left < max ? left : max;
+
+	*next_step = step;
+	*next_offset = offset + size;
+	if (*next_offset >= plan[step].sec->len) {
+		(*next_step)++;
+		*next_offset = 0;
+	}
+
+	return size;
+}
+
+#endif /* __iwl_pcie_fw_load_plan_h__ */
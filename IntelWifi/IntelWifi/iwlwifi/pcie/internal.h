@@ -48,12 +48,14 @@
 
 #include <sys/kernel_types.h>
 #include <sys/queue.h>
+#include <libkern/OSAtomic.h>
 
 
 #include "iwl-modparams.h"
 #include "iwl-fh.h"
 #include "iwl-io.h"
 #include "iwl-csr.h"
+#include "iwl-devtrace.h"
 
 /* We need 2 entries for the TX command and header, and another one might
  * be needed for potential data in the SKB's head. The remaining ones can
@@ -68,6 +70,8 @@
 #define RX_POST_REQ_ALLOC 2
 #define RX_CLAIM_REQ_ALLOC 8
 #define RX_PENDING_WATERMARK 16
+/* Default number of RBs iwl_pcie_rx_handle handles per pass (NAPI weight) */
+#define IWL_RX_POLL_BUDGET 64
 
 
 /**
@@ -83,19 +87,29 @@ enum iwl_shared_irq_flags {
 /*This file includes the declaration that are internal to the
  * trans_pcie layer */
 
+/*
+ * RBs are carved out of physically contiguous slabs of this size, see
+ * iwl_pcie_rx_alloc_slabs
+ */
+#define IWL_RX_SLAB_SIZE (64 * 1024)
+
 /**
  * struct iwl_rx_mem_buffer
- * @page_dma: bus address of rxb page
- * @page: driver's pointer to the rxb page
+ * @page_dma: bus address of rxb page, fixed for the lifetime of the RX slab
+ * @page: driver's pointer to the rxb page, NULL while no RB is attached
+ * @rb_addr: this rxb's RB inside the RX slab
  * @invalid: rxb is in driver ownership - not owned by HW
  * @vid: index of this rxb in the global table
+ * @rba_next: link in the allocator's rbd_empty / rbd_allocated stacks
  */
 struct iwl_rx_mem_buffer {
     dma_addr_t page_dma;
-    mbuf_t page;
+    void *page;
+    void *rb_addr;
     u16 vid;
     bool invalid;
     TAILQ_ENTRY(iwl_rx_mem_buffer) list;
+    struct iwl_rx_mem_buffer *rba_next;
 };
 
 /**
@@ -116,6 +130,82 @@ struct isr_statistics {
     u32 unhandled;
 };
 
+/*
+ * Adaptive interrupt moderation. The RX interrupt rate is sampled in
+ * windows of IWL_INT_MIT_WINDOW_MS: CSR_INT_COALESCING is halved while the
+ * rate is low (less latency) and doubled back up to the default while it
+ * is high. Above IWL_INT_MIT_POLL_RATE at full coalescing the RX causes are
+ * masked and a timer polls the queues every IWL_INT_MIT_POLL_US instead.
+ */
+#define IWL_INT_MIT_WINDOW_MS       100
+#define IWL_INT_MIT_LOW_RATE        1000    /* events per second */
+#define IWL_INT_MIT_HIGH_RATE       4000
+#define IWL_INT_MIT_POLL_RATE       8000
+#define IWL_INT_MIT_POLL_US         250
+#define IWL_INT_MIT_COALESCING_MIN  0x02    /* 64 usecs */
+#define IWL_INT_MIT_COALESCING_MAX  IWL_HOST_INT_TIMEOUT_DEF
+#define IWL_INT_MIT_RX_INTS         (CSR_INT_BIT_FH_RX | CSR_INT_BIT_SW_RX | CSR_INT_BIT_RX_PERIODIC)
+
+/**
+ * struct iwl_int_mit - interrupt moderation state
+ * @adaptive: false pins the coalescing timer to the default (INT_MIT off)
+ * @polling: RX causes are masked and the poll timer drains the queues
+ * @coalescing: value currently programmed in CSR_INT_COALESCING
+ * @events: RX interrupts, or polls that found work, in the current window
+ * @window_start: uptime in ns at which the current window started
+ */
+struct iwl_int_mit {
+    bool adaptive;
+    bool polling;
+    u8 coalescing;
+    u32 events;
+    u64 window_start;
+};
+
+/**
+ * struct iwl_rx_work_ring - RX work handoff from the interrupt to a worker
+ * @head: next slot to fill, only written by the interrupt workloop
+ * @tail: next slot to drain, only written by the RX worker
+ * @queue: RX queue ids waiting to be drained
+ *
+ * Single producer / single consumer, so no lock is needed: each side only
+ * moves its own index and the barrier orders the slot against the index.
+ */
+#define IWL_RX_WORK_RING_SIZE   16
+
+struct iwl_rx_work_ring {
+    volatile u32 head;
+    volatile u32 tail;
+    u8 queue[IWL_RX_WORK_RING_SIZE];
+};
+
+static inline bool iwl_rx_work_ring_push(struct iwl_rx_work_ring *ring, u8 queue)
+{
+    u32 head = ring->head;
+    
+    if (head - ring->tail >= IWL_RX_WORK_RING_SIZE)
+        return false;
+    
+    ring->queue[head & (IWL_RX_WORK_RING_SIZE - 1)] = queue;
+    OSMemoryBarrier();
+    ring->head = head + 1;
+    return true;
+}
+
+static inline bool iwl_rx_work_ring_pop(struct iwl_rx_work_ring *ring, u8 *queue)
+{
+    u32 tail = ring->tail;
+    
+    if (tail == ring->head)
+        return false;
+    
+    OSMemoryBarrier();
+    *queue = ring->queue[tail & (IWL_RX_WORK_RING_SIZE - 1)];
+    OSMemoryBarrier();
+    ring->tail = tail + 1;
+    return true;
+}
+
 /**
  * struct iwl_rxq - Rx queue
  * @id: queue index
@@ -135,6 +225,11 @@ struct isr_statistics {
  * @rb_stts: driver's pointer to receive buffer status
  * @rb_stts_dma: bus address of receive buffer status
  * @lock:
+ * @budget: max RBs handled per iwl_pcie_rx_handle pass, 0 for no limit
+ * @irq_ts: time of the oldest interrupt the queue was scheduled for and
+ *    hasn't been handled yet, 0 if none
+ * @draining: set while iwl_pcie_rx_handle runs on the queue, it is the only
+ *    consumer and the only writer of @read
  * @queue: actual rx queue. Not used for multi-rx queue.
  *
  * NOTE:  rx_free and rx_used are used as a FIFO for iwl_rx_mem_buffers
@@ -160,6 +255,11 @@ struct iwl_rxq {
     struct iwl_rb_status *rb_stts;
     dma_addr_t rb_stts_dma;
     IOSimpleLock *lock;
+    u32 budget;
+    volatile u64 irq_ts;
+    volatile UInt32 draining;
+    /* CUSTOM: iwh_malloc() calls of the thread draining the queue, CONFIG_IWLWIFI_RX_PROF */
+    u32 allocs;
     //struct napi_struct napi;
     struct iwl_rx_mem_buffer *queue[RX_QUEUE_SIZE];
 };
@@ -169,23 +269,119 @@ struct iwl_rxq {
 * @req_pending: number of requests the allcator had not processed yet
 * @req_ready: number of requests honored and ready for claiming
 * @rbd_allocated: RBDs with pages allocated and ready to be handled to
-*    the queue. This is a list of &struct iwl_rx_mem_buffer
-* @rbd_empty: RBDs with no page attached for allocator use. This is a list
-*    of &struct iwl_rx_mem_buffer
-* @lock: protects the rbd_allocated and rbd_empty lists
+*    the queue. This is a lock-free stack of &struct iwl_rx_mem_buffer
+* @rbd_empty: RBDs with no page attached for allocator use. This is a
+*    lock-free stack of &struct iwl_rx_mem_buffer
+* @lock: makes the claimer in iwl_rba_claim() the only rbd_allocated popper
 * @alloc_wq: work queue for background calls
 * @rx_alloc: work struct for background calls
+*
+* Both stacks are pushed to without a lock. rbd_empty is only ever emptied
+* as a whole and rbd_allocated is only popped through iwl_rba_claim(), one
+* claimer at a time, so a compare-and-swap on the head can't be fooled by
+* an entry that was popped and pushed back in between (ABA).
 */
 struct iwl_rb_allocator {
-    int req_pending;
-    int req_ready;
-    TAILQ_HEAD(, iwl_rx_mem_buffer) rbd_allocated;
-    TAILQ_HEAD(, iwl_rx_mem_buffer) rbd_empty;
+    volatile SInt32 req_pending;
+    volatile SInt32 req_ready;
+    struct iwl_rx_mem_buffer * volatile rbd_allocated;
+    struct iwl_rx_mem_buffer * volatile rbd_empty;
     IOSimpleLock *lock;
 //    struct workqueue_struct *alloc_wq;
 //    struct work_struct rx_alloc;
 };
 
+/*
+ * Push the chain first..last (linked through rba_next) onto an allocator
+ * stack.
+ */
+static inline void iwl_rba_push(struct iwl_rx_mem_buffer * volatile *head,
+                                struct iwl_rx_mem_buffer *first,
+                                struct iwl_rx_mem_buffer *last)
+{
+    struct iwl_rx_mem_buffer *old;
+    
+    do {
+        old = *head;
+        last->rba_next = old;
+    } while (!OSCompareAndSwapPtr(old, first, (void * volatile *)head));
+}
+
+/*
+ * Detach a whole allocator stack, returns its first entry.
+ */
+static inline struct iwl_rx_mem_buffer *iwl_rba_take_all(struct iwl_rx_mem_buffer * volatile *head)
+{
+    struct iwl_rx_mem_buffer *old;
+    
+    do {
+        old = *head;
+    } while (old && !OSCompareAndSwapPtr(old, NULL, (void * volatile *)head));
+    
+    return old;
+}
+
+/*
+ * Pop one entry. old->rba_next is only stable while nobody else can pop
+ * old and push it back, so there must be a single popper; use
+ * iwl_rba_claim(), not this.
+ */
+static inline struct iwl_rx_mem_buffer *__iwl_rba_pop(struct iwl_rx_mem_buffer * volatile *head)
+{
+    struct iwl_rx_mem_buffer *old;
+    
+    do {
+        old = *head;
+    } while (old && !OSCompareAndSwapPtr(old, old->rba_next, (void * volatile *)head));
+    
+    return old;
+}
+
+/*
+ * Pop up to @n allocated RBDs into @rxbs, returns how many there were.
+ * Pushers need not hold rba->lock, claimers do.
+ */
+static inline int iwl_rba_claim(struct iwl_rb_allocator *rba, struct iwl_rx_mem_buffer **rxbs, int n)
+{
+    int i;
+    
+    IOSimpleLockLock(rba->lock);
+    for (i = 0; i < n; i++) {
+        rxbs[i] = __iwl_rba_pop(&rba->rbd_allocated);
+        if (!rxbs[i])
+            break;
+    }
+    IOSimpleLockUnlock(rba->lock);
+    
+    return i;
+}
+
+/* atomic_xchg(v, 0) */
+static inline SInt32 iwl_atomic_take(volatile SInt32 *v)
+{
+    SInt32 old;
+    
+    do {
+        old = *v;
+    } while (!OSCompareAndSwap((UInt32)old, 0, (volatile UInt32 *)v));
+    
+    return old;
+}
+
+/* atomic_dec_if_positive(v) */
+static inline SInt32 iwl_atomic_dec_if_positive(volatile SInt32 *v)
+{
+    SInt32 old;
+    
+    do {
+        old = *v;
+        if (old <= 0)
+            return old - 1;
+    } while (!OSCompareAndSwap((UInt32)old, (UInt32)(old - 1), (volatile UInt32 *)v));
+    
+    return old - 1;
+}
+
 struct iwl_dma_ptr {
     dma_addr_t dma;
     void *addr;
@@ -239,6 +435,19 @@ struct iwl_cmd_meta {
 #define IWL_FIRST_TB_SIZE    20
 #define IWL_FIRST_TB_SIZE_ALIGN LNX_ALIGN(IWL_FIRST_TB_SIZE, 64)
 
+/*
+ * Deferred TX doorbell. While a TX batch is open the write pointer of a data
+ * queue is pushed to the device at most every IWL_TX_BATCH_MAX_FRAMES frames,
+ * the rest is flushed when the last open batch is closed or, at the latest,
+ * IWL_TX_BATCH_MAX_LATENCY_US after the first deferred frame. Batches may be
+ * opened from several threads at once, only atomics are used for the state.
+ */
+#define IWL_TX_BATCH_MAX_FRAMES         16
+#define IWL_TX_BATCH_MAX_LATENCY_US     500
+
+/* chunk buffers the firmware sections are streamed through */
+#define IWL_FW_LOAD_BUFS 2
+
 struct iwl_pcie_txq_entry {
     struct iwl_device_cmd *cmd;
     struct sk_buff *skb;
@@ -246,12 +455,31 @@ struct iwl_pcie_txq_entry {
     const void *free_buf;
     vm_size_t free_buf_size;
     struct iwl_cmd_meta meta;
+    /* SYNC commands: slot is complete once hcmd_done catches up with hcmd_seq */
+    u32 hcmd_seq;
+    u32 hcmd_done;
+    /* CUSTOM: enqueue time, for the latency histograms */
+    u64 ts;
 };
 
 struct iwl_pcie_first_tb_buf {
     u8 buf[IWL_FIRST_TB_SIZE_ALIGN];
 };
 
+/*
+ * The second TB of a data frame holds the rest of the TX command and the
+ * 802.11 header. Linux maps the device command in place with
+ * dma_map_single(), but our device commands live in IOMalloc'ed memory, so
+ * every data queue slot owns a small preallocated DMA buffer instead. It is
+ * big enough for the TX command and the longest (4-address QoS + HT control)
+ * header.
+ */
+#define IWL_TX_CMD_TB1_SIZE     128
+
+struct iwl_pcie_tx_cmd_buf {
+    u8 buf[IWL_TX_CMD_TB1_SIZE];
+};
+
 /**
  * struct iwl_txq - Tx Queue for DMA
  * @q: generic Rx/Tx queue descriptor
@@ -260,13 +488,21 @@ struct iwl_pcie_first_tb_buf {
  *    the writeback -- this is DMA memory and an array holding one buffer
  *    for each command on the queue
  * @first_tb_dma: DMA address for the first_tb_bufs start
+ * @tx_cmd_bufs: per slot TX command + 802.11 header buffers (DMA memory),
+ *    only allocated for data queues
+ * @tx_cmd_dma: DMA address for the tx_cmd_bufs start
  * @entries: transmit entries (driver state)
  * @lock: queue lock
  * @stuck_timer: timer that fires if queue gets stuck
  * @trans_pcie: pointer back to transport (for timer)
  * @need_update: indicates need to update read/write index
+ * @wr_ptr_deferred: data frames queued since the last write pointer update
+ *    while TX batching is active
  * @ampdu: true if this queue is an ampdu queue for an specific RA/TID
  * @wd_timeout: queue watchdog timeout (jiffies) - per queue
+ * @overflow_q: packet list (linked with mbuf_nextpkt) of frames that didn't
+ *    fit into the ring while the queue was stopped
+ * @overflow_tail: last packet of @overflow_q
  * @frozen: tx stuck queue timer is frozen
  * @frozen_expiry_remainder: remember how long until the timer fires
  * @bc_tbl: byte count table of the queue (relevant only for gen2 transport)
@@ -300,18 +536,23 @@ struct iwl_txq {
     struct iwl_pcie_first_tb_buf *first_tb_bufs;
     dma_addr_t first_tb_dma;
     struct iwl_dma_ptr *first_tb_dma_ptr;
+    struct iwl_pcie_tx_cmd_buf *tx_cmd_bufs;
+    dma_addr_t tx_cmd_dma;
+    struct iwl_dma_ptr *tx_cmd_dma_ptr;
     struct iwl_pcie_txq_entry *entries;
     IOSimpleLock *lock;
     unsigned long frozen_expiry_remainder;
-    //struct timer_list stuck_timer;
+    void *stuck_timer; // IOTimerEventSource, refcon is the txq
     struct iwl_trans_pcie *trans_pcie;
     bool need_update;
+    int wr_ptr_deferred;
     bool frozen;
     bool ampdu;
     int block;
     unsigned long wd_timeout;
     
     mbuf_t overflow_q;
+    mbuf_t overflow_tail;
     struct iwl_dma_ptr bc_tbl;
     
     int write_ptr;
@@ -323,6 +564,14 @@ struct iwl_txq {
     int high_mark;
 };
 
+/* CUSTOM: what iwl_pcie_txq_progress() wants done with @stuck_timer */
+enum iwl_txq_stuck_timer {
+    IWL_TXQ_TIMER_KEEP,
+    IWL_TXQ_TIMER_ARM,
+    IWL_TXQ_TIMER_CANCEL,
+};
+/* CUSTOM END */
+
 
 static inline dma_addr_t
 iwl_pcie_get_first_tb_dma(struct iwl_txq *txq, int idx)
@@ -330,6 +579,12 @@ iwl_pcie_get_first_tb_dma(struct iwl_txq *txq, int idx)
     return txq->first_tb_dma + sizeof(struct iwl_pcie_first_tb_buf) * idx;
 }
 
+static inline dma_addr_t
+iwl_pcie_get_tx_cmd_dma(struct iwl_txq *txq, int idx)
+{
+    return txq->tx_cmd_dma + sizeof(struct iwl_pcie_tx_cmd_buf) * idx;
+}
+
 static inline u16 iwl_pcie_tfd_tb_get_len(struct iwl_trans *trans, void *_tfd,
                                           u8 idx)
 {
@@ -350,10 +605,24 @@ static inline u16 iwl_pcie_tfd_tb_get_len(struct iwl_trans *trans, void *_tfd,
 
 
 
+/*
+ * CUSTOM
+ * Firmware error dumps are written into IWL_FW_DUMP_SLOTS buffers that are
+ * allocated with the transport, nothing is allocated when the firmware
+ * crashes. The oldest dump is overwritten.
+ */
+#define IWL_FW_DUMP_SLOTS       2
+#define IWL_FW_DUMP_MAX_RBS     8
+#define IWL_FW_DUMP_RB_CAPLEN   4096
+#define IWL_CSR_TO_DUMP         (0x250)
+
 struct iwl_trans_pcie {
     struct iwl_rxq *rxq;
     struct iwl_rx_mem_buffer rx_pool[RX_POOL_SIZE];
     struct iwl_rx_mem_buffer *global_table[RX_POOL_SIZE];
+    struct iwl_dma_ptr **rx_slabs;
+    int num_rx_slabs;
+    u32 rx_slab_rb_size;
     struct iwl_rb_allocator rba;
     struct iwl_trans *trans;
     
@@ -366,6 +635,9 @@ struct iwl_trans_pcie {
     bool is_down, opmode_down;
     bool debug_rfkill;
     struct isr_statistics isr_stats;
+    struct iwl_int_mit int_mit;
+    /* CUSTOM: time of the last interrupt, taken in the interrupt filter */
+    volatile u64 irq_ts;
     
     IOSimpleLock* irq_lock;
     IOLock *mutex;
@@ -385,10 +657,20 @@ struct iwl_trans_pcie {
     
     bool ucode_write_complete;
     IOLock* ucode_write_waitq;
+    struct iwl_dma_ptr *fw_load_bufs[IWL_FW_LOAD_BUFS];
     IOLock* wait_command_queue;
     IOLock* d0i3_waitq;
+    /*
+     * the command queue's lock in place of txq->lock: held to enqueue and
+     * to complete a host command, SYNC commands may be pipelined
+     */
+    IOLock* hcmd_lock;
+    u32 hcmd_seq;
+    int sync_hcmds;
 
     u8 page_offs, dev_cmd_offs;
+    /* mbufs have no skb->cb, overflowed frames keep dev_cmd in a tag */
+    mbuf_tag_id_t dev_cmd_tag;
     
     u8 cmd_queue;
     u8 cmd_fifo;
@@ -413,9 +695,20 @@ struct iwl_trans_pcie {
     bool cmd_hold_nic_awake;
     bool ref_cmd_in_flight;
     
+    /* deferred TX doorbell, see IWL_TX_BATCH_MAX_FRAMES */
+    volatile SInt32 tx_batch_depth;
+    volatile UInt32 tx_batch_timer_armed;
+    
     u32 fw_mon_size;
     dma_addr_t fw_mon_phys;
     void *fw_mon_page;
+    
+    /* firmware error dumps, fw_dump_seq is the number of the last one */
+    IOLock *fw_dump_lock;
+    u8 *fw_dump_slots[IWL_FW_DUMP_SLOTS];
+    u32 fw_dump_len[IWL_FW_DUMP_SLOTS];
+    u32 fw_dump_slot_size;
+    u32 fw_dump_seq;
   
     bool msix_enabled;
     u8 shared_vec_mask;
@@ -482,6 +775,8 @@ void iwl_trans_pcie_txq_set_shared_mode(struct iwl_trans *trans, u32 txq_id,
 //                      struct iwl_device_cmd *dev_cmd, int txq_id);
 void iwl_pcie_txq_check_wrptrs(struct iwl_trans *trans);
 int iwl_trans_pcie_send_hcmd(struct iwl_trans *trans, struct iwl_host_cmd *cmd);
+int iwl_trans_pcie_send_hcmd_start(struct iwl_trans *trans, struct iwl_host_cmd *cmd);
+int iwl_trans_pcie_wait_hcmds(struct iwl_trans *trans, struct iwl_host_cmd **cmds, int n_cmds);
 //void iwl_pcie_hcmd_complete(struct iwl_trans *trans,
 //                            struct iwl_rx_cmd_buffer *rxb);
 //void iwl_trans_pcie_reclaim(struct iwl_trans *trans, int txq_id, int ssn,
@@ -662,7 +957,10 @@ static inline u8 iwl_pcie_get_cmd_index(struct iwl_txq *q, u32 index)
 
 static inline void *iwl_pcie_get_tfd(struct iwl_trans_pcie *trans_pcie, struct iwl_txq *txq, int idx)
 {
-    return (u8*)txq->tfds + trans_pcie->tfd_size * iwl_pcie_get_cmd_index(txq, idx);
+    if (trans_pcie->trans->cfg->use_tfh)
+        idx = iwl_pcie_get_cmd_index(txq, idx);
+    
+    return (u8*)txq->tfds + trans_pcie->tfd_size * idx;
 }
 
 
@@ -753,6 +1051,10 @@ extern const struct iwl_trans_ops trans_ops_pcie;
 extern const struct iwl_trans_ops trans_ops_pcie_gen2;
 
 void iwl_trans_pcie_configure(struct iwl_trans *trans, const struct iwl_trans_config *trans_cfg);
+int iwl_trans_pcie_rxq_dma_data(struct iwl_trans *trans, int queue,
+                                struct iwl_trans_rxq_dma_data *data);
+void iwl_pcie_fw_dump_collect(struct iwl_trans *trans);
+size_t iwl_trans_pcie_fw_dump_read(struct iwl_trans *trans, void *buf, size_t size, u32 *seq);
 void iwl_trans_pcie_fw_alive(struct iwl_trans *trans, u32 scd_addr);
 //int iwl_trans_pcie_start_fw(struct iwl_trans *trans, const struct fw_img *fw, bool run_in_rfkill);
 
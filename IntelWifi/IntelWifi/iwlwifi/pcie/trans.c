@@ -277,6 +277,8 @@ const struct iwl_trans_ops trans_ops_pcie = {
     IWL_TRANS_COMMON_OPS,
     IWL_TRANS_PM_OPS
     .send_cmd = iwl_trans_pcie_send_hcmd,
+    .send_cmd_start = iwl_trans_pcie_send_hcmd_start,
+    .wait_cmds = iwl_trans_pcie_wait_hcmds,
     .fw_alive = iwl_trans_pcie_fw_alive,
 //    .start_hw = iwl_trans_pcie_start_hw,
 //    .start_fw = iwl_trans_pcie_start_fw,
@@ -425,6 +425,18 @@ static inline bool ieee80211_is_data_present(__le16 fc)
     cpu_to_le16(IEEE80211_FTYPE_DATA);
 }
 
+/**
+ * ieee80211_get_qos_ctl - get pointer to qos control bytes
+ * @hdr: the frame
+ */
+static inline u8 *ieee80211_get_qos_ctl(struct ieee80211_hdr *hdr)
+{
+    if (ieee80211_has_a4(hdr->frame_control))
+        return (u8 *)hdr + 30;
+    else
+        return (u8 *)hdr + 24;
+}
+
 /**
  * ieee80211_is_assoc_req - check if IEEE80211_FTYPE_MGMT && IEEE80211_STYPE_ASSOC_REQ
  * @fc: frame control bytes in little-endian byteorder
@@ -178,6 +178,11 @@ static inline u32 get_unaligned_le32(const void *p)
     return le32_to_cpup((__le32 *)p);
 }
 
+static inline void put_unaligned_le64(u64 val, void *p)
+{
+    *((__le64 *)p) = cpu_to_le64(val);
+}
+
 
 
 static inline int atomic_dec_and_test(volatile SInt32 * addr)
@@ -249,6 +249,13 @@ struct ieee80211_supported_band {
 
 int ieee80211_channel_to_frequency(int chan, enum nl80211_band band);
 
+/**
+ * ieee80211_hdrlen - get header length in bytes from frame control
+ * @fc: frame control field in little-endian format
+ * Return: The header length in bytes.
+ */
+unsigned int ieee80211_hdrlen(__le16 fc);
+
 
 /** line 409
  * struct cfg80211_chan_def - channel definition
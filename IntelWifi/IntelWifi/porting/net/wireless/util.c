@@ -8,6 +8,46 @@
 
 #include <net/cfg80211.h>
 
+unsigned int ieee80211_hdrlen(__le16 fc)
+{
+    unsigned int hdrlen = 24;
+    
+    if (ieee80211_is_data(fc)) {
+        if (ieee80211_has_a4(fc))
+            hdrlen = 30;
+        if (ieee80211_is_data_qos(fc)) {
+            hdrlen += IEEE80211_QOS_CTL_LEN;
+            if (ieee80211_has_order(fc))
+                hdrlen += IEEE80211_HT_CTL_LEN;
+        }
+        goto out;
+    }
+    
+    if (ieee80211_is_mgmt(fc)) {
+        if (ieee80211_has_order(fc))
+            hdrlen += IEEE80211_HT_CTL_LEN;
+        goto out;
+    }
+    
+    if (ieee80211_is_ctl(fc)) {
+        /*
+         * ACK and CTS are 10 bytes, all others 16. To see how
+         * to get this condition consider
+         *   subtype mask:   0b0000000011110000 (0x00F0)
+         *   ACK subtype:    0b0000000011010000 (0x00D0)
+         *   CTS subtype:    0b0000000011000000 (0x00C0)
+         *   bits that matter:         ^^^      (0x00E0)
+         *   value of those: 0b0000000011000000 (0x00C0)
+         */
+        if ((fc & cpu_to_le16(0x00E0)) == cpu_to_le16(0x00C0))
+            hdrlen = 10;
+        else
+            hdrlen = 16;
+    }
+out:
+    return hdrlen;
+}
+
 int ieee80211_channel_to_frequency(int chan, enum nl80211_band band)
 {
     /* see 802.11 17.3.8.3.2 and Annex J
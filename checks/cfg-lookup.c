@@ -0,0 +1,87 @@
+//
+//  cfg-lookup.c
+//  checks
+//
+//  Host check of the sorted card lookup in Configuration.c. Every device
+//  in iwl_hw_card_ids is looked up with every subsystem ID and has to get
+//  the cfg the linear scan of the table gives. Build and run from this
+//  directory:
+//
+//      cc -Ihost -I../IntelWifi/IntelWifi/porting -I../IntelWifi/IntelWifi/iwlwifi -o cfg-lookup cfg-lookup.c ../IntelWifi/IntelWifi/iwlwifi/cfg/*.c
+//      ./cfg-lookup
+//
+
+#include <stdio.h>
+
+/* the table and the index are static */
+#include "../IntelWifi/IntelWifi/Configuration.c"
+
+/* first exact match in table order, then the device's PCI_ANY_ID entry */
+static struct iwl_cfg *linear_lookup(u16 device, u16 subdevice)
+{
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(iwl_hw_card_ids); i++)
+        if (iwl_hw_card_ids[i].device == device && iwl_hw_card_ids[i].subdevice == subdevice)
+            return (struct iwl_cfg *)iwl_hw_card_ids[i].driver_data;
+
+    for (i = 0; i < ARRAY_SIZE(iwl_hw_card_ids); i++)
+        if (iwl_hw_card_ids[i].device == device &&
+            iwl_hw_card_ids[i].subdevice == (u32)PCI_ANY_ID)
+            return (struct iwl_cfg *)iwl_hw_card_ids[i].driver_data;
+
+    return NULL;
+}
+
+int main(void)
+{
+    static bool seen[0x10000];
+    int i, devices = 0, hits = 0, failures = 0;
+    u32 sub;
+
+    /* the lookup builds the index on first use */
+    getConfiguration(0, 0);
+
+    for (i = 1; i < ARRAY_SIZE(iwl_hw_card_ids); i++) {
+        if (iwl_hw_card_entry_key(iwl_hw_card_index[i - 1]) >
+            iwl_hw_card_entry_key(iwl_hw_card_index[i])) {
+            printf("FAIL index: entries %d and %d out of order\n", i - 1, i);
+            return 1;
+        }
+    }
+
+    for (i = 0; i < ARRAY_SIZE(iwl_hw_card_ids); i++) {
+        u16 device = (u16)iwl_hw_card_ids[i].device;
+
+        if (seen[device])
+            continue;
+        seen[device] = true;
+        devices++;
+
+        for (sub = 0; sub <= 0xffff; sub++) {
+            struct iwl_cfg *want = linear_lookup(device, (u16)sub);
+            struct iwl_cfg *got = getConfiguration(device, (u16)sub);
+
+            if (got != want) {
+                printf("FAIL %04x:%04x: got %s, expected %s\n", device, sub,
+                       got ? got->name : "none", want ? want->name : "none");
+                failures++;
+            }
+            hits += !!want;
+        }
+    }
+
+    /* devices that aren't in the table at all */
+    for (sub = 0; sub <= 0xffff; sub += 0x101) {
+        if (!seen[sub] && getConfiguration((u16)sub, 0x1234)) {
+            printf("FAIL %04x:1234: found a cfg for an unknown device\n", sub);
+            failures++;
+        }
+    }
+
+    printf("%s %d entries, %d devices, %d of %d subsystem IDs matched\n",
+           failures ? "FAIL" : "ok  ", (int)ARRAY_SIZE(iwl_hw_card_ids), devices,
+           hits, devices * 0x10000);
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,129 @@
+//
+//  cmd-table.c
+//  checks
+//
+//  Host check of the per command ID tables in iwlwifi/iwl-cmd-table.h.
+//  Every (group, opcode, version) has to find the name a binary search of
+//  its group finds, like iwl_get_cmd_string() did before the tables, and
+//  IDs of groups past the table have to get no slot. Build and run from
+//  this directory:
+//
+//      cc -Ihost -I../IntelWifi/IntelWifi/porting -I../IntelWifi/IntelWifi/iwlwifi -o cmd-table cmd-table.c
+//      ./cmd-table
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "iwl-cmd-table.h"
+
+static const struct iwl_hcmd_names legacy_names[] = {
+    { 0x00, "FIRST" },
+    { 0x01, "ALIVE" },
+    { 0x1c, "TX_CMD" },
+    { 0x77, "TIME_EVENT" },
+    { 0xfe, "NEXT_TO_LAST" },
+    { 0xff, "LAST" },
+};
+
+static const struct iwl_hcmd_names system_names[] = {
+    { 0x00, "SHARED_MEM_CFG_CMD" },
+    { 0x03, "INIT_EXTENDED_CFG_CMD" },
+    { 0xff, "FW_ERROR_RECOVERY_CMD" },
+};
+
+static const struct iwl_hcmd_names phy_names[] = {
+    { 0x09, "CMD_DTS_MEASUREMENT_TRIGGER_WIDE" },
+};
+
+/* the same array twice, a hole and a group with a single command */
+static const struct iwl_hcmd_arr groups[] = {
+    [0x0] = HCMD_ARR(legacy_names),
+    [0x1] = HCMD_ARR(legacy_names),
+    [0x2] = HCMD_ARR(system_names),
+    [0x4] = HCMD_ARR(phy_names),
+};
+
+static int names_cmp(const void *key, const void *elt)
+{
+    const struct iwl_hcmd_names *name = elt;
+
+    return *(const u8 *)key - name->cmd_id;
+}
+
+/* what iwl_get_cmd_string() finds without the tables */
+static const char *bsearch_name(const struct iwl_hcmd_arr *g, int n_groups, u32 id)
+{
+    u8 grp = iwl_cmd_groupid(id), cmd = iwl_cmd_opcode(id);
+    const struct iwl_hcmd_names *ret;
+
+    if (grp >= n_groups || !g[grp].arr)
+        return NULL;
+
+    ret = bsearch(&cmd, g[grp].arr, g[grp].size, sizeof(*g[grp].arr), names_cmp);
+    return ret ? ret->cmd_name : NULL;
+}
+
+static int check_groups(const char *name, const struct iwl_hcmd_arr *g, int n_groups)
+{
+    static const u8 versions[] = { 0, 1, 0xff };
+    u32 size = iwl_cmd_table_size(n_groups);
+    const char **names = calloc(size, sizeof(*names));
+    unsigned char *used = calloc(size, 1);
+    int grp, op, v, ids = 0, named = 0, failures = 0;
+
+    iwl_cmd_table_fill_names(g, n_groups, names);
+
+    if (size != (u32)(n_groups > 1 ? n_groups : 1) << 8) {
+        printf("FAIL %s: %u slots for %d groups\n", name, size, n_groups);
+        failures++;
+    }
+
+    for (grp = 0; grp <= 0xff; grp++) {
+        for (op = 0; op <= 0xff; op++) {
+            for (v = 0; v < (int)ARRAY_SIZE(versions); v++) {
+                u32 id = iwl_cmd_id((u8)op, (u8)grp, versions[v]);
+                int slot = iwl_cmd_table_slot(size, id);
+                const char *want = bsearch_name(g, n_groups, id);
+                const char *got = slot < 0 ? NULL : names[slot];
+
+                ids++;
+                if ((slot < 0) != ((u32)grp << 8 >= size) || got != want) {
+                    printf("FAIL %s: id 0x%06x slot %d name %s, expected %s\n",
+                           name, id, slot, got ? got : "none", want ? want : "none");
+                    failures++;
+                    continue;
+                }
+
+                /* the version aside, two IDs never share a slot */
+                if (slot >= 0 && !v) {
+                    if (used[slot]) {
+                        printf("FAIL %s: id 0x%06x shares slot %d\n", name, id, slot);
+                        failures++;
+                    }
+                    used[slot] = 1;
+                }
+                named += !!got;
+            }
+        }
+    }
+
+    free(names);
+    free(used);
+
+    if (!failures)
+        printf("ok   %s: %d IDs, %u slots, %d named\n", name, ids, size, named);
+
+    return failures;
+}
+
+int main(void)
+{
+    int failures = 0;
+
+    failures += check_groups("groups", groups, ARRAY_SIZE(groups));
+    failures += check_groups("one group", groups, 1);
+    failures += check_groups("no groups", NULL, 0);
+
+    return failures ? 1 : 0;
+}
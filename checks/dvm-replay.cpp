@@ -0,0 +1,690 @@
+//
+//  dvm-replay.cpp
+//  checks
+//
+//  Replays a recorded session through the DVM op mode's RX handler table,
+//  iwl_setup_rx_handlers() and iwl_rx_dispatch() from IwlDvmOpMode_rx.cpp
+//  built as is: PHY/MPDU pairs of data frames, good and with a bad CRC,
+//  beacon notifications, statistics notifications of both layouts and the
+//  reply to REPLY_STATISTICS_CMD, missed beacons, scan results, NoA
+//  updates, RF kill and a notification nothing handles. The capture is
+//  built once from a fixed script, so every run replays the same packets.
+//
+//  Each handler has to leave what it is for: the frames that passed go up
+//  to the interface whole, the rest are dropped, the PHY data, the
+//  statistics, the IBSS manager state and the NoA attribute are cached,
+//  the temperature and sensitivity hooks run when they should and the
+//  table counts what it dispatched. Then the capture is replayed for
+//  throughput, and once more timing every packet, which gives the time
+//  per packet and the allocations (mbufs and iwh_malloc()) of each
+//  handler; the allocations are checked, they don't depend on the host.
+//
+//  The handlers iwl_setup_rx_handlers() takes from the rest of the op
+//  mode (REPLY_ADD_STA and the scan notifications) and the hooks the RX
+//  handlers call into it are stood in for below: scan.cpp, sta.cpp and
+//  calib.cpp need the command path and the mac80211 glue, the replay
+//  counts the calls instead. Build and run from this directory:
+//
+//      make dvm-replay
+//      ./dvm-replay
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+#include "sim/sim.h"
+
+extern "C" {
+#include "agn.h"
+#include "iwl-trans.h"
+#include "iw_utils/allocation.h"
+}
+
+#define REPLAY_ROUNDS       100         /* beacon intervals in the capture */
+#define REPLAY_FRAMES       16          /* data frames per interval */
+#define REPLAY_RUNS         50
+#define MISSED_THRESHOLD    5
+#define PAGE_LEN            4096
+
+static int failures;
+
+#define CHECK(name, cond, ...) do {                             \
+    if (!(cond)) {                                              \
+        printf("FAIL %s: ", (name));                            \
+        printf(__VA_ARGS__);                                    \
+        printf("\n");                                           \
+        failures++;                                             \
+        return;                                                 \
+    }                                                           \
+} while (0)
+
+static UInt64 now_ns(void)
+{
+    return mach_absolute_time();
+}
+
+// MARK: Stand-ins for the rest of the op mode
+
+static struct {
+    unsigned long add_sta;
+    unsigned long scan_results;
+    unsigned long chswitch;
+    unsigned long short_scan;
+    unsigned long scan_cancel;
+    unsigned long sensitivity;
+    unsigned long temperature;
+} calls;
+
+static void replay_scan_notif(struct iwl_priv *priv, struct iwl_rx_cmd_buffer *rxb)
+{
+    calls.scan_results++;
+}
+
+extern "C" {
+
+void iwl_add_sta_callback(struct iwl_priv *priv, struct iwl_rx_cmd_buffer *rxb)
+{
+    calls.add_sta++;
+}
+
+/* the same slots scan.cpp takes */
+void iwl_setup_rx_scan_handlers(struct iwl_priv *priv)
+{
+    priv->rx_handlers[REPLY_SCAN_CMD] = replay_scan_notif;
+    priv->rx_handlers[SCAN_START_NOTIFICATION] = replay_scan_notif;
+    priv->rx_handlers[SCAN_RESULTS_NOTIFICATION] = replay_scan_notif;
+    priv->rx_handlers[SCAN_COMPLETE_NOTIFICATION] = replay_scan_notif;
+}
+
+void iwl_chswitch_done(struct iwl_priv *priv, bool is_success)
+{
+    calls.chswitch++;
+}
+
+void iwl_internal_short_hw_scan(struct iwl_priv *priv)
+{
+    calls.short_scan++;
+}
+
+int iwl_scan_cancel(struct iwl_priv *priv)
+{
+    calls.scan_cancel++;
+    return 0;
+}
+
+void iwl_init_sensitivity(struct iwl_priv *priv)
+{
+    calls.sensitivity++;
+}
+
+/* what IwlDvmOpMode_lib.cpp returns: the MCS of an HT rate, legacy ones aren't looked up */
+int iwlagn_hwrate_to_mac80211_idx(u32 rate_n_flags, enum nl80211_band band)
+{
+    return rate_n_flags & RATE_MCS_HT_MSK ? (int)(rate_n_flags & 0xff) : -1;
+}
+
+}
+
+static void replay_temperature(struct iwl_priv *priv)
+{
+    calls.temperature++;
+}
+
+/* the interface mac80211 would hand the frames to */
+class ReplayInterface : public IO80211Interface {
+    OSDeclareDefaultStructors(ReplayInterface)
+
+public:
+    UInt64 frames;
+    UInt64 bytes;
+    UInt64 bad;                 /* not the packet that was handed up */
+    const struct iwl_rx_packet *expect;
+
+    UInt32 inputPacket(mbuf_t m, UInt32 length = 0, IOOptionBits options = 0, void *param = 0) override
+    {
+        size_t len = mbuf_pkthdr_len(m);
+        u8 buf[PAGE_LEN];
+
+        if (!expect || len != iwl_rx_packet_len(expect) + sizeof(u32) || len > sizeof(buf) ||
+            mbuf_copydata(m, 0, len, buf) || memcmp(buf, expect, len))
+            bad++;
+        frames++;
+        bytes += len;
+        mbuf_freem(m);
+        return 1;
+    }
+};
+
+OSDefineMetaClassAndStructors(ReplayInterface, IO80211Interface)
+
+class ReplayController : public IO80211Controller {
+    OSDeclareDefaultStructors(ReplayController)
+
+public:
+    ReplayInterface netif;
+
+    IO80211Interface *getNetworkInterface() override { return &netif; }
+
+    SInt32 apple80211Request(unsigned int, int, IO80211Interface *, void *) override { return kIOReturnUnsupported; }
+    const OSString *newVendorString() const override { return NULL; }
+    const OSString *newModelString() const override { return NULL; }
+    IOReturn getHardwareAddressForInterface(IO80211Interface *netif, IOEthernetAddress *addr) override
+    {
+        return kIOReturnUnsupported;
+    }
+    IOReturn getHardwareAddress(IOEthernetAddress *addrP) override { return kIOReturnUnsupported; }
+    IOReturn enable(IONetworkInterface *netif) override { return kIOReturnSuccess; }
+    IOReturn disable(IONetworkInterface *netif) override { return kIOReturnSuccess; }
+    IOReturn setPromiscuousMode(bool active) override { return kIOReturnSuccess; }
+    IOReturn setMulticastMode(bool active) override { return kIOReturnSuccess; }
+    SInt32 monitorModeSetEnabled(IO80211Interface *, bool, unsigned int) override { return kIOReturnUnsupported; }
+    bool createWorkLoop() override { return true; }
+};
+
+OSDefineMetaClassAndStructors(ReplayController, IO80211Controller)
+
+/* the registers the RF kill handler writes */
+static struct {
+    unsigned long gp1_set;
+    unsigned long gp1_clr;
+    unsigned long mbx;
+    unsigned long other;
+} regs;
+
+static void replay_write32(struct iwl_trans *trans, u32 ofs, u32 val)
+{
+    if (ofs == CSR_UCODE_DRV_GP1_SET)
+        regs.gp1_set++;
+    else if (ofs == CSR_UCODE_DRV_GP1_CLR)
+        regs.gp1_clr++;
+    else if (ofs == HBUS_TARG_MBX_C)
+        regs.mbx++;
+    else
+        regs.other++;
+}
+
+static u32 replay_read32(struct iwl_trans *trans, u32 ofs)
+{
+    return 0;
+}
+
+static bool replay_grab_nic_access(struct iwl_trans *trans, IOInterruptState *state)
+{
+    return true;
+}
+
+static void replay_release_nic_access(struct iwl_trans *trans, IOInterruptState *state)
+{
+}
+
+// MARK: The capture
+
+struct replay_pkt {
+    std::vector<u8> data;       /* len_n_flags, header and payload */
+    bool delivered;             /* an MPDU that has to reach the interface */
+};
+
+/* what replaying the capture once has to leave behind */
+struct replay_expect {
+    u32 dispatched[REPLY_MAX];
+    u32 unhandled;
+    u64 frames;
+    u64 frame_bytes;
+    u32 ibss_manager;
+    u32 beacon_time;
+    __le32 temperature;
+    unsigned long temperature_calls;
+    unsigned long sensitivity_calls;
+    unsigned long noa_allocs;
+    bool noa_active;
+    u32 noa_len;
+    unsigned long rf_kills;
+    unsigned long rf_ons;
+};
+
+struct replay {
+    std::vector<replay_pkt> pkts;
+    replay_expect expect;
+    UInt64 bytes;
+};
+
+static void replay_add(struct replay *r, u8 cmd, const void *data, u32 len, bool delivered = false)
+{
+    replay_pkt p;
+    struct iwl_rx_packet *pkt;
+
+    /* the length covers the header but not len_n_flags itself */
+    p.data.resize(sizeof(*pkt) + len);
+    pkt = (struct iwl_rx_packet *)p.data.data();
+    pkt->len_n_flags = cpu_to_le32((sizeof(pkt->hdr) + len) & FH_RSCSR_FRAME_SIZE_MSK);
+    pkt->hdr.cmd = cmd;
+    pkt->hdr.group_id = 0;
+    pkt->hdr.sequence = cpu_to_le16(SEQ_RX_FRAME);
+    memcpy(pkt->data, data, len);
+    p.delivered = delivered;
+
+    r->pkts.push_back(p);
+    r->bytes += p.data.size();
+    if (r->expect.dispatched[cmd] != (u32)-1)
+        r->expect.dispatched[cmd]++;
+}
+
+/* REPLY_RX_PHY_CMD then REPLY_RX_MPDU_CMD, the frame is @len bytes */
+static void replay_add_frame(struct replay *r, u32 n, u32 len, bool ht, bool crc_ok)
+{
+    struct iwl_rx_phy_res phy = {};
+    struct iwlagn_non_cfg_phy *ncphy = (struct iwlagn_non_cfg_phy *)phy.non_cfg_phy_buf;
+    std::vector<u8> mpdu(sizeof(struct iwl_rx_mpdu_res_start) + len + sizeof(__le32));
+    struct iwl_rx_mpdu_res_start *start = (struct iwl_rx_mpdu_res_start *)mpdu.data();
+    struct ieee80211_hdr *hdr = (struct ieee80211_hdr *)(start + 1);
+    __le32 status = RX_RES_STATUS_NO_RXE_OVERFLOW | (crc_ok ? RX_RES_STATUS_NO_CRC32_ERROR : 0);
+
+    phy.non_cfg_phy_cnt = sizeof(phy.non_cfg_phy_buf) / sizeof(__le32);
+    phy.timestamp = cpu_to_le64(1000000ULL * n);
+    phy.beacon_time_stamp = cpu_to_le32(0x1000 + n);
+    phy.phy_flags = RX_RES_PHY_FLAGS_BAND_24_MSK;
+    phy.channel = cpu_to_le16(1 + n % 11);
+    ncphy->non_cfg_phy[IWLAGN_RX_RES_AGC_IDX] = cpu_to_le32(40 << IWLAGN_OFDM_AGC_BIT_POS);
+    ncphy->non_cfg_phy[IWLAGN_RX_RES_RSSI_AB_IDX] = cpu_to_le32((60 + n % 8) << IWLAGN_OFDM_RSSI_A_BIT_POS);
+    phy.rate_n_flags = cpu_to_le32(ht ? RATE_MCS_HT_MSK | (n % 16) : 0x0d);
+    phy.byte_count = cpu_to_le16(len);
+    replay_add(r, REPLY_RX_PHY_CMD, &phy, sizeof(phy));
+
+    start->byte_count = cpu_to_le16(len);
+    hdr->frame_control = cpu_to_le16(IEEE80211_FTYPE_DATA | IEEE80211_STYPE_DATA | IEEE80211_FCTL_FROMDS);
+    for (u32 i = sizeof(*hdr); i < len; i++)
+        ((u8 *)hdr)[i] = (u8)(n + i);
+    memcpy((u8 *)hdr + len, &status, sizeof(status));
+    replay_add(r, REPLY_RX_MPDU_CMD, mpdu.data(), (u32)mpdu.size(), crc_ok);
+
+    if (crc_ok) {
+        /* a bad CRC is dropped before the PHY data is looked at */
+        r->expect.beacon_time = 0x1000 + n;
+        r->expect.frames++;
+        /* the whole packet goes up, len_n_flags included */
+        r->expect.frame_bytes += sizeof(struct iwl_rx_packet) + mpdu.size();
+    }
+}
+
+static void replay_add_statistics(struct replay *r, u8 cmd, bool bt, __le32 temperature, __le32 flag)
+{
+    struct statistics_general_common *common;
+    std::vector<u8> buf;
+
+    if (bt) {
+        struct iwl_bt_notif_statistics *stats;
+
+        buf.resize(sizeof(*stats));
+        stats = (struct iwl_bt_notif_statistics *)buf.data();
+        stats->flag = flag;
+        common = &stats->general.common;
+        stats->rx.general.common.beacon_silence_rssi_a = cpu_to_le32(30);
+    } else {
+        struct iwl_notif_statistics *stats;
+
+        buf.resize(sizeof(*stats));
+        stats = (struct iwl_notif_statistics *)buf.data();
+        stats->flag = flag;
+        common = &stats->general.common;
+        stats->rx.general.beacon_silence_rssi_a = cpu_to_le32(30);
+    }
+    common->temperature = temperature;
+    replay_add(r, cmd, buf.data(), (u32)buf.size());
+
+    /* iwlagn_rx_statistics() calls the hook when the temperature changes */
+    if (temperature != r->expect.temperature)
+        r->expect.temperature_calls++;
+    r->expect.temperature = temperature;
+}
+
+static void replay_build(struct replay *r)
+{
+    u32 n = 0;
+
+    memset(&r->expect, 0, sizeof(r->expect));
+    r->bytes = 0;
+    /* nothing handles these, the table mustn't count them */
+    r->expect.dispatched[REPLY_TX] = (u32)-1;
+
+    for (u32 round = 0; round < REPLAY_ROUNDS; round++) {
+        struct iwlagn_beacon_notif beacon = {};
+
+        beacon.low_tsf = cpu_to_le32(round * 102400);
+        beacon.ibss_mgr_status = cpu_to_le32(round % 3 == 0);
+        replay_add(r, BEACON_NOTIFICATION, &beacon, sizeof(beacon));
+        r->expect.ibss_manager = round % 3 == 0;
+
+        for (u32 i = 0; i < REPLAY_FRAMES; i++, n++)
+            replay_add_frame(r, n, 60 + (n * 97) % 1440, i & 1, n % 8 != 7);
+
+        if (round % 10 == 9) {
+            /* the temperature moves every 30 intervals, the BT layout every other time */
+            __le32 temperature = cpu_to_le32(40 + round / 30);
+
+            replay_add_statistics(r, STATISTICS_NOTIFICATION, round % 20 == 19, temperature, 0);
+        }
+        if (round % 50 == 49) {
+            replay_add_statistics(r, REPLY_STATISTICS_CMD, false, r->expect.temperature,
+                                  cpu_to_le32(UCODE_STATISTICS_CLEAR_MSK));
+        }
+
+        if (round % 5 == 4) {
+            struct iwl_missed_beacon_notif missed = {};
+            u32 consecutive = round % 25 == 24 ? MISSED_THRESHOLD + 1 : 1;
+
+            missed.consecutive_missed_beacons = cpu_to_le32(consecutive);
+            missed.num_expected_beacons = cpu_to_le32(round + 1);
+            replay_add(r, MISSED_BEACONS_NOTIFICATION, &missed, sizeof(missed));
+            if (consecutive > MISSED_THRESHOLD)
+                r->expect.sensitivity_calls++;
+        }
+
+        if (round % 4 == 1) {
+            u8 results[32] = { (u8)round };
+
+            replay_add(r, SCAN_RESULTS_NOTIFICATION, results, sizeof(results));
+        }
+
+        if (round % 20 == 10) {
+            struct iwl_wipan_noa_notification noa = {};
+            bool active = round % 40 == 10;
+
+            noa.noa_active = active;
+            noa.noa_attribute.id = 12;
+            noa.noa_attribute.length = cpu_to_le16(sizeof(noa.noa_attribute) - 3);
+            replay_add(r, REPLY_WIPAN_NOA_NOTIFICATION, &noa, sizeof(noa));
+            r->expect.noa_allocs += active;
+            r->expect.noa_active = active;
+            /* the attribute with the vendor IE header and the P2P id and length */
+            r->expect.noa_len = le16_to_cpu(noa.noa_attribute.length) + 1 + 1 + 3 + 1 + 1 + 2;
+        }
+
+        if (round == REPLAY_ROUNDS / 2 || round == REPLAY_ROUNDS / 2 + 1) {
+            struct iwl_card_state_notif card = {};
+            bool kill = round == REPLAY_ROUNDS / 2;
+
+            card.flags = cpu_to_le32(kill ? HW_CARD_DISABLED : 0);
+            replay_add(r, CARD_STATE_NOTIFICATION, &card, sizeof(card));
+            r->expect.rf_kills += kill;
+            r->expect.rf_ons += !kill;
+        }
+
+        if (round % 10 == 0) {
+            u8 tx[16] = {};
+
+            replay_add(r, REPLY_TX, tx, sizeof(tx));
+            r->expect.unhandled++;
+        }
+    }
+    r->expect.dispatched[REPLY_TX] = 0;
+}
+
+// MARK: Replay
+
+struct replay_state {
+    struct iwl_priv *priv;
+    struct iwl_trans trans;
+    struct iwl_trans_ops ops;
+    struct iwl_dvm_cfg lib;
+    ReplayController ctrl;
+    volatile SInt32 copy_fails;
+    u8 *page;
+};
+
+static bool replay_up(struct replay_state *s)
+{
+    memset(&s->trans, 0, sizeof(s->trans));
+    memset(&s->ops, 0, sizeof(s->ops));
+    memset(&s->lib, 0, sizeof(s->lib));
+    s->ops.write32 = replay_write32;
+    s->ops.read32 = replay_read32;
+    s->ops.grab_nic_access = replay_grab_nic_access;
+    s->ops.release_nic_access = replay_release_nic_access;
+    s->trans.ops = &s->ops;
+    s->trans.dev = static_cast<IO80211Controller *>(&s->ctrl);
+    s->lib.temperature = replay_temperature;
+    s->ctrl.netif.frames = 0;
+    s->ctrl.netif.bytes = 0;
+    s->ctrl.netif.bad = 0;
+    s->ctrl.netif.expect = NULL;
+    s->copy_fails = 0;
+
+    s->priv = (struct iwl_priv *)calloc(1, sizeof(*s->priv));
+    s->page = (u8 *)calloc(1, PAGE_LEN);
+    if (!s->priv || !s->page)
+        return false;
+
+    s->priv->trans = &s->trans;
+    s->priv->lib = &s->lib;
+    s->priv->is_open = 1;
+    s->priv->missed_beacon_threshold = MISSED_THRESHOLD;
+    s->priv->plcp_delta_threshold = IWL_MAX_PLCP_ERR_THRESHOLD_DISABLE;
+    iwl_setup_rx_handlers(s->priv);
+    return true;
+}
+
+static void replay_down(struct replay_state *s)
+{
+    if (s->priv && s->priv->noa_data)
+        iwh_free(s->priv->noa_data);
+    free(s->priv);
+    free(s->page);
+    s->priv = NULL;
+    s->page = NULL;
+}
+
+/* the transport hands the op mode the packet in its RB, at offset 0 here */
+static void replay_one(struct replay_state *s, const replay_pkt &p)
+{
+    struct iwl_rx_cmd_buffer rxcb = {
+        ._page = s->page,
+        ._offset = 0,
+        ._page_stolen = false,
+        ._rx_page_order = 0,
+        .truesize = PAGE_LEN,
+        ._copy_fails = &s->copy_fails,
+    };
+
+    memcpy(s->page, p.data.data(), p.data.size());
+    s->ctrl.netif.expect = p.delivered ? (const struct iwl_rx_packet *)p.data.data() : NULL;
+    iwl_rx_dispatch(s->priv, NULL, &rxcb);
+}
+
+static const struct {
+    u8 cmd;
+    const char *name;
+} replay_names[] = {
+    { REPLY_RX_PHY_CMD, "REPLY_RX_PHY_CMD" },
+    { REPLY_RX_MPDU_CMD, "REPLY_RX_MPDU_CMD" },
+    { BEACON_NOTIFICATION, "BEACON_NOTIFICATION" },
+    { STATISTICS_NOTIFICATION, "STATISTICS_NOTIFICATION" },
+    { REPLY_STATISTICS_CMD, "REPLY_STATISTICS_CMD" },
+    { MISSED_BEACONS_NOTIFICATION, "MISSED_BEACONS_NOTIFICATION" },
+    { SCAN_RESULTS_NOTIFICATION, "SCAN_RESULTS_NOTIFICATION" },
+    { REPLY_WIPAN_NOA_NOTIFICATION, "REPLY_WIPAN_NOA_NOTIFICATION" },
+    { CARD_STATE_NOTIFICATION, "CARD_STATE_NOTIFICATION" },
+    { REPLY_TX, "REPLY_TX" },
+};
+
+static void check_table(const char *name)
+{
+    struct replay_state s;
+
+    CHECK(name, replay_up(&s), "no memory");
+    for (size_t i = 0; i < ARRAY_SIZE(replay_names); i++) {
+        u8 cmd = replay_names[i].cmd;
+
+        if (cmd == REPLY_TX) {
+            CHECK(name, !s.priv->rx_handlers[cmd], "%s has a handler", replay_names[i].name);
+        } else {
+            CHECK(name, s.priv->rx_handlers[cmd], "no handler for %s", replay_names[i].name);
+        }
+    }
+    CHECK(name, s.priv->rx_handlers[REPLY_ADD_STA] == iwl_add_sta_callback, "REPLY_ADD_STA isn't the station's");
+    replay_down(&s);
+
+    printf("ok   %s: every replayed notification but REPLY_TX has a handler\n", name);
+}
+
+static void check_replay(const char *name, const struct replay *r)
+{
+    struct replay_state s;
+    const replay_expect &e = r->expect;
+    struct iwl_priv *priv;
+    unsigned long mbufs;
+    UInt32 allocs = 0;
+    bool tracked;
+
+    memset(&calls, 0, sizeof(calls));
+    memset(&regs, 0, sizeof(regs));
+    CHECK(name, replay_up(&s), "no memory");
+    priv = s.priv;
+
+    mbufs = sim_stats.mbuf_allocs;
+    tracked = iwh_alloc_track(&allocs);
+    for (const replay_pkt &p : r->pkts)
+        replay_one(&s, p);
+    if (tracked)
+        iwh_alloc_untrack();
+    mbufs = sim_stats.mbuf_allocs - mbufs;
+
+    for (size_t i = 0; i < ARRAY_SIZE(replay_names); i++) {
+        u8 cmd = replay_names[i].cmd;
+
+        CHECK(name, priv->rx_handlers_stats[cmd] == e.dispatched[cmd], "%s dispatched %u times of %u",
+              replay_names[i].name, priv->rx_handlers_stats[cmd], e.dispatched[cmd]);
+    }
+
+    CHECK(name, s.ctrl.netif.frames == e.frames && s.ctrl.netif.bytes == e.frame_bytes,
+          "%llu frames, %llu bytes went up of %llu, %llu", (unsigned long long)s.ctrl.netif.frames,
+          (unsigned long long)s.ctrl.netif.bytes, (unsigned long long)e.frames,
+          (unsigned long long)e.frame_bytes);
+    CHECK(name, !s.ctrl.netif.bad, "%llu frames went up that weren't the packet",
+          (unsigned long long)s.ctrl.netif.bad);
+    CHECK(name, !s.copy_fails, "%d copies failed", s.copy_fails);
+    CHECK(name, priv->last_phy_res_valid && priv->ampdu_ref == e.dispatched[REPLY_RX_PHY_CMD],
+          "PHY data %s, %u PHY responses counted of %u", priv->last_phy_res_valid ? "cached" : "not cached",
+          priv->ampdu_ref, e.dispatched[REPLY_RX_PHY_CMD]);
+    CHECK(name, priv->ucode_beacon_time == e.beacon_time, "beacon time %#x, the last frame had %#x",
+          priv->ucode_beacon_time, e.beacon_time);
+    CHECK(name, priv->ibss_manager == e.ibss_manager, "IBSS manager %u, the last beacon said %u",
+          priv->ibss_manager, e.ibss_manager);
+
+    CHECK(name, test_bit(STATUS_STATISTICS, &priv->status) &&
+          priv->statistics.common.temperature == e.temperature,
+          "statistics %s, temperature %u of %u", test_bit(STATUS_STATISTICS, &priv->status) ? "in" : "missing",
+          le32_to_cpu(priv->statistics.common.temperature), le32_to_cpu(e.temperature));
+    CHECK(name, calls.temperature == e.temperature_calls, "temperature hook ran %lu times of %lu",
+          calls.temperature, e.temperature_calls);
+    CHECK(name, calls.sensitivity == e.sensitivity_calls, "sensitivity reset %lu times of %lu",
+          calls.sensitivity, e.sensitivity_calls);
+    CHECK(name, calls.scan_results == e.dispatched[SCAN_RESULTS_NOTIFICATION], "%lu scan results handled of %u",
+          calls.scan_results, e.dispatched[SCAN_RESULTS_NOTIFICATION]);
+    CHECK(name, !calls.short_scan && !calls.chswitch, "%lu radio resets, %lu channel switches, not associated",
+          calls.short_scan, calls.chswitch);
+
+    CHECK(name, e.noa_active ? priv->noa_data && priv->noa_data->length == e.noa_len : !priv->noa_data,
+          "NoA %s after an %s one", priv->noa_data ? "kept" : "dropped", e.noa_active ? "active" : "inactive");
+
+    CHECK(name, regs.gp1_set == e.rf_kills && regs.gp1_clr == e.rf_kills && regs.mbx == 2 * e.rf_kills &&
+          !regs.other, "RF kill wrote GP1 set %lu, clear %lu, MBX %lu, %lu others for %lu kills", regs.gp1_set,
+          regs.gp1_clr, regs.mbx, regs.other, e.rf_kills);
+    CHECK(name, calls.scan_cancel == e.rf_kills + e.rf_ons && !test_bit(STATUS_RF_KILL_HW, &priv->status),
+          "%lu scans cancelled for %lu card states, RF kill %s", calls.scan_cancel, e.rf_kills + e.rf_ons,
+          test_bit(STATUS_RF_KILL_HW, &priv->status) ? "left on" : "off");
+
+    /* a copy per frame that went up, the NoA attribute, nothing else */
+    CHECK(name, mbufs == e.frames, "%lu mbufs for %llu frames", mbufs, (unsigned long long)e.frames);
+    CHECK(name, !tracked || allocs == e.noa_allocs, "%u iwh_malloc() calls for %lu active NoAs", allocs,
+          e.noa_allocs);
+    replay_down(&s);
+    CHECK(name, !sim_mbuf_live(), "%lu mbufs leaked", sim_mbuf_live());
+
+    printf("ok   %s: %zu packets, %llu frames up, %u dropped, %u unhandled\n", name, r->pkts.size(),
+           (unsigned long long)e.frames, e.dispatched[REPLY_RX_MPDU_CMD] - (u32)e.frames, e.unhandled);
+}
+
+static void bench_replay(const char *name, const struct replay *r)
+{
+    struct replay_state s;
+    struct {
+        u32 count;
+        UInt64 ns;
+        UInt64 max_ns;
+        unsigned long mbufs;
+        UInt32 allocs;
+    } prof[REPLY_MAX] = {};
+    size_t total = r->pkts.size() * REPLAY_RUNS;
+    UInt64 t, ns;
+    bool tracked;
+
+    CHECK(name, replay_up(&s), "no memory");
+
+    t = now_ns();
+    for (int run = 0; run < REPLAY_RUNS; run++)
+        for (const replay_pkt &p : r->pkts)
+            replay_one(&s, p);
+    ns = now_ns() - t;
+    CHECK(name, s.ctrl.netif.frames == r->expect.frames * REPLAY_RUNS && !s.ctrl.netif.bad,
+          "%llu frames went up, %llu of them wrong, of %llu", (unsigned long long)s.ctrl.netif.frames,
+          (unsigned long long)s.ctrl.netif.bad, (unsigned long long)(r->expect.frames * REPLAY_RUNS));
+    printf("     %zu packets, %.1f MB in %.1f ms, %.0f packets per s\n", total,
+           r->bytes * REPLAY_RUNS / 1e6, ns / 1e6, total * 1e9 / ns);
+
+    /* once more timing every packet, the clock adds its own cost */
+    for (const replay_pkt &p : r->pkts) {
+        u8 cmd = ((const struct iwl_rx_packet *)p.data.data())->hdr.cmd;
+        unsigned long mbufs = sim_stats.mbuf_allocs;
+        UInt32 allocs = 0;
+
+        tracked = iwh_alloc_track(&allocs);
+        t = now_ns();
+        replay_one(&s, p);
+        ns = now_ns() - t;
+        if (tracked)
+            iwh_alloc_untrack();
+
+        prof[cmd].count++;
+        prof[cmd].ns += ns;
+        if (ns > prof[cmd].max_ns)
+            prof[cmd].max_ns = ns;
+        prof[cmd].mbufs += sim_stats.mbuf_allocs - mbufs;
+        prof[cmd].allocs += allocs;
+    }
+    replay_down(&s);
+
+    for (size_t i = 0; i < ARRAY_SIZE(replay_names); i++) {
+        u8 cmd = replay_names[i].cmd;
+
+        if (!prof[cmd].count)
+            continue;
+        printf("     %-28s %5u packets %7.0f ns per packet, max %6llu ns, %lu mbufs, %u allocs\n",
+               replay_names[i].name, prof[cmd].count, (double)prof[cmd].ns / prof[cmd].count,
+               (unsigned long long)prof[cmd].max_ns, prof[cmd].mbufs, prof[cmd].allocs);
+    }
+    CHECK(name, prof[REPLY_RX_MPDU_CMD].mbufs == r->expect.frames &&
+          prof[REPLY_WIPAN_NOA_NOTIFICATION].allocs == r->expect.noa_allocs,
+          "%lu mbufs for %llu frames, %u allocations for %lu active NoAs", prof[REPLY_RX_MPDU_CMD].mbufs,
+          (unsigned long long)r->expect.frames, prof[REPLY_WIPAN_NOA_NOTIFICATION].allocs, r->expect.noa_allocs);
+    CHECK(name, !sim_mbuf_live(), "%lu mbufs leaked", sim_mbuf_live());
+
+    printf("ok   %s: %d replays\n", name, REPLAY_RUNS);
+}
+
+int main(void)
+{
+    static struct replay r;
+
+    replay_build(&r);
+    check_table("dvm table");
+    check_replay("dvm replay", &r);
+    bench_replay("dvm replay bench", &r);
+
+    if (failures)
+        printf("%d checks failed\n", failures);
+
+    return failures ? 1 : 0;
+}
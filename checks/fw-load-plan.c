@@ -0,0 +1,205 @@
+//
+//  fw-load-plan.c
+//  checks
+//
+//  Host check of the planned 8000 family firmware load in
+//  iwlwifi/pcie/fw-load-plan.h: the plan must pick the same sections with
+//  the same load status bits as the per-section loader, and its chunks
+//  must copy every section exactly once. Build and run from this
+//  directory:
+//
+//      cc -Ihost -I../IntelWifi/IntelWifi/porting -I../IntelWifi/IntelWifi/iwlwifi -o fw-load-plan fw-load-plan.c
+//      ./fw-load-plan
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pcie/fw-load-plan.h"
+
+#define CHUNK_MAX   16
+#define DEV_SIZE    0x1000
+#define MAX_SECS    16
+
+struct sec_spec {
+    u32 offset;     /* device offset, or one of the separators */
+    size_t len;
+    bool no_data;
+};
+
+struct plan_case {
+    const char *name;
+    const struct sec_spec *secs;
+    int num_sec;
+};
+
+static int failures;
+
+#define CHECK(c, cond, ...) do {                                \
+    if (!(cond)) {                                              \
+        printf("FAIL %s: ", (c)->name);                         \
+        printf(__VA_ARGS__);                                    \
+        printf("\n");                                           \
+        failures++;                                             \
+        return;                                                 \
+    }                                                           \
+} while (0)
+
+/*
+ * The sections and status bits iwl_pcie_load_cpu_sections_8000() loads,
+ * CPU1 from the start of the image, CPU2 past the section that ended CPU1.
+ */
+static int legacy_order(const struct fw_img *image, struct iwl_fw_load_step *out)
+{
+    int first = 0, n = 0, cpu, i;
+
+    for (cpu = 1; cpu <= 2; cpu++) {
+        int shift_param = cpu == 1 ? 0 : 16;
+        u32 sec_num = 0x1, last = 0;
+
+        if (cpu == 2)
+            first++;
+
+        for (i = first; i < image->num_sec; i++) {
+            last = i;
+            if (!image->sec[i].data ||
+                image->sec[i].offset == CPU1_CPU2_SEPARATOR_SECTION ||
+                image->sec[i].offset == PAGING_SEPARATOR_SECTION)
+                break;
+
+            out[n].sec = &image->sec[i];
+            out[n].sec_idx = i;
+            out[n].cpu = cpu;
+            out[n].status = sec_num << shift_param;
+            n++;
+            sec_num = (sec_num << 1) | 0x1;
+        }
+        first = last;
+    }
+
+    return n;
+}
+
+static void check_case(const struct plan_case *c)
+{
+    static u8 data[MAX_SECS][DEV_SIZE];
+    static u8 dev[DEV_SIZE];
+    struct fw_desc desc[MAX_SECS];
+    struct fw_img image = { .sec = desc, .num_sec = c->num_sec };
+    struct iwl_fw_load_step plan[MAX_SECS], ref[MAX_SECS];
+    int n, n_ref, i, step = 0, chunks = 0, want_chunks = 0;
+    u32 offset = 0;
+
+    for (i = 0; i < c->num_sec; i++) {
+        size_t j;
+
+        for (j = 0; j < c->secs[i].len; j++)
+            data[i][j] = (u8)(i * 31 + j + 1);
+        desc[i].data = c->secs[i].no_data ? NULL : data[i];
+        desc[i].len = c->secs[i].len;
+        desc[i].offset = c->secs[i].offset;
+        desc[i].blob = NULL;
+    }
+
+    n = iwl_pcie_plan_sections_8000(&image, plan);
+    n_ref = legacy_order(&image, ref);
+
+    CHECK(c, n == n_ref, "%d steps, the per-section loader loads %d", n, n_ref);
+    for (i = 0; i < n; i++) {
+        CHECK(c, plan[i].sec == ref[i].sec && plan[i].cpu == ref[i].cpu &&
+              plan[i].status == ref[i].status,
+              "step %d: section %d cpu %d status 0x%x, expected section %d cpu %d status 0x%x",
+              i, plan[i].sec_idx, plan[i].cpu, plan[i].status,
+              ref[i].sec_idx, ref[i].cpu, ref[i].status);
+        want_chunks += (int)((plan[i].sec->len + CHUNK_MAX - 1) / CHUNK_MAX);
+    }
+
+    /* copy the chunks the way iwl_pcie_load_plan_8000() hands them to the FH */
+    memset(dev, 0, sizeof(dev));
+    while (step < n) {
+        int next_step;
+        u32 next_offset;
+        u32 size = iwl_pcie_plan_chunk_8000(plan, step, offset, CHUNK_MAX, &next_step, &next_offset);
+        u32 dst = plan[step].sec->offset + offset;
+
+        CHECK(c, size > 0 && size <= CHUNK_MAX, "chunk %d is %u bytes", chunks, size);
+        CHECK(c, next_step == step ? next_offset == offset + size :
+              next_step == step + 1 && next_offset == 0 && offset + size == plan[step].sec->len,
+              "chunk %d of step %d at %u doesn't lead to step %d at %u",
+              chunks, step, offset, next_step, next_offset);
+        CHECK(c, dst + size <= DEV_SIZE, "chunk %d lands outside the device", chunks);
+
+        memcpy(dev + dst, (const u8 *)plan[step].sec->data + offset, size);
+        chunks++;
+        step = next_step;
+        offset = next_offset;
+    }
+
+    CHECK(c, chunks == want_chunks, "%d chunks, expected %d", chunks, want_chunks);
+    for (i = 0; i < n; i++)
+        CHECK(c, !memcmp(dev + plan[i].sec->offset, plan[i].sec->data, plan[i].sec->len),
+              "section %d wasn't copied intact", plan[i].sec_idx);
+
+    printf("ok   %s: %d sections, %d chunks\n", c->name, n, chunks);
+}
+
+static const struct sec_spec single_cpu[] = {
+    { 0x000, 40 }, { 0x100, 16 }, { 0x200, 1 },
+};
+
+static const struct sec_spec dual_cpu[] = {
+    { 0x000, 33 }, { 0x100, 32 },
+    { CPU1_CPU2_SEPARATOR_SECTION, 4 },
+    { 0x200, 17 }, { 0x300, 64 },
+    { PAGING_SEPARATOR_SECTION, 4 },
+    { 0x400, 48 }, { 0x500, 48 },
+};
+
+static const struct sec_spec empty_cpu1[] = {
+    { CPU1_CPU2_SEPARATOR_SECTION, 4 },
+    { 0x000, 20 }, { 0x100, 15 },
+};
+
+static const struct sec_spec empty_cpu2[] = {
+    { 0x000, 20 },
+    { CPU1_CPU2_SEPARATOR_SECTION, 4 },
+    { PAGING_SEPARATOR_SECTION, 4 },
+    { 0x100, 20 },
+};
+
+static const struct sec_spec missing_data[] = {
+    { 0x000, 20 }, { 0x100, 20, true }, { 0x200, 20 }, { 0x300, 5 },
+};
+
+static const struct sec_spec many_secs[] = {
+    { 0x000, 1 }, { 0x010, 2 }, { 0x020, 3 }, { 0x030, 4 }, { 0x040, 5 },
+    { 0x050, 6 }, { 0x060, 7 }, { 0x070, 8 }, { 0x080, 9 }, { 0x090, 10 },
+    { CPU1_CPU2_SEPARATOR_SECTION, 4 },
+    { 0x100, 200 }, { 0x200, 16 }, { 0x300, 15 }, { 0x400, 17 },
+};
+
+#define PLAN_CASE(s) { #s, s, ARRAY_SIZE(s) }
+
+static const struct plan_case cases[] = {
+    PLAN_CASE(single_cpu),
+    PLAN_CASE(dual_cpu),
+    PLAN_CASE(empty_cpu1),
+    PLAN_CASE(empty_cpu2),
+    PLAN_CASE(missing_data),
+    PLAN_CASE(many_secs),
+    { "no_sections", NULL, 0 },
+};
+
+int main(void)
+{
+    size_t i;
+
+    for (i = 0; i < ARRAY_SIZE(cases); i++)
+        check_case(&cases[i]);
+
+    if (failures)
+        printf("%d of %zu cases failed\n", failures, ARRAY_SIZE(cases));
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,30 @@
+//
+//  IOBufferMemoryDescriptor.h
+//  checks
+//
+//  Host stand-in for IOBufferMemoryDescriptor, backed by the simulator's
+//  DMA space.
+//
+
+#ifndef host_IOBufferMemoryDescriptor_h
+#define host_IOBufferMemoryDescriptor_h
+
+#include <IOKit/IOMemoryDescriptor.h>
+#include <kern/task.h>
+
+class IOBufferMemoryDescriptor : public IOMemoryDescriptor {
+    OSDeclareDefaultStructors(IOBufferMemoryDescriptor)
+
+public:
+    static IOBufferMemoryDescriptor *inTaskWithPhysicalMask(task_t inTask, IOOptionBits options,
+                                                            vm_size_t capacity,
+                                                            mach_vm_address_t physicalMask);
+    static IOBufferMemoryDescriptor *withCapacity(vm_size_t capacity, IOOptionBits options,
+                                                  bool contiguous = false);
+
+    void *getBytesNoCopy() const { return virt; }
+
+    virtual void free() override;
+};
+
+#endif /* host_IOBufferMemoryDescriptor_h */
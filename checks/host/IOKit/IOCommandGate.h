@@ -0,0 +1,28 @@
+//
+//  IOCommandGate.h
+//  checks
+//
+//  Host stand-in for IOCommandGate, the actions run on the caller's
+//  thread with the work loop gate closed.
+//
+
+#ifndef host_IOCommandGate_h
+#define host_IOCommandGate_h
+
+#include <IOKit/IOEventSource.h>
+
+class IOCommandGate : public IOEventSource {
+    OSDeclareDefaultStructors(IOCommandGate)
+
+public:
+    typedef IOReturn (*Action)(OSObject *owner, void *arg0, void *arg1, void *arg2, void *arg3);
+
+    static IOCommandGate *commandGate(OSObject *owner, Action action = 0);
+
+    IOReturn runCommand(void *arg0 = 0, void *arg1 = 0, void *arg2 = 0, void *arg3 = 0);
+    IOReturn runAction(Action action, void *arg0 = 0, void *arg1 = 0, void *arg2 = 0, void *arg3 = 0);
+
+    virtual bool checkForWork() override { return false; }
+};
+
+#endif /* host_IOCommandGate_h */
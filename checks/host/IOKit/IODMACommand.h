@@ -0,0 +1,53 @@
+//
+//  IODMACommand.h
+//  checks
+//
+//  Host stand-in for IODMACommand. The memory already lives in the DMA
+//  space, generating the segment only hands back its bus address.
+//
+
+#ifndef host_IODMACommand_h
+#define host_IODMACommand_h
+
+#include <IOKit/IOMemoryDescriptor.h>
+
+class IODMACommand : public OSObject {
+    OSDeclareDefaultStructors(IODMACommand)
+
+public:
+    struct Segment64 {
+        UInt64 fIOVMAddr;
+        UInt64 fLength;
+    };
+
+    typedef bool (*SegmentFunction)(IODMACommand *target, Segment64 segment, void *segments, UInt32 segmentIndex);
+
+    enum MappingOptions {
+        kMapped       = 0x00000000,
+        kBypassed     = 0x00000001,
+        kNonCoherent  = 0x00000002,
+    };
+
+    static bool OutputHost64(IODMACommand *target, Segment64 segment, void *segments, UInt32 segmentIndex);
+
+    static IODMACommand *withSpecification(SegmentFunction outSegFunc, UInt8 numAddressBits,
+                                           UInt64 maxSegmentSize, MappingOptions mappingOptions = kMapped,
+                                           UInt64 maxTransferSize = 0, UInt32 alignment = 1);
+
+    IOReturn setMemoryDescriptor(const IOMemoryDescriptor *mem, bool autoPrepare = true);
+    IOReturn clearMemoryDescriptor(bool autoComplete = true);
+    IOReturn prepare(UInt64 offset = 0, UInt64 length = 0) { return kIOReturnSuccess; }
+    IOReturn complete() { return kIOReturnSuccess; }
+
+    IOReturn gen64IOVMSegments(UInt64 *offset, Segment64 *segments, UInt32 *numSegments);
+
+    virtual void free() override;
+
+private:
+    const IOMemoryDescriptor *md;
+    UInt8 numAddressBits;
+};
+
+#define kIODMACommandOutputHost64   (&IODMACommand::OutputHost64)
+
+#endif /* host_IODMACommand_h */
@@ -0,0 +1,43 @@
+//
+//  IOEventSource.h
+//  checks
+//
+//  Host stand-in for IOEventSource. checkForWork() is called on the
+//  work loop thread with the gate closed, and returns true to be called
+//  again before the thread goes to sleep.
+//
+
+#ifndef host_IOEventSource_h
+#define host_IOEventSource_h
+
+#include <IOKit/IOWorkLoop.h>
+
+class IOEventSource : public OSObject {
+    OSDeclareDefaultStructors(IOEventSource)
+
+public:
+    typedef void (*Action)(OSObject *owner, ...);
+
+    virtual bool init(OSObject *owner, Action action = 0);
+
+    virtual void enable() { enabled = true; signalWorkAvailable(); }
+    virtual void disable() { enabled = false; }
+    bool isEnabled() const { return enabled; }
+
+    IOWorkLoop *getWorkLoop() const { return workLoop; }
+    virtual void setWorkLoop(IOWorkLoop *inWorkLoop) { workLoop = inWorkLoop; }
+
+    virtual bool checkForWork() = 0;
+
+    IOEventSource *next;
+
+protected:
+    void signalWorkAvailable() { if (workLoop) workLoop->signalWorkAvailable(); }
+
+    OSObject *owner;
+    Action action;
+    IOWorkLoop *workLoop;
+    volatile bool enabled;
+};
+
+#endif /* host_IOEventSource_h */
@@ -0,0 +1,35 @@
+//
+//  IOFilterInterruptEventSource.h
+//  checks
+//
+//  Host stand-in for IOFilterInterruptEventSource. The simulated device
+//  calls the filter on its own thread, as the primary interrupt handler.
+//
+
+#ifndef host_IOFilterInterruptEventSource_h
+#define host_IOFilterInterruptEventSource_h
+
+#include <IOKit/IOInterruptEventSource.h>
+
+class IOFilterInterruptEventSource : public IOInterruptEventSource {
+    OSDeclareDefaultStructors(IOFilterInterruptEventSource)
+
+public:
+    typedef bool (*Filter)(OSObject *owner, IOFilterInterruptEventSource *sender);
+
+    static IOFilterInterruptEventSource *filterInterruptEventSource(OSObject *owner,
+                                                                    IOInterruptEventSource::Action action,
+                                                                    Filter filter,
+                                                                    IOService *provider,
+                                                                    int intIndex = 0);
+
+    virtual void signalInterrupt();
+    virtual void normalInterruptOccurred(void *nub, IOService *provider, int source) override;
+
+private:
+    Filter filterAction;
+};
+
+typedef IOFilterInterruptEventSource::Filter IOFilterInterruptAction;
+
+#endif /* host_IOFilterInterruptEventSource_h */
@@ -0,0 +1,13 @@
+//
+//  IOInterruptController.h
+//  checks
+//
+//  Host stand-in, the interrupt types live in IOService.h.
+//
+
+#ifndef host_IOInterruptController_h
+#define host_IOInterruptController_h
+
+#include <IOKit/IOService.h>
+
+#endif /* host_IOInterruptController_h */
@@ -0,0 +1,45 @@
+//
+//  IOInterruptEventSource.h
+//  checks
+//
+//  Host stand-in for IOInterruptEventSource. interruptOccurred() may be
+//  called from any thread, the action runs on the work loop.
+//
+
+#ifndef host_IOInterruptEventSource_h
+#define host_IOInterruptEventSource_h
+
+#include <IOKit/IOEventSource.h>
+
+class IOService;
+
+class IOInterruptEventSource : public IOEventSource {
+    OSDeclareDefaultStructors(IOInterruptEventSource)
+
+public:
+    typedef void (*Action)(OSObject *owner, IOInterruptEventSource *sender, int count);
+
+    static IOInterruptEventSource *interruptEventSource(OSObject *owner, Action action,
+                                                        IOService *provider = 0, int intIndex = 0);
+
+    virtual bool init(OSObject *owner, Action action, IOService *provider = 0, int intIndex = 0);
+    virtual void free() override;
+
+    virtual void enable() override;
+    virtual void disable() override;
+
+    virtual void interruptOccurred(void *nub, IOService *provider, int source);
+    virtual void normalInterruptOccurred(void *nub, IOService *provider, int source);
+
+    virtual bool checkForWork() override;
+
+protected:
+    IOService *provider;
+    int intIndex;
+    volatile UInt32 producerCount;
+    UInt32 consumerCount;
+};
+
+typedef IOInterruptEventSource::Action IOInterruptEventAction;
+
+#endif /* host_IOInterruptEventSource_h */
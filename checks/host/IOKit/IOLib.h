@@ -0,0 +1,73 @@
+//
+//  IOLib.h
+//  checks
+//
+//  Host stand-in for the IOLib bits the driver uses. The one-file checks
+//  only need the declarations, the simulator implements them on pthreads
+//  in sim/iokit.cpp.
+//
+
+#ifndef host_IOLib_h
+#define host_IOLib_h
+
+#include <stdio.h>
+
+#include <IOKit/IOTypes.h>
+#include <IOKit/IOReturn.h>
+#include <libkern/OSByteOrder.h>
+#include <kern/clock.h>
+#include <libkern/libkern.h>
+
+#define OS_EXPECT(x, v)     __builtin_expect((x), (v))
+
+/* the kernel log, kept off the checks' own output */
+#define IOLog(fmt, ...)     fprintf(stderr, fmt, ##__VA_ARGS__)
+
+#define PAGE_SHIFT          12
+#define PAGE_SIZE           (1 << PAGE_SHIFT)
+
+typedef uintptr_t pointer_t;
+
+typedef struct host_IOLock IOLock;
+typedef struct host_IOSimpleLock IOSimpleLock;
+typedef struct host_IOThread *IOThread;
+
+#define THREAD_UNINT        0
+#define THREAD_INTERRUPTIBLE 1
+
+#define THREAD_AWAKENED     0
+#define THREAD_TIMED_OUT    1
+#define THREAD_INTERRUPTED  2
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+IOLock *IOLockAlloc(void);
+void IOLockFree(IOLock *lock);
+void IOLockLock(IOLock *lock);
+void IOLockUnlock(IOLock *lock);
+int IOLockSleep(IOLock *lock, void *event, UInt32 interType);
+int IOLockSleepDeadline(IOLock *lock, void *event, AbsoluteTime deadline, UInt32 interType);
+void IOLockWakeup(IOLock *lock, void *event, bool oneThread);
+
+IOSimpleLock *IOSimpleLockAlloc(void);
+void IOSimpleLockFree(IOSimpleLock *lock);
+void IOSimpleLockLock(IOSimpleLock *lock);
+void IOSimpleLockUnlock(IOSimpleLock *lock);
+IOInterruptState IOSimpleLockLockDisableInterrupt(IOSimpleLock *lock);
+void IOSimpleLockUnlockEnableInterrupt(IOSimpleLock *lock, IOInterruptState state);
+
+void *IOMalloc(vm_size_t size);
+void IOFree(void *address, vm_size_t size);
+
+void IODelay(unsigned microseconds);
+void IOSleep(unsigned milliseconds);
+
+IOThread IOThreadSelf(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* host_IOLib_h */
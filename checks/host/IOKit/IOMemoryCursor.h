@@ -0,0 +1,19 @@
+//
+//  IOMemoryCursor.h
+//  checks
+//
+//  Host stand-in for the memory cursor segment type.
+//
+
+#ifndef host_IOMemoryCursor_h
+#define host_IOMemoryCursor_h
+
+#include <IOKit/IOLib.h>
+#include <libkern/c++/OSObject.h>
+
+struct IOPhysicalSegment {
+    IOPhysicalAddress64 location;
+    UInt64 length;
+};
+
+#endif /* host_IOMemoryCursor_h */
@@ -0,0 +1,62 @@
+//
+//  IOMemoryDescriptor.h
+//  checks
+//
+//  Host stand-in for IOMemoryDescriptor and IOMemoryMap. Buffers come
+//  from the simulator's DMA space, which hands out bus addresses that
+//  honour the physical mask, see sim/dma.cpp.
+//
+
+#ifndef host_IOMemoryDescriptor_h
+#define host_IOMemoryDescriptor_h
+
+#include <IOKit/IOLib.h>
+#include <libkern/c++/OSObject.h>
+
+typedef UInt64 mach_vm_address_t;
+typedef UInt64 IOByteCount;
+typedef UInt64 IOVirtualAddress;
+
+enum {
+    kIODirectionNone  = 0x0,
+    kIODirectionIn    = 0x1,
+    kIODirectionOut   = 0x2,
+    kIODirectionInOut = kIODirectionIn | kIODirectionOut,
+};
+
+enum {
+    kIOMemoryPhysicallyContiguous = 0x00000010,
+    kIOMapInhibitCache            = 0x00000100,
+};
+
+class IOMemoryDescriptor : public OSObject {
+    OSDeclareDefaultStructors(IOMemoryDescriptor)
+
+public:
+    virtual IOReturn prepare(IOOptionBits forDirection = 0) { return kIOReturnSuccess; }
+    virtual IOReturn complete(IOOptionBits forDirection = 0) { return kIOReturnSuccess; }
+
+    IOByteCount getLength() const { return length; }
+    IOPhysicalAddress64 getBusAddress() const { return bus; }
+
+protected:
+    void *virt;
+    IOPhysicalAddress64 bus;
+    IOByteCount length;
+};
+
+class IOMemoryMap : public OSObject {
+    OSDeclareDefaultStructors(IOMemoryMap)
+
+public:
+    IOMemoryMap(void *address, IOByteCount length) : address(address), length(length) {}
+
+    IOVirtualAddress getVirtualAddress() const { return (IOVirtualAddress)(uintptr_t)address; }
+    IOByteCount getLength() const { return length; }
+
+private:
+    void *address;
+    IOByteCount length;
+};
+
+#endif /* host_IOMemoryDescriptor_h */
@@ -0,0 +1,29 @@
+//
+//  IOReturn.h
+//  checks
+//
+//  Host stand-in for the IOKit return codes.
+//
+
+#ifndef host_IOReturn_h
+#define host_IOReturn_h
+
+typedef int IOReturn;
+
+#define kIOReturnSuccess        0
+#define kIOReturnError          ((IOReturn)0xe00002bc)
+#define kIOReturnNoMemory       ((IOReturn)0xe00002bd)
+#define kIOReturnNoResources    ((IOReturn)0xe00002be)
+#define kIOReturnBadArgument    ((IOReturn)0xe00002c2)
+#define kIOReturnUnsupported    ((IOReturn)0xe00002c7)
+#define kIOReturnNotReady       ((IOReturn)0xe00002d8)
+#define kIOReturnNotFound       ((IOReturn)0xe00002f0)
+#define kIOReturnTimeout        ((IOReturn)0xe00002d6)
+#define kIOReturnMessageTooLarge ((IOReturn)0xe00002eb)
+
+/* IONetworkController's outputPacket() results */
+#define kIOReturnOutputSuccess  0x00
+#define kIOReturnOutputStall    0x01
+#define kIOReturnOutputDropped  0x02
+
+#endif /* host_IOReturn_h */
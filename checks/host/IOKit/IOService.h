@@ -0,0 +1,82 @@
+//
+//  IOService.h
+//  checks
+//
+//  Host stand-in for IOService: the matching and power management calls
+//  the driver makes are accepted and ignored, the interrupt registration
+//  is what the simulated device drives.
+//
+
+#ifndef host_IOService_h
+#define host_IOService_h
+
+#include <IOKit/IOLib.h>
+#include <libkern/c++/OSObject.h>
+
+class IOWorkLoop;
+class IOService;
+
+typedef void (*IOInterruptAction)(OSObject *target, void *refCon, IOService *nub, int source);
+
+#define kIOInterruptTypeEdge        0
+#define kIOInterruptTypeLevel       1
+#define kIOInterruptTypePCIMessaged 0x10000
+
+/* pwr_mgt/IOPM.h */
+enum {
+    kIOPMPowerStateVersion1 = 1,
+};
+
+enum {
+    kIOPMPowerOn      = 0x00000002,
+    kIOPMDeviceUsable = 0x00008000,
+};
+
+struct IOPMPowerState {
+    unsigned long version;
+    unsigned long capabilityFlags;
+    unsigned long outputPowerCharacter;
+    unsigned long inputPowerRequirement;
+    unsigned long staticPower;
+    unsigned long unbudgetedPower;
+    unsigned long powerToAttain;
+    unsigned long timeToAttain;
+    unsigned long settleUpTime;
+    unsigned long timeToLower;
+    unsigned long settleDownTime;
+    unsigned long powerDomainBudget;
+};
+
+class IOService : public OSObject {
+    OSDeclareDefaultStructors(IOService)
+
+public:
+    virtual bool init(OSDictionary *dictionary = 0) { return true; }
+    virtual IOService *probe(IOService *provider, SInt32 *score) { return this; }
+    virtual bool start(IOService *provider) { return true; }
+    virtual void stop(IOService *provider) {}
+
+    virtual OSObject *getProperty(const char *aKey) const { return 0; }
+    virtual void registerService(unsigned int options = 0) {}
+    virtual IOWorkLoop *getWorkLoop() const { return 0; }
+
+    virtual IOReturn registerInterrupt(int source, OSObject *target, IOInterruptAction handler, void *refCon = 0)
+    {
+        return kIOReturnUnsupported;
+    }
+    virtual IOReturn unregisterInterrupt(int source) { return kIOReturnUnsupported; }
+    virtual IOReturn getInterruptType(int source, int *interruptType) { return kIOReturnUnsupported; }
+    virtual IOReturn enableInterrupt(int source) { return kIOReturnUnsupported; }
+    virtual IOReturn disableInterrupt(int source) { return kIOReturnUnsupported; }
+
+    void PMinit() {}
+    void PMstop() {}
+    void joinPMtree(IOService *driver) {}
+    IOReturn registerPowerDriver(IOService *controllingDriver, IOPMPowerState *powerStates,
+                                 unsigned long numberOfStates) { return kIOReturnSuccess; }
+    IOReturn changePowerStateTo(unsigned long ordinal) { return kIOReturnSuccess; }
+    IOReturn makeUsable() { return kIOReturnSuccess; }
+    IOReturn setIdleTimerPeriod(unsigned long period) { return kIOReturnSuccess; }
+};
+
+#endif /* host_IOService_h */
@@ -0,0 +1,39 @@
+//
+//  IOTimerEventSource.h
+//  checks
+//
+//  Host stand-in for IOTimerEventSource, one shot like the kernel one.
+//
+
+#ifndef host_IOTimerEventSource_h
+#define host_IOTimerEventSource_h
+
+#include <IOKit/IOEventSource.h>
+
+class IOTimerEventSource : public IOEventSource {
+    OSDeclareDefaultStructors(IOTimerEventSource)
+
+public:
+    typedef void (*Action)(OSObject *owner, IOTimerEventSource *sender);
+
+    static IOTimerEventSource *timerEventSource(OSObject *owner, Action action = 0);
+
+    IOReturn setTimeout(AbsoluteTime deadline);
+    IOReturn setTimeoutUS(UInt32 interval) { return setTimeout(mach_absolute_time() + (UInt64)interval * kMicrosecondScale); }
+    IOReturn setTimeoutMS(UInt32 interval) { return setTimeout(mach_absolute_time() + (UInt64)interval * kMillisecondScale); }
+    void cancelTimeout();
+
+    void setRefcon(void *refcon) { this->refcon = refcon; }
+    void *getRefcon() const { return refcon; }
+
+    /* next deadline, 0 if the timer isn't armed */
+    AbsoluteTime getDeadline() const { return deadline; }
+
+    virtual bool checkForWork() override;
+
+private:
+    volatile AbsoluteTime deadline;
+    void *refcon;
+};
+
+#endif /* host_IOTimerEventSource_h */
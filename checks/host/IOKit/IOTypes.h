@@ -0,0 +1,18 @@
+//
+//  IOTypes.h
+//  checks
+//
+//  Host stand-in for the IOKit types the porting headers use.
+//
+
+#ifndef host_IOTypes_h
+#define host_IOTypes_h
+
+#include <libkern/OSTypes.h>
+
+typedef UInt64 IOPhysicalAddress64;
+typedef size_t vm_size_t;
+typedef int IOInterruptState;
+typedef UInt32 IOOptionBits;
+
+#endif /* host_IOTypes_h */
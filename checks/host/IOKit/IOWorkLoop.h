@@ -0,0 +1,56 @@
+//
+//  IOWorkLoop.h
+//  checks
+//
+//  Host stand-in for IOWorkLoop: a pthread serving its event sources
+//  with the gate closed, like the kernel one. runAction() closes the gate
+//  on the caller's thread.
+//
+
+#ifndef host_IOWorkLoop_h
+#define host_IOWorkLoop_h
+
+#include <IOKit/IOLib.h>
+#include <libkern/c++/OSObject.h>
+
+#define APPLE_KEXT_OVERRIDE     override
+
+class IOEventSource;
+struct host_IOWorkLoopState;
+
+class IOWorkLoop : public OSObject {
+    OSDeclareDefaultStructors(IOWorkLoop)
+
+public:
+    typedef IOReturn (*Action)(OSObject *target, void *arg0, void *arg1, void *arg2, void *arg3);
+
+    static IOWorkLoop *workLoop();
+
+    virtual bool init() override;
+    virtual void free() override;
+
+    IOReturn addEventSource(IOEventSource *newEvent);
+    IOReturn removeEventSource(IOEventSource *toRemove);
+
+    IOReturn runAction(Action action, OSObject *target,
+                       void *arg0 = 0, void *arg1 = 0, void *arg2 = 0, void *arg3 = 0);
+
+    virtual void openGate();
+    virtual void closeGate();
+    virtual bool tryCloseGate();
+    virtual int sleepGate(void *event, UInt32 interuptibleType);
+    virtual void wakeupGate(void *event, bool oneThread);
+    bool onThread() const;
+    bool inGate() const;
+
+    /* wake the thread up to look at the event sources again */
+    void signalWorkAvailable();
+
+private:
+    static void *threadMain(void *arg);
+    void threadLoop();
+
+    host_IOWorkLoopState *state;
+};
+
+#endif /* host_IOWorkLoop_h */
@@ -0,0 +1,15 @@
+//
+//  IOEthernetController.h
+//  checks
+//
+//  Host stand-in, the driver only includes it. IOEthernetAddress comes
+//  with the IO80211 stand-in, sim/sim-80211.h.
+//
+
+#ifndef host_IOEthernetController_h
+#define host_IOEthernetController_h
+
+#include <IOKit/IOService.h>
+#include <sys/kpi_mbuf.h>
+
+#endif /* host_IOEthernetController_h */
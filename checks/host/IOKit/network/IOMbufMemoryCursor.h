@@ -0,0 +1,37 @@
+//
+//  IOMbufMemoryCursor.h
+//  checks
+//
+//  Host stand-in for IOMbufNaturalMemoryCursor over the simulator's
+//  mbufs, whose data lives in the DMA space. Segments are cut at
+//  maxSegmentSize, a chain that needs more than the caller's segments is
+//  copied into a single buffer first, as the kernel one does.
+//
+
+#ifndef host_IOMbufMemoryCursor_h
+#define host_IOMbufMemoryCursor_h
+
+#include <IOKit/IOMemoryCursor.h>
+#include <sys/kpi_mbuf.h>
+
+class IOMbufNaturalMemoryCursor : public OSObject {
+    OSDeclareDefaultStructors(IOMbufNaturalMemoryCursor)
+
+public:
+    static IOMbufNaturalMemoryCursor *withSpecification(UInt32 maxSegmentSize, UInt32 maxNumSegments);
+
+    UInt32 getPhysicalSegments(mbuf_t packet, IOPhysicalSegment *vector, UInt32 numVectorSegments = 0);
+    UInt32 getPhysicalSegmentsWithCoalesce(mbuf_t packet, IOPhysicalSegment *vector,
+                                           UInt32 numVectorSegments = 0);
+
+    /* chains copied into a single buffer so far */
+    UInt32 coalesced;
+
+private:
+    UInt32 genSegments(mbuf_t packet, IOPhysicalSegment *vector, UInt32 max);
+
+    UInt32 maxSegmentSize;
+    UInt32 maxNumSegments;
+};
+
+#endif /* host_IOMbufMemoryCursor_h */
@@ -0,0 +1,14 @@
+//
+//  IOPacketQueue.h
+//  checks
+//
+//  Host stand-in, the driver only includes it.
+//
+
+#ifndef host_IOPacketQueue_h
+#define host_IOPacketQueue_h
+
+#include <libkern/c++/OSObject.h>
+#include <sys/kpi_mbuf.h>
+
+#endif /* host_IOPacketQueue_h */
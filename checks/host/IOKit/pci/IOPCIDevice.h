@@ -0,0 +1,39 @@
+//
+//  IOPCIDevice.h
+//  checks
+//
+//  Host stand-in for IOPCIDevice. The simulated device subclasses it,
+//  see sim/SimDevice.h.
+//
+
+#ifndef host_IOPCIDevice_h
+#define host_IOPCIDevice_h
+
+#include <IOKit/IOService.h>
+#include <IOKit/IOMemoryDescriptor.h>
+
+enum {
+    kIOPCIConfigVendorID        = 0x00,
+    kIOPCIConfigDeviceID        = 0x02,
+    kIOPCIConfigCommand         = 0x04,
+    kIOPCIConfigRevisionID      = 0x08,
+    kIOPCIConfigBaseAddress0    = 0x10,
+    kIOPCIConfigSubSystemVendorID = 0x2c,
+    kIOPCIConfigSubSystemID     = 0x2e,
+};
+
+#define kIOPCIExpressLinkCapabilitiesKey    "IOPCIExpressLinkCapabilities"
+
+class IOPCIDevice : public IOService {
+    OSDeclareDefaultStructors(IOPCIDevice)
+
+public:
+    virtual UInt16 configRead16(UInt8 offset) = 0;
+    virtual UInt32 configRead32(UInt8 offset) = 0;
+    virtual void configWrite8(UInt8 offset, UInt8 data) = 0;
+    virtual bool setBusMasterEnable(bool enable) = 0;
+    virtual bool setMemoryEnable(bool enable) = 0;
+    virtual IOMemoryMap *mapDeviceMemoryWithRegister(UInt8 reg, IOOptionBits options = 0) = 0;
+};
+
+#endif /* host_IOPCIDevice_h */
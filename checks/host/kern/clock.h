@@ -0,0 +1,58 @@
+//
+//  clock.h
+//  checks
+//
+//  Host stand-in for the Mach absolute time, in nanoseconds.
+//
+
+#ifndef host_clock_h
+#define host_clock_h
+
+#include <time.h>
+
+#include <libkern/OSTypes.h>
+
+typedef UInt64 AbsoluteTime;
+
+/* mach/clock_types.h */
+#define NSEC_PER_USEC   1000ull
+#define NSEC_PER_MSEC   1000000ull
+#define NSEC_PER_SEC    1000000000ull
+#define USEC_PER_SEC    1000000ull
+
+enum {
+    kNanosecondScale  = 1,
+    kMicrosecondScale = 1000,
+    kMillisecondScale = 1000 * 1000,
+    kSecondScale      = 1000 * 1000 * 1000,
+};
+
+static inline UInt64 mach_absolute_time(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (UInt64)ts.tv_sec * 1000000000ULL + (UInt64)ts.tv_nsec;
+}
+
+static inline void absolutetime_to_nanoseconds(UInt64 abstime, UInt64 *result)
+{
+    *result = abstime;
+}
+
+static inline void nanoseconds_to_absolutetime(UInt64 nanoseconds, UInt64 *result)
+{
+    *result = nanoseconds;
+}
+
+static inline void clock_get_uptime(UInt64 *result)
+{
+    *result = mach_absolute_time();
+}
+
+static inline void clock_interval_to_deadline(UInt32 interval, UInt32 scale_factor, UInt64 *result)
+{
+    *result = mach_absolute_time() + (UInt64)interval * scale_factor;
+}
+
+#endif /* host_clock_h */
@@ -0,0 +1,15 @@
+//
+//  task.h
+//  checks
+//
+//  Host stand-in for the kernel task, the simulator has a single one.
+//
+
+#ifndef host_task_h
+#define host_task_h
+
+typedef struct host_task *task_t;
+
+#define kernel_task     ((task_t)0)
+
+#endif /* host_task_h */
@@ -0,0 +1,54 @@
+//
+//  OSAtomic.h
+//  checks
+//
+//  Host stand-in for the libkern atomics, on top of the compiler builtins.
+//
+
+#ifndef host_OSAtomic_h
+#define host_OSAtomic_h
+
+#include <libkern/OSTypes.h>
+
+static inline Boolean host_OSCompareAndSwap(UInt32 oldValue, UInt32 newValue, volatile UInt32 *address)
+{
+    return __atomic_compare_exchange_n(address, &oldValue, newValue, false,
+                                       __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+static inline Boolean host_OSCompareAndSwap64(UInt64 oldValue, UInt64 newValue, volatile UInt64 *address)
+{
+    return __atomic_compare_exchange_n(address, &oldValue, newValue, false,
+                                       __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+static inline Boolean OSCompareAndSwapPtr(void *oldValue, void *newValue, void * volatile *address)
+{
+    return __atomic_compare_exchange_n(address, &oldValue, newValue, false,
+                                       __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+static inline SInt32 host_OSAddAtomic(SInt32 amount, volatile SInt32 *address)
+{
+    return __atomic_fetch_add(address, amount, __ATOMIC_SEQ_CST);
+}
+
+static inline SInt64 host_OSAddAtomic64(SInt64 amount, volatile SInt64 *address)
+{
+    return __atomic_fetch_add(address, amount, __ATOMIC_SEQ_CST);
+}
+
+/* like libkern, the pointers are cast to the type of the call */
+#define OSCompareAndSwap(o, n, a)   host_OSCompareAndSwap((o), (n), (volatile UInt32 *)(a))
+#define OSCompareAndSwap64(o, n, a) host_OSCompareAndSwap64((o), (n), (volatile UInt64 *)(a))
+#define OSAddAtomic(v, a)           host_OSAddAtomic((v), (volatile SInt32 *)(a))
+#define OSAddAtomic64(v, a)         host_OSAddAtomic64((v), (volatile SInt64 *)(a))
+#define OSIncrementAtomic(a)    OSAddAtomic(1, (a))
+#define OSDecrementAtomic(a)    OSAddAtomic(-1, (a))
+#define OSIncrementAtomic64(a)  OSAddAtomic64(1, (a))
+#define OSMemoryBarrier()       __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+/* os/base.h */
+#define os_compiler_barrier()   __asm__ __volatile__("" ::: "memory")
+
+#endif /* host_OSAtomic_h */
@@ -0,0 +1,28 @@
+//
+//  OSByteOrder.h
+//  checks
+//
+//  Host stand-in for libkern/OSByteOrder.h. The driver only uses the
+//  little endian accessors on the register BAR, so they are the
+//  simulated device's MMIO entry points rather than plain loads.
+//
+
+#ifndef host_OSByteOrder_h
+#define host_OSByteOrder_h
+
+#include <libkern/OSTypes.h>
+
+#define OS_INLINE   static inline
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void OSWriteLittleInt32(volatile void *base, uintptr_t byteOffset, UInt32 data);
+UInt32 OSReadLittleInt32(const volatile void *base, uintptr_t byteOffset);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* host_OSByteOrder_h */
@@ -0,0 +1,35 @@
+//
+//  OSKextLib.h
+//  checks
+//
+//  Host stand-in for the kext resource requests. The simulator serves
+//  them from the firmware directory of the kext.
+//
+
+#ifndef host_OSKextLib_h
+#define host_OSKextLib_h
+
+#include <libkern/OSReturn.h>
+#include <libkern/OSTypes.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef UInt32 OSKextRequestTag;
+
+typedef void (*OSKextRequestResourceCallback)(OSKextRequestTag requestTag, OSReturn result,
+                                              const void *resourceData, UInt32 resourceDataLength,
+                                              void *context);
+
+const char *OSKextGetCurrentIdentifier(void);
+
+OSReturn OSKextRequestResource(const char *kextIdentifier, const char *resourceName,
+                               OSKextRequestResourceCallback callback, void *context,
+                               OSKextRequestTag *requestTagOut);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* host_OSKextLib_h */
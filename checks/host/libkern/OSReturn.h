@@ -0,0 +1,16 @@
+//
+//  OSReturn.h
+//  checks
+//
+//  Host stand-in for the libkern return codes.
+//
+
+#ifndef host_OSReturn_h
+#define host_OSReturn_h
+
+typedef int OSReturn;
+
+#define kOSReturnSuccess    0
+#define kOSReturnError      0xdc000001
+
+#endif /* host_OSReturn_h */
@@ -0,0 +1,40 @@
+//
+//  OSTypes.h
+//  checks
+//
+//  Host stand-in for the libkern types the porting headers use.
+//
+
+#ifndef host_OSTypes_h
+#define host_OSTypes_h
+
+/* before the porting headers define __init and friends */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef uint8_t  UInt8;
+typedef uint16_t UInt16;
+typedef uint32_t UInt32;
+typedef uint64_t UInt64;
+typedef int8_t   SInt8;
+typedef int16_t  SInt16;
+typedef int32_t  SInt32;
+typedef int64_t  SInt64;
+typedef bool     Boolean;
+
+/* from the kernel's sys/types.h */
+typedef int64_t  user_time_t;
+
+/* from the Darwin sys/cdefs.h */
+#ifndef __unused
+#define __unused            __attribute__((unused))
+#endif
+
+#define OS_STRINGIFY1(x)    #x
+#define OS_STRINGIFY(x)     OS_STRINGIFY1(x)
+
+#endif /* host_OSTypes_h */
@@ -0,0 +1,82 @@
+//
+//  OSObject.h
+//  checks
+//
+//  Host stand-in for the libkern object model: a reference count and
+//  the RTTI casts, no meta classes.
+//
+
+#ifndef host_OSObject_h
+#define host_OSObject_h
+
+#include <libkern/OSTypes.h>
+#include <libkern/OSAtomic.h>
+
+#include <stdlib.h>
+
+class OSObject {
+public:
+    OSObject() : retainCount(1) {}
+    virtual ~OSObject() {}
+
+    /* libkern hands out zeroed objects, the drivers rely on it */
+    static void *operator new(size_t size) { return calloc(1, size); }
+    static void operator delete(void *mem) { ::free(mem); }
+
+    virtual bool init() { return true; }
+    virtual void free() { delete this; }
+
+    void retain() const { OSIncrementAtomic(&retainCount); }
+    void release() const
+    {
+        if (OSDecrementAtomic(&retainCount) == 1)
+            const_cast<OSObject *>(this)->free();
+    }
+    int getRetainCount() const { return retainCount; }
+
+private:
+    mutable volatile SInt32 retainCount;
+};
+
+#define OSDynamicCast(type, inst)   dynamic_cast<type *>((OSObject *)(inst))
+#define OSTypeAlloc(type)           (new type)
+
+#define OSDeclareDefaultStructors(className)    public:
+#define OSDefineMetaClassAndStructors(className, superclassName)
+
+class OSString : public OSObject {
+public:
+    static OSString *withCString(const char *cString);
+    const char *getCStringNoCopy() const { return string; }
+
+private:
+    ~OSString() { ::free(string); }
+    char *string;
+};
+
+class OSNumber : public OSObject {
+public:
+    static OSNumber *withNumber(unsigned long long value, unsigned int numberOfBits)
+    {
+        OSNumber *me = new OSNumber;
+
+        me->value = value;
+        me->size = numberOfBits;
+        return me;
+    }
+    UInt32 unsigned32BitValue() const { return (UInt32)value; }
+    UInt64 unsigned64BitValue() const { return value; }
+    unsigned int numberOfBits() const { return size; }
+
+private:
+    UInt64 value;
+    unsigned int size;
+};
+
+/* nothing the simulator runs looks anything up, it only carries the pointer */
+class OSDictionary : public OSObject {
+public:
+    static OSDictionary *withCapacity(unsigned int capacity) { return new OSDictionary; }
+};
+
+#endif /* host_OSObject_h */
@@ -0,0 +1,21 @@
+//
+//  libkern.h
+//  checks
+//
+//  Host stand-in for the libkern helpers the driver uses.
+//
+
+#ifndef host_libkern_h
+#define host_libkern_h
+
+static inline unsigned int min(unsigned int a, unsigned int b)
+{
+    return a < b ? a : b;
+}
+
+static inline unsigned int max(unsigned int a, unsigned int b)
+{
+    return a > b ? a : b;
+}
+
+#endif /* host_libkern_h */
@@ -0,0 +1,19 @@
+//
+//  log.h
+//  checks
+//
+//  Host stand-in for os_log, to stdout.
+//
+
+#ifndef host_os_log_h
+#define host_os_log_h
+
+#include <stdio.h>
+
+#define OS_LOG_DEFAULT      NULL
+
+#define os_log(log, fmt, ...)       ((void)(log), printf(fmt "\n", ##__VA_ARGS__))
+#define os_log_error(log, fmt, ...) os_log(log, fmt, ##__VA_ARGS__)
+#define os_log_info(log, fmt, ...)  os_log(log, fmt, ##__VA_ARGS__)
+
+#endif /* host_os_log_h */
@@ -0,0 +1,19 @@
+//
+//  pexpert.h
+//  checks
+//
+//  Host stand-in for the boot-args lookup, read from the IWL_BOOT_ARGS
+//  environment variable, e.g. IWL_BOOT_ARGS="iwl_rx_inline=1".
+//
+
+#ifndef host_pexpert_h
+#define host_pexpert_h
+
+#include <libkern/OSTypes.h>
+
+#ifdef __cplusplus
+extern "C"
+#endif
+Boolean PE_parse_boot_argn(const char *arg_string, void *arg_ptr, int max_arg);
+
+#endif /* host_pexpert_h */
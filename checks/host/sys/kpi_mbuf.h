@@ -0,0 +1,53 @@
+//
+//  kpi_mbuf.h
+//  checks
+//
+//  Host stand-in for the mbuf KPI the driver uses. The one-file checks
+//  only need the declarations, the simulator implements them in
+//  sim/mbuf.cpp with the data in its DMA space.
+//
+
+#ifndef host_kpi_mbuf_h
+#define host_kpi_mbuf_h
+
+#include <IOKit/IOTypes.h>
+#include <sys/errno.h>
+
+typedef struct __mbuf *mbuf_t;
+typedef UInt32 mbuf_tag_id_t;
+typedef UInt16 mbuf_tag_type_t;
+typedef int errno_t;
+
+typedef enum {
+    MBUF_WAITOK = 0,
+    MBUF_DONTWAIT = 1,
+} mbuf_how_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+errno_t mbuf_allocpacket(mbuf_how_t how, size_t packetlen, unsigned int *maxchunks, mbuf_t *mbuf);
+errno_t mbuf_copyback(mbuf_t mbuf, size_t offset, size_t length, const void *data, mbuf_how_t how);
+errno_t mbuf_copydata(mbuf_t mbuf, size_t offset, size_t length, void *out_data);
+void mbuf_freem(mbuf_t mbuf);
+int mbuf_freem_list(mbuf_t mbuf);
+void *mbuf_data(mbuf_t mbuf);
+size_t mbuf_len(mbuf_t mbuf);
+mbuf_t mbuf_next(mbuf_t mbuf);
+size_t mbuf_pkthdr_len(mbuf_t mbuf);
+mbuf_t mbuf_nextpkt(mbuf_t mbuf);
+void mbuf_setnextpkt(mbuf_t mbuf, mbuf_t nextpkt);
+
+errno_t mbuf_tag_id_find(const char *module_string, mbuf_tag_id_t *module_id);
+errno_t mbuf_tag_allocate(mbuf_t mbuf, mbuf_tag_id_t module_id, mbuf_tag_type_t type, size_t length,
+                          mbuf_how_t how, void **data_p);
+errno_t mbuf_tag_find(mbuf_t mbuf, mbuf_tag_id_t module_id, mbuf_tag_type_t type, size_t *length,
+                      void **data_p);
+void mbuf_tag_free(mbuf_t mbuf, mbuf_tag_id_t module_id, mbuf_tag_type_t type);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* host_kpi_mbuf_h */
@@ -0,0 +1,267 @@
+//
+//  lat-hist.c
+//  checks
+//
+//  Host check of the latency histograms in common/lat_shared.h and
+//  iwlwifi/iwl-lat.h, and of how iwmc reads them. Every bucket has to
+//  take exactly the values from the end of the one before it to
+//  iwl_lat_bucket_max(), be no wider than 1/IWL_LAT_SUB of them, and the
+//  last one has to take everything above. iwmc's percentiles have to be
+//  the nearest rank rounded up to the end of its bucket. Threads racing
+//  to record host commands have to end up with one slot per command ID,
+//  the overflow in the last one, and every sample counted. Build and run
+//  from this directory:
+//
+//      cc -Ihost -I../IntelWifi/IntelWifi/porting -I../IntelWifi/IntelWifi/iwlwifi -I../IntelWifi/IntelWifi -I../common -I../iwmc/iwmc -o lat-hist lat-hist.c ../iwmc/iwmc/stats.c -lpthread
+//      ./lat-hist
+//
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "iwl-lat.h"
+#include "stats.h"
+
+#define EXHAUSTIVE_NS   (1 << 22)
+#define PCT_SAMPLES     100000
+#define HCMD_THREADS    4
+#define HCMD_IDS        (IWL_LAT_HCMD_SLOTS + 16)
+#define HCMD_ROUNDS     2000        /* per thread, each round records every ID */
+
+static int failures;
+
+#define CHECK(name, cond, ...) do {                             \
+    if (!(cond)) {                                              \
+        printf("FAIL %s: ", (name));                            \
+        printf(__VA_ARGS__);                                    \
+        printf("\n");                                           \
+        failures++;                                             \
+        return;                                                 \
+    }                                                           \
+} while (0)
+
+static uint64_t bucket_min(uint32_t idx)
+{
+    return idx ? iwl_lat_bucket_max(idx - 1) + 1 : 0;
+}
+
+static void check_buckets(const char *name)
+{
+    uint32_t last = IWL_LAT_BUCKETS - 1;
+
+    for (uint32_t idx = 0; idx < IWL_LAT_BUCKETS; idx++) {
+        uint64_t min = bucket_min(idx), max = iwl_lat_bucket_max(idx), width = max - min + 1;
+
+        CHECK(name, max >= min, "bucket %u runs from %llu to %llu", idx, (unsigned long long)min,
+              (unsigned long long)max);
+        CHECK(name, iwl_lat_bucket(min) == idx && iwl_lat_bucket(max) == idx,
+              "bucket %u is %llu to %llu, they land in %u and %u", idx, (unsigned long long)min,
+              (unsigned long long)max, iwl_lat_bucket(min), iwl_lat_bucket(max));
+        /* the first octave is exact, the others split theirs in IWL_LAT_SUB */
+        CHECK(name, idx < IWL_LAT_SUB ? width == 1 : width * IWL_LAT_SUB <= min &&
+              width == 1ULL << (idx / IWL_LAT_SUB - 1),
+              "bucket %u is %llu wide from %llu", idx, (unsigned long long)width, (unsigned long long)min);
+    }
+
+    CHECK(name, iwl_lat_bucket_max(last) == (1ULL << IWL_LAT_MAX_BITS) - 1,
+          "the last bucket ends at %llu", (unsigned long long)iwl_lat_bucket_max(last));
+    for (int bit = IWL_LAT_MAX_BITS; bit < 64; bit++) {
+        uint64_t ns = 1ULL << bit;
+
+        CHECK(name, iwl_lat_bucket(ns) == last && iwl_lat_bucket(ns | (ns - 1)) == last,
+              "2^%d ns lands in %u, 2^%d - 1 in %u", bit, iwl_lat_bucket(ns), bit + 1,
+              iwl_lat_bucket(ns | (ns - 1)));
+    }
+
+    printf("ok   %s: %d buckets up to %llu ns\n", name, IWL_LAT_BUCKETS,
+           (unsigned long long)iwl_lat_bucket_max(last));
+}
+
+/* every value up to EXHAUSTIVE_NS, then the edges of every octave */
+static void check_values(const char *name)
+{
+    uint32_t prev = 0;
+
+    for (uint64_t ns = 0; ns < EXHAUSTIVE_NS; ns++) {
+        uint32_t idx = iwl_lat_bucket(ns);
+
+        CHECK(name, idx == prev || idx == prev + 1, "%llu ns lands in %u after %u",
+              (unsigned long long)ns, idx, prev);
+        CHECK(name, ns >= bucket_min(idx) && ns <= iwl_lat_bucket_max(idx), "%llu ns lands in %u, %llu to %llu",
+              (unsigned long long)ns, idx, (unsigned long long)bucket_min(idx),
+              (unsigned long long)iwl_lat_bucket_max(idx));
+        prev = idx;
+    }
+
+    for (int bit = 1; bit < IWL_LAT_MAX_BITS; bit++) {
+        uint64_t edge = 1ULL << bit;
+
+        CHECK(name, iwl_lat_bucket(edge) == iwl_lat_bucket(edge - 1) + 1 &&
+              iwl_lat_bucket_max(iwl_lat_bucket(edge - 1)) == edge - 1,
+              "2^%d ns doesn't start a bucket", bit);
+    }
+
+    printf("ok   %s: every value to %d ns, the octave edges to 2^%d\n", name, EXHAUSTIVE_NS,
+           IWL_LAT_MAX_BITS);
+}
+
+static void hist_add(struct iwl_lat_hist *h, uint64_t ns)
+{
+    h->buckets[iwl_lat_bucket(ns)]++;
+    h->count++;
+    h->sum += ns;
+    if (ns > h->max)
+        h->max = ns;
+}
+
+/* iwmc's percentile of @h against the nearest rank in @sorted */
+static int pct_ok(const struct iwl_lat_hist *h, const uint64_t *sorted, double q, uint64_t *got,
+                  uint64_t *want)
+{
+    uint64_t rank = (uint64_t)(q * h->count);
+
+    if (rank < q * h->count || !rank)
+        rank++;
+    *want = sorted[rank - 1];
+    *got = iwmc_lat_percentile(h, q);
+
+    return *got == (iwl_lat_bucket_max(iwl_lat_bucket(*want)) < h->max ?
+                    iwl_lat_bucket_max(iwl_lat_bucket(*want)) : h->max);
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static void check_percentiles(const char *name)
+{
+    static const double qs[] = { 0.5, 0.9, 0.99, 0.999, 1.0 };
+    static struct iwl_lat_hist h;
+    static uint64_t samples[PCT_SAMPLES];
+    uint64_t got, want;
+
+    memset(&h, 0, sizeof(h));
+    CHECK(name, !iwmc_lat_percentile(&h, 0.5), "p50 of nothing is %llu",
+          (unsigned long long)iwmc_lat_percentile(&h, 0.5));
+
+    hist_add(&h, 12345);
+    for (size_t i = 0; i < sizeof(qs) / sizeof(qs[0]); i++)
+        CHECK(name, iwmc_lat_percentile(&h, qs[i]) == 12345, "p%g of one 12345 ns sample is %llu",
+              qs[i] * 100, (unsigned long long)iwmc_lat_percentile(&h, qs[i]));
+
+    /* half at 3 ns and half at 7, both exact: p50 is 3, anything above is 7 */
+    memset(&h, 0, sizeof(h));
+    for (int i = 0; i < 1000; i++)
+        hist_add(&h, i < 500 ? 3 : 7);
+    CHECK(name, iwmc_lat_percentile(&h, 0.5) == 3 && iwmc_lat_percentile(&h, 0.501) == 7,
+          "p50 and p50.1 of 500 samples of 3 ns and 500 of 7 are %llu and %llu",
+          (unsigned long long)iwmc_lat_percentile(&h, 0.5), (unsigned long long)iwmc_lat_percentile(&h, 0.501));
+
+    /* 1 to PCT_SAMPLES ns, then a spread over the whole range with a tail */
+    for (int shape = 0; shape < 2; shape++) {
+        memset(&h, 0, sizeof(h));
+        srand(4);
+        for (int i = 0; i < PCT_SAMPLES; i++) {
+            samples[i] = shape ? (uint64_t)rand() % 50000 + 1000 : (uint64_t)i + 1;
+            if (shape && i % 500 == 0)
+                samples[i] <<= 8 + i % 20;
+            hist_add(&h, samples[i]);
+        }
+        qsort(samples, PCT_SAMPLES, sizeof(samples[0]), cmp_u64);
+
+        for (size_t i = 0; i < sizeof(qs) / sizeof(qs[0]); i++)
+            CHECK(name, pct_ok(&h, samples, qs[i], &got, &want),
+                  "shape %d: p%g is %llu, the sample at that rank is %llu", shape, qs[i] * 100,
+                  (unsigned long long)got, (unsigned long long)want);
+    }
+
+    printf("ok   %s: p50 to p100 of %d samples\n", name, PCT_SAMPLES);
+}
+
+static struct iwl_lat_stats lat;
+
+static void *hcmd_recorder(void *arg)
+{
+    uint32_t first = (uint32_t)(uintptr_t)arg;
+
+    for (int round = 0; round < HCMD_ROUNDS; round++) {
+        /* each thread goes through the IDs from a different one, the slots get raced for */
+        for (uint32_t i = 0; i < HCMD_IDS; i++)
+            iwl_lat_record_hcmd(&lat, (first + i) % HCMD_IDS, mach_absolute_time());
+        if (round % 64 == 0)
+            sched_yield();
+    }
+    return NULL;
+}
+
+static void check_hcmd_slots(const char *name)
+{
+    pthread_t threads[HCMD_THREADS];
+    int owner[HCMD_IDS];
+    uint64_t per_id = (uint64_t)HCMD_THREADS * HCMD_ROUNDS, total = 0;
+
+    memset(&lat, 0, sizeof(lat));
+    iwl_lat_init(&lat);
+    for (int i = 0; i < HCMD_THREADS; i++)
+        pthread_create(&threads[i], NULL, hcmd_recorder, (void *)(uintptr_t)(i * 7));
+    for (int i = 0; i < HCMD_THREADS; i++)
+        pthread_join(threads[i], NULL);
+
+    memset(owner, -1, sizeof(owner));
+    for (int i = 0; i < IWL_LAT_HCMD_SLOTS; i++) {
+        const struct iwl_lat_hist *h = &lat.hcmd[i];
+        uint64_t in_buckets = 0;
+
+        for (int b = 0; b < IWL_LAT_BUCKETS; b++)
+            in_buckets += h->buckets[b];
+        CHECK(name, in_buckets == h->count, "slot %d counts %llu samples, its buckets %llu", i,
+              (unsigned long long)h->count, (unsigned long long)in_buckets);
+        total += h->count;
+
+        if (i == IWL_LAT_HCMD_SLOTS - 1) {
+            CHECK(name, h->id == IWL_LAT_HCMD_OTHER &&
+                  h->count == (HCMD_IDS - IWL_LAT_HCMD_SLOTS + 1) * per_id,
+                  "the last slot is %#x with %llu samples", h->id, (unsigned long long)h->count);
+            break;
+        }
+
+        uint32_t id = h->id & ~IWL_LAT_HCMD_USED;
+
+        CHECK(name, (h->id & IWL_LAT_HCMD_USED) && id < HCMD_IDS, "slot %d is %#x", i, h->id);
+        CHECK(name, owner[id] < 0, "command %u has slots %d and %d", id, owner[id], i);
+        CHECK(name, h->count == per_id, "command %u has %llu of %llu samples", id,
+              (unsigned long long)h->count, (unsigned long long)per_id);
+        owner[id] = i;
+    }
+    CHECK(name, total == per_id * HCMD_IDS, "%llu samples of %llu", (unsigned long long)total,
+          (unsigned long long)(per_id * HCMD_IDS));
+
+    /* the samples go, the IDs stay */
+    iwl_lat_reset(&lat);
+    for (int i = 0; i < IWL_LAT_HCMD_SLOTS; i++)
+        CHECK(name, !lat.hcmd[i].count && !lat.hcmd[i].max && (lat.hcmd[i].id & IWL_LAT_HCMD_USED),
+              "slot %d is %#x with %llu samples after a reset", i, lat.hcmd[i].id,
+              (unsigned long long)lat.hcmd[i].count);
+
+    printf("ok   %s: %d commands from %d threads over %d slots\n", name, HCMD_IDS, HCMD_THREADS,
+           IWL_LAT_HCMD_SLOTS);
+}
+
+int main(void)
+{
+    check_buckets("lat buckets");
+    check_values("lat values");
+    check_percentiles("lat percentiles");
+    check_hcmd_slots("lat hcmd slots");
+
+    if (failures)
+        printf("%d checks failed\n", failures);
+
+    return failures ? 1 : 0;
+}
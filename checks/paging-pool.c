@@ -0,0 +1,129 @@
+//
+//  paging-pool.c
+//  checks
+//
+//  Host check of the firmware paging pool in iwlwifi/fw/paging-pool.h:
+//  for every paging image size the TLV parser accepts, the pool has to
+//  hold the CSS block and every paging block, 4KB aligned and back to
+//  back, the last block has to take exactly what iwl_fill_paging_mem()
+//  copies into it, and FW_PAGING_BLOCK_CMD has to have room for the
+//  blocks. A pool sized for one image must serve every smaller one, a
+//  firmware restart keeps it. Build and run from this directory:
+//
+//      cc -Ihost -I../IntelWifi/IntelWifi/porting -I../IntelWifi/IntelWifi/iwlwifi -o paging-pool paging-pool.c
+//      ./paging-pool
+//
+
+#include <stdio.h>
+#include <string.h>
+
+#include "fw/paging-pool.h"
+#include "fw/api/paging.h"
+
+/* a 4KB aligned DMA address above 4GB, the paging command takes it >> 12 */
+#define POOL_DMA        0x123456000ULL
+
+static int failures;
+
+#define CHECK(name, cond, ...) do {                             \
+    if (!(cond)) {                                              \
+        printf("FAIL %s: ", (name));                            \
+        printf(__VA_ARGS__);                                    \
+        printf("\n");                                           \
+        failures++;                                             \
+        return;                                                 \
+    }                                                           \
+} while (0)
+
+static void check_size(const char *name, u32 paging_mem_size)
+{
+    struct iwl_fw_paging db[NUM_OF_FW_PAGING_BLOCKS + 1];
+    struct iwl_fw_paging_cmd cmd;
+    u16 num_blk, last_pages;
+    u32 pages = paging_mem_size / FW_PAGING_SIZE, remaining;
+    u8 *pool = (u8 *)0x10000;
+    size_t size = iwl_fw_paging_pool_size(paging_mem_size, &num_blk, &last_pages);
+    int i;
+
+    CHECK(name, num_blk >= 1 && num_blk + 1 <= ARRAY_SIZE(cmd.device_phy_addr),
+          "%u bytes: %u blocks, the paging command has room for %zu with the CSS block",
+          paging_mem_size, num_blk, ARRAY_SIZE(cmd.device_phy_addr));
+    CHECK(name, last_pages >= 1 && last_pages <= NUM_OF_PAGE_PER_GROUP &&
+          (num_blk - 1) * NUM_OF_PAGE_PER_GROUP + last_pages == pages,
+          "%u bytes: %u blocks with %u pages in the last one for %u pages",
+          paging_mem_size, num_blk, last_pages, pages);
+    CHECK(name, size >= FW_PAGING_SIZE + paging_mem_size &&
+          size < FW_PAGING_SIZE + paging_mem_size + PAGING_BLOCK_SIZE,
+          "%u bytes: %zu byte pool", paging_mem_size, size);
+
+    memset(db, 0xa5, sizeof(db));
+    iwl_fw_paging_carve(db, num_blk, pool, POOL_DMA);
+    CHECK(name, db[num_blk + 1].fw_paging_size == 0xa5a5a5a5,
+          "%u bytes: carved past block %u", paging_mem_size, num_blk);
+
+    for (i = 0; i < num_blk + 1; i++) {
+        size_t offset = (size_t)(db[i].fw_paging_block - pool);
+        u32 want = i ? PAGING_BLOCK_SIZE : FW_PAGING_SIZE;
+
+        CHECK(name, db[i].fw_paging_size == want, "%u bytes: block %d is %u bytes",
+              paging_mem_size, i, db[i].fw_paging_size);
+        CHECK(name, db[i].fw_paging_phys == POOL_DMA + offset,
+              "%u bytes: block %d at %#zx maps to %#llx", paging_mem_size, i, offset,
+              (unsigned long long)db[i].fw_paging_phys);
+        CHECK(name, !(db[i].fw_paging_phys & (FW_PAGING_SIZE - 1)),
+              "%u bytes: block %d at %#llx isn't 4KB aligned", paging_mem_size, i,
+              (unsigned long long)db[i].fw_paging_phys);
+        CHECK(name, i ? offset == db[i - 1].fw_paging_block - pool + db[i - 1].fw_paging_size : !offset,
+              "%u bytes: block %d at %#zx doesn't follow the one before", paging_mem_size, i, offset);
+        CHECK(name, offset + db[i].fw_paging_size <= size,
+              "%u bytes: block %d ends at %#zx, past the %zu byte pool", paging_mem_size, i,
+              offset + db[i].fw_paging_size, size);
+    }
+
+    /* iwl_fill_paging_mem(): a paging section of the advertised size */
+    remaining = paging_mem_size - (num_blk - 1) * PAGING_BLOCK_SIZE;
+    CHECK(name, remaining == last_pages * FW_PAGING_SIZE,
+          "%u bytes: %u bytes left for the last block, it holds %u pages", paging_mem_size,
+          remaining, last_pages);
+}
+
+static void check_sizes(const char *name)
+{
+    size_t prev = 0, min = 0, max = 0;
+    int sizes = 0;
+
+    /* the TLV parser takes any multiple of 4KB up to MAX_PAGING_IMAGE_SIZE */
+    for (u32 sz = FW_PAGING_SIZE; sz <= MAX_PAGING_IMAGE_SIZE; sz += FW_PAGING_SIZE) {
+        u16 num_blk, last_pages;
+        size_t size = iwl_fw_paging_pool_size(sz, &num_blk, &last_pages);
+        int before = failures;
+
+        check_size(name, sz);
+        if (failures != before)
+            return;
+
+        /* iwl_alloc_fw_paging_mem() keeps a pool that is big enough */
+        CHECK(name, size >= prev, "%u bytes take a %zu byte pool, %u bytes less take %zu",
+              sz, size, (u32)FW_PAGING_SIZE, prev);
+        prev = size;
+        if (!min)
+            min = size;
+        max = size;
+        sizes++;
+    }
+
+    CHECK(name, max == FW_PAGING_SIZE + NUM_OF_BLOCK_PER_IMAGE * PAGING_BLOCK_SIZE,
+          "the largest image takes a %zu byte pool", max);
+
+    printf("ok   %s: %d image sizes, pools of %zu to %zu bytes\n", name, sizes, min, max);
+}
+
+int main(void)
+{
+    check_sizes("paging pool");
+
+    if (failures)
+        printf("%d checks failed\n", failures);
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,192 @@
+//
+//  rba-stack.cpp
+//  checks
+//
+//  Host torture test of the RB allocator's lock-free stacks in
+//  pcie/internal.h. Allocator threads take rbd_empty whole and push the
+//  RBDs to rbd_allocated in requests of RX_CLAIM_REQ_ALLOC, claimer threads
+//  take them with iwl_rba_claim() and hand them back to rbd_empty like a
+//  queue giving up its used RBDs. No RBD may be held by two claimers at
+//  once, and when it's over every one has to be on exactly one stack.
+//  The races are only hit when the threads really run side by side, on
+//  a single CPU host this mostly checks the bookkeeping. Build and run
+//  from this directory:
+//
+//      c++ -Ihost -I../IntelWifi/IntelWifi/porting -I../IntelWifi/IntelWifi/iwlwifi -I../IntelWifi/IntelWifi -I../common -o rba-stack rba-stack.cpp -lpthread
+//      ./rba-stack
+//
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+
+extern "C" {
+#include "pcie/internal.h"
+}
+
+#define RBDS            256
+#define ALLOCATORS      2
+#define CLAIMERS        3
+#define CLAIMS          200000      /* per claimer */
+
+static int failures;
+
+#define CHECK(name, cond, ...) do {                             \
+    if (!(cond)) {                                              \
+        printf("FAIL %s: ", (name));                            \
+        printf(__VA_ARGS__);                                    \
+        printf("\n");                                           \
+        failures++;                                             \
+        return;                                                 \
+    }                                                           \
+} while (0)
+
+/* the only IOKit the stacks need */
+struct host_IOSimpleLock {
+    pthread_mutex_t mutex;
+};
+
+extern "C" IOSimpleLock *IOSimpleLockAlloc(void)
+{
+    IOSimpleLock *lock = new IOSimpleLock;
+
+    pthread_mutex_init(&lock->mutex, NULL);
+    return lock;
+}
+
+extern "C" void IOSimpleLockFree(IOSimpleLock *lock)
+{
+    pthread_mutex_destroy(&lock->mutex);
+    delete lock;
+}
+
+extern "C" void IOSimpleLockLock(IOSimpleLock *lock)
+{
+    pthread_mutex_lock(&lock->mutex);
+}
+
+extern "C" void IOSimpleLockUnlock(IOSimpleLock *lock)
+{
+    pthread_mutex_unlock(&lock->mutex);
+}
+
+static struct iwl_rb_allocator rba;
+static struct iwl_rx_mem_buffer rbds[RBDS];
+static volatile SInt32 held[RBDS];      /* claimers holding each RBD */
+static volatile SInt32 doubles;         /* RBDs claimed while already held */
+static volatile SInt32 claimers_left;
+static volatile SInt32 requests;        /* pushed to rbd_allocated */
+static volatile SInt32 claimed;
+static volatile SInt32 short_claims;
+
+/* iwl_pcie_rx_allocator(): take rbd_empty whole, push it back in requests */
+static void *allocator(void *arg)
+{
+    while (claimers_left) {
+        struct iwl_rx_mem_buffer *empty = iwl_rba_take_all(&rba.rbd_empty);
+
+        if (!empty) {
+            sched_yield();
+            continue;
+        }
+        while (empty) {
+            struct iwl_rx_mem_buffer *first = empty, *last = empty;
+
+            for (int i = 1; i < RX_CLAIM_REQ_ALLOC && last->rba_next; i++)
+                last = last->rba_next;
+            empty = last->rba_next;
+            iwl_rba_push(&rba.rbd_allocated, first, last);
+            OSIncrementAtomic(&requests);
+        }
+    }
+    return NULL;
+}
+
+/* iwl_pcie_rx_allocator_get() and iwl_pcie_rx_give_used() */
+static void *claimer(void *arg)
+{
+    struct iwl_rx_mem_buffer *rxbs[RX_CLAIM_REQ_ALLOC];
+
+    for (int c = 0; c < CLAIMS; c++) {
+        int n = iwl_rba_claim(&rba, rxbs, RX_CLAIM_REQ_ALLOC);
+
+        if (!n) {
+            sched_yield();
+            continue;
+        }
+        if (n < RX_CLAIM_REQ_ALLOC)
+            OSIncrementAtomic(&short_claims);
+        OSAddAtomic(n, &claimed);
+
+        for (int i = 0; i < n; i++) {
+            if (OSIncrementAtomic(&held[rxbs[i]->vid]) != 0)
+                OSIncrementAtomic(&doubles);
+        }
+        /* hold them for a moment, the others get to push and pop meanwhile */
+        if (c % 16 == 0)
+            sched_yield();
+        for (int i = 0; i < n; i++) {
+            OSDecrementAtomic(&held[rxbs[i]->vid]);
+            rxbs[i]->rba_next = i + 1 < n ? rxbs[i + 1] : NULL;
+        }
+        iwl_rba_push(&rba.rbd_empty, rxbs[0], rxbs[n - 1]);
+    }
+    OSDecrementAtomic(&claimers_left);
+    return NULL;
+}
+
+static int count_stack(struct iwl_rx_mem_buffer *rxb, int *seen)
+{
+    int n = 0;
+
+    for (; rxb && n <= RBDS; rxb = rxb->rba_next, n++)
+        seen[rxb->vid]++;
+    return n;
+}
+
+static void check_torture(const char *name)
+{
+    pthread_t allocators[ALLOCATORS], claimers[CLAIMERS];
+    int seen[RBDS] = { 0 }, n;
+
+    memset(&rba, 0, sizeof(rba));
+    rba.lock = IOSimpleLockAlloc();
+    for (int i = 0; i < RBDS; i++) {
+        rbds[i].vid = (u16)i;
+        rbds[i].rba_next = i + 1 < RBDS ? &rbds[i + 1] : NULL;
+    }
+    iwl_rba_push(&rba.rbd_empty, &rbds[0], &rbds[RBDS - 1]);
+    claimers_left = CLAIMERS;
+
+    for (int i = 0; i < CLAIMERS; i++)
+        pthread_create(&claimers[i], NULL, claimer, NULL);
+    for (int i = 0; i < ALLOCATORS; i++)
+        pthread_create(&allocators[i], NULL, allocator, NULL);
+    for (int i = 0; i < CLAIMERS; i++)
+        pthread_join(claimers[i], NULL);
+    for (int i = 0; i < ALLOCATORS; i++)
+        pthread_join(allocators[i], NULL);
+
+    n = count_stack(iwl_rba_take_all(&rba.rbd_empty), seen);
+    n += count_stack(iwl_rba_take_all(&rba.rbd_allocated), seen);
+    IOSimpleLockFree(rba.lock);
+
+    CHECK(name, !doubles, "%d RBDs were claimed twice", doubles);
+    CHECK(name, n == RBDS, "%d RBDs on the stacks, %d expected", n, RBDS);
+    for (int i = 0; i < RBDS; i++)
+        CHECK(name, seen[i] == 1, "RBD %d is on the stacks %d times", i, seen[i]);
+
+    printf("ok   %s: %d RBDs, %d requests pushed, %d claimed, %d claims came up short\n", name, RBDS,
+           requests, claimed, short_claims);
+}
+
+int main(void)
+{
+    check_torture("rba");
+
+    if (failures)
+        printf("%d checks failed\n", failures);
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,144 @@
+//
+//  rx-work-ring.cpp
+//  checks
+//
+//  Host check of iwl_rx_work_ring, the single producer / single consumer
+//  ring the interrupt workloop hands RX queues to their worker through.
+//  On one thread: empty, full and the u32 indexes wrapping. Then a
+//  producer and a consumer thread hammer it the way the interrupt
+//  workloop and the worker do, and every id has to come out once and in
+//  order. Build and run from this directory:
+//
+//      c++ -Ihost -I../IntelWifi/IntelWifi/porting -I../IntelWifi/IntelWifi/iwlwifi -I../IntelWifi/IntelWifi -I../common -o rx-work-ring rx-work-ring.cpp -lpthread
+//      ./rx-work-ring
+//
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+
+extern "C" {
+#include "pcie/internal.h"
+}
+
+#define STRESS_IDS      (1000 * 1000)
+
+static int failures;
+
+#define CHECK(name, cond, ...) do {                             \
+    if (!(cond)) {                                              \
+        printf("FAIL %s: ", (name));                            \
+        printf(__VA_ARGS__);                                    \
+        printf("\n");                                           \
+        failures++;                                             \
+        return;                                                 \
+    }                                                           \
+} while (0)
+
+static void check_single(const char *name, u32 start)
+{
+    struct iwl_rx_work_ring ring;
+    u8 queue;
+
+    memset(&ring, 0, sizeof(ring));
+    ring.head = ring.tail = start;
+
+    CHECK(name, !iwl_rx_work_ring_pop(&ring, &queue), "popped %u from an empty ring", queue);
+
+    /* fill it, around the wrap if @start is close to it */
+    for (int i = 0; i < IWL_RX_WORK_RING_SIZE; i++)
+        CHECK(name, iwl_rx_work_ring_push(&ring, (u8)i), "full after %d of %d", i, IWL_RX_WORK_RING_SIZE);
+    CHECK(name, !iwl_rx_work_ring_push(&ring, 0xff), "took %d entries", IWL_RX_WORK_RING_SIZE + 1);
+
+    for (int i = 0; i < IWL_RX_WORK_RING_SIZE; i++) {
+        CHECK(name, iwl_rx_work_ring_pop(&ring, &queue), "empty after %d of %d", i, IWL_RX_WORK_RING_SIZE);
+        CHECK(name, queue == i, "entry %d came out as %u", i, queue);
+    }
+    CHECK(name, !iwl_rx_work_ring_pop(&ring, &queue), "popped %u past the end", queue);
+    CHECK(name, ring.head == ring.tail && ring.tail == start + IWL_RX_WORK_RING_SIZE,
+          "head %u tail %u", ring.head, ring.tail);
+
+    /* and space again once drained */
+    CHECK(name, iwl_rx_work_ring_push(&ring, 7) && iwl_rx_work_ring_pop(&ring, &queue) && queue == 7,
+          "no reuse after draining");
+
+    printf("ok   %s: from %#x\n", name, start);
+}
+
+struct stress {
+    struct iwl_rx_work_ring ring;
+    unsigned long full;         /* producer found no room */
+    unsigned long empty;        /* consumer found nothing */
+    int errors;
+    u32 first_bad;
+};
+
+static void *producer(void *arg)
+{
+    struct stress *s = (struct stress *)arg;
+
+    for (u32 i = 0; i < STRESS_IDS; ) {
+        if (iwl_rx_work_ring_push(&s->ring, (u8)i)) {
+            i++;
+        } else {
+            s->full++;
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+static void *consumer(void *arg)
+{
+    struct stress *s = (struct stress *)arg;
+    u8 queue;
+
+    for (u32 i = 0; i < STRESS_IDS; ) {
+        if (!iwl_rx_work_ring_pop(&s->ring, &queue)) {
+            /* a single CPU host only gets anywhere if the spinning side yields */
+            s->empty++;
+            sched_yield();
+            continue;
+        }
+        if (queue != (u8)i && !s->errors++)
+            s->first_bad = i;
+        i++;
+    }
+    return NULL;
+}
+
+static void check_stress(const char *name, u32 start)
+{
+    static struct stress s;
+    pthread_t prod, cons;
+
+    memset(&s, 0, sizeof(s));
+    s.ring.head = s.ring.tail = start;
+
+    pthread_create(&cons, NULL, consumer, &s);
+    pthread_create(&prod, NULL, producer, &s);
+    pthread_join(prod, NULL);
+    pthread_join(cons, NULL);
+
+    CHECK(name, !s.errors, "%d ids out of order, the first at %u", s.errors, s.first_bad);
+    CHECK(name, s.ring.head == s.ring.tail && s.ring.tail == start + STRESS_IDS,
+          "head %u tail %u", s.ring.head, s.ring.tail);
+    CHECK(name, s.full && s.empty, "never full (%lu) or never empty (%lu), the edges weren't hit",
+          s.full, s.empty);
+
+    printf("ok   %s: %d ids, full %lu times, empty %lu times\n", name, STRESS_IDS, s.full, s.empty);
+}
+
+int main(void)
+{
+    check_single("ring", 0);
+    check_single("ring wrap", 0xfffffff8);
+    check_stress("ring threads", 0);
+    check_stress("ring threads wrap", 0xffffff00);
+
+    if (failures)
+        printf("%d checks failed\n", failures);
+
+    return failures ? 1 : 0;
+}
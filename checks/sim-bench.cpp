@@ -0,0 +1,1344 @@
+//
+//  sim-bench.cpp
+//  checks
+//
+//  Runs the real transport (IntelWifi_trans/tx/rx, pcie/trans.c, the
+//  firmware loader in iwl-drv.c) against the simulated 8265 in sim/ and
+//  times it: notification wait dispatch, start to ALIVE with and without
+//  the load plan and the firmware cache, the reuse of the firmware load
+//  buffers and the references on the firmware blob, host command round
+//  trips and how many commands the device sees queued, sending the PHY DB
+//  in batches against a command per section, notification RX,
+//  its dispatch by queue and the RX budget per pass, the interrupt
+//  moderation following the RX interrupt rate, the layout of a firmware
+//  error dump and the slots it rotates through, data TX counted in
+//  doorbells and register writes per frame, and how data frames of every
+//  mbuf chain shape end up in their TBs. Every section also checks that
+//  the work got done. Build and run from this directory:
+//
+//      make sim-bench
+//      ./sim-bench
+//
+//  The device costs are made up but fixed, so the numbers compare runs
+//  of this tree against each other, not against hardware.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sim/SimDevice.h"
+#include "sim/SimOpMode.h"
+#include "sim/sim.h"
+
+extern "C" {
+#include "fw/api/alive.h"
+#include "fw/api/commands.h"
+#include "fw/error-dump.h"
+#include "iwl-phy-db.h"
+}
+
+#define SIM_DEVICE_ID       0x24FD      /* 8265 */
+#define SIM_SUBSYSTEM_ID    0x0010
+#define SIM_HW_REV          0x230
+
+#define ALIVE_RUNS          4
+#define HCMD_SYNC           200
+#define HCMD_PIPELINE       16
+#define PHY_DB_RUNS         50
+#define RX_NOTIFS           20000
+#define RX_RSS_QUEUES       4
+#define RX_RSS_NOTIFS       5000
+#define TX_FRAMES           20000
+#define TX_BATCH            16
+#define TX_QUEUE            5
+#define TX_FIFO             1
+
+static int failures;
+
+#define CHECK(name, cond, ...) do {                             \
+    if (!(cond)) {                                              \
+        printf("FAIL %s: ", name);                              \
+        printf(__VA_ARGS__);                                    \
+        printf("\n");                                           \
+        failures++;                                             \
+        return;                                                 \
+    }                                                           \
+} while (0)
+
+static const SimDevice::Config sim_config = {
+    .deviceId = SIM_DEVICE_ID,
+    .subsystemId = SIM_SUBSYSTEM_ID,
+    .hwRev = SIM_HW_REV,
+    .dmaSetupNs = 2000,
+    .dmaNsPerKB = 1000,
+    .bootNs = 200000,
+    .cmdNs = 20000,
+    .txNs = 2000,
+};
+
+static UInt64 now_ns(void)
+{
+    return mach_absolute_time();
+}
+
+/* a started driver with the op mode attached and the firmware ALIVE */
+struct sim_run {
+    SimDevice *dev;
+    IntelWifi *iw;
+    SimOpMode *op;
+    UInt64 start_ns;            /* iwl_drv_start, firmware request and parse */
+    UInt64 load_ns;             /* start_fw to the ALIVE notification */
+    SimDevice::Counters load;
+    UInt64 hash;
+};
+
+static bool alive_fn(struct iwl_notif_wait_data *notif_wait, struct iwl_rx_packet *pkt, void *data)
+{
+    struct mvm_alive_resp_v3 *resp = (struct mvm_alive_resp_v3 *)pkt->data;
+
+    *(u32 *)data = le16_to_cpu(resp->status) == IWL_ALIVE_STATUS_OK ?
+                   le32_to_cpu(resp->lmac_data.scd_base_ptr) : 0;
+    return true;
+}
+
+/* start_fw to ALIVE, fills in the load figures of @run */
+static bool sim_load(struct sim_run *run)
+{
+    static const u16 alive_cmds[] = { MVM_ALIVE };
+    struct iwl_notification_wait wait;
+    UInt64 t;
+    u32 scd_base = 0;
+
+    run->dev->drain();
+    run->dev->resetCounters();
+    iwl_init_notification_wait(&run->op->notifWait, &wait, alive_cmds, ARRAY_SIZE(alive_cmds),
+                               alive_fn, &scd_base);
+
+    t = now_ns();
+    if (sim_host.ops->start_fw(sim_host.trans, &sim_host.trans->drv->fw.img[IWL_UCODE_REGULAR], false)) {
+        iwl_remove_notification(&run->op->notifWait, &wait);
+        return false;
+    }
+    if (iwl_wait_notification(&run->op->notifWait, &wait, HZ) || !scd_base)
+        return false;
+    run->load_ns = now_ns() - t;
+    run->load = run->dev->counters();
+    run->hash = run->dev->sramHash();
+
+    iwl_trans_fw_alive(sim_host.trans, scd_base);
+    return true;
+}
+
+static bool sim_up(struct sim_run *run, const SimDevice::Config &config = sim_config)
+{
+    SInt32 score = 0;
+    UInt64 t;
+
+    memset(run, 0, sizeof(*run));
+    run->dev = SimDevice::withConfig(config);
+    run->iw = new IntelWifi;
+    if (!run->iw->init(NULL) || !run->iw->probe(run->dev, &score))
+        return false;
+
+    t = now_ns();
+    if (!run->iw->start(run->dev))
+        return false;
+    run->start_ns = now_ns() - t;
+
+    run->op = new SimOpMode(sim_host.trans, sim_host.ops);
+    run->iw->opmode = run->op;
+    run->op->configure();
+
+    if (sim_host.ops->start_hw(sim_host.trans, false))
+        return false;
+
+    return sim_load(run);
+}
+
+static void sim_down(struct sim_run *run)
+{
+    if (run->iw) {
+        if (sim_host.trans)
+            run->iw->stop(run->dev);
+        run->iw->opmode = NULL;
+        run->iw->release();
+    }
+    delete run->op;
+    if (run->dev)
+        run->dev->release();
+    memset(run, 0, sizeof(*run));
+}
+
+// MARK: notification waits
+
+/*
+ * iwl_notification_wait(), what iwl_rx_dispatch() pays for every packet,
+ * with 0, 1 and 16 waiters registered. A packet nobody waits for is a
+ * single unlocked cmd_refs[] read however many there are, one whose
+ * opcode a waiter has takes the lock and walks the list.
+ */
+#define NOTIF_WAIT_RUNS     1000000
+#define NOTIF_WAIT_OPCODE   0x40        /* the waiters wait for 0x40 + i */
+
+static bool notif_wait_fn(struct iwl_notif_wait_data *notif_wait, struct iwl_rx_packet *pkt, void *data)
+{
+    (*(unsigned long *)data)++;
+    return false;
+}
+
+static UInt64 notif_wait_dispatch(struct iwl_notif_wait_data *notif_wait, u8 cmd, bool *triggered)
+{
+    struct iwl_rx_packet pkt;
+    UInt64 t;
+
+    memset(&pkt, 0, sizeof(pkt));
+    pkt.hdr.cmd = cmd;
+    t = now_ns();
+    for (int i = 0; i < NOTIF_WAIT_RUNS; i++)
+        *triggered |= iwl_notification_wait(notif_wait, &pkt);
+    return now_ns() - t;
+}
+
+static void bench_notif_wait(void)
+{
+    static const int counts[] = { 0, 1, 16 };
+    static struct iwl_notification_wait waits[16];
+
+    for (unsigned c = 0; c < ARRAY_SIZE(counts); c++) {
+        struct iwl_notif_wait_data notif_wait;
+        unsigned long calls = 0;
+        bool triggered = false;
+        UInt64 miss, hit = 0;
+        int n = counts[c], refs = 0;
+        bool empty;
+        char name[24];
+
+        snprintf(name, sizeof(name), "notif wait %d", n);
+        iwl_notification_wait_init(&notif_wait);
+        for (int i = 0; i < n; i++) {
+            u16 cmd = NOTIF_WAIT_OPCODE + i;
+
+            iwl_init_notification_wait(&notif_wait, &waits[i], &cmd, 1, notif_wait_fn, &calls);
+        }
+
+        miss = notif_wait_dispatch(&notif_wait, 0xaa, &triggered);
+        if (n)
+            hit = notif_wait_dispatch(&notif_wait, NOTIF_WAIT_OPCODE + n - 1, &triggered);
+
+        /* the middle ones first, the list has to come apart in any order */
+        for (int i = n / 2; i < n; i++)
+            iwl_remove_notification(&notif_wait, &waits[i]);
+        for (int i = n / 2 - 1; i >= 0; i--)
+            iwl_remove_notification(&notif_wait, &waits[i]);
+
+        for (int i = 0; i < IWL_NOTIF_WAIT_SLOTS; i++)
+            refs += notif_wait.cmd_refs[i];
+        empty = TAILQ_EMPTY(&notif_wait.notif_waits);
+        iwl_notification_wait_free(&notif_wait);
+
+        CHECK(name, !triggered, "a waiter was triggered");
+        CHECK(name, calls == (n ? NOTIF_WAIT_RUNS : 0), "the waiter was called %lu times", calls);
+        CHECK(name, empty && !refs, "%s, %d cmd_refs left after removing them all",
+              empty ? "list empty" : "list not empty", refs);
+        if (n)
+            printf("     %2d waiters  %5.1f ns per packet nobody waits for, %5.1f ns for a waiter's\n", n,
+                   (double)miss / NOTIF_WAIT_RUNS, (double)hit / NOTIF_WAIT_RUNS);
+        else
+            printf("     %2d waiters  %5.1f ns per packet\n", n, (double)miss / NOTIF_WAIT_RUNS);
+    }
+    printf("ok   notif wait: %d packets per count\n", NOTIF_WAIT_RUNS);
+}
+
+// MARK: start to ALIVE
+
+static void bench_alive(void)
+{
+    static const struct {
+        const char *name;
+        bool plan;
+        bool cached;
+    } modes[] = {
+        { "per-section, cold", false, false },
+        { "per-section, cached", false, true },
+        { "plan, cold", true, false },
+        { "plan, cached", true, true },
+    };
+    UInt64 hash = 0, cold_ns = 0, status_writes = 0;
+    bool saved = iwlwifi_mod_params.fw_load_plan;
+
+    for (size_t m = 0; m < ARRAY_SIZE(modes); m++) {
+        UInt64 start_ns = 0, load_ns = 0;
+        unsigned long requests = 0;
+        struct sim_run run;
+
+        iwlwifi_mod_params.fw_load_plan = modes[m].plan;
+        for (int i = 0; i < ALIVE_RUNS; i++) {
+            unsigned long before;
+
+            /* a cached start follows a stop that kept the firmware */
+            if (!modes[m].cached)
+                iwl_drv_fw_cache_flush();
+            before = sim_stats.fw_requests;
+            if (!sim_up(&run)) {
+                sim_down(&run);
+                iwlwifi_mod_params.fw_load_plan = saved;
+                CHECK("alive", false, "%s: no ALIVE", modes[m].name);
+            }
+            requests += sim_stats.fw_requests - before;
+            start_ns += run.start_ns;
+            load_ns += run.load_ns;
+            if (!hash)
+                hash = run.hash;
+            if (run.hash != hash) {
+                sim_down(&run);
+                iwlwifi_mod_params.fw_load_plan = saved;
+                CHECK("alive", false, "%s: the device got a different image", modes[m].name);
+            }
+            /* the plan reports every section the way the per-section load does */
+            if (!status_writes)
+                status_writes = run.load.loadStatusWrites;
+            if (run.load.loadStatusWrites != status_writes) {
+                sim_down(&run);
+                iwlwifi_mod_params.fw_load_plan = saved;
+                CHECK("alive", false, "%s: %llu load status writes, %llu per-section", modes[m].name,
+                      (unsigned long long)run.load.loadStatusWrites, (unsigned long long)status_writes);
+            }
+            if (i == ALIVE_RUNS - 1)
+                printf("     %-20s drv start %7.1f us, load to ALIVE %7.1f us, "
+                       "%llu chunks, %llu KB, %llu load status writes, %lu fw requests\n",
+                       modes[m].name, start_ns / 1e3 / ALIVE_RUNS, load_ns / 1e3 / ALIVE_RUNS,
+                       (unsigned long long)run.load.fwChunks, (unsigned long long)run.load.fwBytes / 1024,
+                       (unsigned long long)run.load.loadStatusWrites, requests);
+            sim_down(&run);
+        }
+        if (modes[m].cached && requests > 1) {
+            iwlwifi_mod_params.fw_load_plan = saved;
+            CHECK("alive", false, "%s: the firmware was requested %lu times", modes[m].name, requests);
+        }
+        /* each cached mode follows its cold one, the parse is all it may save */
+        if (!modes[m].cached) {
+            cold_ns = start_ns + load_ns;
+        } else if ((start_ns + load_ns) * 10 > cold_ns * 9) {
+            iwlwifi_mod_params.fw_load_plan = saved;
+            CHECK("alive", false, "%s: start to ALIVE %.1f us, %.1f us cold", modes[m].name,
+                  (start_ns + load_ns) / 1e3 / ALIVE_RUNS, cold_ns / 1e3 / ALIVE_RUNS);
+        }
+    }
+    iwlwifi_mod_params.fw_load_plan = saved;
+    iwl_drv_fw_cache_flush();
+
+    printf("ok   alive: same image and load status writes through every path, "
+           "the cache saves 10%% or more of start to ALIVE\n");
+}
+
+// MARK: firmware load buffers
+
+/*
+ * A device whose service channel takes its time, and restarts of it the
+ * way a firmware restart reloads it. Every chunk has to come from one of
+ * the same IWL_FW_LOAD_BUFS buffers the first load used, with the plan
+ * never twice in a row from the same one and every chunk but the first
+ * staged while the one before is still on its way. The simulated device
+ * scribbles over each chunk once it's in, so a buffer that wasn't
+ * restaged shows. With the real costs a short chunk can be in before the
+ * next one is copied, the slow DMA keeps that out of the check.
+ */
+static void check_fw_load_bufs_restart(struct sim_run *run, bool plan, UInt64 hash)
+{
+    const char *name = plan ? "fw load bufs plan" : "fw load bufs per-section";
+    bool saved = iwlwifi_mod_params.fw_load_plan;
+    unsigned long allocs;
+    bool up;
+
+    iwlwifi_mod_params.fw_load_plan = plan;
+    sim_host.ops->stop_device(sim_host.trans, false);
+    allocs = sim_stats.dma_allocs;
+    up = !sim_host.ops->start_hw(sim_host.trans, false) && sim_load(run);
+    iwlwifi_mod_params.fw_load_plan = saved;
+
+    CHECK(name, up, "no ALIVE after the restart");
+    CHECK(name, run->hash == hash, "the device got a different image");
+    CHECK(name, run->load.fwLoadBufs == IWL_FW_LOAD_BUFS, "chunks came from %u buffers, %d expected",
+          run->load.fwLoadBufs, IWL_FW_LOAD_BUFS);
+    CHECK(name, !plan || (!run->load.fwBufRepeats && run->load.fwStaged == run->load.fwChunks - 1),
+          "%llu of %llu chunks staged early, %llu from the buffer just used",
+          (unsigned long long)run->load.fwStaged, (unsigned long long)run->load.fwChunks,
+          (unsigned long long)run->load.fwBufRepeats);
+    printf("ok   %s: %llu chunks, %llu staged early, %lu DMA allocations for the restart\n", name,
+           (unsigned long long)run->load.fwChunks, (unsigned long long)run->load.fwStaged,
+           sim_stats.dma_allocs - allocs);
+}
+
+static void check_fw_load_bufs(void)
+{
+    SimDevice::Config config = sim_config;
+    struct sim_run run;
+
+    config.dmaSetupNs = NSEC_PER_MSEC;
+    if (sim_up(&run, config)) {
+        UInt64 hash = run.hash;
+
+        check_fw_load_bufs_restart(&run, false, hash);
+        check_fw_load_bufs_restart(&run, true, hash);
+    } else {
+        failures++;
+        printf("FAIL fw load bufs: no ALIVE\n");
+    }
+    sim_down(&run);
+}
+
+// MARK: firmware blob
+
+/*
+ * The parsed image points into a single refcounted copy of the file: one
+ * reference per section, none left over from the parser, no section
+ * copied out of it. The cache parks it across a stop and hands the same
+ * blob back, and the flush frees it.
+ */
+static struct iwl_fw_blob *fw_blob_refs(const struct iwl_fw *fw, int *secs, size_t *bytes, bool *outside)
+{
+    struct iwl_fw_blob *blob = NULL;
+
+    *secs = 0;
+    *bytes = 0;
+    *outside = false;
+    for (int i = 0; i < IWL_UCODE_TYPE_MAX; i++) {
+        for (int j = 0; j < fw->img[i].num_sec; j++) {
+            const struct fw_desc *desc = &fw->img[i].sec[j];
+
+            if (!desc->data)
+                continue;
+            if (!blob)
+                blob = desc->blob;
+            if (!desc->blob || desc->blob != blob || (const u8 *)desc->data < blob->data ||
+                (const u8 *)desc->data + desc->len > blob->data + blob->size)
+                *outside = true;
+            (*secs)++;
+            *bytes += desc->len;
+        }
+    }
+    return blob;
+}
+
+static void check_fw_blob(void)
+{
+    struct sim_run run;
+    struct iwl_fw_blob *blob, *cached;
+    unsigned long heap, file, flushed;
+    size_t bytes;
+    int secs, refs;
+    bool outside;
+
+    iwl_drv_fw_cache_flush();
+    file = sim_stats.fw_bytes;
+    heap = sim_stats.heap_bytes;
+    if (!sim_up(&run)) {
+        sim_down(&run);
+        CHECK("fw blob", false, "no ALIVE");
+    }
+    file = sim_stats.fw_bytes - file;
+    heap = sim_stats.heap_bytes - heap;
+    blob = fw_blob_refs(&sim_host.trans->drv->fw, &secs, &bytes, &outside);
+    refs = blob ? blob->refcount : 0;
+    sim_down(&run);
+
+    CHECK("fw blob", blob && !outside, "a section doesn't point into the blob");
+    CHECK("fw blob", blob->size == file, "a blob of %zu bytes for a file of %lu", blob->size, file);
+    CHECK("fw blob", refs == secs, "%d references for %d sections", refs, secs);
+    /* parked in the cache, nothing dropped */
+    CHECK("fw blob", blob->refcount == secs, "%d references left in the cache", blob->refcount);
+
+    if (!sim_up(&run)) {
+        sim_down(&run);
+        CHECK("fw blob cached", false, "no ALIVE");
+    }
+    cached = fw_blob_refs(&sim_host.trans->drv->fw, &secs, &bytes, &outside);
+    sim_down(&run);
+    CHECK("fw blob cached", cached == blob && !outside, "the cached start got another blob");
+    CHECK("fw blob cached", blob->refcount == secs, "%d references for %d sections", blob->refcount, secs);
+
+    flushed = sim_stats.heap_bytes;
+    iwl_drv_fw_cache_flush();
+    flushed -= sim_stats.heap_bytes;
+    CHECK("fw blob", flushed >= file, "the flush freed %lu bytes, the blob has %lu", flushed, file);
+
+    printf("ok   fw blob: %lu byte file, %d sections and %zu bytes in it, %lu bytes allocated by the start\n",
+           file, secs, bytes, heap);
+}
+
+// MARK: host commands
+
+static void bench_hcmd(struct sim_run *run)
+{
+    struct iwl_trans *trans = sim_host.trans;
+    struct iwl_host_cmd cmds[HCMD_PIPELINE], *pcmds[HCMD_PIPELINE];
+    SimDevice::Counters c;
+    UInt64 t, sync_ns, pipe_ns;
+    int i, ret;
+
+    run->dev->resetCounters();
+    t = now_ns();
+    for (i = 0; i < HCMD_SYNC; i++) {
+        struct iwl_host_cmd cmd = {};
+
+        cmd.id = ECHO_CMD;
+        ret = iwl_trans_send_cmd(trans, &cmd);
+        CHECK("hcmd", !ret, "sync ECHO_CMD %d failed: %d", i, ret);
+    }
+    sync_ns = now_ns() - t;
+    c = run->dev->counters();
+    CHECK("hcmd", c.hcmds == HCMD_SYNC, "device saw %llu of %d commands",
+          (unsigned long long)c.hcmds, HCMD_SYNC);
+    CHECK("hcmd", c.cmdInflightMax == 1, "sync commands overlapped, %u in flight", c.cmdInflightMax);
+
+    run->dev->resetCounters();
+    t = now_ns();
+    for (int round = 0; round < HCMD_SYNC / HCMD_PIPELINE; round++) {
+        for (i = 0; i < HCMD_PIPELINE; i++) {
+            memset(&cmds[i], 0, sizeof(cmds[i]));
+            cmds[i].id = ECHO_CMD;
+            pcmds[i] = &cmds[i];
+            ret = iwl_trans_send_cmd_start(trans, &cmds[i]);
+            CHECK("hcmd", !ret, "pipelined ECHO_CMD %d failed: %d", i, ret);
+        }
+        ret = iwl_trans_wait_cmds(trans, pcmds, HCMD_PIPELINE);
+        CHECK("hcmd", !ret, "waiting for %d commands failed: %d", HCMD_PIPELINE, ret);
+    }
+    pipe_ns = now_ns() - t;
+    c = run->dev->counters();
+    CHECK("hcmd", c.hcmds == HCMD_SYNC / HCMD_PIPELINE * HCMD_PIPELINE, "device saw %llu commands",
+          (unsigned long long)c.hcmds);
+
+    printf("     sync         %7.1f us per command\n", sync_ns / 1e3 / HCMD_SYNC);
+    printf("     pipelined    %7.1f us per command, in flight max %u avg %.1f\n",
+           pipe_ns / 1e3 / c.hcmds, c.cmdInflightMax, (double)c.cmdInflightSum / c.hcmds);
+    CHECK("hcmd", c.cmdInflightMax >= HCMD_PIPELINE / 2 && c.cmdInflightSum >= c.hcmds * HCMD_PIPELINE / 4,
+          "%u in flight at most, %.1f on average, for batches of %d", c.cmdInflightMax,
+          (double)c.cmdInflightSum / c.hcmds, HCMD_PIPELINE);
+
+    /* async ones complete through the op mode, whose callback may send a command */
+    UInt64 cbs = run->op->stats.asyncCbs, sent = run->op->stats.asyncSent;
+    run->dev->resetCounters();
+    run->op->asyncResend = HCMD_PIPELINE / 2;
+    for (i = 0; i < HCMD_PIPELINE; i++) {
+        struct iwl_host_cmd cmd = {};
+
+        cmd.id = ECHO_CMD;
+        cmd.flags = CMD_ASYNC | CMD_WANT_ASYNC_CALLBACK;
+        ret = iwl_trans_send_cmd(trans, &cmd);
+        CHECK("hcmd", !ret, "async ECHO_CMD %d failed: %d", i, ret);
+    }
+    for (t = now_ns(); run->op->stats.asyncCbs - cbs < HCMD_PIPELINE && now_ns() - t < NSEC_PER_SEC; )
+        IOSleep(1);
+    run->dev->drain();
+    CHECK("hcmd", run->op->stats.asyncCbs - cbs == HCMD_PIPELINE, "%llu of %d async callbacks",
+          (unsigned long long)(run->op->stats.asyncCbs - cbs), HCMD_PIPELINE);
+    CHECK("hcmd", run->op->stats.asyncSent - sent == HCMD_PIPELINE / 2 &&
+          run->dev->counters().hcmds == HCMD_PIPELINE + HCMD_PIPELINE / 2,
+          "%llu of %d sent from the callback, the device saw %llu commands",
+          (unsigned long long)(run->op->stats.asyncSent - sent), HCMD_PIPELINE / 2,
+          (unsigned long long)run->dev->counters().hcmds);
+
+    printf("ok   hcmd: %d sync, %llu pipelined, %d async, %d sent from the callback\n", HCMD_SYNC,
+           (unsigned long long)c.hcmds, HCMD_PIPELINE, HCMD_PIPELINE / 2);
+}
+
+// MARK: PHY DB
+
+/* from iwl-phy-db.c */
+#define PHY_DB_CMD              0x6c
+#define PHY_DB_CFG              1
+#define PHY_DB_CALIB_NCH        2
+#define PHY_DB_CALIB_CHG_PAPD   4
+#define PHY_DB_CALIB_CHG_TXP    5
+
+struct phy_db_section {
+    u16 type;
+    std::vector<u8> data;
+};
+
+/*
+ * Hand @phy_db a section the way the calibration results come in, and keep
+ * what it should send for it. The channel group ones start with their group.
+ */
+static int phy_db_set(struct iwl_phy_db *phy_db, std::vector<phy_db_section> *sent, u16 type,
+                      u16 chg_id, u16 len)
+{
+    struct iwl_rx_packet *pkt = (struct iwl_rx_packet *)calloc(1, sizeof(*pkt) +
+                                                                sizeof(struct iwl_calib_res_notif_phy_db) + len);
+    struct iwl_calib_res_notif_phy_db *notif = (struct iwl_calib_res_notif_phy_db *)pkt->data;
+    phy_db_section section;
+    int ret;
+
+    notif->type = cpu_to_le16(type);
+    notif->length = cpu_to_le16(len);
+    for (int i = 0; i < len; i++)
+        notif->data[i] = (u8)(type * 31 + chg_id * 7 + i);
+    if (type == PHY_DB_CALIB_CHG_PAPD || type == PHY_DB_CALIB_CHG_TXP)
+        *(__le16 *)notif->data = cpu_to_le16(chg_id);
+
+    ret = iwl_phy_db_set_section(phy_db, pkt);
+    section.type = type;
+    section.data.assign(notif->data, notif->data + len);
+    free(pkt);
+
+    /* sections go out CFG, NCH, then the groups in order */
+    if (!ret && (type == PHY_DB_CFG || type == PHY_DB_CALIB_NCH)) {
+        sent->insert(sent->begin() + (type == PHY_DB_CALIB_NCH && !sent->empty()), section);
+    } else if (!ret) {
+        std::vector<phy_db_section>::iterator it = sent->begin();
+
+        while (it != sent->end() && (it->type < type || (it->type == type &&
+               le16_to_cpup((const __le16 *)it->data.data()) < chg_id)))
+            ++it;
+        sent->insert(it, section);
+    }
+    return ret;
+}
+
+/*
+ * A PHY DB the way the init firmware leaves it: CFG, NCH and the channel
+ * groups, largest group first. @skip_papd is left out, the way a group the
+ * firmware never reported is.
+ */
+static struct iwl_phy_db *phy_db_build(std::vector<phy_db_section> *sent, int papd, int txp, int skip_papd)
+{
+    struct iwl_phy_db *phy_db = iwl_phy_db_init(sim_host.trans);
+    int ret;
+
+    if (!phy_db)
+        return NULL;
+    ret = phy_db_set(phy_db, sent, PHY_DB_CFG, 0, 40);
+    ret = ret ?: phy_db_set(phy_db, sent, PHY_DB_CALIB_NCH, 0, 220);
+    for (int i = papd - 1; i >= 0 && !ret; i--)
+        if (i != skip_papd || i == papd - 1)
+            ret = phy_db_set(phy_db, sent, PHY_DB_CALIB_CHG_PAPD, (u16)i, 64);
+    for (int i = txp - 1; i >= 0 && !ret; i--)
+        ret = phy_db_set(phy_db, sent, PHY_DB_CALIB_CHG_TXP, (u16)i, 120);
+    if (ret) {
+        iwl_phy_db_free(phy_db);
+        return NULL;
+    }
+    return phy_db;
+}
+
+/* what iwl_send_phy_db_data() did before it batched: one SYNC command per section */
+static int phy_db_send_serial(const std::vector<phy_db_section> &sections)
+{
+    for (size_t i = 0; i < sections.size(); i++) {
+        struct iwl_calib_res_notif_phy_db hdr;
+        struct iwl_host_cmd cmd = {};
+        int ret;
+
+        hdr.type = cpu_to_le16(sections[i].type);
+        hdr.length = cpu_to_le16((u16)sections[i].data.size());
+        cmd.id = PHY_DB_CMD;
+        cmd.data[0] = &hdr;
+        cmd.len[0] = sizeof(hdr);
+        cmd.data[1] = sections[i].data.data();
+        cmd.len[1] = (u16)sections[i].data.size();
+        cmd.dataflags[1] = IWL_HCMD_DFL_NOCOPY;
+        ret = iwl_trans_send_cmd(sim_host.trans, &cmd);
+        if (ret)
+            return ret;
+    }
+    return 0;
+}
+
+/*
+ * iwl_send_phy_db_data() for @papd and @txp channel groups: every section
+ * has to reach the device once, in order and intact, with no more than
+ * IWL_PHY_DB_BATCH in flight, however the sections fall on the batches.
+ */
+static void check_phy_db(struct sim_run *run, const char *name, int papd, int txp, int skip_papd)
+{
+    std::vector<phy_db_section> sent;
+    std::vector<std::vector<UInt8> > cmds;
+    struct iwl_phy_db *phy_db = phy_db_build(&sent, papd, txp, skip_papd);
+    SimDevice::Counters c;
+    int ret;
+
+    CHECK(name, phy_db, "building a PHY DB of %d PAPD and %d TXP groups failed", papd, txp);
+
+    run->dev->resetCounters();
+    run->dev->captureCmds(true);
+    ret = iwl_send_phy_db_data(phy_db);
+    run->dev->drain();
+    cmds = run->dev->cmds();
+    run->dev->captureCmds(false);
+    c = run->dev->counters();
+    iwl_phy_db_free(phy_db);
+
+    CHECK(name, !ret, "iwl_send_phy_db_data() failed: %d", ret);
+    CHECK(name, cmds.size() == sent.size(), "the device got %zu of %zu sections", cmds.size(), sent.size());
+    for (size_t i = 0; i < cmds.size(); i++) {
+        const struct iwl_cmd_header *hdr = (const struct iwl_cmd_header *)cmds[i].data();
+        /* struct iwl_phy_db_cmd is laid out the same */
+        const struct iwl_calib_res_notif_phy_db *cmd = (const struct iwl_calib_res_notif_phy_db *)(hdr + 1);
+        size_t len = sent[i].data.size();
+
+        CHECK(name, cmds[i].size() == sizeof(*hdr) + sizeof(*cmd) + len && hdr->cmd == PHY_DB_CMD &&
+              le16_to_cpu(cmd->type) == sent[i].type && le16_to_cpu(cmd->length) == len &&
+              !memcmp(cmd->data, sent[i].data.data(), len),
+              "command %zu isn't section %zu, type %u, %zu bytes", i, i, sent[i].type, len);
+    }
+    CHECK(name, c.cmdInflightMax > 1 && c.cmdInflightMax <= IWL_PHY_DB_BATCH,
+          "%u sections in flight, batches of %d", c.cmdInflightMax, IWL_PHY_DB_BATCH);
+
+    printf("ok   %s: %zu sections, %u in flight at most\n", name, sent.size(), c.cmdInflightMax);
+}
+
+/* the bring-up cost of the PHY DB, batched against a SYNC command per section */
+static void bench_phy_db(struct sim_run *run)
+{
+    std::vector<phy_db_section> sent;
+    struct iwl_phy_db *phy_db;
+    UInt64 t, serial_ns = 0, batch_ns = 0;
+    int ret = 0;
+
+    /* right at the batch size, and past it with a group missing */
+    check_phy_db(run, "phy db batch", IWL_PHY_DB_BATCH / 2 - 1, IWL_PHY_DB_BATCH / 2 - 1, -1);
+    check_phy_db(run, "phy db two batches", 9, 10, 3);
+
+    phy_db = phy_db_build(&sent, 9, 10, -1);
+    CHECK("phy db", phy_db, "building the PHY DB failed");
+    for (int i = 0; i < PHY_DB_RUNS && !ret; i++) {
+        t = now_ns();
+        ret = phy_db_send_serial(sent);
+        serial_ns += now_ns() - t;
+        t = now_ns();
+        ret = ret ?: iwl_send_phy_db_data(phy_db);
+        batch_ns += now_ns() - t;
+    }
+    iwl_phy_db_free(phy_db);
+    run->dev->drain();
+    CHECK("phy db", !ret, "sending the PHY DB failed: %d", ret);
+
+    printf("     serial       %7.1f us for %zu sections\n", serial_ns / 1e3 / PHY_DB_RUNS, sent.size());
+    printf("     batched      %7.1f us\n", batch_ns / 1e3 / PHY_DB_RUNS);
+    CHECK("phy db", batch_ns < serial_ns, "batched %.1f us, serial %.1f us",
+          batch_ns / 1e3 / PHY_DB_RUNS, serial_ns / 1e3 / PHY_DB_RUNS);
+    printf("ok   phy db: %.0f%% of the serial bring-up\n", 100.0 * batch_ns / serial_ns);
+}
+
+// MARK: RX
+
+/*
+ * iwl_pcie_rx_alloc_slabs(): every RBD of the pool owns its own RB, carved
+ * out of the slabs in order. The RBs are 4K aligned for the vid bits of
+ * the RBD, within the DMA mask, don't overlap, and the cached bus address
+ * is the one the device sees for the RB's memory.
+ */
+static void check_rx_slabs(struct sim_run *run)
+{
+    struct iwl_trans_pcie *trans_pcie = IWL_TRANS_GET_PCIE_TRANS(sim_host.trans);
+    u32 rb_size = PAGE_SIZE << trans_pcie->rx_page_order;
+    int rbs_per_slab = max_t(int, 1, IWL_RX_SLAB_SIZE / rb_size);
+    u64 mask = DMA_BIT_MASK(trans_pcie->addr_size);
+
+    CHECK("rx slabs", trans_pcie->rx_slab_rb_size == rb_size, "carved for %u byte RBs, %u in use",
+          trans_pcie->rx_slab_rb_size, rb_size);
+    CHECK("rx slabs", trans_pcie->num_rx_slabs == (RX_POOL_SIZE + rbs_per_slab - 1) / rbs_per_slab,
+          "%d slabs for %d RBs of %u bytes", trans_pcie->num_rx_slabs, RX_POOL_SIZE, rb_size);
+
+    for (int i = 0; i < RX_POOL_SIZE; i++) {
+        struct iwl_rx_mem_buffer *rxb = &trans_pcie->rx_pool[i];
+        struct iwl_dma_ptr *slab = trans_pcie->rx_slabs[i / rbs_per_slab];
+        u64 offset = (u64)(i % rbs_per_slab) * rb_size;
+
+        CHECK("rx slabs", rxb->rb_addr == (u8 *)slab->addr + offset && rxb->page_dma == slab->dma + offset,
+              "RB %d isn't at offset %llu of slab %d", i, (unsigned long long)offset, i / rbs_per_slab);
+        CHECK("rx slabs", !(rxb->page_dma & (PAGE_SIZE - 1)) && rxb->page_dma + rb_size - 1 <= mask,
+              "RB %d at %#llx", i, (unsigned long long)rxb->page_dma);
+        CHECK("rx slabs", sim_dma_virt(rxb->page_dma, rb_size) == rxb->rb_addr,
+              "RB %d: the device sees other memory at %#llx", i, (unsigned long long)rxb->page_dma);
+        /* in order within a slab, so a neighbour check covers overlaps */
+        if (i % rbs_per_slab)
+            CHECK("rx slabs", rxb->page_dma == trans_pcie->rx_pool[i - 1].page_dma + rb_size,
+                  "RB %d doesn't follow RB %d", i, i - 1);
+    }
+
+    printf("ok   rx slabs: %d RBs of %u bytes in %d slabs\n", RX_POOL_SIZE, rb_size, trans_pcie->num_rx_slabs);
+}
+
+static void bench_rx(struct sim_run *run)
+{
+    static const u32 sizes[] = { 8, 64, 200, 1000 };
+    u8 payload[1024];
+    UInt64 notifs = run->op->stats.notifs, t, ns;
+    SimDevice::Counters c;
+
+    memset(payload, 0xa5, sizeof(payload));
+    run->dev->resetCounters();
+
+    t = now_ns();
+    for (int i = 0; i < RX_NOTIFS; i++)
+        run->dev->injectNotif(0xaa, 0, payload, sizes[i % ARRAY_SIZE(sizes)]);
+    while (run->op->stats.notifs - notifs < RX_NOTIFS && now_ns() - t < 5 * NSEC_PER_SEC)
+        IODelay(10);
+    ns = now_ns() - t;
+    c = run->dev->counters();
+
+    CHECK("rx", run->op->stats.notifs - notifs == RX_NOTIFS, "%llu of %d notifications",
+          (unsigned long long)(run->op->stats.notifs - notifs), RX_NOTIFS);
+    printf("     %d notifications in %.1f ms, %.0f per s, %llu interrupts, %llu times out of RBs\n",
+           RX_NOTIFS, ns / 1e6, RX_NOTIFS * 1e9 / ns, (unsigned long long)c.irqs,
+           (unsigned long long)c.rxStalls);
+    printf("ok   rx: %llu packets\n", (unsigned long long)c.rxPackets);
+}
+
+/*
+ * Queue dispatch in iwl_pcie_rx_handle_rb(): queue 0 goes to rx(), any
+ * other to rx_rss() with its id. The transport only runs one RX queue
+ * until MSI-X is ported, so the replay relabels it as queue q for a round
+ * and has the device steer the notifications there.
+ */
+static void bench_rx_rss(struct sim_run *run)
+{
+    struct iwl_trans_pcie *trans_pcie = IWL_TRANS_GET_PCIE_TRANS(sim_host.trans);
+    struct iwl_rxq *rxq = &trans_pcie->rxq[0];
+    u8 payload[64];
+
+    memset(payload, 0x5a, sizeof(payload));
+
+    for (int q = 0; q < RX_RSS_QUEUES; q++) {
+        UInt64 notifs = run->op->stats.notifs, rss[RX_RSS_QUEUES], got, t, ns;
+        char name[16];
+
+        snprintf(name, sizeof(name), "rx rss %d", q);
+        for (int i = 0; i < RX_RSS_QUEUES; i++)
+            rss[i] = run->op->stats.rss[i];
+
+        run->dev->drain();
+        rxq->id = q;
+        t = now_ns();
+        for (int i = 0; i < RX_RSS_NOTIFS; i++)
+            run->dev->injectNotif(0xab, 0, payload, sizeof(payload), q);
+        do {
+            got = q ? run->op->stats.rss[q] - rss[q] : run->op->stats.notifs - notifs;
+            IODelay(10);
+        } while (got < RX_RSS_NOTIFS && now_ns() - t < 5 * NSEC_PER_SEC);
+        ns = now_ns() - t;
+        run->dev->drain();
+        rxq->id = 0;
+
+        CHECK(name, got == RX_RSS_NOTIFS, "%llu of %d notifications", (unsigned long long)got,
+              RX_RSS_NOTIFS);
+        CHECK(name, !q || run->op->stats.notifs == notifs, "%llu went to rx()",
+              (unsigned long long)(run->op->stats.notifs - notifs));
+        for (int i = 0; i < RX_RSS_QUEUES; i++)
+            CHECK(name, i == q || run->op->stats.rss[i] == rss[i], "%llu went to rx_rss() for queue %d",
+                  (unsigned long long)(run->op->stats.rss[i] - rss[i]), i);
+        printf("ok   %s: %d notifications, %.0f per s\n", name, RX_RSS_NOTIFS, RX_RSS_NOTIFS * 1e9 / ns);
+    }
+}
+
+// MARK: interrupt moderation
+
+/*
+ * The adaptive moderation in IntelWifi_rx.cpp, driven by real RX
+ * interrupts: notifications one at a time and a few ms apart halve the
+ * coalescing timer down to its minimum, back to back they double it up
+ * to the default and then hand the RX queues to the poll timer, and once
+ * the device goes quiet the poll timer gives them back. Every step waits
+ * for the state it expects, the windows are IWL_INT_MIT_WINDOW_MS long.
+ */
+static u8 int_mit_coalescing(struct sim_run *run)
+{
+    return run->dev->read32(CSR_INT_COALESCING) & 0xff;
+}
+
+static bool int_mit_notif(struct sim_run *run, u8 *payload)
+{
+    UInt64 notifs = run->op->stats.notifs, t = now_ns();
+
+    run->dev->injectNotif(0xac, 0, payload, 16);
+    while (run->op->stats.notifs == notifs && now_ns() - t < NSEC_PER_SEC / 10)
+        IODelay(10);
+    return run->op->stats.notifs != notifs;
+}
+
+static void check_int_mit(struct sim_run *run)
+{
+    struct iwl_trans_pcie *trans_pcie = IWL_TRANS_GET_PCIE_TRANS(sim_host.trans);
+    volatile struct iwl_int_mit *mit = &trans_pcie->int_mit;
+    u32 rx_mask = trans_pcie->inta_mask & IWL_INT_MIT_RX_INTS;
+    u8 payload[16], prev, raised = 0;
+    int trickled = 0, flooded = 0, polled = 0;
+    UInt64 t, notifs, irqs;
+
+    memset(payload, 0x3c, sizeof(payload));
+    run->dev->drain();
+    CHECK("int mit", mit->adaptive, "adaptive moderation is off by default");
+
+    /* a few hundred interrupts per second, well below IWL_INT_MIT_LOW_RATE */
+    t = now_ns();
+    while ((mit->polling || int_mit_coalescing(run) != IWL_INT_MIT_COALESCING_MIN) &&
+           now_ns() - t < 3 * NSEC_PER_SEC) {
+        CHECK("int mit trickle", int_mit_notif(run, payload), "notification %d not delivered", trickled);
+        trickled++;
+        IOSleep(5);
+    }
+    CHECK("int mit trickle", !mit->polling && int_mit_coalescing(run) == IWL_INT_MIT_COALESCING_MIN,
+          "coalescing 0x%x%s after %d notifications", int_mit_coalescing(run),
+          mit->polling ? ", polling" : "", trickled);
+    CHECK("int mit trickle", mit->coalescing == IWL_INT_MIT_COALESCING_MIN,
+          "0x%x tracked, 0x%x in CSR_INT_COALESCING", mit->coalescing, int_mit_coalescing(run));
+
+    /* an interrupt per notification, as fast as they're handled */
+    prev = IWL_INT_MIT_COALESCING_MIN;
+    t = now_ns();
+    while (!mit->polling && now_ns() - t < 3 * NSEC_PER_SEC) {
+        u8 coalescing;
+
+        CHECK("int mit flood", int_mit_notif(run, payload), "notification %d not delivered", flooded);
+        flooded++;
+        coalescing = int_mit_coalescing(run);
+        CHECK("int mit flood", coalescing >= prev, "coalescing went down from 0x%x to 0x%x", prev, coalescing);
+        if (coalescing != prev)
+            raised++;
+        prev = coalescing;
+    }
+    CHECK("int mit flood", mit->polling, "not polling after %d notifications in %.0f ms, coalescing 0x%x",
+          flooded, (now_ns() - t) / 1e6, int_mit_coalescing(run));
+    CHECK("int mit flood", int_mit_coalescing(run) == IWL_INT_MIT_COALESCING_MAX,
+          "polling at coalescing 0x%x", int_mit_coalescing(run));
+    CHECK("int mit flood", !(run->dev->read32(CSR_INT_MASK) & IWL_INT_MIT_RX_INTS),
+          "RX causes 0x%x still unmasked", run->dev->read32(CSR_INT_MASK) & IWL_INT_MIT_RX_INTS);
+
+    /* the window just restarted, the poll timer owns RX for a while */
+    notifs = run->op->stats.notifs;
+    irqs = run->dev->counters().irqs;
+    for (int i = 0; i < 64; i++)
+        run->dev->injectNotif(0xac, 0, payload, sizeof(payload));
+    t = now_ns();
+    while (run->op->stats.notifs - notifs < 64 && now_ns() - t < NSEC_PER_SEC / 20)
+        IODelay(10);
+    polled = (int)(run->op->stats.notifs - notifs);
+    CHECK("int mit poll", polled == 64, "%d of 64 notifications polled", polled);
+    CHECK("int mit poll", mit->polling && run->dev->counters().irqs == irqs,
+          "%llu interrupts while polling", (unsigned long long)(run->dev->counters().irqs - irqs));
+
+    /* idle, the poll timer sees nothing and gives the interrupts back */
+    t = now_ns();
+    while (mit->polling && now_ns() - t < NSEC_PER_SEC)
+        IOSleep(1);
+    CHECK("int mit idle", !mit->polling, "still polling after %.0f ms", (now_ns() - t) / 1e6);
+    CHECK("int mit idle", (run->dev->read32(CSR_INT_MASK) & IWL_INT_MIT_RX_INTS) == rx_mask,
+          "RX causes 0x%x unmasked, 0x%x expected", run->dev->read32(CSR_INT_MASK) & IWL_INT_MIT_RX_INTS,
+          rx_mask);
+    CHECK("int mit idle", int_mit_notif(run, payload), "no interrupt after polling");
+
+    printf("ok   int mit: down to 0x%x in %d notifications, %d raises to 0x%x and polling in %d, "
+           "%d polled, back to interrupts\n", IWL_INT_MIT_COALESCING_MIN, trickled, raised,
+           IWL_INT_MIT_COALESCING_MAX, flooded, polled);
+}
+
+// MARK: RX budget
+
+/*
+ * The budget in iwl_pcie_rx_handle(): with the interrupt line held off
+ * the device fills RX_BUDGET_NOTIFS RBs, then every pass has to handle
+ * exactly min(budget, left) of them and say whether any are left, the
+ * way iwl_pcie_rx_schedule() and the RX workers count on.
+ */
+#define RX_BUDGET_NOTIFS    100
+
+static void check_rx_budget_pass(struct sim_run *run, u32 budget)
+{
+    struct iwl_trans_pcie *trans_pcie = IWL_TRANS_GET_PCIE_TRANS(sim_host.trans);
+    struct iwl_rxq *rxq = &trans_pcie->rxq[0];
+    u32 saved = rxq->budget, left = RX_BUDGET_NOTIFS, closed, passes = 0, got = 0, expect = 0;
+    bool more = false;
+    u8 payload[32];
+    char name[24];
+    UInt64 t;
+
+    snprintf(name, sizeof(name), "rx budget %u", budget);
+    memset(payload, 0x96, sizeof(payload));
+
+    /* drain() would wait for the interrupt, watch the closed RBs instead */
+    run->dev->drain();
+    run->dev->disableInterrupt(0);
+    closed = (rxq->read + RX_BUDGET_NOTIFS) & (rxq->queue_size - 1);
+    for (int i = 0; i < RX_BUDGET_NOTIFS; i++)
+        run->dev->injectNotif(0xad, 0, payload, sizeof(payload));
+    t = now_ns();
+    while ((le16_to_cpu(rxq->rb_stts->closed_rb_num) & (rxq->queue_size - 1)) != closed &&
+           now_ns() - t < NSEC_PER_SEC)
+        IODelay(10);
+
+    rxq->budget = budget;
+    while (left) {
+        UInt64 notifs = run->op->stats.notifs;
+
+        expect = budget && budget < left ? budget : left;
+        more = sim_host.ops->rx_handle(sim_host.trans, 0);
+        got = (u32)(run->op->stats.notifs - notifs);
+        passes++;
+        if (got != expect || more != (got < left))
+            break;
+        left -= got;
+    }
+    rxq->budget = saved;
+    run->dev->enableInterrupt(0);
+
+    CHECK(name, got == expect, "pass %u handled %u RBs, %u expected", passes, got, expect);
+    CHECK(name, !left, "pass %u says %s with %u of %d left", passes, more ? "more" : "done", left - got,
+          RX_BUDGET_NOTIFS);
+    CHECK(name, rxq->read == closed, "read %u, the device closed %u", rxq->read, closed);
+    CHECK(name, !rxq->draining, "queue left draining");
+    printf("ok   %s: %d RBs in %u passes\n", name, RX_BUDGET_NOTIFS, passes);
+}
+
+static void check_rx_budget(struct sim_run *run)
+{
+    static const u32 budgets[] = { 0, 1, 7, IWL_RX_POLL_BUDGET, RX_BUDGET_NOTIFS };
+    struct iwl_trans_pcie *trans_pcie = IWL_TRANS_GET_PCIE_TRANS(sim_host.trans);
+
+    CHECK("rx budget", trans_pcie->rxq[0].budget == IWL_RX_POLL_BUDGET, "queue 0 starts with %u RBs a pass",
+          trans_pcie->rxq[0].budget);
+    for (unsigned i = 0; i < ARRAY_SIZE(budgets); i++)
+        check_rx_budget_pass(run, budgets[i]);
+}
+
+// MARK: firmware error dump
+
+/*
+ * iwl_pcie_fw_dump_collect() with host commands in flight and more RBs
+ * waiting than a dump takes. The dump has to fit the slot
+ * iwl_pcie_fw_dump_size() sized, read back as an iwl_fw_error_dump_file
+ * whose segments end exactly at file_len, and carry the commands that
+ * weren't answered yet and the first pending RBs in ring order. Each
+ * collect takes the next slot.
+ */
+#define FW_DUMP_NOTIFS      (IWL_FW_DUMP_MAX_RBS + 4)
+#define FW_DUMP_NOTIF_CMD   0xdc
+#define FW_DUMP_CMDS        4
+
+static void check_fw_dump_layout(const char *name, const u8 *buf, u32 len, u32 first_rb)
+{
+    const struct iwl_fw_error_dump_file *file = (const struct iwl_fw_error_dump_file *)buf;
+    const struct iwl_fw_error_dump_data *data = (const struct iwl_fw_error_dump_data *)file->data;
+    static const u32 order[] = { IWL_FW_ERROR_DUMP_CSR, IWL_FW_ERROR_DUMP_FH_REGS, IWL_FW_ERROR_DUMP_PRPH,
+                                 IWL_FW_ERROR_DUMP_TXCMD, IWL_FW_ERROR_DUMP_RB };
+    u32 segs[ARRAY_SIZE(order)] = { 0 };
+    unsigned stage = 0;
+
+    CHECK(name, le32_to_cpu(file->barker) == IWL_FW_ERROR_DUMP_BARKER && le32_to_cpu(file->file_len) == len,
+          "barker %#x, file_len %u of %u", le32_to_cpu(file->barker), le32_to_cpu(file->file_len), len);
+
+    while ((const u8 *)data < buf + len) {
+        u32 type = le32_to_cpu(data->type), seg_len = le32_to_cpu(data->len);
+        u32 off = (u32)((const u8 *)data - buf);
+
+        CHECK(name, off + sizeof(*data) + seg_len <= len, "segment %u at %u runs past the end", type, off);
+        while (stage < ARRAY_SIZE(order) && order[stage] != type)
+            stage++;
+        CHECK(name, stage < ARRAY_SIZE(order), "segment %u at %u is out of order", type, off);
+        segs[stage]++;
+
+        switch (type) {
+        case IWL_FW_ERROR_DUMP_CSR: {
+            const __le32 *csr = (const __le32 *)data->data;
+
+            CHECK(name, seg_len == IWL_CSR_TO_DUMP, "%u bytes of CSR", seg_len);
+            CHECK(name, le32_to_cpu(csr[CSR_HW_REV / 4]) == sim_host.trans->hw_rev,
+                  "CSR_HW_REV %#x in the dump", le32_to_cpu(csr[CSR_HW_REV / 4]));
+            break;
+        }
+        case IWL_FW_ERROR_DUMP_FH_REGS:
+            CHECK(name, seg_len == FH_MEM_UPPER_BOUND - FH_MEM_LOWER_BOUND, "%u bytes of FH", seg_len);
+            break;
+        case IWL_FW_ERROR_DUMP_PRPH: {
+            const struct iwl_fw_error_dump_prph *prph = (const struct iwl_fw_error_dump_prph *)data->data;
+
+            CHECK(name, seg_len > sizeof(*prph) && !(seg_len % 4) && !(le32_to_cpu(prph->prph_start) % 4),
+                  "PRPH range at %#x, %u bytes", le32_to_cpu(prph->prph_start), seg_len);
+            break;
+        }
+        case IWL_FW_ERROR_DUMP_TXCMD: {
+            const u8 *p = data->data, *end = data->data + seg_len;
+            u32 echo = 0;
+
+            while (p < end) {
+                const struct iwl_fw_error_dump_txcmd *txcmd = (const struct iwl_fw_error_dump_txcmd *)p;
+                u32 cmdlen = le32_to_cpu(txcmd->cmdlen), caplen = le32_to_cpu(txcmd->caplen);
+
+                CHECK(name, cmdlen && caplen == min_t(u32, cmdlen, TFD_MAX_PAYLOAD_SIZE) &&
+                      txcmd->data + caplen <= end, "command of %u bytes, %u captured", cmdlen, caplen);
+                echo += ((const struct iwl_cmd_header *)txcmd->data)->cmd == ECHO_CMD;
+                p = txcmd->data + caplen;
+                segs[stage]++;
+            }
+            /* one for the segment, the rest are the commands */
+            CHECK(name, segs[stage] - 1 == FW_DUMP_CMDS && echo == FW_DUMP_CMDS,
+                  "%u commands, %u of them ECHO_CMD, %d in flight", segs[stage] - 1, echo, FW_DUMP_CMDS);
+            break;
+        }
+        case IWL_FW_ERROR_DUMP_RB: {
+            const struct iwl_fw_error_dump_rb *rb = (const struct iwl_fw_error_dump_rb *)data->data;
+            const struct iwl_rx_packet *pkt = (const struct iwl_rx_packet *)rb->data;
+            u32 index = le32_to_cpu(rb->index), want = (first_rb + segs[stage] - 1) & (RX_QUEUE_SIZE - 1);
+
+            CHECK(name, index == want && pkt->hdr.cmd == FW_DUMP_NOTIF_CMD,
+                  "RB %u is ring index %u with cmd %#x, index %u expected", segs[stage], index, pkt->hdr.cmd, want);
+            break;
+        }
+        }
+        data = iwl_fw_error_next_data((struct iwl_fw_error_dump_data *)data);
+    }
+
+    CHECK(name, (const u8 *)data == buf + len, "the segments end at %u, the file at %u",
+          (u32)((const u8 *)data - buf), len);
+    CHECK(name, segs[0] == 1 && segs[1] == 1 && segs[2] && segs[3],
+          "%u CSR, %u FH, %u PRPH and %u TXCMD segments", segs[0], segs[1], segs[2], segs[3]);
+    CHECK(name, segs[4] == IWL_FW_DUMP_MAX_RBS, "%u RBs, %d pending", segs[4], FW_DUMP_NOTIFS);
+
+    printf("ok   %s: %u bytes, %u PRPH ranges, %u commands, %u RBs\n", name, len, segs[2], segs[3] - 1, segs[4]);
+}
+
+static void check_fw_dump_slots(const char *name, u8 *buf, u32 len)
+{
+    struct iwl_trans_pcie *trans_pcie = IWL_TRANS_GET_PCIE_TRANS(sim_host.trans);
+    u32 seq, last;
+
+    iwl_trans_pcie_fw_dump_read(sim_host.trans, NULL, 0, &last);
+    for (int i = 0; i < IWL_FW_DUMP_SLOTS + 1; i++) {
+        iwl_pcie_fw_dump_collect(sim_host.trans);
+        CHECK(name, iwl_trans_pcie_fw_dump_read(sim_host.trans, NULL, 0, &seq) && seq == last + i + 1,
+              "dump %u after dump %u", seq, last + i);
+        CHECK(name, trans_pcie->fw_dump_slots[seq % IWL_FW_DUMP_SLOTS] != trans_pcie->fw_dump_slots[(seq - 1) %
+              IWL_FW_DUMP_SLOTS], "dumps %u and %u share a slot", seq - 1, seq);
+    }
+
+    /* a buffer too small gets the length only */
+    memset(buf, 0x5a, len);
+    CHECK(name, iwl_trans_pcie_fw_dump_read(sim_host.trans, buf, 16, NULL) > 16 && buf[0] == 0x5a,
+          "a 16 byte buffer was written to");
+
+    printf("ok   %s: %d dumps over %d slots\n", name, IWL_FW_DUMP_SLOTS + 1, IWL_FW_DUMP_SLOTS);
+}
+
+static void check_fw_dump(struct sim_run *run)
+{
+    struct iwl_trans_pcie *trans_pcie = IWL_TRANS_GET_PCIE_TRANS(sim_host.trans);
+    struct iwl_rxq *rxq = &trans_pcie->rxq[0];
+    u8 *buf = (u8 *)malloc(trans_pcie->fw_dump_slot_size);
+    u32 first_rb = rxq->read, closed, len;
+    u8 payload[32];
+    UInt64 t;
+
+    memset(payload, 0x3c, sizeof(payload));
+
+    /* RBs and responses the driver hasn't handled yet, like when the error interrupt comes in */
+    run->dev->drain();
+    run->dev->disableInterrupt(0);
+    closed = (rxq->read + FW_DUMP_NOTIFS) & (rxq->queue_size - 1);
+    for (int i = 0; i < FW_DUMP_NOTIFS; i++)
+        run->dev->injectNotif(FW_DUMP_NOTIF_CMD, 0, payload, sizeof(payload));
+    t = now_ns();
+    while ((le16_to_cpu(rxq->rb_stts->closed_rb_num) & (rxq->queue_size - 1)) != closed &&
+           now_ns() - t < NSEC_PER_SEC)
+        IODelay(10);
+    for (int i = 0; i < FW_DUMP_CMDS; i++) {
+        struct iwl_host_cmd cmd = {};
+
+        cmd.id = ECHO_CMD;
+        cmd.flags = CMD_ASYNC;
+        if (iwl_trans_send_cmd(sim_host.trans, &cmd))
+            printf("FAIL fw dump: async ECHO_CMD %d failed\n", i), failures++;
+    }
+
+    iwl_pcie_fw_dump_collect(sim_host.trans);
+    len = (u32)iwl_trans_pcie_fw_dump_read(sim_host.trans, buf, trans_pcie->fw_dump_slot_size, NULL);
+    if (len && len <= trans_pcie->fw_dump_slot_size)
+        check_fw_dump_layout("fw dump", buf, len, first_rb);
+    else
+        printf("FAIL fw dump: %u bytes, the slot has %u\n", len, trans_pcie->fw_dump_slot_size), failures++;
+    check_fw_dump_slots("fw dump slots", buf, trans_pcie->fw_dump_slot_size);
+
+    while (sim_host.ops->rx_handle(sim_host.trans, 0))
+        ;
+    run->dev->enableInterrupt(0);
+    run->dev->drain();
+    free(buf);
+}
+
+// MARK: TX
+
+static void bench_tx_pass(struct sim_run *run, const char *name, int batch, SimDevice::Counters *out)
+{
+    static const size_t segs[] = { 24, 200, 1276 };
+    UInt64 reclaimed = run->op->stats.txReclaimed, t, ns;
+    SimDevice::Counters c;
+    int sent = 0;
+
+    run->dev->drain();
+    run->dev->resetCounters();
+    t = now_ns();
+    while (sent < TX_FRAMES && now_ns() - t < 5 * NSEC_PER_SEC) {
+        /* don't outrun the ring, the overflow queue isn't what's measured */
+        if (sent - (int)(run->op->stats.txReclaimed - reclaimed) > TFD_QUEUE_SIZE_MAX / 2) {
+            IODelay(10);
+            continue;
+        }
+        /* a batch is a packet list handed to outputPacket() in one go */
+        mbuf_t list = NULL, tail = NULL;
+        int n, ret;
+
+        for (n = 0; n < batch && sent + n < TX_FRAMES; n++) {
+            mbuf_t m = SimOpMode::frame(1500, segs, ARRAY_SIZE(segs));
+
+            CHECK(name, m, "no mbufs");
+            if (tail)
+                mbuf_setnextpkt(tail, m);
+            else
+                list = m;
+            tail = m;
+        }
+        ret = run->op->txFrames(TX_QUEUE, list);
+        CHECK(name, !ret, "frames %d to %d: %d", sent, sent + n - 1, ret);
+        sent += n;
+    }
+    while (run->op->stats.txReclaimed - reclaimed < TX_FRAMES && now_ns() - t < 5 * NSEC_PER_SEC)
+        IODelay(10);
+    ns = now_ns() - t;
+    c = run->dev->counters();
+
+    CHECK(name, run->op->stats.txReclaimed - reclaimed == TX_FRAMES, "%llu of %d frames reclaimed",
+          (unsigned long long)(run->op->stats.txReclaimed - reclaimed), TX_FRAMES);
+    CHECK(name, c.txBytes >= (UInt64)TX_FRAMES * 1500, "device gathered %llu bytes",
+          (unsigned long long)c.txBytes);
+    printf("     %-12s %.0f frames per s, %.2f doorbells and %.1f register writes per frame\n",
+           name, TX_FRAMES * 1e9 / ns, (double)c.doorbells / TX_FRAMES, (double)c.mmioWrites / TX_FRAMES);
+    *out = c;
+}
+
+static void bench_tx(struct sim_run *run)
+{
+    unsigned long live = sim_mbuf_live();
+    SimDevice::Counters single = {}, batched = {};
+    int failed = failures;
+
+    iwl_trans_ac_txq_enable(sim_host.trans, TX_QUEUE, TX_FIFO, 0);
+
+    bench_tx_pass(run, "tx", 1, &single);
+    bench_tx_pass(run, "tx batched", TX_BATCH, &batched);
+    if (failures != failed)
+        return;
+
+    /*
+     * A lone frame rings the doorbell, a list rings it once at the end
+     * (TX_BATCH is IWL_TX_BATCH_MAX_FRAMES). The batch timer may ring an
+     * extra one if a list takes longer than IWL_TX_BATCH_MAX_LATENCY_US.
+     */
+    CHECK("tx", single.doorbells == TX_FRAMES, "%llu doorbells for %d frames",
+          (unsigned long long)single.doorbells, TX_FRAMES);
+    CHECK("tx batched", batched.doorbells <= TX_FRAMES / TX_BATCH * 21 / 20,
+          "%llu doorbells for %d lists", (unsigned long long)batched.doorbells, TX_FRAMES / TX_BATCH);
+    CHECK("tx batched", batched.mmioWrites * 2 < single.mmioWrites, "%llu register writes, %llu alone",
+          (unsigned long long)batched.mmioWrites, (unsigned long long)single.mmioWrites);
+    CHECK("tx", sim_mbuf_live() == live, "%lu mbufs leaked", sim_mbuf_live() - live);
+    printf("ok   tx: %d frames twice\n", TX_FRAMES);
+}
+
+/*
+ * iwl_fill_data_tbs(): whatever the chain looks like, the TBs after the
+ * TX command have to carry exactly the frame past its header, none longer
+ * than a TB can say. The frame's bytes are their offsets, see txFrame().
+ */
+static const struct {
+    const char *name;
+    size_t len;
+    size_t segs[32];
+    unsigned nsegs;
+    bool coalesce;              /* more pieces than IWL_PCIE_MAX_FRAGS */
+} tb_cases[] = {
+    { "header alone",   1500, { 24, 200, 1276 }, 3 },
+    { "header split",   1500, { 10, 30, 1460 }, 3 },
+    { "header short",   1500, { 30, 1470 }, 2 },
+    { "tiny pieces",    300,  { 24, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1 }, 17 },
+    { "over a page",    7000, { 7000 }, 1 },
+    { "too many",       1500, { 50, 50, 50, 50, 50, 50, 50, 50, 50, 50, 50, 50, 50, 50, 50, 50,
+                                50, 50, 50, 50, 50, 50, 50, 50, 50, 50, 50, 50, 50, 50 }, 30, true },
+};
+
+#define TB_HDR_LEN          24          /* ieee80211_hdrlen() of a plain data frame */
+
+static void bench_tx_tbs_case(struct sim_run *run, int c)
+{
+    IOMbufNaturalMemoryCursor *curs = (IOMbufNaturalMemoryCursor *)sim_host.trans->tx_mbuf_cursor;
+    UInt64 reclaimed = run->op->stats.txReclaimed, t;
+    UInt32 coalesced = curs->coalesced, sum = 0;
+    const char *name = tb_cases[c].name;
+    SimDevice::TxCapture cap;
+    int ret;
+
+    ret = run->op->txFrame(TX_QUEUE, tb_cases[c].len, tb_cases[c].segs, tb_cases[c].nsegs);
+    CHECK(name, !ret, "not sent: %d", ret);
+    for (t = now_ns(); run->op->stats.txReclaimed == reclaimed && now_ns() - t < NSEC_PER_SEC; )
+        IODelay(10);
+    CHECK(name, run->op->stats.txReclaimed == reclaimed + 1, "not reclaimed");
+
+    cap = run->dev->lastTx();
+    CHECK(name, cap.tbLen.size() > 2 && cap.tbLen.size() <= IWL_NUM_OF_TBS, "%zu TBs", cap.tbLen.size());
+    for (size_t i = 2; i < cap.tbLen.size(); i++) {
+        CHECK(name, cap.tbLen[i] && cap.tbLen[i] <= IWL_TFD_MAX_TB_LEN, "TB%zu is %u bytes", i, cap.tbLen[i]);
+        sum += cap.tbLen[i];
+    }
+    CHECK(name, sum == tb_cases[c].len - TB_HDR_LEN && cap.data.size() == sum,
+          "%u bytes in the data TBs for a %zu byte frame", sum, tb_cases[c].len);
+    for (size_t i = 0; i < cap.data.size(); i++)
+        CHECK(name, cap.data[i] == (UInt8)(i + TB_HDR_LEN), "byte %zu of the frame is wrong", i + TB_HDR_LEN);
+    CHECK(name, (curs->coalesced != coalesced) == tb_cases[c].coalesce, "%s", tb_cases[c].coalesce ?
+          "chain wasn't coalesced" : "chain was coalesced");
+
+    printf("ok   tx tbs %s: %zu data TBs\n", name, cap.tbLen.size() - 2);
+}
+
+static void bench_tx_tbs(struct sim_run *run)
+{
+    unsigned long live = sim_mbuf_live();
+
+    run->dev->captureTx(true);
+    for (unsigned c = 0; c < ARRAY_SIZE(tb_cases); c++)
+        bench_tx_tbs_case(run, c);
+    run->dev->captureTx(false);
+
+    CHECK("tx tbs", sim_mbuf_live() == live, "%lu mbufs leaked", sim_mbuf_live() - live);
+}
+
+int main(void)
+{
+    struct sim_run run;
+
+    bench_notif_wait();
+    bench_alive();
+    check_fw_load_bufs();
+    check_fw_blob();
+
+    if (!sim_up(&run)) {
+        sim_down(&run);
+        printf("FAIL sim: no ALIVE\n");
+        return 1;
+    }
+    bench_hcmd(&run);
+    bench_phy_db(&run);
+    check_rx_slabs(&run);
+    bench_rx(&run);
+    bench_rx_rss(&run);
+    check_int_mit(&run);
+    check_rx_budget(&run);
+    check_fw_dump(&run);
+    bench_tx(&run);
+    bench_tx_tbs(&run);
+    sim_down(&run);
+    iwl_drv_fw_cache_flush();
+
+    if (failures)
+        printf("%d checks failed\n", failures);
+
+    return failures ? 1 : 0;
+}
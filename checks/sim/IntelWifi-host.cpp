@@ -0,0 +1,272 @@
+//
+//  IntelWifi-host.cpp
+//  checks
+//
+//  The parts of IntelWifi.cpp the simulator needs, against the host
+//  IOKit: start() sets up the interrupt source, the gate, the timers and
+//  the transport exactly like the kext and loads the firmware through
+//  iwl_drv_start(), it stops short of the MVM op mode and the network
+//  interface. The transport itself (IntelWifi_trans/tx/rx) is the real one.
+//
+
+#include "IntelWifi.hpp"
+
+extern "C" {
+#include "Configuration.h"
+}
+
+#include <IOKit/IOCommandGate.h>
+#include <pexpert/pexpert.h>
+
+#include "IwlTransOps.h"
+#include "SimOpMode.h"
+
+#define super IO80211Controller
+OSDefineMetaClassAndStructors(IntelWifi, IO80211Controller)
+
+bool IntelWifi::init(OSDictionary *properties) {
+    if (!super::init(properties))
+        return false;
+
+    parseModParams();
+    return true;
+}
+
+void IntelWifi::parseModParams() {
+    UInt32 val;
+
+    if (PE_parse_boot_argn("iwl_rx_inline", &val, sizeof(val)))
+        iwlwifi_mod_params.rx_inline = val != 0;
+    if (PE_parse_boot_argn("iwl_rx_budget", &val, sizeof(val)))
+        iwlwifi_mod_params.rx_budget = val;
+    if (PE_parse_boot_argn("iwl_fw_load_plan", &val, sizeof(val)))
+        iwlwifi_mod_params.fw_load_plan = val != 0;
+}
+
+void IntelWifi::free() {
+    OSObject::free();
+}
+
+IOService* IntelWifi::probe(IOService* provider, SInt32 *score) {
+    pciDevice = OSDynamicCast(IOPCIDevice, provider);
+    if (!pciDevice)
+        return NULL;
+
+    fDeviceId = pciDevice->configRead16(kIOPCIConfigDeviceID);
+    fSubsystemId = pciDevice->configRead16(kIOPCIConfigSubSystemID);
+
+    fConfiguration = getConfiguration(fDeviceId, fSubsystemId);
+    if (!fConfiguration) {
+        pciDevice = NULL;
+        return NULL;
+    }
+    pciDevice->retain();
+
+    return this;
+}
+
+SInt32 IntelWifi::apple80211Request(UInt32 request_type, int request_number,
+                                    IO80211Interface* interface, void* data) {
+    return kIOReturnUnsupported;
+}
+
+IOReturn IntelWifi::getINT_MIT(IO80211Interface *interface, struct apple80211_intmit_data *md) {
+    return kIOReturnUnsupported;
+}
+
+IOReturn IntelWifi::setINT_MIT(IO80211Interface *interface, struct apple80211_intmit_data *md) {
+    return kIOReturnUnsupported;
+}
+
+IOReturn IntelWifi::intMitAction(OSObject *owner, void *arg0, void *arg1, void *arg2, void *arg3) {
+    IntelWifi *me = (IntelWifi *)owner;
+
+    me->iwl_pcie_int_mit_reset(me->fTrans, arg0 != NULL);
+    return kIOReturnSuccess;
+}
+
+bool IntelWifi::createWorkLoop() {
+    if (!fWorkLoop)
+        fWorkLoop = IOWorkLoop::workLoop();
+
+    return fWorkLoop != NULL;
+}
+
+IOWorkLoop* IntelWifi::getWorkLoop() const {
+    return fWorkLoop;
+}
+
+bool IntelWifi::start(IOService *provider) {
+    /* IO80211Controller::start() creates the workloop in the kernel */
+    if (!super::start(provider) || !createWorkLoop()) {
+        releaseAll();
+        return false;
+    }
+
+    int source = findMSIInterruptTypeIndex();
+    fIrqLoop = IOWorkLoop::workLoop();
+    fInterruptSource = IOFilterInterruptEventSource::filterInterruptEventSource(this,
+                                                                                (IOInterruptEventAction) &IntelWifi::interruptOccured,
+                                                                                (IOFilterInterruptAction) &IntelWifi::interruptFilter,
+                                                                                pciDevice, source);
+    if (!fInterruptSource || fIrqLoop->addEventSource(fInterruptSource) != kIOReturnSuccess) {
+        releaseAll();
+        return false;
+    }
+
+    fInterruptSource->enable();
+
+    gate = IOCommandGate::commandGate(this, (IOCommandGate::Action)&IntelWifi::gateAction);
+    if (fWorkLoop->addEventSource(gate) != kIOReturnSuccess) {
+        releaseAll();
+        return false;
+    }
+    gate->enable();
+
+    fTxBatchTimer = IOTimerEventSource::timerEventSource(this, &IntelWifi::txBatchTimeout);
+    if (!fTxBatchTimer || fWorkLoop->addEventSource(fTxBatchTimer) != kIOReturnSuccess) {
+        releaseAll();
+        return false;
+    }
+
+    fIntMitPollTimer = IOTimerEventSource::timerEventSource(this, &IntelWifi::intMitPollTimeout);
+    if (!fIntMitPollTimer || fIrqLoop->addEventSource(fIntMitPollTimer) != kIOReturnSuccess) {
+        releaseAll();
+        return false;
+    }
+
+    fTrans = iwl_trans_pcie_alloc(fConfiguration);
+    if (!fTrans) {
+        releaseAll();
+        return false;
+    }
+    if (!createRxWorkers())
+        releaseRxWorkers();
+
+    fTrans->tx_mbuf_cursor = IOMbufNaturalMemoryCursor::withSpecification(IWL_TFD_MAX_TB_LEN, fTrans->max_skb_frags);
+    fTrans->dev = this;
+    fTrans->gate = gate;
+
+    fTrans->drv = iwl_drv_start(fTrans);
+    if (!fTrans->drv) {
+        releaseAll();
+        return false;
+    }
+
+    /* the benchmark plays the op mode */
+    sim_host.iw = this;
+    sim_host.trans = fTrans;
+    sim_host.ops = transOps;
+    return true;
+}
+
+void IntelWifi::stop(IOService *provider) {
+    if (fWorkLoop && fTxBatchTimer) {
+        fTxBatchTimer->cancelTimeout();
+        fWorkLoop->removeEventSource(fTxBatchTimer);
+    }
+    if (fIrqLoop) {
+        if (fIntMitPollTimer) {
+            fIntMitPollTimer->cancelTimeout();
+            fIrqLoop->removeEventSource(fIntMitPollTimer);
+        }
+        if (fInterruptSource) {
+            fInterruptSource->disable();
+            fIrqLoop->removeEventSource(fInterruptSource);
+        }
+    }
+
+    releaseRxWorkers();
+
+    iwl_drv_stop(fTrans->drv);
+    iwl_trans_pcie_free(fTrans);
+    fTrans = NULL;
+    memset(&sim_host, 0, sizeof(sim_host));
+
+    super::stop(provider);
+}
+
+IOReturn IntelWifi::enable(IONetworkInterface *netif) {
+    fTrans->intf = netif;
+    return kIOReturnSuccess;
+}
+
+IOReturn IntelWifi::disable(IONetworkInterface *netif) {
+    fTrans->intf = NULL;
+    return kIOReturnSuccess;
+}
+
+IOReturn IntelWifi::getHardwareAddress(IOEthernetAddress *addrP) {
+    memset(addrP->bytes, 0, sizeof(addrP->bytes));
+    return kIOReturnSuccess;
+}
+
+IOReturn IntelWifi::getHardwareAddressForInterface(IO80211Interface* netif, IOEthernetAddress* addr) {
+    return getHardwareAddress(addr);
+}
+
+IOReturn IntelWifi::setPromiscuousMode(bool active) {
+    return kIOReturnSuccess;
+}
+
+IOReturn IntelWifi::setMulticastMode(bool active) {
+    return kIOReturnSuccess;
+}
+
+bool IntelWifi::configureInterface(IONetworkInterface *netif) {
+    return super::configureInterface(netif);
+}
+
+IOReturn IntelWifi::gateAction(OSObject *owner, void *arg0, void *arg1, void *arg2, void *arg3) {
+    return kIOReturnSuccess;
+}
+
+IO80211Interface *IntelWifi::getNetworkInterface() {
+    return netif;
+}
+
+const OSString* IntelWifi::newVendorString() const {
+    return OSString::withCString("Intel");
+}
+
+const OSString* IntelWifi::newModelString() const {
+    return OSString::withCString(fConfiguration->name);
+}
+
+bool IntelWifi::createMediumDict() {
+    return true;
+}
+
+int IntelWifi::findMSIInterruptTypeIndex() {
+    int index, source = 0;
+
+    for (index = 0; ; index++) {
+        int interruptType;
+
+        if (pciDevice->getInterruptType(index, &interruptType) != kIOReturnSuccess)
+            break;
+        if (interruptType & kIOInterruptTypePCIMessaged) {
+            source = index;
+            break;
+        }
+    }
+    return source;
+}
+
+void IntelWifi::releaseAll() {
+    releaseRxWorkers();
+    RELEASE(fInterruptSource);
+    RELEASE(fTxBatchTimer);
+    RELEASE(fIntMitPollTimer);
+    RELEASE(gate);
+    RELEASE(fIrqLoop);
+    RELEASE(fWorkLoop);
+
+    RELEASE(fMemoryMap);
+    if (fTrans) {
+        iwl_trans_pcie_free(fTrans);
+        fTrans = NULL;
+    }
+
+    RELEASE(pciDevice);
+}
@@ -0,0 +1,894 @@
+//
+//  SimDevice.cpp
+//  checks
+//
+//  See SimDevice.h. Register offsets and layouts come from the driver's
+//  own headers, the behaviour behind them is what the transport expects
+//  of an 8000 family device on the legacy (single queue) RX path.
+//
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+
+extern "C" {
+#include "iwl-trans.h"
+#include "iwl-csr.h"
+#include "iwl-fh.h"
+#include "iwl-io.h"
+#include "iwl-prph.h"
+#include "iwl-scd.h"
+#include "fw/api/alive.h"
+#include "fw/api/commands.h"
+#include "fw/api/tx.h"
+}
+
+#include "SimDevice.h"
+#include "sim.h"
+
+static pthread_mutex_t sim_devices_mutex = PTHREAD_MUTEX_INITIALIZER;
+static std::vector<SimDevice *> sim_devices;
+
+static UInt32 sim_cbbc(int q)
+{
+    if (q < 16)
+        return FH_MEM_CBBC_0_15_LOWER_BOUND + 4 * q;
+    if (q < 20)
+        return FH_MEM_CBBC_16_19_LOWER_BOUND + 4 * (q - 16);
+    return FH_MEM_CBBC_20_31_LOWER_BOUND + 4 * (q - 20);
+}
+
+static UInt64 sim_now(void)
+{
+    return mach_absolute_time();
+}
+
+/* a 64 bit mix of a word and where it went, see sramHash() */
+static UInt64 sim_mix(UInt32 addr, UInt32 word)
+{
+    UInt64 x = ((UInt64)addr << 32) | word;
+
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+SimDevice *SimDevice::withConfig(const Config &config)
+{
+    SimDevice *me = new SimDevice;
+
+    me->config = config;
+    memset(&me->stats, 0, sizeof(me->stats));
+    if (posix_memalign((void **)&me->bar, PAGE_SIZE, SIM_BAR_SIZE)) {
+        delete me;
+        return NULL;
+    }
+    memset((void *)me->bar, 0, SIM_BAR_SIZE);
+    me->barMap = new IOMemoryMap((void *)me->bar, SIM_BAR_SIZE);
+
+    pthread_mutex_init(&me->mutex, NULL);
+    me->exiting = false;
+    me->working = false;
+    me->irqTarget = NULL;
+    me->irqHandler = NULL;
+    me->irqRefCon = NULL;
+    me->irqEnabled = false;
+    me->irqAsserted = false;
+    me->irqPending = false;
+    me->cmdCapturing = false;
+    me->prphWaddr = me->prphRaddr = 0;
+    me->memWaddr = me->memRaddr = 0;
+    me->resetDevice();
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&me->cond, &attr);
+    pthread_cond_init(&me->idle, &attr);
+    pthread_condattr_destroy(&attr);
+
+    pthread_mutex_lock(&sim_devices_mutex);
+    sim_devices.push_back(me);
+    pthread_mutex_unlock(&sim_devices_mutex);
+
+    pthread_create(&me->thread, NULL, threadMain, me);
+    return me;
+}
+
+void SimDevice::free()
+{
+    pthread_mutex_lock(&mutex);
+    exiting = true;
+    kick();
+    pthread_mutex_unlock(&mutex);
+    pthread_join(thread, NULL);
+
+    pthread_mutex_lock(&sim_devices_mutex);
+    for (auto it = sim_devices.begin(); it != sim_devices.end(); ++it) {
+        if (*it == this) {
+            sim_devices.erase(it);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&sim_devices_mutex);
+
+    barMap->release();
+    ::free((void *)bar);
+    IOPCIDevice::free();
+}
+
+SimDevice *SimDevice::fromBar(const volatile void *base)
+{
+    SimDevice *found = NULL;
+
+    pthread_mutex_lock(&sim_devices_mutex);
+    for (SimDevice *dev : sim_devices) {
+        if ((const volatile void *)dev->bar == base) {
+            found = dev;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&sim_devices_mutex);
+    return found;
+}
+
+/* the BAR is the only memory the driver reads and writes as little endian words */
+extern "C" void OSWriteLittleInt32(volatile void *base, uintptr_t byteOffset, UInt32 data)
+{
+    SimDevice *dev = SimDevice::fromBar(base);
+
+    if (!dev) {
+        *(volatile UInt32 *)((volatile UInt8 *)base + byteOffset) = data;
+        return;
+    }
+    dev->write32((UInt32)byteOffset, data);
+}
+
+extern "C" UInt32 OSReadLittleInt32(const volatile void *base, uintptr_t byteOffset)
+{
+    SimDevice *dev = SimDevice::fromBar(base);
+
+    if (!dev)
+        return *(const volatile UInt32 *)((const volatile UInt8 *)base + byteOffset);
+    return dev->read32((UInt32)byteOffset);
+}
+
+// MARK: PCI
+
+UInt16 SimDevice::configRead16(UInt8 offset)
+{
+    switch (offset) {
+        case kIOPCIConfigVendorID:
+            return 0x8086;
+        case kIOPCIConfigDeviceID:
+            return config.deviceId;
+        case kIOPCIConfigSubSystemVendorID:
+            return 0x8086;
+        case kIOPCIConfigSubSystemID:
+            return config.subsystemId;
+    }
+    return 0;
+}
+
+UInt32 SimDevice::configRead32(UInt8 offset)
+{
+    if (offset == kIOPCIConfigVendorID)
+        return ((UInt32)config.deviceId << 16) | 0x8086;
+    return 0;
+}
+
+void SimDevice::configWrite8(UInt8 offset, UInt8 data)
+{
+}
+
+IOMemoryMap *SimDevice::mapDeviceMemoryWithRegister(UInt8 reg, IOOptionBits options)
+{
+    if (reg != kIOPCIConfigBaseAddress0)
+        return NULL;
+    barMap->retain();
+    return barMap;
+}
+
+IOReturn SimDevice::registerInterrupt(int source, OSObject *target, IOInterruptAction handler, void *refCon)
+{
+    if (source)
+        return kIOReturnBadArgument;
+    pthread_mutex_lock(&mutex);
+    irqTarget = target;
+    irqHandler = handler;
+    irqRefCon = refCon;
+    pthread_mutex_unlock(&mutex);
+    return kIOReturnSuccess;
+}
+
+IOReturn SimDevice::unregisterInterrupt(int source)
+{
+    pthread_mutex_lock(&mutex);
+    irqEnabled = false;
+    irqHandler = NULL;
+    irqTarget = NULL;
+    pthread_mutex_unlock(&mutex);
+    return kIOReturnSuccess;
+}
+
+IOReturn SimDevice::getInterruptType(int source, int *interruptType)
+{
+    if (source)
+        return kIOReturnBadArgument;
+    *interruptType = kIOInterruptTypeEdge | kIOInterruptTypePCIMessaged;
+    return kIOReturnSuccess;
+}
+
+IOReturn SimDevice::enableInterrupt(int source)
+{
+    pthread_mutex_lock(&mutex);
+    irqEnabled = true;
+    kick();
+    pthread_mutex_unlock(&mutex);
+    return kIOReturnSuccess;
+}
+
+IOReturn SimDevice::disableInterrupt(int source)
+{
+    pthread_mutex_lock(&mutex);
+    irqEnabled = false;
+    pthread_mutex_unlock(&mutex);
+    return kIOReturnSuccess;
+}
+
+// MARK: device thread
+
+void *SimDevice::threadMain(void *arg)
+{
+    static_cast<SimDevice *>(arg)->threadLoop();
+    return NULL;
+}
+
+void SimDevice::post(UInt64 when, EventType type, UInt32 arg)
+{
+    Event ev = { type, arg };
+
+    events.insert(std::make_pair(when, ev));
+    kick();
+}
+
+void SimDevice::threadLoop()
+{
+    pthread_mutex_lock(&mutex);
+    while (!exiting) {
+        /* the message goes out without the device lock, the filter writes CSR_INT_MASK */
+        if (irqPending && irqEnabled && irqHandler) {
+            OSObject *target = irqTarget;
+            IOInterruptAction handler = irqHandler;
+            void *refCon = irqRefCon;
+
+            irqPending = false;
+            stats.irqs++;
+            working = true;
+            pthread_mutex_unlock(&mutex);
+            handler(target, refCon, this, 0);
+            pthread_mutex_lock(&mutex);
+            continue;
+        }
+
+        if (events.empty()) {
+            working = false;
+            pthread_cond_broadcast(&idle);
+            pthread_cond_wait(&cond, &mutex);
+            continue;
+        }
+
+        working = true;
+        auto first = events.begin();
+        UInt64 now = sim_now();
+        if (first->first > now) {
+            struct timespec ts;
+
+            ts.tv_sec = (time_t)(first->first / NSEC_PER_SEC);
+            ts.tv_nsec = (long)(first->first % NSEC_PER_SEC);
+            pthread_cond_timedwait(&cond, &mutex, &ts);
+            continue;
+        }
+
+        Event ev = first->second;
+        events.erase(first);
+
+        switch (ev.type) {
+            case kEventDmaDone:
+                finishDma();
+                break;
+            case kEventBoot: {
+                struct mvm_alive_resp_v3 alive;
+
+                memset(&alive, 0, sizeof(alive));
+                alive.status = cpu_to_le16(IWL_ALIVE_STATUS_OK);
+                alive.lmac_data.ucode_major = cpu_to_le32(34);
+                alive.lmac_data.scd_base_ptr = cpu_to_le32(SIM_SCD_BASE);
+                queuePacket(MVM_ALIVE, 0, le16_to_cpu(SEQ_RX_FRAME), &alive, sizeof(alive));
+                raise(CSR_INT_BIT_ALIVE, 0);
+                break;
+            }
+            case kEventTxq:
+                serviceTxq(ev.arg);
+                break;
+            case kEventRx:
+                deliverRx();
+                break;
+            case kEventIrq:
+                evaluateIrq();
+                break;
+        }
+    }
+    pthread_mutex_unlock(&mutex);
+}
+
+void SimDevice::drain()
+{
+    pthread_mutex_lock(&mutex);
+    while (working || irqPending || !events.empty())
+        pthread_cond_wait(&idle, &mutex);
+    pthread_mutex_unlock(&mutex);
+}
+
+void SimDevice::resetCounters()
+{
+    pthread_mutex_lock(&mutex);
+    memset(&stats, 0, sizeof(stats));
+    stats.fwLoadBufs = (UInt32)fwBufs.size();
+    pthread_mutex_unlock(&mutex);
+}
+
+/* SW_RESET: the MAC and whatever the firmware had set up are gone */
+void SimDevice::resetDevice()
+{
+    events.clear();
+    rxPending.clear();
+    prph.clear();
+    irqPending = false;
+    irqAsserted = false;
+    ictBase = 0;
+    ictIndex = 0;
+    dmaSrc = 0;
+    dmaDst = dmaLen = 0;
+    fwHash = 0;
+    booted = false;
+    fwNextSrc = fwLastSrc = 0;
+    memset(txq, 0, sizeof(txq));
+    txActive = 0;
+    rxSize = RX_QUEUE_SIZE;
+    rxRbSize = 4096;
+    rxRead = 0;
+    setReg(CSR_INT, 0);
+    setReg(CSR_FH_INT_STATUS, 0);
+    setReg(CSR_INT_MASK, 0);
+    setReg(FH_UCODE_LOAD_STATUS, 0);
+}
+
+// MARK: interrupts
+
+void SimDevice::raise(UInt32 inta, UInt32 fh)
+{
+    setReg(CSR_INT, reg(CSR_INT) | inta);
+    setReg(CSR_FH_INT_STATUS, reg(CSR_FH_INT_STATUS) | fh);
+    evaluateIrq();
+}
+
+/* MSI: a message goes out when an unmasked cause appears, not while one stays */
+void SimDevice::evaluateIrq()
+{
+    UInt32 inta = reg(CSR_INT) & reg(CSR_INT_MASK);
+    bool asserted = inta != 0;
+
+    if (asserted && !irqAsserted) {
+        if (ictBase) {
+            UInt32 *ict = (UInt32 *)sim_dma_virt(ictBase, PAGE_SIZE);
+            UInt32 val = (reg(CSR_INT) & 0xff) | ((reg(CSR_INT) >> 16) & 0xff00);
+
+            if (ict) {
+                __atomic_store_n(&ict[ictIndex], cpu_to_le32(val), __ATOMIC_RELEASE);
+                ictIndex = (ictIndex + 1) & (PAGE_SIZE / sizeof(UInt32) - 1);
+            }
+        }
+        irqPending = true;
+        kick();
+    }
+    irqAsserted = asserted;
+}
+
+// MARK: registers
+
+UInt32 SimDevice::read32(UInt32 ofs)
+{
+    UInt32 val;
+
+    if (ofs >= SIM_BAR_SIZE)
+        return 0xa5a5a5a2;
+
+    pthread_mutex_lock(&mutex);
+    stats.mmioReads++;
+    val = reg(ofs);
+
+    switch (ofs) {
+        case CSR_HW_REV:
+            val = config.hwRev;
+            break;
+        case CSR_HW_RF_ID:
+            val = 0;
+            break;
+        case CSR_GP_CNTRL:
+            /* the clock runs once INIT_DONE or a MAC access request is set */
+            val &= ~(CSR_GP_CNTRL_REG_FLAG_MAC_CLOCK_READY | CSR_GP_CNTRL_REG_FLAG_GOING_TO_SLEEP);
+            if (val & (CSR_GP_CNTRL_REG_FLAG_INIT_DONE | CSR_GP_CNTRL_REG_FLAG_MAC_ACCESS_REQ))
+                val |= CSR_GP_CNTRL_REG_FLAG_MAC_CLOCK_READY;
+            /* the RF kill switch is off */
+            val |= CSR_GP_CNTRL_REG_FLAG_HW_RF_KILL_SW;
+            break;
+        case CSR_RESET:
+            if (val & CSR_RESET_REG_FLAG_STOP_MASTER)
+                val |= CSR_RESET_REG_FLAG_MASTER_DISABLED;
+            break;
+        case FH_MEM_RSSR_RX_STATUS_REG:
+            val = FH_RSSR_CHNL0_RX_STATUS_CHNL_IDLE;
+            break;
+        case FH_TSSR_TX_STATUS_REG:
+            val = 0;
+            for (int ch = 0; ch < FH_TCSR_CHNL_NUM; ch++)
+                val |= FH_TSSR_TX_STATUS_REG_MSK_CHNL_IDLE(ch);
+            break;
+        case HBUS_TARG_PRPH_RDAT:
+            val = prphRead(prphRaddr);
+            break;
+        case HBUS_TARG_MEM_RDAT: {
+            auto it = sram.find(memRaddr);
+
+            val = it != sram.end() ? it->second : 0;
+            memRaddr += 4;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&mutex);
+    return val;
+}
+
+void SimDevice::write32(UInt32 ofs, UInt32 val)
+{
+    if (ofs >= SIM_BAR_SIZE)
+        return;
+
+    pthread_mutex_lock(&mutex);
+    stats.mmioWrites++;
+
+    switch (ofs) {
+        case CSR_INT:
+        case CSR_FH_INT_STATUS:
+            /* write one to clear */
+            setReg(ofs, reg(ofs) & ~val);
+            evaluateIrq();
+            break;
+        case CSR_INT_MASK:
+            setReg(ofs, val);
+            evaluateIrq();
+            break;
+        case CSR_RESET:
+            if (val & CSR_RESET_REG_FLAG_SW_RESET) {
+                resetDevice();
+                val &= ~CSR_RESET_REG_FLAG_SW_RESET;
+            }
+            if (!(val & CSR_RESET_REG_FLAG_STOP_MASTER))
+                val &= ~CSR_RESET_REG_FLAG_MASTER_DISABLED;
+            /* pre 8000 devices start the ucode by releasing the CPU reset */
+            if (!val && stats.fwChunks && !booted)
+                boot();
+            setReg(ofs, val);
+            break;
+        case CSR_UCODE_DRV_GP1_SET:
+            setReg(CSR_UCODE_DRV_GP1, reg(CSR_UCODE_DRV_GP1) | val);
+            break;
+        case CSR_UCODE_DRV_GP1_CLR:
+            setReg(CSR_UCODE_DRV_GP1, reg(CSR_UCODE_DRV_GP1) & ~val);
+            break;
+        case CSR_DRAM_INT_TBL_REG:
+            setReg(ofs, val);
+            ictBase = (val & CSR_DRAM_INT_TBL_ENABLE) ? (UInt64)(val & 0x07FFFFFF) << 12 : 0;
+            ictIndex = 0;
+            break;
+        case HBUS_TARG_PRPH_WADDR:
+            prphWaddr = val & 0x000FFFFF;
+            break;
+        case HBUS_TARG_PRPH_RADDR:
+            prphRaddr = val & 0x000FFFFF;
+            break;
+        case HBUS_TARG_PRPH_WDAT:
+            prphWrite(prphWaddr, val);
+            break;
+        case HBUS_TARG_MEM_WADDR:
+            memWaddr = val;
+            break;
+        case HBUS_TARG_MEM_RADDR:
+            memRaddr = val;
+            break;
+        case HBUS_TARG_MEM_WDAT:
+            sram[memWaddr] = val;
+            memWaddr += 4;
+            break;
+        case HBUS_TARG_WRPTR:
+            doorbell(val);
+            break;
+        case FH_UCODE_LOAD_STATUS:
+            setReg(ofs, val);
+            stats.loadStatusWrites++;
+            if (val == 0xFFFFFFFF && !booted)
+                boot();
+            break;
+        case FH_RSCSR_CHNL0_WPTR:
+            setReg(ofs, val);
+            /* new RBs, anything that was waiting for one can go */
+            if (!rxPending.empty())
+                post(sim_now(), kEventRx);
+            break;
+        case FH_MEM_RCSR_CHNL0_CONFIG_REG:
+            setReg(ofs, val);
+            rxSize = 1U << ((val >> FH_RCSR_RX_CONFIG_RBDCB_SIZE_POS) & 0xF);
+            switch (val & FH_RCSR_RX_CONFIG_REG_VAL_RB_SIZE_16K) {
+                case FH_RCSR_RX_CONFIG_REG_VAL_RB_SIZE_8K:
+                    rxRbSize = 8192;
+                    break;
+                case FH_RCSR_RX_CONFIG_REG_VAL_RB_SIZE_12K:
+                    rxRbSize = 12288;
+                    break;
+                case FH_RCSR_RX_CONFIG_REG_VAL_RB_SIZE_16K:
+                    rxRbSize = 16384;
+                    break;
+                default:
+                    rxRbSize = 4096;
+            }
+            if (!(val & FH_RCSR_RX_CONFIG_CHNL_EN_ENABLE_VAL))
+                rxRead = 0;
+            break;
+        default:
+            setReg(ofs, val);
+            if (ofs == FH_TCSR_CHNL_TX_CONFIG_REG(FH_SRVC_CHNL) &&
+                (val & FH_TCSR_TX_CONFIG_REG_VAL_DMA_CHNL_ENABLE))
+                startDma();
+            break;
+    }
+
+    pthread_mutex_unlock(&mutex);
+}
+
+UInt32 SimDevice::prphRead(UInt32 addr)
+{
+    if (addr == (SCD_SRAM_BASE_ADDR & 0x000FFFFF))
+        return SIM_SCD_BASE;
+
+    auto it = prph.find(addr);
+    return it != prph.end() ? it->second : 0;
+}
+
+void SimDevice::prphWrite(UInt32 addr, UInt32 val)
+{
+    prph[addr] = val;
+
+    if (addr == (UREG_UCODE_LOAD_STATUS & 0x000FFFFF)) {
+        stats.loadStatusWrites++;
+        if (val == 0xFFFFFFFF && !booted)
+            boot();
+        return;
+    }
+
+    for (int q = 0; q < SIM_NUM_TXQ; q++) {
+        if (addr == (SCD_QUEUE_RDPTR(q) & 0x000FFFFF)) {
+            txq[q].rd = val & (TFD_QUEUE_SIZE_MAX - 1);
+            return;
+        }
+        if (addr == (SCD_QUEUE_STATUS_BITS(q) & 0x000FFFFF)) {
+            if (val & BIT(SCD_QUEUE_STTS_REG_POS_ACTIVE))
+                txActive |= BIT(q);
+            else
+                txActive &= ~BIT(q);
+            return;
+        }
+    }
+}
+
+// MARK: firmware load
+
+/* both CPUs are in, ALIVE follows after the boot time */
+void SimDevice::boot()
+{
+    booted = true;
+    post(sim_now() + config.bootNs, kEventBoot);
+}
+
+void SimDevice::startDma()
+{
+    UInt32 ctrl1 = reg(FH_TFDIB_CTRL1_REG(FH_SRVC_CHNL));
+
+    dmaSrc = reg(FH_TFDIB_CTRL0_REG(FH_SRVC_CHNL)) |
+             ((UInt64)(ctrl1 >> FH_MEM_TFDIB_REG1_ADDR_BITSHIFT) << 32);
+    dmaLen = ctrl1 & ((1U << FH_MEM_TFDIB_REG1_ADDR_BITSHIFT) - 1);
+    dmaDst = reg(FH_SRVC_CHNL_SRAM_ADDR_REG(FH_SRVC_CHNL));
+
+    if (std::find(fwBufs.begin(), fwBufs.end(), dmaSrc) == fwBufs.end())
+        fwBufs.push_back(dmaSrc);
+    stats.fwLoadBufs = (UInt32)fwBufs.size();
+    if (dmaSrc == fwLastSrc)
+        stats.fwBufRepeats++;
+    if (dmaSrc == fwNextSrc && dmaLen <= fwNext.size()) {
+        const void *src = sim_dma_virt(dmaSrc, dmaLen);
+
+        if (src && !memcmp(src, fwNext.data(), dmaLen))
+            stats.fwStaged++;
+    }
+    fwLastSrc = dmaSrc;
+    fwNextSrc = 0;
+
+    post(sim_now() + config.dmaSetupNs + (UInt64)dmaLen * config.dmaNsPerKB / 1024, kEventDmaDone);
+}
+
+void SimDevice::finishDma()
+{
+    const UInt32 *src = (const UInt32 *)sim_dma_virt(dmaSrc, dmaLen);
+
+    if (src) {
+        for (UInt32 i = 0; i < dmaLen / 4; i++)
+            fwHash += sim_mix(dmaDst + i * 4, le32_to_cpu(src[i]));
+    }
+    stats.fwChunks++;
+    stats.fwBytes += dmaLen;
+
+    /*
+     * Scribble over the chunk now that it's in, a buffer that isn't
+     * restaged can't pass for one that is. Whatever the next buffer
+     * holds at this point was staged while this chunk was on its way.
+     */
+    if (src)
+        memset((void *)src, 0xd5, dmaLen);
+    if (fwBufs.size() > 1) {
+        size_t i = std::find(fwBufs.begin(), fwBufs.end(), dmaSrc) - fwBufs.begin();
+        UInt64 next = fwBufs[(i + 1) % fwBufs.size()];
+        const UInt8 *data = (const UInt8 *)sim_dma_virt(next, FH_MEM_TB_MAX_LENGTH);
+
+        if (data) {
+            fwNext.assign(data, data + FH_MEM_TB_MAX_LENGTH);
+            fwNextSrc = next;
+        }
+    }
+    raise(CSR_INT_BIT_FH_TX, CSR_FH_INT_BIT_TX_CHNL0 | CSR_FH_INT_BIT_TX_CHNL1);
+}
+
+// MARK: TX
+
+void SimDevice::doorbell(UInt32 val)
+{
+    int q = (val >> 8) & (SIM_NUM_TXQ - 1);
+    Txq *tq = &txq[q];
+
+    stats.doorbells++;
+    tq->wr = val & (TFD_QUEUE_SIZE_MAX - 1);
+
+    /* a queue that isn't active yet only has its pointers set up */
+    if (!(txActive & BIT(q))) {
+        tq->rd = tq->wr;
+        return;
+    }
+
+    if (!tq->busy && tq->rd != tq->wr) {
+        tq->busy = true;
+        post(sim_now() + config.cmdNs, kEventTxq, q);
+    }
+}
+
+void SimDevice::serviceTxq(int q)
+{
+    Txq *tq = &txq[q];
+    UInt64 base = (UInt64)reg(sim_cbbc(q)) << 8;
+    struct iwl_tfd *tfd = (struct iwl_tfd *)sim_dma_virt(base + tq->rd * sizeof(struct iwl_tfd),
+                                                         sizeof(struct iwl_tfd));
+    struct iwl_cmd_header hdr;
+    UInt32 bytes = 0;
+    UInt8 *tb0;
+
+    if (!tfd || !tfd->num_tbs) {
+        tq->busy = false;
+        return;
+    }
+
+    for (int i = 0; i < (tfd->num_tbs & 0x1f); i++)
+        bytes += le16_to_cpu(tfd->tbs[i].hi_n_len) >> 4;
+    tb0 = (UInt8 *)sim_dma_virt(le32_to_cpu(tfd->tbs[0].lo) |
+                                ((UInt64)(le16_to_cpu(tfd->tbs[0].hi_n_len) & 0xF) << 32),
+                                sizeof(hdr));
+    if (!tb0) {
+        tq->busy = false;
+        return;
+    }
+    memcpy(&hdr, tb0, sizeof(hdr));
+
+    UInt32 inflight = (tq->wr - tq->rd) & (TFD_QUEUE_SIZE_MAX - 1);
+
+    if (hdr.cmd == TX_CMD && !hdr.group_id) {
+        struct {
+            struct iwl_mvm_tx_resp resp;
+            __le32 ssn;
+        } __packed tx;
+
+        memset(&tx, 0, sizeof(tx));
+        tx.resp.frame_count = 1;
+        tx.resp.tx_queue = cpu_to_le16(q);
+        tx.resp.status.status = cpu_to_le16(TX_STATUS_SUCCESS);
+        tx.ssn = cpu_to_le32((tq->rd + 1) & (TFD_QUEUE_SIZE_MAX - 1));
+        stats.txFrames++;
+        stats.txBytes += bytes;
+        if (txCapturing)
+            capture(tfd);
+        queuePacket(TX_CMD, 0, le16_to_cpu(hdr.sequence), &tx, sizeof(tx));
+    } else {
+        /* every command is answered with an empty status */
+        __le32 status = 0;
+
+        stats.hcmds++;
+        if (cmdCapturing)
+            captureCmd(tfd);
+        stats.cmdInflightSum += inflight;
+        if (inflight > stats.cmdInflightMax)
+            stats.cmdInflightMax = inflight;
+        queuePacket(hdr.cmd, hdr.group_id, le16_to_cpu(hdr.sequence), &status, sizeof(status));
+    }
+
+    tq->rd = (tq->rd + 1) & (TFD_QUEUE_SIZE_MAX - 1);
+    if (tq->rd != tq->wr)
+        post(sim_now() + (hdr.cmd == TX_CMD ? config.txNs : config.cmdNs), kEventTxq, q);
+    else
+        tq->busy = false;
+}
+
+void SimDevice::capture(const struct iwl_tfd *tfd)
+{
+    txCapture.tbLen.clear();
+    txCapture.data.clear();
+
+    for (int i = 0; i < (tfd->num_tbs & 0x1f); i++) {
+        UInt16 hi_n_len = le16_to_cpu(tfd->tbs[i].hi_n_len);
+        UInt32 len = hi_n_len >> 4;
+        const UInt8 *tb = (const UInt8 *)sim_dma_virt(le32_to_cpu(tfd->tbs[i].lo) |
+                                                      ((UInt64)(hi_n_len & 0xF) << 32), len);
+
+        txCapture.tbLen.push_back(len);
+        if (i >= 2 && tb)
+            txCapture.data.insert(txCapture.data.end(), tb, tb + len);
+    }
+}
+
+void SimDevice::captureCmd(const struct iwl_tfd *tfd)
+{
+    std::vector<UInt8> cmd;
+
+    for (int i = 0; i < (tfd->num_tbs & 0x1f); i++) {
+        UInt16 hi_n_len = le16_to_cpu(tfd->tbs[i].hi_n_len);
+        UInt32 len = hi_n_len >> 4;
+        const UInt8 *tb = (const UInt8 *)sim_dma_virt(le32_to_cpu(tfd->tbs[i].lo) |
+                                                      ((UInt64)(hi_n_len & 0xF) << 32), len);
+
+        if (tb)
+            cmd.insert(cmd.end(), tb, tb + len);
+    }
+    cmdCapture.push_back(cmd);
+}
+
+void SimDevice::captureTx(bool on)
+{
+    pthread_mutex_lock(&mutex);
+    txCapturing = on;
+    txCapture = TxCapture();
+    pthread_mutex_unlock(&mutex);
+}
+
+SimDevice::TxCapture SimDevice::lastTx()
+{
+    TxCapture c;
+
+    pthread_mutex_lock(&mutex);
+    c = txCapture;
+    pthread_mutex_unlock(&mutex);
+    return c;
+}
+
+void SimDevice::captureCmds(bool on)
+{
+    pthread_mutex_lock(&mutex);
+    cmdCapturing = on;
+    cmdCapture.clear();
+    pthread_mutex_unlock(&mutex);
+}
+
+std::vector<std::vector<UInt8> > SimDevice::cmds()
+{
+    std::vector<std::vector<UInt8> > c;
+
+    pthread_mutex_lock(&mutex);
+    c = cmdCapture;
+    pthread_mutex_unlock(&mutex);
+    return c;
+}
+
+// MARK: RX
+
+void SimDevice::injectNotif(UInt8 cmd, UInt8 group, const void *data, UInt32 len, UInt8 rxq)
+{
+    pthread_mutex_lock(&mutex);
+    queuePacket(cmd, group, le16_to_cpu(SEQ_RX_FRAME), data, len, rxq);
+    pthread_mutex_unlock(&mutex);
+}
+
+void SimDevice::queuePacket(UInt8 cmd, UInt8 group, UInt16 sequence, const void *data, UInt32 len,
+                            UInt8 rxq)
+{
+    Packet pkt;
+    struct iwl_rx_packet *p;
+
+    pkt.data.resize(sizeof(*p) + len);
+    p = (struct iwl_rx_packet *)pkt.data.data();
+    /* the length covers the header but not len_n_flags itself */
+    p->len_n_flags = cpu_to_le32(((sizeof(p->hdr) + len) & FH_RSCSR_FRAME_SIZE_MSK) |
+                                 (((UInt32)rxq << FH_RSCSR_RXQ_POS) & FH_RSCSR_RXQ_MASK));
+    p->hdr.cmd = cmd;
+    p->hdr.group_id = group;
+    p->hdr.sequence = cpu_to_le16(sequence);
+    memcpy(p->data, data, len);
+
+    rxPending.push_back(pkt);
+    deliverRx();
+}
+
+/* one packet per RB, followed by the end marker */
+bool SimDevice::deliverRx()
+{
+    UInt64 bdBase = (UInt64)reg(FH_RSCSR_CHNL0_RBDCB_BASE_REG) << 8;
+    UInt64 sttsBase = (UInt64)reg(FH_RSCSR_CHNL0_STTS_WPTR_REG) << 4;
+    bool delivered = false;
+
+    if (!(reg(FH_MEM_RCSR_CHNL0_CONFIG_REG) & FH_RCSR_RX_CONFIG_CHNL_EN_ENABLE_VAL))
+        return false;
+
+    while (!rxPending.empty()) {
+        UInt32 write = reg(FH_RSCSR_CHNL0_WPTR) & (rxSize - 1);
+        const __le32 *bd = (const __le32 *)sim_dma_virt(bdBase, rxSize * sizeof(__le32));
+        struct iwl_rb_status *stts = (struct iwl_rb_status *)sim_dma_virt(sttsBase, sizeof(*stts));
+        Packet &pkt = rxPending.front();
+        UInt8 *page;
+
+        /* the RBs between the device's read index and the driver's write index are free */
+        if (!bd || !stts || rxRead == write) {
+            stats.rxStalls++;
+            break;
+        }
+
+        page = (UInt8 *)sim_dma_virt((UInt64)le32_to_cpu(bd[rxRead]) << 8, rxRbSize);
+        if (!page || pkt.data.size() + sizeof(__le32) > rxRbSize) {
+            rxPending.pop_front();
+            continue;
+        }
+
+        memcpy(page, pkt.data.data(), pkt.data.size());
+        UInt32 end = (UInt32)((pkt.data.size() + FH_RSCSR_FRAME_ALIGN - 1) & ~(FH_RSCSR_FRAME_ALIGN - 1));
+        if (end + sizeof(__le32) <= rxRbSize)
+            *(__le32 *)(page + end) = cpu_to_le32(FH_RSCSR_FRAME_INVALID);
+        rxPending.pop_front();
+
+        rxRead = (rxRead + 1) & (rxSize - 1);
+        __atomic_store_n(&stts->closed_rb_num, cpu_to_le16(rxRead & 0xFFF), __ATOMIC_RELEASE);
+        stats.rxPackets++;
+        delivered = true;
+    }
+
+    if (delivered)
+        raise(CSR_INT_BIT_FH_RX, CSR_FH_INT_BIT_RX_CHNL0);
+    return delivered;
+}
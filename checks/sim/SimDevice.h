@@ -0,0 +1,222 @@
+//
+//  SimDevice.h
+//  checks
+//
+//  A simulated 8000 family PCIe device for the transport to drive: the
+//  CSR, HBUS/PRPH and FH registers it touches, the ICT, the service
+//  channel that loads the firmware, the TX queues and the legacy RX
+//  queue. Behind them a scripted firmware answers with ALIVE once both
+//  CPUs are loaded, echoes every host command, sends a REPLY_TX for every
+//  data frame and delivers whatever RX notifications the caller injects.
+//
+//  Everything the device does happens on its own thread, in time order,
+//  so DMA, boot and air time can be given a cost; register accesses only
+//  post work to it. The interrupt goes to the handler registered on the
+//  device, the way IOPCIDevice hands it to the filter event source.
+//
+
+#ifndef SimDevice_h
+#define SimDevice_h
+
+#include <pthread.h>
+
+#include <map>
+#include <deque>
+#include <unordered_map>
+#include <vector>
+
+#include <IOKit/pci/IOPCIDevice.h>
+
+#define SIM_BAR_SIZE        0x4000
+#define SIM_NUM_TXQ         32
+#define SIM_SCD_BASE        0x00800000
+
+class SimDevice : public IOPCIDevice {
+    OSDeclareDefaultStructors(SimDevice)
+
+public:
+    struct Config {
+        UInt16 deviceId;
+        UInt16 subsystemId;
+        UInt32 hwRev;
+        /* cost of the work the device does, in ns */
+        UInt64 dmaSetupNs;          /* per service channel chunk */
+        UInt64 dmaNsPerKB;
+        UInt64 bootNs;              /* last section loaded to ALIVE */
+        UInt64 cmdNs;               /* host command to its response */
+        UInt64 txNs;                /* per data frame */
+    };
+
+    struct Counters {
+        UInt64 mmioReads;
+        UInt64 mmioWrites;
+        UInt64 doorbells;           /* HBUS_TARG_WRPTR writes */
+        UInt64 irqs;                /* interrupts delivered */
+        UInt64 fwChunks;
+        UInt64 fwBytes;
+        UInt64 loadStatusWrites;    /* FH_UCODE_LOAD_STATUS */
+        UInt32 fwLoadBufs;          /* buffers the chunks came from, since the device was created */
+        UInt64 fwBufRepeats;        /* chunks from the buffer the one before came from */
+        UInt64 fwStaged;            /* chunks that were in place before the one before was in */
+        UInt64 hcmds;
+        UInt64 txFrames;
+        UInt64 txBytes;
+        UInt64 rxPackets;
+        UInt64 rxStalls;            /* no free RB when a packet was due */
+        UInt32 cmdInflightMax;      /* commands queued but not answered */
+        UInt64 cmdInflightSum;      /* summed over the commands */
+    };
+
+    /* how the driver laid out a data frame's TFD */
+    struct TxCapture {
+        std::vector<UInt32> tbLen;
+        std::vector<UInt8> data;    /* gathered from TB2 on, the frame past its header */
+    };
+
+    static SimDevice *withConfig(const Config &config);
+
+    /* the device's BAR is the memory the driver maps, see OSWriteLittleInt32 */
+    static SimDevice *fromBar(const volatile void *base);
+    void write32(UInt32 ofs, UInt32 val);
+    UInt32 read32(UInt32 ofs);
+
+    /*
+     * queue a firmware notification, delivered through the RX queue; @rxq
+     * is the queue the firmware says it steered it to (FH_RSCSR_RXQ_MASK)
+     */
+    void injectNotif(UInt8 cmd, UInt8 group, const void *data, UInt32 len, UInt8 rxq = 0);
+
+    /* wait until the device has nothing left to do */
+    void drain();
+
+    void resetCounters();
+    Counters counters() const { return stats; }
+    /* sum over every word the firmware load wrote, chunking independent */
+    UInt64 sramHash() const { return fwHash; }
+    /* keep the TFD of the data frames sent from now on, the last one wins */
+    void captureTx(bool on);
+    TxCapture lastTx();
+    /* keep every host command sent from now on, its TBs gathered, header included */
+    void captureCmds(bool on);
+    std::vector<std::vector<UInt8> > cmds();
+
+    /* IOPCIDevice */
+    UInt16 configRead16(UInt8 offset) override;
+    UInt32 configRead32(UInt8 offset) override;
+    void configWrite8(UInt8 offset, UInt8 data) override;
+    bool setBusMasterEnable(bool enable) override { return true; }
+    bool setMemoryEnable(bool enable) override { return true; }
+    IOMemoryMap *mapDeviceMemoryWithRegister(UInt8 reg, IOOptionBits options = 0) override;
+
+    IOReturn registerInterrupt(int source, OSObject *target, IOInterruptAction handler, void *refCon = 0) override;
+    IOReturn unregisterInterrupt(int source) override;
+    IOReturn getInterruptType(int source, int *interruptType) override;
+    IOReturn enableInterrupt(int source) override;
+    IOReturn disableInterrupt(int source) override;
+
+    void free() override;
+
+private:
+    enum EventType {
+        kEventDmaDone,
+        kEventBoot,
+        kEventTxq,
+        kEventRx,
+        kEventIrq,
+    };
+
+    struct Event {
+        EventType type;
+        UInt32 arg;
+    };
+
+    struct Packet {
+        std::vector<UInt8> data;    /* len_n_flags, header and payload */
+    };
+
+    struct Txq {
+        UInt32 rd;
+        UInt32 wr;
+        bool busy;                  /* a kEventTxq is pending */
+    };
+
+    static void *threadMain(void *arg);
+    void threadLoop();
+    void post(UInt64 when, EventType type, UInt32 arg = 0);
+    void kick() { pthread_cond_signal(&cond); }
+
+    UInt32 reg(UInt32 ofs) const { return bar[ofs / 4]; }
+    void setReg(UInt32 ofs, UInt32 val) { bar[ofs / 4] = val; }
+    void raise(UInt32 inta, UInt32 fh);
+    void evaluateIrq();
+
+    void prphWrite(UInt32 addr, UInt32 val);
+    UInt32 prphRead(UInt32 addr);
+    void doorbell(UInt32 val);
+    void boot();
+    void startDma();
+    void finishDma();
+    void serviceTxq(int q);
+    void capture(const struct iwl_tfd *tfd);
+    void captureCmd(const struct iwl_tfd *tfd);
+    void queuePacket(UInt8 cmd, UInt8 group, UInt16 sequence, const void *data, UInt32 len,
+                     UInt8 rxq = 0);
+    bool deliverRx();
+    void resetDevice();
+
+    Config config;
+    Counters stats;
+
+    volatile UInt32 *bar;
+    IOMemoryMap *barMap;
+
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    pthread_cond_t idle;
+    bool exiting;
+    bool working;
+    std::multimap<UInt64, Event> events;
+
+    /* interrupt line */
+    OSObject *irqTarget;
+    IOInterruptAction irqHandler;
+    void *irqRefCon;
+    bool irqEnabled;
+    bool irqAsserted;
+    bool irqPending;
+    UInt64 ictBase;
+    UInt32 ictIndex;
+
+    /* indirect accesses */
+    UInt32 prphWaddr, prphRaddr;
+    UInt32 memWaddr, memRaddr;
+    std::unordered_map<UInt32, UInt32> prph;
+    std::unordered_map<UInt32, UInt32> sram;
+
+    /* firmware load */
+    UInt64 dmaSrc;
+    UInt32 dmaDst, dmaLen;
+    UInt64 fwHash;
+    bool booted;                /* ALIVE sent or on its way */
+    std::vector<UInt64> fwBufs; /* chunk sources, in the order they were first used */
+    std::vector<UInt8> fwNext;  /* the next buffer when the last chunk was in */
+    UInt64 fwNextSrc;
+    UInt64 fwLastSrc;
+
+    /* TX */
+    Txq txq[SIM_NUM_TXQ];
+    UInt32 txActive;            /* bitmap from SCD_QUEUE_STATUS_BITS */
+    bool txCapturing;
+    TxCapture txCapture;
+    bool cmdCapturing;
+    std::vector<std::vector<UInt8> > cmdCapture;
+
+    /* legacy RX queue 0 */
+    UInt32 rxSize;
+    UInt32 rxRbSize;
+    UInt32 rxRead;              /* next RB the device fills */
+    std::deque<Packet> rxPending;
+};
+
+#endif /* SimDevice_h */
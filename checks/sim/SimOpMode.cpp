@@ -0,0 +1,202 @@
+//
+//  SimOpMode.cpp
+//  checks
+//
+//  See SimOpMode.h.
+//
+
+#include "SimOpMode.h"
+
+extern "C" {
+#include "fw/api/commands.h"
+#include "fw/api/tx.h"
+#include <linux/ieee80211.h>
+}
+
+#include "sim.h"
+
+struct sim_host sim_host;
+
+/* the transport's dev_cmd tag is type 0, the op mode keeps its own copy */
+#define SIM_DEV_CMD_TAG     1
+
+/* MVM: DQA command queue and fifo */
+#define SIM_CMD_QUEUE       0
+#define SIM_CMD_FIFO        7
+
+static const u8 sim_no_reclaim_cmds[] = {
+    TX_CMD,
+};
+
+static void sim_async_cb(struct iwl_op_mode *op_mode, const struct iwl_device_cmd *cmd)
+{
+    SimOpMode *me = *(SimOpMode **)op_mode->op_mode_specific;
+
+    me->stats.asyncCbs++;
+    if (me->asyncResend) {
+        struct iwl_host_cmd hcmd = {};
+
+        me->asyncResend--;
+        hcmd.id = ECHO_CMD;
+        hcmd.flags = CMD_ASYNC;
+        if (!iwl_trans_send_cmd(sim_host.trans, &hcmd))
+            me->stats.asyncSent++;
+    }
+}
+
+static const struct iwl_op_mode_ops sim_op_mode_ops = {
+    .async_cb = sim_async_cb,
+};
+
+SimOpMode::SimOpMode(struct iwl_trans *trans, IwlTransOps *ops)
+    : asyncResend(0), trans(trans), ops(ops), txQueue(0)
+{
+    memset(&stats, 0, sizeof(stats));
+    iwl_notification_wait_init(&notifWait);
+    mbuf_tag_id_find("net.rpeshkov.IntelWifi.sim", &tagId);
+
+    opMode = (struct iwl_op_mode *)iwh_zalloc(sizeof(*opMode) + sizeof(SimOpMode *));
+    opMode->ops = &sim_op_mode_ops;
+    *(SimOpMode **)opMode->op_mode_specific = this;
+}
+
+SimOpMode::~SimOpMode()
+{
+    iwl_abort_notification_waits(&notifWait);
+    iwl_notification_wait_free(&notifWait);
+    iwh_free(opMode);
+}
+
+void SimOpMode::configure()
+{
+    struct iwl_trans_config trans_cfg = {};
+
+    trans_cfg.op_mode = opMode;
+    trans_cfg.cmd_queue = SIM_CMD_QUEUE;
+    trans_cfg.cmd_fifo = SIM_CMD_FIFO;
+    trans_cfg.cmd_q_wdg_timeout = IWL_DEF_WD_TIMEOUT;
+    trans_cfg.no_reclaim_cmds = sim_no_reclaim_cmds;
+    trans_cfg.n_no_reclaim_cmds = ARRAY_SIZE(sim_no_reclaim_cmds);
+    trans_cfg.rx_buf_size = IWL_AMSDU_4K;
+    trans_cfg.bc_table_dword = true;
+    trans_cfg.scd_set_active = true;
+
+    iwl_trans_configure(trans, &trans_cfg);
+}
+
+mbuf_t SimOpMode::frame(size_t len, const size_t *seglens, unsigned nsegs)
+{
+    struct ieee80211_hdr_3addr *hdr;
+    u8 *buf;
+    mbuf_t m;
+
+    if (len < sizeof(*hdr))
+        return NULL;
+
+    buf = (u8 *)IOMalloc(len);
+    for (size_t i = 0; i < len; i++)
+        buf[i] = (u8)i;
+    hdr = (struct ieee80211_hdr_3addr *)buf;
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->frame_control = cpu_to_le16(IEEE80211_FTYPE_DATA | IEEE80211_STYPE_DATA);
+
+    m = sim_mbuf_chain(buf, len, seglens, nsegs);
+    IOFree(buf, len);
+    return m;
+}
+
+int SimOpMode::txFrames(int queue, mbuf_t frames)
+{
+    txQueue = queue;
+    return sim_host.iw->outputPacket(frames, NULL) == kIOReturnOutputSuccess ? 0 : -EIO;
+}
+
+/* what iwl_mvm_tx_skb_non_sta() would build, minus rates and security */
+int SimOpMode::tx(struct sk_buff *skb)
+{
+    mbuf_t m = (mbuf_t)skb;
+    struct iwl_device_cmd *dev_cmd, **dev_cmd_ptr;
+    struct iwl_tx_cmd *tx_cmd;
+    int ret;
+
+    if (mbuf_pkthdr_len(m) < sizeof(struct ieee80211_hdr_3addr))
+        return -EINVAL;
+
+    dev_cmd = iwl_trans_alloc_tx_cmd(trans);
+    if (!dev_cmd)
+        return -ENOMEM;
+    memset(dev_cmd, 0, sizeof(*dev_cmd));
+    dev_cmd->hdr.cmd = TX_CMD;
+    tx_cmd = (struct iwl_tx_cmd *)dev_cmd->payload;
+    tx_cmd->len = cpu_to_le16((u16)mbuf_pkthdr_len(m));
+    mbuf_copydata(m, 0, sizeof(struct ieee80211_hdr_3addr), tx_cmd->payload);
+
+    if (mbuf_tag_allocate(m, tagId, SIM_DEV_CMD_TAG, sizeof(*dev_cmd_ptr), MBUF_DONTWAIT,
+                          (void **)&dev_cmd_ptr)) {
+        iwl_trans_free_tx_cmd(trans, dev_cmd);
+        return -ENOMEM;
+    }
+    *dev_cmd_ptr = dev_cmd;
+
+    /* on error the controller drops the frame, the command is ours to free */
+    ret = ops->tx(trans, skb, dev_cmd, txQueue);
+    if (ret)
+        iwl_trans_free_tx_cmd(trans, dev_cmd);
+    return ret;
+}
+
+void SimOpMode::rx(struct napi_struct *napi, struct iwl_rx_cmd_buffer *rxb)
+{
+    struct iwl_rx_packet *pkt = (struct iwl_rx_packet *)rxb_addr(rxb);
+
+    if (pkt->hdr.cmd == TX_CMD && !pkt->hdr.group_id) {
+        txReply(pkt);
+        return;
+    }
+
+    stats.notifs++;
+    iwl_notification_wait_notify(&notifWait, pkt);
+}
+
+void SimOpMode::rx_rss(struct napi_struct *napi, struct iwl_rx_cmd_buffer *rxb, unsigned int queue)
+{
+    if (queue < ARRAY_SIZE(stats.rss))
+        stats.rss[queue]++;
+}
+
+/* iwl_mvm_rx_tx_cmd_single(): the SSN follows the frame statuses */
+void SimOpMode::txReply(struct iwl_rx_packet *pkt)
+{
+    struct iwl_mvm_tx_resp *tx_resp = (struct iwl_mvm_tx_resp *)pkt->data;
+    int queue = SEQ_TO_QUEUE(le16_to_cpu(pkt->hdr.sequence));
+    int ssn = le32_to_cpup((__le32 *)(&tx_resp->status + tx_resp->frame_count)) & 0xfff;
+    mbuf_t skbs = NULL;
+
+    stats.txReplies++;
+    ops->reclaim(trans, queue, ssn, &skbs);
+
+    while (skbs) {
+        mbuf_t m = skbs;
+
+        skbs = mbuf_nextpkt(m);
+        mbuf_setnextpkt(m, NULL);
+        stats.txReclaimed++;
+        free_skb((struct sk_buff *)m);
+    }
+}
+
+void SimOpMode::queue_full(int queue)
+{
+    stats.queueFull++;
+}
+
+void SimOpMode::free_skb(struct sk_buff *skb)
+{
+    mbuf_t m = (mbuf_t)skb;
+    struct iwl_device_cmd **dev_cmd_ptr;
+    size_t len;
+
+    if (!mbuf_tag_find(m, tagId, SIM_DEV_CMD_TAG, &len, (void **)&dev_cmd_ptr))
+        iwl_trans_free_tx_cmd(trans, *dev_cmd_ptr);
+    mbuf_freem(m);
+}
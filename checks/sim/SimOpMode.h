@@ -0,0 +1,103 @@
+//
+//  SimOpMode.h
+//  checks
+//
+//  The op mode end of the simulator: what the transport hands up goes to
+//  the notification waits, REPLY_TX reclaims the data queue the way the
+//  MVM op mode does, and the transport sees it through iwl_trans_configure
+//  like any other op mode. No mac80211 behind it.
+//
+
+#ifndef SimOpMode_h
+#define SimOpMode_h
+
+#include "IntelWifi.hpp"
+#include "IwlTransOps.h"
+
+extern "C" {
+#include "fw/notif-wait.h"
+}
+
+/* what IntelWifi::start sets up, the glue fills it in for the benchmark */
+struct sim_host {
+    IntelWifi *iw;
+    struct iwl_trans *trans;
+    IwlTransOps *ops;
+};
+
+extern struct sim_host sim_host;
+
+class SimOpMode : public IwlOpModeOps {
+public:
+    struct Counters {
+        UInt64 notifs;              /* packets not reclaimed by the op mode */
+        UInt64 rss[IWL_MAX_RX_HW_QUEUES];   /* what rx_rss() got, per queue */
+        UInt64 txReplies;
+        UInt64 txReclaimed;         /* frames handed back by reclaim */
+        UInt64 asyncCbs;
+        UInt64 asyncSent;           /* commands sent from async callbacks */
+        UInt64 queueFull;
+    };
+
+    SimOpMode(struct iwl_trans *trans, IwlTransOps *ops);
+    virtual ~SimOpMode();
+
+    /* iwl_trans_configure() with the MVM command queue and fifo */
+    void configure();
+
+    /* a data frame of @len bytes split over @nsegs mbufs, byte i of it is i */
+    static mbuf_t frame(size_t len, const size_t *seglens, unsigned nsegs);
+    /* send @frames (linked with mbuf_nextpkt) through IntelWifi::outputPacket */
+    int txFrames(int queue, mbuf_t frames);
+    int txFrame(int queue, size_t len, const size_t *seglens, unsigned nsegs)
+    {
+        mbuf_t m = frame(len, seglens, nsegs);
+
+        return m ? txFrames(queue, m) : -ENOMEM;
+    }
+
+    struct iwl_notif_wait_data notifWait;
+    Counters stats;
+    /* async callbacks left that send an async ECHO_CMD of their own */
+    volatile UInt32 asyncResend;
+
+    /* IwlOpModeOps */
+    struct ieee80211_hw *start(struct iwl_trans *trans, const struct iwl_cfg *cfg,
+                               const struct iwl_fw *fw) override { return NULL; }
+    void nic_config() override {}
+    void stop() override {}
+    void rx(struct napi_struct *napi, struct iwl_rx_cmd_buffer *rxb) override;
+    void rx_rss(struct napi_struct *napi, struct iwl_rx_cmd_buffer *rxb, unsigned int queue) override;
+    void queue_full(int queue) override;
+    void queue_not_full(int queue) override {}
+    void free_skb(struct sk_buff *skb) override;
+    int tx(struct sk_buff *skb) override;
+
+    IOReturn getCARD_CAPABILITIES(IO80211Interface *interface, struct apple80211_capability_data *cd) override
+    {
+        return kIOReturnUnsupported;
+    }
+    IOReturn getPHY_MODE(IO80211Interface *interface, struct apple80211_phymode_data *pd) override
+    {
+        return kIOReturnUnsupported;
+    }
+    IOReturn getPOWER(IO80211Interface *intf, apple80211_power_data *power_data) override
+    {
+        return kIOReturnUnsupported;
+    }
+    IOReturn setPOWER(IO80211Interface *intf, apple80211_power_data *power_data) override
+    {
+        return kIOReturnUnsupported;
+    }
+
+private:
+    void txReply(struct iwl_rx_packet *pkt);
+
+    struct iwl_trans *trans;
+    IwlTransOps *ops;
+    struct iwl_op_mode *opMode;
+    mbuf_tag_id_t tagId;
+    int txQueue;                    /* where tx() puts the frame, no stations to pick one */
+};
+
+#endif /* SimOpMode_h */
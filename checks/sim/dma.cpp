@@ -0,0 +1,236 @@
+//
+//  dma.cpp
+//  checks
+//
+//  The simulator's DMA space. Two anonymous mappings stand for host
+//  memory below and above 4G; a bus address is the arena's bus base plus
+//  the offset into the mapping, so the device model can turn any address
+//  the driver programs back into a pointer. IOBufferMemoryDescriptor and
+//  IODMACommand hand these buffers to the driver.
+//
+
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include <map>
+
+#include <IOKit/IOBufferMemoryDescriptor.h>
+#include <IOKit/IODMACommand.h>
+
+#include "sim.h"
+
+struct sim_stats sim_stats;
+
+#define SIM_ARENA_SIZE  (256UL << 20)
+
+struct sim_arena {
+    uint64_t bus;
+    uint8_t *base;
+    std::map<size_t, size_t> free;      /* offset -> length */
+    std::map<size_t, size_t> used;
+};
+
+static sim_arena arenas[2] = {
+    { 0x10000000ULL, NULL, {}, {} },
+    { 0x200000000ULL, NULL, {}, {} },
+};
+static pthread_mutex_t dma_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void sim_arena_init(sim_arena *a)
+{
+    if (a->base)
+        return;
+    a->base = (uint8_t *)mmap(NULL, SIM_ARENA_SIZE, PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (a->base == MAP_FAILED)
+        abort();
+    a->free[0] = SIM_ARENA_SIZE;
+}
+
+static sim_arena *sim_arena_of(const void *virt)
+{
+    for (sim_arena &a : arenas) {
+        if (a.base && (const uint8_t *)virt >= a.base && (const uint8_t *)virt < a.base + SIM_ARENA_SIZE)
+            return &a;
+    }
+    return NULL;
+}
+
+void *sim_dma_alloc(size_t len, size_t align, uint64_t mask, uint64_t *bus)
+{
+    sim_arena *a = &arenas[mask && mask <= 0xFFFFFFFFULL ? 0 : 1];
+    void *virt = NULL;
+
+    if (!len)
+        len = 1;
+    len = (len + 63) & ~(size_t)63;
+    if (mask && (mask & -mask) > align)
+        align = (size_t)(mask & -mask);
+    if (align < 64)
+        align = 64;
+
+    pthread_mutex_lock(&dma_mutex);
+    sim_arena_init(a);
+    for (auto it = a->free.begin(); it != a->free.end(); ++it) {
+        size_t ofs = it->first, flen = it->second;
+        size_t start = (size_t)((a->bus + ofs + align - 1) & ~(uint64_t)(align - 1)) - (size_t)a->bus;
+
+        if (start + len > ofs + flen)
+            continue;
+        a->free.erase(it);
+        if (start > ofs)
+            a->free[ofs] = start - ofs;
+        if (start + len < ofs + flen)
+            a->free[start + len] = ofs + flen - start - len;
+        a->used[start] = len;
+        virt = a->base + start;
+        *bus = a->bus + start;
+        sim_stats.dma_allocs++;
+        sim_stats.dma_bytes += len;
+        break;
+    }
+    pthread_mutex_unlock(&dma_mutex);
+
+    if (virt)
+        memset(virt, 0, len);
+    return virt;
+}
+
+void sim_dma_free(void *virt)
+{
+    sim_arena *a = sim_arena_of(virt);
+
+    if (!a)
+        return;
+
+    pthread_mutex_lock(&dma_mutex);
+    size_t ofs = (uint8_t *)virt - a->base;
+    auto u = a->used.find(ofs);
+    if (u != a->used.end()) {
+        size_t len = u->second;
+
+        a->used.erase(u);
+        sim_stats.dma_bytes -= len;
+
+        auto next = a->free.lower_bound(ofs);
+        if (next != a->free.end() && next->first == ofs + len) {
+            len += next->second;
+            next = a->free.erase(next);
+        }
+        if (next != a->free.begin()) {
+            auto prev = std::prev(next);
+            if (prev->first + prev->second == ofs) {
+                prev->second += len;
+                len = 0;
+            }
+        }
+        if (len)
+            a->free[ofs] = len;
+    }
+    pthread_mutex_unlock(&dma_mutex);
+}
+
+void *sim_dma_virt(uint64_t bus, size_t len)
+{
+    for (sim_arena &a : arenas) {
+        if (a.base && bus >= a.bus && bus + len <= a.bus + SIM_ARENA_SIZE)
+            return a.base + (bus - a.bus);
+    }
+    return NULL;
+}
+
+uint64_t sim_dma_bus(const void *virt)
+{
+    sim_arena *a = sim_arena_of(virt);
+
+    return a ? a->bus + ((const uint8_t *)virt - a->base) : 0;
+}
+
+// MARK: IOBufferMemoryDescriptor
+
+IOBufferMemoryDescriptor *IOBufferMemoryDescriptor::inTaskWithPhysicalMask(task_t inTask, IOOptionBits options,
+                                                                           vm_size_t capacity,
+                                                                           mach_vm_address_t physicalMask)
+{
+    IOBufferMemoryDescriptor *me = new IOBufferMemoryDescriptor;
+    uint64_t bus;
+
+    /* contiguous buffers come from kmem_alloc_contig() in the kernel, page granular */
+    me->virt = sim_dma_alloc(capacity, (options & kIOMemoryPhysicallyContiguous) || capacity >= PAGE_SIZE ?
+                                       PAGE_SIZE : 64, physicalMask, &bus);
+    if (!me->virt) {
+        delete me;
+        return NULL;
+    }
+    me->bus = bus;
+    me->length = capacity;
+    return me;
+}
+
+IOBufferMemoryDescriptor *IOBufferMemoryDescriptor::withCapacity(vm_size_t capacity, IOOptionBits options,
+                                                                 bool contiguous)
+{
+    return inTaskWithPhysicalMask(kernel_task, options, capacity, 0);
+}
+
+void IOBufferMemoryDescriptor::free()
+{
+    sim_dma_free(virt);
+    IOMemoryDescriptor::free();
+}
+
+// MARK: IODMACommand
+
+bool IODMACommand::OutputHost64(IODMACommand *target, Segment64 segment, void *segments, UInt32 segmentIndex)
+{
+    ((Segment64 *)segments)[segmentIndex] = segment;
+    return true;
+}
+
+IODMACommand *IODMACommand::withSpecification(SegmentFunction outSegFunc, UInt8 numAddressBits,
+                                              UInt64 maxSegmentSize, MappingOptions mappingOptions,
+                                              UInt64 maxTransferSize, UInt32 alignment)
+{
+    IODMACommand *me = new IODMACommand;
+
+    me->md = NULL;
+    me->numAddressBits = numAddressBits;
+    return me;
+}
+
+IOReturn IODMACommand::setMemoryDescriptor(const IOMemoryDescriptor *mem, bool autoPrepare)
+{
+    if (mem)
+        mem->retain();
+    if (md)
+        md->release();
+    md = mem;
+    return kIOReturnSuccess;
+}
+
+IOReturn IODMACommand::clearMemoryDescriptor(bool autoComplete)
+{
+    return setMemoryDescriptor(NULL, autoComplete);
+}
+
+IOReturn IODMACommand::gen64IOVMSegments(UInt64 *offset, Segment64 *segments, UInt32 *numSegments)
+{
+    if (!md || !*numSegments || *offset >= md->getLength())
+        return kIOReturnBadArgument;
+
+    /* the whole rest of a contiguous buffer is one segment */
+    segments[0].fIOVMAddr = md->getBusAddress() + *offset;
+    segments[0].fLength = md->getLength() - *offset;
+    if (numAddressBits < 64 && (segments[0].fIOVMAddr + segments[0].fLength) >> numAddressBits)
+        return kIOReturnMessageTooLarge;
+
+    *offset = md->getLength();
+    *numSegments = 1;
+    return kIOReturnSuccess;
+}
+
+void IODMACommand::free()
+{
+    clearMemoryDescriptor();
+    OSObject::free();
+}
@@ -0,0 +1,771 @@
+//
+//  iokit.cpp
+//  checks
+//
+//  The IOKit runtime the transport runs on in the simulator: locks, sleep
+//  and wakeup, work loops and their event sources on pthreads, the kext
+//  resource requests and the boot-args. Only the behaviour the driver
+//  relies on is modelled; in particular a work loop runs its event
+//  sources on its own thread with the gate closed, and runAction() and
+//  the command gate close that gate on the caller's thread.
+//
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <unistd.h>
+
+#include <list>
+
+#include <IOKit/IOLib.h>
+#include <IOKit/IOWorkLoop.h>
+#include <IOKit/IOTimerEventSource.h>
+#include <IOKit/IOFilterInterruptEventSource.h>
+#include <IOKit/IOCommandGate.h>
+#include <IOKit/IOService.h>
+#include <libkern/OSKextLib.h>
+#include <pexpert/pexpert.h>
+
+#include "sim.h"
+
+// MARK: time
+
+static void host_abstime_to_timespec(AbsoluteTime deadline, struct timespec *ts)
+{
+    ts->tv_sec = (time_t)(deadline / NSEC_PER_SEC);
+    ts->tv_nsec = (long)(deadline % NSEC_PER_SEC);
+}
+
+extern "C" void IODelay(unsigned microseconds)
+{
+    UInt64 end = mach_absolute_time() + (UInt64)microseconds * NSEC_PER_USEC;
+
+    /* a delay is a spin in the kernel, only long ones are worth sleeping */
+    if (microseconds > 100) {
+        struct timespec ts;
+
+        host_abstime_to_timespec(end, &ts);
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+            ;
+        return;
+    }
+    while (mach_absolute_time() < end)
+        __builtin_ia32_pause();
+}
+
+extern "C" void IOSleep(unsigned milliseconds)
+{
+    usleep(milliseconds * 1000);
+}
+
+extern "C" IOThread IOThreadSelf(void)
+{
+    return (IOThread)pthread_self();
+}
+
+// MARK: memory
+
+extern "C" void *IOMalloc(vm_size_t size)
+{
+    void *address = malloc(size);
+
+    if (address)
+        __atomic_add_fetch(&sim_stats.heap_bytes, size, __ATOMIC_RELAXED);
+    return address;
+}
+
+extern "C" void IOFree(void *address, vm_size_t size)
+{
+    if (address)
+        __atomic_sub_fetch(&sim_stats.heap_bytes, size, __ATOMIC_RELAXED);
+    free(address);
+}
+
+extern "C" size_t strlcpy(char *dst, const char *src, size_t size)
+{
+    size_t len = strlen(src);
+
+    if (size) {
+        size_t n = len < size - 1 ? len : size - 1;
+
+        memcpy(dst, src, n);
+        dst[n] = 0;
+    }
+    return len;
+}
+
+// MARK: locks
+
+struct host_IOLock {
+    pthread_mutex_t mutex;
+};
+
+struct host_IOSimpleLock {
+    pthread_mutex_t mutex;
+};
+
+/*
+ * Sleep/wakeup on an event, like assert_wait()/thread_wakeup(): waiters
+ * are kept in one list under one mutex, and a sleeper enters it before it
+ * drops its own lock, so a wakeup can't slip in between.
+ */
+struct host_Waiter {
+    const void *event;
+    bool woken;
+    pthread_cond_t cond;
+};
+
+static pthread_mutex_t host_wait_mutex = PTHREAD_MUTEX_INITIALIZER;
+static std::list<host_Waiter *> host_waiters;
+
+static int host_wait(pthread_mutex_t *drop, const void *event, AbsoluteTime deadline)
+{
+    host_Waiter w;
+    struct timespec ts;
+    int ret = THREAD_AWAKENED;
+
+    w.event = event;
+    w.woken = false;
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&w.cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    pthread_mutex_lock(&host_wait_mutex);
+    host_waiters.push_back(&w);
+    if (drop)
+        pthread_mutex_unlock(drop);
+
+    if (deadline)
+        host_abstime_to_timespec(deadline, &ts);
+    while (!w.woken) {
+        if (!deadline) {
+            pthread_cond_wait(&w.cond, &host_wait_mutex);
+        } else if (pthread_cond_timedwait(&w.cond, &host_wait_mutex, &ts) == ETIMEDOUT) {
+            if (!w.woken)
+                ret = THREAD_TIMED_OUT;
+            break;
+        }
+    }
+    host_waiters.remove(&w);
+    pthread_mutex_unlock(&host_wait_mutex);
+    pthread_cond_destroy(&w.cond);
+
+    if (drop)
+        pthread_mutex_lock(drop);
+    return ret;
+}
+
+static void host_wakeup(const void *event, bool oneThread)
+{
+    pthread_mutex_lock(&host_wait_mutex);
+    for (host_Waiter *w : host_waiters) {
+        if (w->event != event || w->woken)
+            continue;
+        w->woken = true;
+        pthread_cond_signal(&w->cond);
+        if (oneThread)
+            break;
+    }
+    pthread_mutex_unlock(&host_wait_mutex);
+}
+
+extern "C" IOLock *IOLockAlloc(void)
+{
+    IOLock *lock = (IOLock *)malloc(sizeof(*lock));
+
+    pthread_mutex_init(&lock->mutex, NULL);
+    return lock;
+}
+
+extern "C" void IOLockFree(IOLock *lock)
+{
+    pthread_mutex_destroy(&lock->mutex);
+    free(lock);
+}
+
+extern "C" void IOLockLock(IOLock *lock)
+{
+    pthread_mutex_lock(&lock->mutex);
+}
+
+extern "C" void IOLockUnlock(IOLock *lock)
+{
+    pthread_mutex_unlock(&lock->mutex);
+}
+
+extern "C" int IOLockSleep(IOLock *lock, void *event, UInt32 interType)
+{
+    return host_wait(&lock->mutex, event, 0);
+}
+
+extern "C" int IOLockSleepDeadline(IOLock *lock, void *event, AbsoluteTime deadline, UInt32 interType)
+{
+    return host_wait(&lock->mutex, event, deadline ? deadline : 1);
+}
+
+extern "C" void IOLockWakeup(IOLock *lock, void *event, bool oneThread)
+{
+    host_wakeup(event, oneThread);
+}
+
+extern "C" IOSimpleLock *IOSimpleLockAlloc(void)
+{
+    IOSimpleLock *lock = (IOSimpleLock *)malloc(sizeof(*lock));
+
+    pthread_mutex_init(&lock->mutex, NULL);
+    return lock;
+}
+
+extern "C" void IOSimpleLockFree(IOSimpleLock *lock)
+{
+    pthread_mutex_destroy(&lock->mutex);
+    free(lock);
+}
+
+extern "C" void IOSimpleLockLock(IOSimpleLock *lock)
+{
+    pthread_mutex_lock(&lock->mutex);
+}
+
+extern "C" void IOSimpleLockUnlock(IOSimpleLock *lock)
+{
+    pthread_mutex_unlock(&lock->mutex);
+}
+
+/* the primary interrupt runs on the device thread, there is nothing to mask */
+extern "C" IOInterruptState IOSimpleLockLockDisableInterrupt(IOSimpleLock *lock)
+{
+    pthread_mutex_lock(&lock->mutex);
+    return 0;
+}
+
+extern "C" void IOSimpleLockUnlockEnableInterrupt(IOSimpleLock *lock, IOInterruptState state)
+{
+    pthread_mutex_unlock(&lock->mutex);
+}
+
+// MARK: work loop
+
+struct host_IOWorkLoopState {
+    pthread_t thread;
+    /* protects everything below, the gate is built on it */
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    pthread_t gateOwner;
+    int gateCount;
+    bool workPending;
+    bool exiting;
+    IOEventSource *sources;
+};
+
+IOWorkLoop *IOWorkLoop::workLoop()
+{
+    IOWorkLoop *me = new IOWorkLoop;
+
+    if (!me->init()) {
+        me->release();
+        return NULL;
+    }
+    return me;
+}
+
+bool IOWorkLoop::init()
+{
+    pthread_condattr_t attr;
+
+    state = new host_IOWorkLoopState();
+    pthread_mutex_init(&state->mutex, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&state->cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    return pthread_create(&state->thread, NULL, &IOWorkLoop::threadMain, this) == 0;
+}
+
+void IOWorkLoop::free()
+{
+    pthread_mutex_lock(&state->mutex);
+    state->exiting = true;
+    pthread_cond_broadcast(&state->cond);
+    pthread_mutex_unlock(&state->mutex);
+
+    pthread_join(state->thread, NULL);
+    pthread_cond_destroy(&state->cond);
+    pthread_mutex_destroy(&state->mutex);
+    delete state;
+    OSObject::free();
+}
+
+void *IOWorkLoop::threadMain(void *arg)
+{
+    static_cast<IOWorkLoop *>(arg)->threadLoop();
+    return NULL;
+}
+
+void IOWorkLoop::threadLoop()
+{
+    for (;;) {
+        AbsoluteTime deadline = 0;
+        bool more;
+
+        pthread_mutex_lock(&state->mutex);
+        if (state->exiting) {
+            pthread_mutex_unlock(&state->mutex);
+            return;
+        }
+        state->workPending = false;
+        pthread_mutex_unlock(&state->mutex);
+
+        closeGate();
+        do {
+            more = false;
+            for (IOEventSource *es = state->sources; es; es = es->next) {
+                if (es->isEnabled() && es->checkForWork())
+                    more = true;
+            }
+        } while (more);
+
+        for (IOEventSource *es = state->sources; es; es = es->next) {
+            IOTimerEventSource *timer = OSDynamicCast(IOTimerEventSource, es);
+            AbsoluteTime d = timer ? timer->getDeadline() : 0;
+
+            if (d && (!deadline || d < deadline))
+                deadline = d;
+        }
+        openGate();
+
+        pthread_mutex_lock(&state->mutex);
+        while (!state->workPending && !state->exiting) {
+            if (!deadline) {
+                pthread_cond_wait(&state->cond, &state->mutex);
+            } else {
+                struct timespec ts;
+
+                host_abstime_to_timespec(deadline, &ts);
+                if (pthread_cond_timedwait(&state->cond, &state->mutex, &ts) == ETIMEDOUT)
+                    break;
+            }
+        }
+        pthread_mutex_unlock(&state->mutex);
+    }
+}
+
+void IOWorkLoop::signalWorkAvailable()
+{
+    pthread_mutex_lock(&state->mutex);
+    state->workPending = true;
+    pthread_cond_broadcast(&state->cond);
+    pthread_mutex_unlock(&state->mutex);
+}
+
+IOReturn IOWorkLoop::addEventSource(IOEventSource *newEvent)
+{
+    closeGate();
+    newEvent->retain();
+    newEvent->setWorkLoop(this);
+    newEvent->next = NULL;
+    IOEventSource **tail = &state->sources;
+    while (*tail)
+        tail = &(*tail)->next;
+    *tail = newEvent;
+    openGate();
+
+    signalWorkAvailable();
+    return kIOReturnSuccess;
+}
+
+IOReturn IOWorkLoop::removeEventSource(IOEventSource *toRemove)
+{
+    closeGate();
+    for (IOEventSource **es = &state->sources; *es; es = &(*es)->next) {
+        if (*es != toRemove)
+            continue;
+        *es = toRemove->next;
+        toRemove->next = NULL;
+        toRemove->setWorkLoop(NULL);
+        openGate();
+        toRemove->release();
+        return kIOReturnSuccess;
+    }
+    openGate();
+    return kIOReturnNotFound;
+}
+
+IOReturn IOWorkLoop::runAction(Action action, OSObject *target, void *arg0, void *arg1, void *arg2, void *arg3)
+{
+    IOReturn ret;
+
+    closeGate();
+    ret = action(target, arg0, arg1, arg2, arg3);
+    openGate();
+    return ret;
+}
+
+void IOWorkLoop::closeGate()
+{
+    pthread_t self = pthread_self();
+
+    pthread_mutex_lock(&state->mutex);
+    if (state->gateCount && pthread_equal(state->gateOwner, self)) {
+        state->gateCount++;
+    } else {
+        while (state->gateCount)
+            pthread_cond_wait(&state->cond, &state->mutex);
+        state->gateOwner = self;
+        state->gateCount = 1;
+    }
+    pthread_mutex_unlock(&state->mutex);
+}
+
+bool IOWorkLoop::tryCloseGate()
+{
+    pthread_t self = pthread_self();
+    bool ret = true;
+
+    pthread_mutex_lock(&state->mutex);
+    if (state->gateCount && pthread_equal(state->gateOwner, self)) {
+        state->gateCount++;
+    } else if (!state->gateCount) {
+        state->gateOwner = self;
+        state->gateCount = 1;
+    } else {
+        ret = false;
+    }
+    pthread_mutex_unlock(&state->mutex);
+    return ret;
+}
+
+void IOWorkLoop::openGate()
+{
+    pthread_mutex_lock(&state->mutex);
+    if (!--state->gateCount)
+        pthread_cond_broadcast(&state->cond);
+    pthread_mutex_unlock(&state->mutex);
+}
+
+/* the gate is given up for the sleep whatever its recursion count */
+int IOWorkLoop::sleepGate(void *event, UInt32 interuptibleType)
+{
+    int count, ret;
+
+    pthread_mutex_lock(&state->mutex);
+    count = state->gateCount;
+    state->gateCount = 0;
+    pthread_cond_broadcast(&state->cond);
+
+    ret = host_wait(&state->mutex, event, 0);
+
+    while (state->gateCount)
+        pthread_cond_wait(&state->cond, &state->mutex);
+    state->gateOwner = pthread_self();
+    state->gateCount = count;
+    pthread_mutex_unlock(&state->mutex);
+    return ret;
+}
+
+void IOWorkLoop::wakeupGate(void *event, bool oneThread)
+{
+    host_wakeup(event, oneThread);
+}
+
+bool IOWorkLoop::onThread() const
+{
+    return pthread_equal(state->thread, pthread_self());
+}
+
+bool IOWorkLoop::inGate() const
+{
+    bool ret;
+
+    pthread_mutex_lock(&state->mutex);
+    ret = state->gateCount && pthread_equal(state->gateOwner, pthread_self());
+    pthread_mutex_unlock(&state->mutex);
+    return ret;
+}
+
+// MARK: event sources
+
+bool IOEventSource::init(OSObject *owner, Action action)
+{
+    this->owner = owner;
+    this->action = action;
+    this->workLoop = NULL;
+    this->enabled = true;
+    this->next = NULL;
+    return true;
+}
+
+IOTimerEventSource *IOTimerEventSource::timerEventSource(OSObject *owner, Action action)
+{
+    IOTimerEventSource *me = new IOTimerEventSource;
+
+    me->init(owner, (IOEventSource::Action)action);
+    me->deadline = 0;
+    me->refcon = NULL;
+    return me;
+}
+
+IOReturn IOTimerEventSource::setTimeout(AbsoluteTime deadline)
+{
+    this->deadline = deadline ? deadline : 1;
+    signalWorkAvailable();
+    return kIOReturnSuccess;
+}
+
+void IOTimerEventSource::cancelTimeout()
+{
+    deadline = 0;
+}
+
+bool IOTimerEventSource::checkForWork()
+{
+    AbsoluteTime d = deadline;
+
+    if (!d || mach_absolute_time() < d)
+        return false;
+
+    /* a timeout set again from the action stays armed */
+    if (!OSCompareAndSwap64(d, 0, &deadline))
+        return false;
+    if (action)
+        ((Action)action)(owner, this);
+    return false;
+}
+
+static void host_interruptHandler(OSObject *target, void *refCon, IOService *nub, int source)
+{
+    static_cast<IOInterruptEventSource *>(target)->normalInterruptOccurred(refCon, nub, source);
+}
+
+IOInterruptEventSource *IOInterruptEventSource::interruptEventSource(OSObject *owner, Action action,
+                                                                     IOService *provider, int intIndex)
+{
+    IOInterruptEventSource *me = new IOInterruptEventSource;
+
+    if (!me->init(owner, action, provider, intIndex)) {
+        me->release();
+        return NULL;
+    }
+    return me;
+}
+
+bool IOInterruptEventSource::init(OSObject *owner, Action action, IOService *provider, int intIndex)
+{
+    IOEventSource::init(owner, (IOEventSource::Action)action);
+    this->provider = provider;
+    this->intIndex = intIndex;
+    producerCount = consumerCount = 0;
+    /* like the kernel one, an event source starts disabled */
+    enabled = false;
+
+    if (provider && provider->registerInterrupt(intIndex, this, host_interruptHandler) != kIOReturnSuccess)
+        return false;
+    return true;
+}
+
+void IOInterruptEventSource::free()
+{
+    if (provider)
+        provider->unregisterInterrupt(intIndex);
+    IOEventSource::free();
+}
+
+void IOInterruptEventSource::enable()
+{
+    IOEventSource::enable();
+    if (provider)
+        provider->enableInterrupt(intIndex);
+}
+
+void IOInterruptEventSource::disable()
+{
+    if (provider)
+        provider->disableInterrupt(intIndex);
+    IOEventSource::disable();
+}
+
+void IOInterruptEventSource::interruptOccurred(void *nub, IOService *provider, int source)
+{
+    OSIncrementAtomic(&producerCount);
+    signalWorkAvailable();
+}
+
+void IOInterruptEventSource::normalInterruptOccurred(void *nub, IOService *provider, int source)
+{
+    interruptOccurred(nub, provider, source);
+}
+
+bool IOInterruptEventSource::checkForWork()
+{
+    UInt32 produced = producerCount;
+    int count = (int)(produced - consumerCount);
+
+    if (!count)
+        return false;
+    consumerCount = produced;
+    if (action)
+        ((Action)action)(owner, this, count);
+    return producerCount != consumerCount;
+}
+
+IOFilterInterruptEventSource *
+IOFilterInterruptEventSource::filterInterruptEventSource(OSObject *owner, IOInterruptEventSource::Action action,
+                                                         Filter filter, IOService *provider, int intIndex)
+{
+    IOFilterInterruptEventSource *me = new IOFilterInterruptEventSource;
+
+    me->filterAction = filter;
+    if (!me->init(owner, action, provider, intIndex)) {
+        me->release();
+        return NULL;
+    }
+    return me;
+}
+
+void IOFilterInterruptEventSource::signalInterrupt()
+{
+    OSIncrementAtomic(&producerCount);
+    signalWorkAvailable();
+}
+
+void IOFilterInterruptEventSource::normalInterruptOccurred(void *nub, IOService *provider, int source)
+{
+    if (filterAction && filterAction(owner, this))
+        signalInterrupt();
+}
+
+IOCommandGate *IOCommandGate::commandGate(OSObject *owner, Action action)
+{
+    IOCommandGate *me = new IOCommandGate;
+
+    me->init(owner, (IOEventSource::Action)action);
+    return me;
+}
+
+IOReturn IOCommandGate::runCommand(void *arg0, void *arg1, void *arg2, void *arg3)
+{
+    return runAction((Action)action, arg0, arg1, arg2, arg3);
+}
+
+IOReturn IOCommandGate::runAction(Action action, void *arg0, void *arg1, void *arg2, void *arg3)
+{
+    IOReturn ret;
+
+    if (!workLoop || !action)
+        return kIOReturnNotReady;
+
+    workLoop->closeGate();
+    ret = action(owner, arg0, arg1, arg2, arg3);
+    workLoop->openGate();
+    return ret;
+}
+
+// MARK: libkern
+
+OSString *OSString::withCString(const char *cString)
+{
+    OSString *me = new OSString;
+
+    me->string = strdup(cString);
+    return me;
+}
+
+extern "C" const char *OSKextGetCurrentIdentifier(void)
+{
+    return "net.rpeshkov.IntelWifi";
+}
+
+struct host_ResourceRequest {
+    char *path;
+    OSKextRequestResourceCallback callback;
+    void *context;
+};
+
+/* the kernel calls back from kextd's reply, on a thread of its own */
+static void *host_resourceThread(void *arg)
+{
+    host_ResourceRequest *req = (host_ResourceRequest *)arg;
+    FILE *f = fopen(req->path, "rb");
+    void *data = NULL;
+    long len = 0;
+    OSReturn result = kOSReturnError;
+
+    if (f) {
+        fseek(f, 0, SEEK_END);
+        len = ftell(f);
+        fseek(f, 0, SEEK_SET);
+        data = malloc(len);
+        if (data && fread(data, 1, len, f) == (size_t)len)
+            result = kOSReturnSuccess;
+        fclose(f);
+    }
+
+    sim_stats.fw_requests++;
+    if (result == kOSReturnSuccess)
+        sim_stats.fw_bytes += len;
+    req->callback(1, result, result == kOSReturnSuccess ? data : NULL,
+                  result == kOSReturnSuccess ? (UInt32)len : 0, req->context);
+
+    free(data);
+    free(req->path);
+    free(req);
+    return NULL;
+}
+
+extern "C" OSReturn OSKextRequestResource(const char *kextIdentifier, const char *resourceName,
+                                          OSKextRequestResourceCallback callback, void *context,
+                                          OSKextRequestTag *requestTagOut)
+{
+    host_ResourceRequest *req = (host_ResourceRequest *)calloc(1, sizeof(*req));
+    const char *dir = getenv("IWL_FW_DIR");
+    pthread_t thread;
+
+    if (!dir)
+        dir = SIM_FW_DIR;
+    if (asprintf(&req->path, "%s/%s", dir, resourceName) < 0) {
+        free(req);
+        return kOSReturnError;
+    }
+    req->callback = callback;
+    req->context = context;
+
+    if (pthread_create(&thread, NULL, host_resourceThread, req)) {
+        free(req->path);
+        free(req);
+        return kOSReturnError;
+    }
+    pthread_detach(thread);
+    if (requestTagOut)
+        *requestTagOut = 1;
+    return kOSReturnSuccess;
+}
+
+/* IWL_BOOT_ARGS="iwl_rx_inline=1 iwl_fw_load_plan=0", numbers only */
+extern "C" Boolean PE_parse_boot_argn(const char *arg_string, void *arg_ptr, int max_arg)
+{
+    const char *args = getenv("IWL_BOOT_ARGS");
+    size_t n = strlen(arg_string);
+
+    for (const char *p = args; p && *p; ) {
+        while (*p == ' ')
+            p++;
+        if (!strncmp(p, arg_string, n) && (p[n] == '=' || p[n] == ' ' || !p[n])) {
+            unsigned long long val = p[n] == '=' ? strtoull(p + n + 1, NULL, 0) : 1;
+
+            if (max_arg >= 8)
+                *(UInt64 *)arg_ptr = val;
+            else if (max_arg >= 4)
+                *(UInt32 *)arg_ptr = (UInt32)val;
+            else if (max_arg >= 2)
+                *(UInt16 *)arg_ptr = (UInt16)val;
+            else
+                *(UInt8 *)arg_ptr = (UInt8)val;
+            return true;
+        }
+        p = strchr(p, ' ');
+    }
+    return false;
+}
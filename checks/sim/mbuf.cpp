@@ -0,0 +1,368 @@
+//
+//  mbuf.cpp
+//  checks
+//
+//  Mbufs for the simulator: a chain of buffers in the DMA space with a
+//  packet header length, the packet list link and the module tags the
+//  transport hangs the device command on. IOMbufNaturalMemoryCursor maps
+//  a chain to bus segments cut at page boundaries and maxSegmentSize.
+//
+
+#include <errno.h>
+#include <pthread.h>
+
+#include <IOKit/network/IOMbufMemoryCursor.h>
+
+#include "sim.h"
+
+#define SIM_MCLBYTES    2048
+
+struct sim_mbuf_tag {
+    struct sim_mbuf_tag *next;
+    mbuf_tag_id_t id;
+    mbuf_tag_type_t type;
+    size_t len;
+    uint64_t data[];
+};
+
+struct __mbuf {
+    mbuf_t next;
+    mbuf_t nextpkt;
+    uint8_t *data;
+    size_t len;
+    uint8_t *buf;
+    size_t pkthdr_len;
+    struct sim_mbuf_tag *tags;
+};
+
+static mbuf_t sim_mbuf_get(size_t buflen, size_t align)
+{
+    mbuf_t m = (mbuf_t)calloc(1, sizeof(*m));
+    uint64_t bus;
+
+    m->buf = (uint8_t *)sim_dma_alloc(buflen, align, 0, &bus);
+    if (!m->buf) {
+        free(m);
+        return NULL;
+    }
+    m->data = m->buf;
+    __atomic_add_fetch(&sim_stats.mbuf_allocs, 1, __ATOMIC_RELAXED);
+    return m;
+}
+
+static void sim_mbuf_put(mbuf_t m)
+{
+    while (m->tags) {
+        struct sim_mbuf_tag *t = m->tags;
+
+        m->tags = t->next;
+        free(t);
+    }
+    sim_dma_free(m->buf);
+    free(m);
+    __atomic_add_fetch(&sim_stats.mbuf_frees, 1, __ATOMIC_RELAXED);
+}
+
+unsigned long sim_mbuf_live(void)
+{
+    return __atomic_load_n(&sim_stats.mbuf_allocs, __ATOMIC_RELAXED) -
+           __atomic_load_n(&sim_stats.mbuf_frees, __ATOMIC_RELAXED);
+}
+
+mbuf_t sim_mbuf_chain(const void *data, size_t len, const size_t *seglens, unsigned nsegs)
+{
+    mbuf_t head = NULL, tail = NULL;
+    size_t off = 0;
+
+    for (unsigned i = 0; off < len; i++) {
+        size_t n = i < nsegs && seglens[i] ? seglens[i] : len - off;
+        mbuf_t m;
+
+        if (n > len - off || i + 1 >= nsegs)
+            n = len - off;
+        m = sim_mbuf_get(n, 64);
+        if (!m) {
+            if (head)
+                mbuf_freem(head);
+            return NULL;
+        }
+        memcpy(m->data, (const uint8_t *)data + off, n);
+        m->len = n;
+        off += n;
+        if (tail)
+            tail->next = m;
+        else
+            head = m;
+        tail = m;
+    }
+    if (head)
+        head->pkthdr_len = len;
+    return head;
+}
+
+// MARK: mbuf KPI
+
+errno_t mbuf_allocpacket(mbuf_how_t how, size_t packetlen, unsigned int *maxchunks, mbuf_t *mbuf)
+{
+    /* a single chunk is a buffer of the whole length, more are clusters */
+    size_t chunk = maxchunks && *maxchunks == 1 ? packetlen : SIM_MCLBYTES;
+    unsigned int n = (unsigned int)((packetlen + chunk - 1) / chunk);
+    mbuf_t head = NULL, tail = NULL;
+    size_t left = packetlen;
+
+    if (!n)
+        n = 1;
+    if (maxchunks && *maxchunks && n > *maxchunks)
+        return EINVAL;
+
+    for (unsigned int i = 0; i < n; i++) {
+        size_t len = left < chunk ? left : chunk;
+        mbuf_t m = sim_mbuf_get(len, 64);
+
+        if (!m) {
+            if (head)
+                mbuf_freem(head);
+            return ENOMEM;
+        }
+        m->len = len;
+        left -= len;
+        if (tail)
+            tail->next = m;
+        else
+            head = m;
+        tail = m;
+    }
+    head->pkthdr_len = packetlen;
+    if (maxchunks)
+        *maxchunks = n;
+    *mbuf = head;
+    return 0;
+}
+
+errno_t mbuf_copyback(mbuf_t mbuf, size_t offset, size_t length, const void *data, mbuf_how_t how)
+{
+    const uint8_t *src = (const uint8_t *)data;
+
+    for (mbuf_t m = mbuf; m && length; m = m->next) {
+        if (offset >= m->len) {
+            offset -= m->len;
+            continue;
+        }
+        size_t n = m->len - offset < length ? m->len - offset : length;
+
+        memcpy(m->data + offset, src, n);
+        src += n;
+        length -= n;
+        offset = 0;
+    }
+    return length ? EINVAL : 0;
+}
+
+errno_t mbuf_copydata(mbuf_t mbuf, size_t offset, size_t length, void *out_data)
+{
+    uint8_t *dst = (uint8_t *)out_data;
+
+    for (mbuf_t m = mbuf; m && length; m = m->next) {
+        if (offset >= m->len) {
+            offset -= m->len;
+            continue;
+        }
+        size_t n = m->len - offset < length ? m->len - offset : length;
+
+        memcpy(dst, m->data + offset, n);
+        dst += n;
+        length -= n;
+        offset = 0;
+    }
+    return length ? EINVAL : 0;
+}
+
+void mbuf_freem(mbuf_t mbuf)
+{
+    while (mbuf) {
+        mbuf_t next = mbuf->next;
+
+        sim_mbuf_put(mbuf);
+        mbuf = next;
+    }
+}
+
+int mbuf_freem_list(mbuf_t mbuf)
+{
+    int n = 0;
+
+    while (mbuf) {
+        mbuf_t next = mbuf_nextpkt(mbuf);
+
+        mbuf_freem(mbuf);
+        mbuf = next;
+        n++;
+    }
+    return n;
+}
+
+void *mbuf_data(mbuf_t mbuf)
+{
+    return mbuf->data;
+}
+
+size_t mbuf_len(mbuf_t mbuf)
+{
+    return mbuf->len;
+}
+
+mbuf_t mbuf_next(mbuf_t mbuf)
+{
+    return mbuf->next;
+}
+
+size_t mbuf_pkthdr_len(mbuf_t mbuf)
+{
+    return mbuf->pkthdr_len;
+}
+
+mbuf_t mbuf_nextpkt(mbuf_t mbuf)
+{
+    return mbuf->nextpkt;
+}
+
+void mbuf_setnextpkt(mbuf_t mbuf, mbuf_t nextpkt)
+{
+    mbuf->nextpkt = nextpkt;
+}
+
+errno_t mbuf_tag_id_find(const char *module_string, mbuf_tag_id_t *module_id)
+{
+    /* one module in the simulator */
+    *module_id = 1;
+    return 0;
+}
+
+errno_t mbuf_tag_allocate(mbuf_t mbuf, mbuf_tag_id_t module_id, mbuf_tag_type_t type, size_t length,
+                          mbuf_how_t how, void **data_p)
+{
+    struct sim_mbuf_tag *t;
+
+    for (t = mbuf->tags; t; t = t->next) {
+        if (t->id == module_id && t->type == type)
+            return EEXIST;
+    }
+    t = (struct sim_mbuf_tag *)calloc(1, sizeof(*t) + length);
+    if (!t)
+        return ENOMEM;
+    t->id = module_id;
+    t->type = type;
+    t->len = length;
+    t->next = mbuf->tags;
+    mbuf->tags = t;
+    *data_p = t->data;
+    return 0;
+}
+
+errno_t mbuf_tag_find(mbuf_t mbuf, mbuf_tag_id_t module_id, mbuf_tag_type_t type, size_t *length,
+                      void **data_p)
+{
+    for (struct sim_mbuf_tag *t = mbuf->tags; t; t = t->next) {
+        if (t->id == module_id && t->type == type) {
+            *length = t->len;
+            *data_p = t->data;
+            return 0;
+        }
+    }
+    return ENOENT;
+}
+
+void mbuf_tag_free(mbuf_t mbuf, mbuf_tag_id_t module_id, mbuf_tag_type_t type)
+{
+    for (struct sim_mbuf_tag **p = &mbuf->tags; *p; p = &(*p)->next) {
+        if ((*p)->id == module_id && (*p)->type == type) {
+            struct sim_mbuf_tag *t = *p;
+
+            *p = t->next;
+            free(t);
+            return;
+        }
+    }
+}
+
+// MARK: IOMbufNaturalMemoryCursor
+
+IOMbufNaturalMemoryCursor *IOMbufNaturalMemoryCursor::withSpecification(UInt32 maxSegmentSize, UInt32 maxNumSegments)
+{
+    IOMbufNaturalMemoryCursor *me = new IOMbufNaturalMemoryCursor;
+
+    me->maxSegmentSize = maxSegmentSize;
+    me->maxNumSegments = maxNumSegments;
+    me->coalesced = 0;
+    return me;
+}
+
+UInt32 IOMbufNaturalMemoryCursor::genSegments(mbuf_t packet, IOPhysicalSegment *vector, UInt32 max)
+{
+    UInt32 n = 0;
+
+    if (max > maxNumSegments)
+        max = maxNumSegments;
+
+    for (mbuf_t m = packet; m; m = m->next) {
+        UInt64 bus = sim_dma_bus(m->data);
+        size_t left = m->len;
+
+        while (left) {
+            /* a segment never crosses a page, the pages need not be adjacent */
+            UInt64 len = PAGE_SIZE - (bus & (PAGE_SIZE - 1));
+
+            if (len > left)
+                len = left;
+            if (len > maxSegmentSize)
+                len = maxSegmentSize;
+            if (n && vector[n - 1].location + vector[n - 1].length == bus &&
+                (bus & (PAGE_SIZE - 1)) && vector[n - 1].length + len <= maxSegmentSize) {
+                vector[n - 1].length += len;
+            } else {
+                if (n == max)
+                    return 0;
+                vector[n].location = bus;
+                vector[n].length = len;
+                n++;
+            }
+            bus += len;
+            left -= len;
+        }
+    }
+    return n;
+}
+
+UInt32 IOMbufNaturalMemoryCursor::getPhysicalSegments(mbuf_t packet, IOPhysicalSegment *vector,
+                                                      UInt32 numVectorSegments)
+{
+    return genSegments(packet, vector, numVectorSegments ? numVectorSegments : maxNumSegments);
+}
+
+UInt32 IOMbufNaturalMemoryCursor::getPhysicalSegmentsWithCoalesce(mbuf_t packet, IOPhysicalSegment *vector,
+                                                                  UInt32 numVectorSegments)
+{
+    UInt32 n = getPhysicalSegments(packet, vector, numVectorSegments);
+    size_t total = 0;
+    uint8_t *buf;
+    uint64_t bus;
+
+    if (n || !packet)
+        return n;
+
+    /* too many pieces: copy the chain into one buffer owned by the head */
+    for (mbuf_t m = packet; m; m = m->next)
+        total += m->len;
+    buf = (uint8_t *)sim_dma_alloc(total, PAGE_SIZE, 0, &bus);
+    if (!buf)
+        return 0;
+    mbuf_copydata(packet, 0, total, buf);
+    mbuf_freem(packet->next);
+    packet->next = NULL;
+    sim_dma_free(packet->buf);
+    packet->buf = packet->data = buf;
+    packet->len = total;
+    coalesced++;
+
+    return getPhysicalSegments(packet, vector, numVectorSegments);
+}
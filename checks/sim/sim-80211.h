@@ -0,0 +1,79 @@
+//
+//  sim-80211.h
+//  checks
+//
+//  Host stand-in for the IO80211 family, force included ahead of the
+//  driver sources (the real headers are empty outside the kernel). Only
+//  what IntelWifi derives from and overrides is declared.
+//
+
+#ifndef sim_80211_h
+#define sim_80211_h
+
+#ifdef __cplusplus
+
+#include <IOKit/IOService.h>
+#include <IOKit/IOWorkLoop.h>
+#include <IOKit/IOCommandGate.h>
+#include <sys/kpi_mbuf.h>
+
+/* keep the real family headers out */
+#define _IO80211CONTROLLER_H
+#define _IO80211INTERFACE_H
+
+struct IOEthernetAddress {
+    UInt8 bytes[6];
+};
+
+struct IONetworkStats;
+struct IOEthernetStats;
+
+struct apple80211_power_data;
+struct apple80211_capability_data;
+struct apple80211_phymode_data;
+struct apple80211_intmit_data;
+
+class IONetworkInterface : public OSObject {
+    OSDeclareDefaultStructors(IONetworkInterface)
+
+public:
+    /* the stack takes the packet, here it is dropped */
+    virtual UInt32 inputPacket(mbuf_t m, UInt32 length = 0, IOOptionBits options = 0, void *param = 0)
+    {
+        mbuf_freem(m);
+        return 1;
+    }
+};
+
+class IO80211Interface : public IONetworkInterface {
+    OSDeclareDefaultStructors(IO80211Interface)
+};
+
+class IO80211Controller : public IOService {
+    OSDeclareDefaultStructors(IO80211Controller)
+
+public:
+    virtual SInt32 apple80211Request(unsigned int, int, IO80211Interface *, void *) = 0;
+    virtual const OSString *newVendorString() const = 0;
+    virtual const OSString *newModelString() const = 0;
+    virtual IOReturn getHardwareAddressForInterface(IO80211Interface *netif, IOEthernetAddress *addr) = 0;
+    virtual IOReturn getHardwareAddress(IOEthernetAddress *addrP) = 0;
+    virtual IOReturn enable(IONetworkInterface *netif) = 0;
+    virtual IOReturn disable(IONetworkInterface *netif) = 0;
+    virtual bool configureInterface(IONetworkInterface *netif) { return true; }
+    virtual IOReturn setPromiscuousMode(bool active) = 0;
+    virtual IOReturn setMulticastMode(bool active) = 0;
+    /* IONetworkController's default drops the packet */
+    virtual UInt32 outputPacket(mbuf_t m, void *param)
+    {
+        mbuf_freem(m);
+        return kIOReturnOutputDropped;
+    }
+    virtual SInt32 monitorModeSetEnabled(IO80211Interface *, bool, unsigned int) = 0;
+    virtual IO80211Interface *getNetworkInterface() { return NULL; }
+    virtual bool createWorkLoop() = 0;
+};
+
+#endif /* __cplusplus */
+
+#endif /* sim_80211_h */
@@ -0,0 +1,48 @@
+//
+//  sim.h
+//  checks
+//
+//  Shared state of the host simulator: the DMA space the device model
+//  reads and writes, the mbufs built on top of it, and the counters the
+//  benchmark reports. See SimDevice.h for the device itself.
+//
+
+#ifndef sim_h
+#define sim_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <sys/kpi_mbuf.h>
+
+/* relative to checks/, override with IWL_FW_DIR */
+#define SIM_FW_DIR  "../IntelWifi/IntelWifi/firmware"
+
+struct sim_stats {
+    unsigned long fw_requests;      /* OSKextRequestResource calls */
+    unsigned long fw_bytes;         /* firmware file bytes handed to the driver */
+    unsigned long heap_bytes;       /* IOMalloc'ed and not freed yet */
+    unsigned long dma_allocs;       /* buffers handed out of the DMA space */
+    unsigned long dma_bytes;        /* bytes currently allocated */
+    unsigned long mbuf_allocs;
+    unsigned long mbuf_frees;
+};
+
+extern struct sim_stats sim_stats;
+
+/*
+ * The DMA space. Buffers come from a low arena below 4G for masks of 32
+ * bits or less and from a high one above it otherwise, so bus addresses
+ * exercise the hi/lo split of the TFDs. Alignment follows the clear low
+ * bits of the mask, at least 'align'.
+ */
+void *sim_dma_alloc(size_t len, size_t align, uint64_t mask, uint64_t *bus);
+void sim_dma_free(void *virt);
+void *sim_dma_virt(uint64_t bus, size_t len);
+uint64_t sim_dma_bus(const void *virt);
+
+/* a packet of 'len' bytes split over mbufs of seglens[0..nsegs) */
+mbuf_t sim_mbuf_chain(const void *data, size_t len, const size_t *seglens, unsigned nsegs);
+unsigned long sim_mbuf_live(void);
+
+#endif /* sim_h */
@@ -0,0 +1,234 @@
+//
+//  tlv-iter.c
+//  checks
+//
+//  Host check of the .ucode TLV walker in iwlwifi/fw/tlv-iter.h: padding,
+//  a last TLV without padding, truncated and trailing streams, section
+//  counting, and random streams that must never be read past their end.
+//  Build and run from this directory:
+//
+//      cc -Ihost -I../IntelWifi/IntelWifi/porting -I../IntelWifi/IntelWifi/iwlwifi -o tlv-iter tlv-iter.c
+//      ./tlv-iter
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fw/tlv-iter.h"
+
+#define STREAM_MAX  512
+
+struct stream {
+    u8 buf[STREAM_MAX];
+    size_t len;
+};
+
+static int failures;
+
+#define CHECK(name, cond, ...) do {                             \
+    if (!(cond)) {                                              \
+        printf("FAIL %s: ", (name));                            \
+        printf(__VA_ARGS__);                                    \
+        printf("\n");                                           \
+        failures++;                                             \
+        return;                                                 \
+    }                                                           \
+} while (0)
+
+static void put_hdr(struct stream *s, u32 type, u32 len)
+{
+    struct iwl_ucode_tlv tlv = {
+        .type = cpu_to_le32(type),
+        .length = cpu_to_le32(len),
+    };
+
+    memcpy(s->buf + s->len, &tlv, sizeof(tlv));
+    s->len += sizeof(tlv);
+}
+
+/* append a TLV, padded to 4 bytes unless @pad is false */
+static void put_tlv(struct stream *s, u32 type, u32 len, bool pad)
+{
+    u32 i;
+
+    put_hdr(s, type, len);
+    for (i = 0; i < len; i++)
+        s->buf[s->len++] = (u8)(type + i);
+    if (pad)
+        while (s->len % 4)
+            s->buf[s->len++] = 0xee;
+}
+
+/* copy of @s in a buffer of its exact size, so reading past the end is caught */
+static u8 *exact_copy(const struct stream *s)
+{
+    u8 *p = malloc(s->len ? s->len : 1);
+
+    memcpy(p, s->buf, s->len);
+    return p;
+}
+
+static void check_walk(void)
+{
+    static const u32 lens[] = { 0, 1, 4, 5, 7, 8, 13 };
+    struct stream s = { .len = 0 };
+    struct iwl_tlv_iter it;
+    size_t i, n = 0;
+    u8 *data;
+
+    for (i = 0; i < ARRAY_SIZE(lens); i++)
+        put_tlv(&s, 100 + (u32)i, lens[i], i != ARRAY_SIZE(lens) - 1);
+
+    data = exact_copy(&s);
+    iwl_tlv_iter_init(&it, data, s.len);
+    while (iwl_tlv_iter_next(&it)) {
+        if (n >= ARRAY_SIZE(lens))
+            break;
+        if (it.type != 100 + n || it.len != lens[n] ||
+            (it.len && it.data[it.len - 1] != (u8)(it.type + it.len - 1))) {
+            free(data);
+            CHECK("walk", false, "TLV %zu is type %u len %u", n, it.type, it.len);
+        }
+        n++;
+    }
+    free(data);
+
+    CHECK("walk", n == ARRAY_SIZE(lens) && it.err == IWL_TLV_ITER_OK,
+          "%zu TLVs, err %d, expected %zu and no error", n, it.err, ARRAY_SIZE(lens));
+    printf("ok   walk: %zu TLVs, the last one unpadded\n", n);
+}
+
+static void check_error(const char *name, const struct stream *s, size_t want_n,
+                        enum iwl_tlv_iter_err want_err)
+{
+    struct iwl_tlv_iter it;
+    size_t n = 0;
+    u8 *data = exact_copy(s);
+
+    iwl_tlv_iter_init(&it, data, s->len);
+    while (iwl_tlv_iter_next(&it))
+        n++;
+    free(data);
+
+    CHECK(name, n == want_n && it.err == want_err,
+          "%zu TLVs, err %d, expected %zu and err %d", n, it.err, want_n, want_err);
+    printf("ok   %s: stops after %zu TLVs with err %d\n", name, n, it.err);
+}
+
+static void check_errors(void)
+{
+    struct stream s = { .len = 0 };
+    size_t i;
+
+    check_error("empty", &s, 0, IWL_TLV_ITER_OK);
+
+    put_tlv(&s, 1, 8, true);
+    put_tlv(&s, 2, 8, true);
+    s.len -= 1;
+    check_error("truncated", &s, 1, IWL_TLV_ITER_TRUNCATED);
+
+    for (i = 1; i < sizeof(struct iwl_ucode_tlv); i++) {
+        s.len = 0;
+        put_tlv(&s, 1, 4, true);
+        memset(s.buf + s.len, 0, i);
+        s.len += i;
+        check_error("trailing", &s, 1, IWL_TLV_ITER_TRAILING);
+    }
+
+    s.len = 0;
+    put_tlv(&s, 1, 4, true);
+    put_hdr(&s, 2, 0xfffffff0);
+    check_error("huge length", &s, 1, IWL_TLV_ITER_TRUNCATED);
+}
+
+static void check_count_secs(void)
+{
+    struct stream s = { .len = 0 };
+    int n_secs[IWL_UCODE_TYPE_MAX];
+    enum iwl_tlv_iter_err err;
+
+    put_tlv(&s, IWL_UCODE_TLV_SEC_RT, 12, true);
+    put_tlv(&s, IWL_UCODE_TLV_SECURE_SEC_RT, 5, true);
+    put_tlv(&s, IWL_UCODE_TLV_SEC_INIT, 4, true);
+    put_tlv(&s, IWL_UCODE_TLV_SECURE_SEC_WOWLAN, 8, true);
+    put_tlv(&s, IWL_UCODE_TLV_SEC_RT_USNIFFER, 8, true);
+    put_tlv(&s, IWL_UCODE_TLV_API_CHANGES_SET, 2, true);
+    put_tlv(&s, IWL_UCODE_TLV_SEC_RT, 4, false);
+
+    err = iwl_tlv_count_secs(s.buf, s.len, n_secs);
+    CHECK("count secs", err == IWL_TLV_ITER_OK &&
+          n_secs[IWL_UCODE_REGULAR] == 3 && n_secs[IWL_UCODE_INIT] == 1 &&
+          n_secs[IWL_UCODE_WOWLAN] == 1 && n_secs[IWL_UCODE_REGULAR_USNIFFER] == 1,
+          "err %d, regular %d init %d wowlan %d usniffer %d", err,
+          n_secs[IWL_UCODE_REGULAR], n_secs[IWL_UCODE_INIT],
+          n_secs[IWL_UCODE_WOWLAN], n_secs[IWL_UCODE_REGULAR_USNIFFER]);
+
+    /* a section needs room for its device offset */
+    put_tlv(&s, IWL_UCODE_TLV_SEC_INIT, 3, true);
+    err = iwl_tlv_count_secs(s.buf, s.len, n_secs);
+    CHECK("short section", err == IWL_TLV_ITER_BAD_SECTION, "err %d", err);
+
+    printf("ok   count secs\n");
+}
+
+/*
+ * Random streams: the iterator has to stop, every TLV it returns has to lie
+ * within the stream, and the TLVs have to tile it up to the padding.
+ */
+static void check_random(void)
+{
+    int round;
+
+    srand(1);
+    for (round = 0; round < 20000; round++) {
+        struct stream s;
+        struct iwl_tlv_iter it;
+        size_t i, covered = 0;
+        int steps = 0;
+        u8 *data;
+
+        s.len = (size_t)rand() % STREAM_MAX;
+        for (i = 0; i < s.len; i++)
+            s.buf[i] = (u8)rand();
+        /* mostly sane lengths, so the walk gets past the first TLV */
+        for (i = 4; i + 4 <= s.len && rand() % 4; i += 8 + (size_t)rand() % 24) {
+            u32 len = (u32)rand() % 32;
+
+            memcpy(s.buf + i, &len, sizeof(len));
+        }
+
+        data = exact_copy(&s);
+        iwl_tlv_iter_init(&it, data, s.len);
+        while (iwl_tlv_iter_next(&it)) {
+            size_t start = (size_t)(it.data - data);
+
+            if (start > s.len || it.len > s.len - start || ++steps > STREAM_MAX) {
+                free(data);
+                CHECK("random", false, "round %d: TLV at %zu len %u outside %zu bytes",
+                      round, start, it.len, s.len);
+            }
+            covered = start + it.len;
+        }
+        free(data);
+
+        CHECK("random", it.err != IWL_TLV_ITER_OK || LNX_ALIGN(covered, 4) >= s.len,
+              "round %d: stream of %zu bytes ends at %zu without an error",
+              round, s.len, covered);
+    }
+
+    printf("ok   random: %d streams\n", round);
+}
+
+int main(void)
+{
+    check_walk();
+    check_errors();
+    check_count_secs();
+    check_random();
+
+    if (failures)
+        printf("%d checks failed\n", failures);
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,218 @@
+//
+//  trace-ring.c
+//  checks
+//
+//  Host check of the binary trace ring in iwl-devtrace.c. On one thread:
+//  reading back what was written, the ring overwriting the oldest records
+//  and iwl_trace_read() counting them as lost, reading in pieces across
+//  the wrap and the 32 bit @seq wrapping. Then writer threads take their
+//  tickets concurrently while a reader drains the ring in small reads:
+//  every record read has to be whole, each writer's records have to come
+//  out in order, and read plus lost has to add up to what was written.
+//  Build and run from this directory:
+//
+//      cc -Ihost -I../IntelWifi/IntelWifi/porting -I../IntelWifi/IntelWifi/iwlwifi -I../IntelWifi/IntelWifi -I../common -o trace-ring trace-ring.c ../IntelWifi/IntelWifi/iwlwifi/iwl-devtrace.c -lpthread
+//      ./trace-ring
+//
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "iwl-devtrace.h"
+
+#define WRITERS         3
+#define WRITES          200000      /* per writer */
+#define READ_CHUNK      64
+
+static int failures;
+
+#define CHECK(name, cond, ...) do {                             \
+    if (!(cond)) {                                              \
+        printf("FAIL %s: ", (name));                            \
+        printf(__VA_ARGS__);                                    \
+        printf("\n");                                           \
+        failures++;                                             \
+        return;                                                 \
+    }                                                           \
+} while (0)
+
+/* the only allocations the ring makes */
+void *iwh_zalloc(vm_size_t len)
+{
+    return calloc(1, len);
+}
+
+void iwh_free(void *ptr)
+{
+    free(ptr);
+}
+
+/* a record checks itself: @id, @n, ~@n and both mixed */
+static void trace_write(u32 id, u32 n)
+{
+    iwl_trace(IWL_TRACE_RX, id, n, ~n, id * 0x9e3779b9 ^ n);
+}
+
+static int trace_whole(const struct iwl_trace_rec *rec)
+{
+    return rec->event == IWL_TRACE_RX && rec->args[2] == ~rec->args[1] &&
+           rec->args[3] == (rec->args[0] * 0x9e3779b9 ^ rec->args[1]);
+}
+
+static int trace_reset(u64 head)
+{
+    iwl_trace_free();
+    if (iwl_trace_init())
+        return -1;
+    iwl_trace_ring.head = (SInt64)head;
+    return 0;
+}
+
+/*
+ * Write @count records from position @start and read them back from @from
+ * in reads of @chunk: the ones the ring still holds come out in order,
+ * the rest are lost.
+ */
+static void check_single(const char *name, u64 start, u32 count, u64 from, u32 chunk)
+{
+    static struct iwl_trace_rec out[IWL_TRACE_RECS];
+    u64 head = start + count, first = head > IWL_TRACE_RECS ? head - IWL_TRACE_RECS : 0;
+    u64 pos = from, want = from < first ? first : from;
+    u32 n, lost, total_lost = 0, got = 0;
+
+    CHECK(name, !trace_reset(start), "no ring");
+    for (u32 i = 0; i < count; i++)
+        trace_write(0, (u32)(start + i));
+
+    while ((n = iwl_trace_read(&pos, out, chunk, &lost)) || lost) {
+        total_lost += lost;
+        for (u32 i = 0; i < n; i++, want++) {
+            CHECK(name, out[i].seq == iwl_trace_seq(want) && out[i].args[1] == (u32)want && trace_whole(&out[i]),
+                  "record %llu came out as seq %u, n %u", (unsigned long long)want, out[i].seq, out[i].args[1]);
+        }
+        got += n;
+    }
+    CHECK(name, pos == head, "stopped at %llu of %llu", (unsigned long long)pos, (unsigned long long)head);
+    CHECK(name, got == head - (from < first ? first : from) && total_lost == (from < first ? first - from : 0),
+          "%u read, %u lost, from %llu with the ring holding %llu to %llu", got, total_lost,
+          (unsigned long long)from, (unsigned long long)first, (unsigned long long)head);
+
+    /* nothing new, nothing read */
+    n = iwl_trace_read(&pos, out, chunk, &lost);
+    CHECK(name, !n && !lost && pos == head, "%u read, %u lost at the head", n, lost);
+
+    printf("ok   %s: %u written, %u read, %u lost\n", name, count, got, total_lost);
+}
+
+struct stress {
+    volatile int writers_left;
+    u64 read;
+    u64 lost;
+    u32 next[WRITERS];          /* the next n expected from each writer */
+    u32 skipped;                /* records of a writer that were lost */
+    int errors;
+    char first_bad[128];
+};
+
+static struct stress s;
+
+static void *writer(void *arg)
+{
+    u32 id = (u32)(uintptr_t)arg;
+
+    for (u32 n = 0; n < WRITES; n++) {
+        trace_write(id, n);
+        if (n % 256 == 0)
+            sched_yield();
+    }
+    __atomic_sub_fetch(&s.writers_left, 1, __ATOMIC_SEQ_CST);
+    return NULL;
+}
+
+static void reader_take(const struct iwl_trace_rec *recs, u32 n)
+{
+    for (u32 i = 0; i < n; i++) {
+        const struct iwl_trace_rec *rec = &recs[i];
+        u32 id = rec->args[0];
+
+        if (!trace_whole(rec) || id >= WRITERS || rec->args[1] < s.next[id]) {
+            if (!s.errors++)
+                snprintf(s.first_bad, sizeof(s.first_bad), "seq %u: id %u n %u after %u", rec->seq, id,
+                         rec->args[1], id < WRITERS ? s.next[id] : 0);
+            continue;
+        }
+        s.skipped += rec->args[1] - s.next[id];
+        s.next[id] = rec->args[1] + 1;
+    }
+}
+
+static void *reader(void *arg)
+{
+    static struct iwl_trace_rec out[READ_CHUNK];
+    u64 pos = 0;
+    u32 n, lost;
+
+    for (;;) {
+        int done = !__atomic_load_n(&s.writers_left, __ATOMIC_SEQ_CST);
+
+        n = iwl_trace_read(&pos, out, READ_CHUNK, &lost);
+        s.read += n;
+        s.lost += lost;
+        reader_take(out, n);
+        if (!n && !lost) {
+            if (done)
+                break;
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+static void check_stress(const char *name, u64 start)
+{
+    pthread_t writers[WRITERS], rd;
+    u64 total = (u64)WRITERS * WRITES;
+
+    memset(&s, 0, sizeof(s));
+    CHECK(name, !trace_reset(start), "no ring");
+    /* the reader starts at 0, everything before @start is lost */
+    s.writers_left = WRITERS;
+
+    pthread_create(&rd, NULL, reader, NULL);
+    for (int i = 0; i < WRITERS; i++)
+        pthread_create(&writers[i], NULL, writer, (void *)(uintptr_t)i);
+    for (int i = 0; i < WRITERS; i++)
+        pthread_join(writers[i], NULL);
+    pthread_join(rd, NULL);
+
+    CHECK(name, !s.errors, "%d records torn or out of order, the first %s", s.errors, s.first_bad);
+    CHECK(name, s.read + s.lost == start + total, "%llu read and %llu lost of %llu",
+          (unsigned long long)s.read, (unsigned long long)s.lost, (unsigned long long)(start + total));
+    CHECK(name, s.lost - start == s.skipped, "%llu lost past the start but %u missing from the writers",
+          (unsigned long long)(s.lost - start), s.skipped);
+    for (int i = 0; i < WRITERS; i++)
+        CHECK(name, s.next[i] == WRITES, "writer %d's last record read is %u of %d", i, s.next[i], WRITES);
+
+    printf("ok   %s: %llu written by %d writers, %llu read, %llu lost\n", name, (unsigned long long)total,
+           WRITERS, (unsigned long long)s.read, (unsigned long long)(s.lost - start));
+}
+
+int main(void)
+{
+    check_single("trace", 0, IWL_TRACE_RECS / 2, 0, IWL_TRACE_RECS);
+    check_single("trace full", 0, IWL_TRACE_RECS, 0, IWL_TRACE_RECS);
+    check_single("trace wrap", 0, IWL_TRACE_RECS * 3 + 5, 0, IWL_TRACE_RECS);
+    check_single("trace wrap pieces", 0, IWL_TRACE_RECS * 3 + 5, IWL_TRACE_RECS * 2 + 100, 7);
+    check_single("trace seq wrap", 0xffffffffULL - IWL_TRACE_RECS / 2, IWL_TRACE_RECS, 0xffffffffULL - 10, 5);
+    check_stress("trace threads", 0);
+    check_stress("trace threads seq wrap", 0xffffffffULL - WRITES);
+    iwl_trace_free();
+
+    if (failures)
+        printf("%d checks failed\n", failures);
+
+    return failures ? 1 : 0;
+}
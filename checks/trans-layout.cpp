@@ -0,0 +1,378 @@
+//
+//  trans-layout.cpp
+//  checks
+//
+//  Host check of the TFD and RBD layouts in IwlTransLayout.h against a
+//  fake device. The fake DMA space hands out bus addresses above 4GB, the
+//  host side fills a TX ring through the TFD layout and the device side
+//  gathers the frames back from the TBs it finds. On RX the device hands
+//  RBs back through the ring the way each RBD layout expects, duplicates
+//  and stray IDs included; each one it rejects logs an ERR line like the
+//  driver does. Last, building and unmapping TFDs is timed for both layouts,
+//  through the specialized accessors and through accessors that look at
+//  the cfg on every call, the way the transport did before. Build and run
+//  from this directory:
+//
+//      c++ -Ihost -I../IntelWifi/IntelWifi/porting -I../IntelWifi/IntelWifi/iwlwifi -I../IntelWifi/IntelWifi -I../common -o trans-layout trans-layout.cpp
+//      ./trans-layout
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "IwlTransLayout.h"
+
+/* one TB of the largest length the TFD takes, the rest up to 256 bytes */
+#define FRAME_MAX   (0xFFFF + IWL_TFH_NUM_TBS * 256)
+#define ARENA_SIZE  (TFD_QUEUE_SIZE_MAX * FRAME_MAX)
+
+#define BENCH_TFDS  (4 * 1000 * 1000)
+#define BENCH_TBS   3           /* TX command, the rest of the header, the payload */
+
+static int failures;
+static int nmis;
+
+/* the fake device can't be kicked, count what the layouts ask for */
+extern "C" void iwl_force_nmi(struct iwl_trans *trans)
+{
+    nmis++;
+}
+
+#define CHECK(name, cond, ...) do {                             \
+    if (!(cond)) {                                              \
+        printf("FAIL %s: ", (name));                            \
+        printf(__VA_ARGS__);                                    \
+        printf("\n");                                           \
+        failures++;                                             \
+        return;                                                 \
+    }                                                           \
+} while (0)
+
+/*
+ * Fake DMA space: bus addresses are offsets into the arena above @base,
+ * so the high bits of every address have to make it through the TFD.
+ */
+struct FakeDma {
+    u8 *arena;
+    dma_addr_t base;
+    size_t used;
+
+    dma_addr_t map(size_t len)
+    {
+        dma_addr_t addr = base + used;
+
+        used = LNX_ALIGN(used + len, 4);
+        return addr;
+    }
+
+    u8 *virt(dma_addr_t addr, size_t len)
+    {
+        if (addr < base || addr - base + len > ARENA_SIZE)
+            return NULL;
+        return arena + (addr - base);
+    }
+};
+
+struct Frame {
+    u8 data[FRAME_MAX];
+    size_t len;
+};
+
+template <class Tfd, class TfdStruct>
+static void check_tx(const char *name, bool use_tfh, dma_addr_t base, int max_tbs, u16 max_len)
+{
+    struct iwl_trans_pcie *trans_pcie = (struct iwl_trans_pcie *)calloc(1, sizeof(*trans_pcie));
+    struct iwl_cfg cfg;
+    struct iwl_trans trans;
+    struct iwl_txq txq;
+    FakeDma dma = { (u8 *)calloc(1, ARENA_SIZE), base, 0 };
+    Frame *sent = (Frame *)calloc(TFD_QUEUE_SIZE_MAX, sizeof(Frame));
+    Frame got;
+    int frames = 0, round;
+
+    memset(&txq, 0, sizeof(txq));
+    txq.tfds = calloc(TFD_QUEUE_SIZE_MAX, sizeof(TfdStruct));
+    txq.n_window = TFD_QUEUE_SIZE_MAX;
+    trans_pcie->tfd_size = sizeof(TfdStruct);
+    memset(&cfg, 0, sizeof(cfg));
+    memset(&trans, 0, sizeof(trans));
+    cfg.use_tfh = use_tfh;
+    trans.cfg = &cfg;
+    trans_pcie->trans = &trans;
+
+    srand(2);
+    for (round = 0; round < 64; round++) {
+        /* host: queue a burst, the ring keeps one slot free */
+        int burst = 1 + rand() % (TFD_QUEUE_SIZE_MAX - 1);
+
+        dma.used = 0;
+        while (burst--) {
+            void *tfd = iwl_pcie_get_tfd(trans_pcie, &txq, txq.write_ptr);
+            Frame *f = &sent[txq.write_ptr];
+            int n_tbs = 1 + rand() % max_tbs, big = rand() % n_tbs, i;
+
+            Tfd::clear_tbs(tfd);
+            f->len = 0;
+            for (i = 0; i < n_tbs; i++) {
+                u16 len = i == big && !(rand() % 8) ? max_len : 1 + rand() % 256;
+                dma_addr_t addr = dma.map(len);
+                u8 *p = dma.virt(addr, len);
+                u16 j;
+
+                for (j = 0; j < len; j++)
+                    p[j] = f->data[f->len + j] = (u8)rand();
+                f->len += len;
+
+                CHECK(name, !Tfd::set_tb(tfd, (u8)i, addr, len), "set_tb of %u bytes failed", len);
+            }
+            txq.write_ptr = iwl_queue_inc_wrap(txq.write_ptr);
+        }
+
+        /* device: fetch everything between the read and the write pointer */
+        while (txq.read_ptr != txq.write_ptr) {
+            void *tfd = iwl_pcie_get_tfd(trans_pcie, &txq, txq.read_ptr);
+            Frame *f = &sent[txq.read_ptr];
+            u8 i, n_tbs = Tfd::num_tbs(tfd);
+
+            CHECK(name, iwl_queue_used(&txq, txq.read_ptr), "slot %d isn't in use", txq.read_ptr);
+
+            got.len = 0;
+            for (i = 0; i < n_tbs; i++) {
+                dma_addr_t addr = Tfd::tb_addr(tfd, i);
+                u16 len = Tfd::tb_len(tfd, i);
+                u8 *p = dma.virt(addr, len);
+
+                CHECK(name, p && got.len + len <= FRAME_MAX,
+                      "TB %u of slot %d points at 0x%llx, %u bytes, outside the DMA space",
+                      i, txq.read_ptr, (unsigned long long)addr, len);
+                memcpy(got.data + got.len, p, len);
+                got.len += len;
+            }
+
+            CHECK(name, got.len == f->len && !memcmp(got.data, f->data, f->len),
+                  "slot %d: the device gathered %zu bytes, the host queued %zu",
+                  txq.read_ptr, got.len, f->len);
+            frames++;
+            txq.read_ptr = iwl_queue_inc_wrap(txq.read_ptr);
+        }
+    }
+
+    /* a TB the length field can't hold is refused and leaves the TFD alone */
+    if (max_len == IWL_TFD_MAX_TB_LEN) {
+        void *tfd = iwl_pcie_get_tfd(trans_pcie, &txq, 0);
+
+        Tfd::clear_tbs(tfd);
+        CHECK(name, Tfd::set_tb(tfd, 0, base, max_len + 1) == -EINVAL && !Tfd::num_tbs(tfd),
+              "a %u byte TB was accepted", max_len + 1);
+    }
+
+    free(txq.tfds);
+    free(sent);
+    free(dma.arena);
+    free(trans_pcie);
+
+    printf("ok   %s: %d frames over %d rounds\n", name, frames, round);
+}
+
+static void check_rx_legacy(void)
+{
+    static struct iwl_rx_mem_buffer rxbs[RX_QUEUE_SIZE];
+    struct iwl_rxq *rxq = (struct iwl_rxq *)calloc(1, sizeof(*rxq));
+    int i;
+
+    for (i = 0; i < RX_QUEUE_SIZE; i++)
+        rxq->queue[i] = &rxbs[i];
+
+    for (i = 0; i < RX_QUEUE_SIZE; i++) {
+        struct iwl_rx_mem_buffer *rxb = IwlRbdLegacy::take(NULL, rxq, i);
+
+        CHECK("rx legacy", rxb == &rxbs[i] && !rxq->queue[i], "slot %d gave the wrong RB", i);
+    }
+
+    free(rxq);
+    printf("ok   rx legacy: %d RBs\n", RX_QUEUE_SIZE);
+}
+
+static void check_rx_mq(void)
+{
+    static struct iwl_rx_mem_buffer rxbs[RX_POOL_SIZE];
+    struct iwl_trans *trans = (struct iwl_trans *)calloc(1, sizeof(*trans) + sizeof(struct iwl_trans_pcie));
+    struct iwl_trans_pcie *trans_pcie = IWL_TRANS_GET_PCIE_TRANS(trans);
+    struct iwl_rxq *rxq = (struct iwl_rxq *)calloc(1, sizeof(*rxq));
+    static const u32 stray[] = { 0, RX_POOL_SIZE + 1, 0xFFF };
+    int i, n = 0, round;
+
+    rxq->used_bd = (__le32 *)calloc(RX_QUEUE_SIZE, sizeof(__le32));
+    for (i = 0; i < RX_POOL_SIZE; i++) {
+        rxbs[i].vid = i + 1;
+        rxbs[i].invalid = true;
+        trans_pcie->global_table[i] = &rxbs[i];
+    }
+
+    srand(3);
+    for (round = 0; round < 1000; round++) {
+        /* host posts an RB, the device hands it back in a random used BD */
+        int idx = rand() % RX_POOL_SIZE;
+        u32 slot = (u32)rand() % RX_QUEUE_SIZE;
+        struct iwl_rx_mem_buffer *rxb;
+
+        rxbs[idx].invalid = false;
+        /* only the low 12 bits carry the vid */
+        rxq->used_bd[slot] = cpu_to_le32(((u32)rand() << 12) | rxbs[idx].vid);
+
+        nmis = 0;
+        rxb = IwlRbdMq::take(trans, rxq, slot);
+        CHECK("rx mq", rxb == &rxbs[idx] && rxb->invalid && !nmis,
+              "vid %u came back as %p", rxbs[idx].vid, (void *)rxb);
+
+        n++;
+
+        /* the device returning it twice is caught, and logged */
+        if (round % 100)
+            continue;
+        rxb = IwlRbdMq::take(trans, rxq, slot);
+        CHECK("rx mq", !rxb && nmis == 1, "vid %u was taken twice", rxbs[idx].vid);
+    }
+
+    for (i = 0; i < (int)ARRAY_SIZE(stray); i++) {
+        nmis = 0;
+        rxq->used_bd[0] = cpu_to_le32(stray[i]);
+        CHECK("rx mq", !IwlRbdMq::take(trans, rxq, 0) && nmis == 1,
+              "stray vid %u was accepted", stray[i]);
+    }
+
+    free(rxq->used_bd);
+    free(rxq);
+    free(trans);
+    printf("ok   rx mq: %d RBs, %zu stray vids\n", n, ARRAY_SIZE(stray));
+}
+
+/*
+ * The TFD accessors as they were before the layouts became types: every
+ * call looks at trans->cfg->use_tfh.
+ */
+static struct iwl_trans *dispatch_trans;
+
+struct IwlTfdDispatch {
+    static inline dma_addr_t tb_addr(void *tfd, u8 idx)
+    {
+        if (dispatch_trans->cfg->use_tfh)
+            return IwlTfdTfh::tb_addr(tfd, idx);
+        return IwlTfdGen1::tb_addr(tfd, idx);
+    }
+
+    static inline u16 tb_len(void *tfd, u8 idx)
+    {
+        if (dispatch_trans->cfg->use_tfh)
+            return IwlTfdTfh::tb_len(tfd, idx);
+        return IwlTfdGen1::tb_len(tfd, idx);
+    }
+
+    static inline int set_tb(void *tfd, u8 idx, dma_addr_t addr, u16 len)
+    {
+        if (dispatch_trans->cfg->use_tfh)
+            return IwlTfdTfh::set_tb(tfd, idx, addr, len);
+        return IwlTfdGen1::set_tb(tfd, idx, addr, len);
+    }
+
+    static inline u8 num_tbs(void *tfd)
+    {
+        if (dispatch_trans->cfg->use_tfh)
+            return IwlTfdTfh::num_tbs(tfd);
+        return IwlTfdGen1::num_tbs(tfd);
+    }
+
+    static inline void clear_tbs(void *tfd)
+    {
+        if (dispatch_trans->cfg->use_tfh)
+            IwlTfdTfh::clear_tbs(tfd);
+        else
+            IwlTfdGen1::clear_tbs(tfd);
+    }
+};
+
+static UInt64 now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (UInt64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * iwl_pcie_txq_build_tfd() for each TB of a frame, then what
+ * iwl_pcie_tfd_unmap() does with the TFD once it's reclaimed. Returns
+ * ns per TFD, the ring is left with the last lap's TFDs.
+ */
+template <class Tfd>
+static double bench_tfds(void *tfds, size_t tfd_size, u64 *sum)
+{
+    static const u16 lens[BENCH_TBS] = { IWL_FIRST_TB_SIZE, 40, 1500 };
+    UInt64 t = now_ns();
+
+    for (int n = 0; n < BENCH_TFDS; n++) {
+        void *tfd = (u8 *)tfds + tfd_size * (n % TFD_QUEUE_SIZE_MAX);
+        dma_addr_t addr = 0x1000000000ULL + (u64)n * 0x1000;
+        u8 i, num_tbs;
+
+        memset(tfd, 0, tfd_size);
+        for (i = 0; i < BENCH_TBS; i++)
+            Tfd::set_tb(tfd, Tfd::num_tbs(tfd), addr + i * 0x100, lens[i]);
+
+        num_tbs = Tfd::num_tbs(tfd);
+        for (i = 0; i < num_tbs; i++)
+            *sum += Tfd::tb_addr(tfd, i) + Tfd::tb_len(tfd, i);
+        /* the last lap stays in the ring to be compared */
+        if (n < BENCH_TFDS - TFD_QUEUE_SIZE_MAX)
+            Tfd::clear_tbs(tfd);
+    }
+    return (double)(now_ns() - t) / BENCH_TFDS;
+}
+
+template <class Tfd, class TfdStruct>
+static void bench_tfd(const char *name, bool use_tfh)
+{
+    struct iwl_cfg cfg;
+    struct iwl_trans trans;
+    void *typed = calloc(TFD_QUEUE_SIZE_MAX, sizeof(TfdStruct));
+    void *dispatched = calloc(TFD_QUEUE_SIZE_MAX, sizeof(TfdStruct));
+    u64 typed_sum = 0, dispatched_sum = 0;
+    double typed_ns, dispatched_ns;
+
+    memset(&cfg, 0, sizeof(cfg));
+    memset(&trans, 0, sizeof(trans));
+    cfg.use_tfh = use_tfh;
+    trans.cfg = &cfg;
+    dispatch_trans = &trans;
+
+    typed_ns = bench_tfds<Tfd>(typed, sizeof(TfdStruct), &typed_sum);
+    dispatched_ns = bench_tfds<IwlTfdDispatch>(dispatched, sizeof(TfdStruct), &dispatched_sum);
+
+    CHECK(name, typed_sum == dispatched_sum &&
+          !memcmp(typed, dispatched, TFD_QUEUE_SIZE_MAX * sizeof(TfdStruct)),
+          "the specialized accessors built different TFDs");
+
+    free(typed);
+    free(dispatched);
+
+    printf("ok   %s: build and unmap %.1f ns per TFD, %.1f ns looking at the cfg per call\n",
+           name, typed_ns, dispatched_ns);
+}
+
+int main(void)
+{
+    /* 36 bit bus addresses for the legacy TFD, 64 bit for TFH */
+    check_tx<IwlTfdGen1, struct iwl_tfd>("tx gen1", false, 0xA00000000ULL, IWL_NUM_OF_TBS, IWL_TFD_MAX_TB_LEN);
+    check_tx<IwlTfdTfh, struct iwl_tfh_tfd>("tx tfh", true, 0x0123456700000000ULL, IWL_TFH_NUM_TBS, 0xFFFF);
+    check_rx_legacy();
+    check_rx_mq();
+    bench_tfd<IwlTfdGen1, struct iwl_tfd>("tfd bench gen1", false);
+    bench_tfd<IwlTfdTfh, struct iwl_tfh_tfd>("tfd bench tfh", true);
+
+    if (failures)
+        printf("%d checks failed\n", failures);
+
+    return failures ? 1 : 0;
+}
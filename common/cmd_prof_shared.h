@@ -0,0 +1,66 @@
+//
+//  cmd_prof_shared.h
+//  IntelWifi
+//
+//  Host command and RX handler profiles, per command ID, as iwmc reads
+//  them.
+//
+
+#ifndef cmd_prof_shared_h
+#define cmd_prof_shared_h
+
+#include <stdint.h>
+
+#define IWL_CMD_PROF_NAME_LEN   40
+/* most records a read returns */
+#define IWL_CMD_PROF_MAX_RECS   1024
+
+/**
+ * struct iwl_cmd_prof - counters of one command ID
+ * @count: commands queued to the device
+ * @done: commands the device answered, the ones the times are taken over
+ * @bytes: bytes queued, headers included
+ * @resp_bytes: bytes of the responses
+ * @time_ns: total enqueue to completion time
+ * @max_ns: longest enqueue to completion time
+ */
+struct iwl_cmd_prof {
+    uint32_t count;
+    uint32_t done;
+    uint64_t bytes;
+    uint64_t resp_bytes;
+    uint64_t time_ns;
+    uint64_t max_ns;
+};
+
+struct iwl_cmd_prof_rec {
+    uint32_t id;    /* group << 8 | opcode */
+    uint32_t reserved;
+    struct iwl_cmd_prof prof;
+    char name[IWL_CMD_PROF_NAME_LEN];
+};
+
+/**
+ * struct iwl_rx_prof - counters of the op mode's RX handler for one ID
+ * @count: packets handled
+ * @allocs: iwh_malloc() calls the RX thread made while the handler ran
+ * @bytes: bytes of the packets
+ * @time_ns: total time spent in the handler
+ * @max_ns: longest time spent in the handler for one packet
+ */
+struct iwl_rx_prof {
+    uint32_t count;
+    uint32_t allocs;
+    uint64_t bytes;
+    uint64_t time_ns;
+    uint64_t max_ns;
+};
+
+struct iwl_rx_prof_rec {
+    uint32_t id;    /* group << 8 | opcode */
+    uint32_t reserved;
+    struct iwl_rx_prof prof;
+    char name[IWL_CMD_PROF_NAME_LEN];
+};
+
+#endif /* cmd_prof_shared_h */
@@ -12,6 +12,11 @@
 // User client method dispatch selectors.
 enum {
     kIwlClientScan,
+    kIwlClientFwDump,   // out: dump length, dump number; struct out: iwl_fw_error_dump_file
+    kIwlClientTrace,    // in: position; out: records, next position, lost; struct out: iwl_trace_rec[]
+    kIwlClientLatency,  // in: reset after reading; out: size; struct out: iwl_lat_stats
+    kIwlClientCmdProf,  // in: reset after reading; out: records; struct out: iwl_cmd_prof_rec[]
+    kIwlClientRxProf,   // in: reset after reading; out: records, ns covered, copy failures; struct out: iwl_rx_prof_rec[]
     
     kNumberOfMethods // Must be last
 };
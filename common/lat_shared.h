@@ -0,0 +1,87 @@
+//
+//  lat_shared.h
+//  IntelWifi
+//
+//  Latency histograms the kext keeps for its hot paths, as iwmc reads
+//  them. Buckets are log2 octaves split into IWL_LAT_SUB linear
+//  sub-buckets, so every bucket is within 1/IWL_LAT_SUB of the values
+//  in it. Values are in nanoseconds.
+//
+
+#ifndef lat_shared_h
+#define lat_shared_h
+
+#include <stdint.h>
+
+#define IWL_LAT_SUB_BITS    3
+#define IWL_LAT_SUB         (1 << IWL_LAT_SUB_BITS)
+/* values from 2^IWL_LAT_MAX_BITS ns (~68s) on land in the last bucket */
+#define IWL_LAT_MAX_BITS    36
+#define IWL_LAT_BUCKETS     ((IWL_LAT_MAX_BITS - IWL_LAT_SUB_BITS + 1) * IWL_LAT_SUB)
+
+/* histograms per host command ID, the last one takes the IDs that don't fit */
+#define IWL_LAT_HCMD_SLOTS  24
+#define IWL_LAT_HCMD_USED   0x80000000
+#define IWL_LAT_HCMD_OTHER  0xffffffff
+
+enum iwl_lat_id {
+    IWL_LAT_ISR_RX,             /* interrupt to iwl_pcie_rx_handle */
+    IWL_LAT_TX,                 /* TX enqueue to reclaim */
+    IWL_LAT_FW_LOAD,            /* start_fw, sections copied to the device */
+    IWL_LAT_FW_ALIVE,           /* start_fw done to the ALIVE notification */
+    IWL_LAT_FW_ALIVE_NOTIFY,    /* ALIVE to the op mode's post-ALIVE setup done */
+
+    IWL_LAT_NUM
+};
+
+/**
+ * struct iwl_lat_hist - one latency histogram
+ * @id: enum iwl_lat_id, or the command ID | %IWL_LAT_HCMD_USED for the
+ *  host command ones, 0 while the slot is unused
+ * @count: number of samples
+ * @sum: sum of the samples
+ * @max: largest sample
+ * @buckets: sample count per bucket, see iwl_lat_bucket()
+ */
+struct iwl_lat_hist {
+    uint32_t id;
+    uint32_t reserved;
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint32_t buckets[IWL_LAT_BUCKETS];
+};
+
+struct iwl_lat_stats {
+    struct iwl_lat_hist fixed[IWL_LAT_NUM];
+    struct iwl_lat_hist hcmd[IWL_LAT_HCMD_SLOTS];
+};
+
+static inline uint32_t iwl_lat_bucket(uint64_t ns)
+{
+    uint32_t msb, idx;
+
+    if (ns < IWL_LAT_SUB)
+        return (uint32_t)ns;
+
+    msb = 63 - __builtin_clzll(ns);
+    idx = (msb - IWL_LAT_SUB_BITS + 1) * IWL_LAT_SUB +
+          (uint32_t)((ns >> (msb - IWL_LAT_SUB_BITS)) & (IWL_LAT_SUB - 1));
+
+    return idx < IWL_LAT_BUCKETS ? idx : IWL_LAT_BUCKETS - 1;
+}
+
+/* largest value that falls in bucket @idx */
+static inline uint64_t iwl_lat_bucket_max(uint32_t idx)
+{
+    uint32_t octave = idx / IWL_LAT_SUB;
+    uint64_t lo;
+
+    if (!octave)
+        return idx;
+
+    lo = (uint64_t)(IWL_LAT_SUB + idx % IWL_LAT_SUB) << (octave - 1);
+    return lo + (1ULL << (octave - 1)) - 1;
+}
+
+#endif /* lat_shared_h */
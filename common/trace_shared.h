@@ -0,0 +1,41 @@
+//
+//  trace_shared.h
+//
+//  Binary trace records, shared between the kext and iwmc. The kext only
+//  stores the event id and raw arguments, iwmc does the formatting.
+//
+
+#ifndef trace_shared_h
+#define trace_shared_h
+
+#include <stdint.h>
+
+#define IWL_TRACE_ARGS  4
+
+enum iwl_trace_event {
+    IWL_TRACE_NONE,
+    IWL_TRACE_IRQ,          // inta, inta_mask
+    IWL_TRACE_ICT_READ,     // ict index, value
+    IWL_TRACE_RX,           // rx queue, (group_id << 8) | cmd, sequence, length
+    IWL_TRACE_HCMD,         // (group_id << 8) | cmd, sequence, length, flags
+    IWL_TRACE_TX,           // tx queue, write_ptr, length
+    IWL_TRACE_TX_RECLAIM,   // tx queue, ssn, frames freed
+    
+    IWL_TRACE_EVENT_MAX // Must be last
+};
+
+/**
+ * One trace event. @seq is the event's position in the trace plus one,
+ * truncated to 32 bits and 1 where that is 0. It is written last, so a
+ * record whose @seq doesn't match was torn or overwritten. @ts is in
+ * mach_absolute_time() units.
+ */
+struct iwl_trace_rec {
+    uint64_t ts;
+    uint32_t seq;
+    uint16_t event;
+    uint16_t reserved;
+    uint32_t args[IWL_TRACE_ARGS];
+};
+
+#endif /* trace_shared_h */
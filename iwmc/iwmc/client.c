@@ -98,3 +98,133 @@ void iwmc_scan(struct iwmc_client* client) {
     struct iwmc_priv *priv = IWMC_PRIV(client);
     IOConnectCallScalarMethod(priv->data_port, kIwlClientScan, 0, 0, 0, 0);
 }
+
+/**
+ * Fetch the last firmware error dump. The size is asked for first, a new
+ * dump may land before the second call so retry if it grew meanwhile.
+ */
+int iwmc_fw_dump(struct iwmc_client* client, void **buf, size_t *len, uint32_t *seq) {
+    struct iwmc_priv *priv = IWMC_PRIV(client);
+    uint64_t out[2];
+    uint32_t out_cnt;
+    size_t size = 0;
+    void *data = NULL;
+    kern_return_t kern_result;
+    
+    for (;;) {
+        size_t out_size = size;
+        
+        out_cnt = 2;
+        kern_result = IOConnectCallMethod(priv->data_port, kIwlClientFwDump, NULL, 0, NULL, 0,
+                                          out, &out_cnt, data, &out_size);
+        if (kern_result != KERN_SUCCESS) {
+            free(data);
+            return -1;
+        }
+        
+        if (!out[0]) {
+            free(data);
+            return 1;
+        }
+        
+        if (data && out[0] <= size) {
+            break;
+        }
+        
+        free(data);
+        size = (size_t)out[0];
+        data = malloc(size);
+        if (!data) {
+            return -1;
+        }
+    }
+    
+    *buf = data;
+    *len = (size_t)out[0];
+    *seq = (uint32_t)out[1];
+    return 0;
+}
+
+/**
+ * Read the next chunk of the trace ring
+ */
+int iwmc_trace_read(struct iwmc_client* client, uint64_t *pos, struct iwl_trace_rec *recs,
+                    uint32_t max, uint32_t *lost) {
+    struct iwmc_priv *priv = IWMC_PRIV(client);
+    uint64_t out[3];
+    uint32_t out_cnt = 3;
+    size_t out_size = max * sizeof(*recs);
+    kern_return_t kern_result;
+    
+    kern_result = IOConnectCallMethod(priv->data_port, kIwlClientTrace, pos, 1, NULL, 0,
+                                      out, &out_cnt, recs, &out_size);
+    if (kern_result != KERN_SUCCESS) {
+        return -1;
+    }
+    
+    *pos = out[1];
+    *lost = (uint32_t)out[2];
+    return (int)out[0];
+}
+
+int iwmc_latency_read(struct iwmc_client* client, struct iwl_lat_stats *lat, bool reset) {
+    struct iwmc_priv *priv = IWMC_PRIV(client);
+    uint64_t in = reset;
+    uint64_t len;
+    uint32_t out_cnt = 1;
+    size_t out_size = sizeof(*lat);
+    kern_return_t kern_result;
+    
+    kern_result = IOConnectCallMethod(priv->data_port, kIwlClientLatency, &in, 1, NULL, 0,
+                                      &len, &out_cnt, lat, &out_size);
+    if (kern_result != KERN_SUCCESS) {
+        return -1;
+    }
+    if (!len) {
+        return 1;
+    }
+    
+    /* built against a different layout than the kext */
+    if (len != sizeof(*lat) || out_size != sizeof(*lat)) {
+        return -1;
+    }
+    return 0;
+}
+
+int iwmc_cmd_prof_read(struct iwmc_client* client, struct iwl_cmd_prof_rec *recs,
+                       uint32_t max, bool reset) {
+    struct iwmc_priv *priv = IWMC_PRIV(client);
+    uint64_t in = reset;
+    uint64_t n;
+    uint32_t out_cnt = 1;
+    size_t out_size = max * sizeof(*recs);
+    kern_return_t kern_result;
+    
+    kern_result = IOConnectCallMethod(priv->data_port, kIwlClientCmdProf, &in, 1, NULL, 0,
+                                      &n, &out_cnt, recs, &out_size);
+    if (kern_result != KERN_SUCCESS) {
+        return -1;
+    }
+    
+    return (int)n;
+}
+
+int iwmc_rx_prof_read(struct iwmc_client* client, struct iwl_rx_prof_rec *recs,
+                      uint32_t max, bool reset, uint64_t *elapsed_ns, uint32_t *copy_fails) {
+    struct iwmc_priv *priv = IWMC_PRIV(client);
+    uint64_t in = reset;
+    uint64_t out[3];
+    uint32_t out_cnt = 3;
+    size_t out_size = max * sizeof(*recs);
+    kern_return_t kern_result;
+    
+    kern_result = IOConnectCallMethod(priv->data_port, kIwlClientRxProf, &in, 1, NULL, 0,
+                                      out, &out_cnt, recs, &out_size);
+    if (kern_result != KERN_SUCCESS) {
+        return -1;
+    }
+    
+    *elapsed_ns = out[1];
+    *copy_fails = (uint32_t)out[2];
+    return (int)out[0];
+}
@@ -10,6 +10,12 @@
 #define client_h
 
 #include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "trace_shared.h"
+#include "lat_shared.h"
+#include "cmd_prof_shared.h"
 
 struct iwmc_client {
     void *priv;
@@ -27,5 +33,38 @@ void iwmc_free(struct iwmc_client* client);
  */
 void iwmc_scan(struct iwmc_client* client);
 
+/*
+ * Fetch the last firmware error dump into a malloc'ed buffer.
+ * Returns 0 on success, 1 if there is no dump, -1 on failure.
+ */
+int iwmc_fw_dump(struct iwmc_client* client, void **buf, size_t *len, uint32_t *seq);
+
+/*
+ * Read up to @max trace records starting at *@pos, *@pos is advanced past
+ * them. Returns the number of records read or -1 on failure.
+ */
+int iwmc_trace_read(struct iwmc_client* client, uint64_t *pos, struct iwl_trace_rec *recs,
+                    uint32_t max, uint32_t *lost);
+
+/*
+ * Read the latency histograms, and clear them in the kext if @reset is set.
+ * Returns 0 on success, 1 if the kext has none, -1 on failure.
+ */
+int iwmc_latency_read(struct iwmc_client* client, struct iwl_lat_stats *lat, bool reset);
+
+/*
+ * Read the profile of up to @max host command IDs, and clear it in the kext
+ * if @reset is set. Returns the number of records or -1 on failure.
+ */
+int iwmc_cmd_prof_read(struct iwmc_client* client, struct iwl_cmd_prof_rec *recs,
+                       uint32_t max, bool reset);
+
+/*
+ * Same for the RX handler profile, *@elapsed_ns is the time it covers and
+ * *@copy_fails the packets the kext lost because it couldn't copy them.
+ */
+int iwmc_rx_prof_read(struct iwmc_client* client, struct iwl_rx_prof_rec *recs,
+                      uint32_t max, bool reset, uint64_t *elapsed_ns, uint32_t *copy_fails);
+
 
 #endif /* client_h */
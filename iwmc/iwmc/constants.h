@@ -15,6 +15,14 @@
  * Commands
  */
 #define IWMC_CMD_SCAN "scan"
+#define IWMC_CMD_FWDUMP "fwdump"
+#define IWMC_CMD_TRACE "trace"
+#define IWMC_CMD_STATS "stats"
+#define IWMC_CMD_CMDS "cmds"
+#define IWMC_CMD_RXPROF "rxprof"
+
+#define IWMC_FWDUMP_DEFAULT_FILE "iwl-fw-dump.bin"
+#define IWMC_CMDS_DEFAULT_TOP 10
 
 
 #endif /* constants_h */
@@ -0,0 +1,251 @@
+//
+//  fwdump.c
+//  iwmc
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fwdump.h"
+
+/* from iwlwifi fw/error-dump.h, the dump is little endian */
+#define IWL_FW_ERROR_DUMP_BARKER    0x14789632
+
+enum {
+    IWL_FW_ERROR_DUMP_CSR = 1,
+    IWL_FW_ERROR_DUMP_RXF = 2,
+    IWL_FW_ERROR_DUMP_TXCMD = 3,
+    IWL_FW_ERROR_DUMP_DEV_FW_INFO = 4,
+    IWL_FW_ERROR_DUMP_FW_MONITOR = 5,
+    IWL_FW_ERROR_DUMP_PRPH = 6,
+    IWL_FW_ERROR_DUMP_TXF = 7,
+    IWL_FW_ERROR_DUMP_FH_REGS = 8,
+    IWL_FW_ERROR_DUMP_MEM = 9,
+    IWL_FW_ERROR_DUMP_ERROR_INFO = 10,
+    IWL_FW_ERROR_DUMP_RB = 11,
+    IWL_FW_ERROR_DUMP_PAGING = 12,
+    IWL_FW_ERROR_DUMP_RADIO_REG = 13,
+    IWL_FW_ERROR_DUMP_INTERNAL_TXF = 14,
+    IWL_FW_ERROR_DUMP_EXTERNAL = 15,
+    IWL_FW_ERROR_DUMP_MEM_CFG = 16,
+};
+
+#define FH_MEM_LOWER_BOUND          0x1000
+#define FH_MEM_LOWER_BOUND_GEN2     0xa06000
+
+/* struct iwl_fw_error_dump_file and struct iwl_fw_error_dump_data headers */
+#define DUMP_FILE_HDR_LEN   8
+#define DUMP_DATA_HDR_LEN   8
+
+static const char *const seg_names[] = {
+    [IWL_FW_ERROR_DUMP_CSR] = "CSR",
+    [IWL_FW_ERROR_DUMP_RXF] = "RXF",
+    [IWL_FW_ERROR_DUMP_TXCMD] = "TXCMD",
+    [IWL_FW_ERROR_DUMP_DEV_FW_INFO] = "DEV_FW_INFO",
+    [IWL_FW_ERROR_DUMP_FW_MONITOR] = "FW_MONITOR",
+    [IWL_FW_ERROR_DUMP_PRPH] = "PRPH",
+    [IWL_FW_ERROR_DUMP_TXF] = "TXF",
+    [IWL_FW_ERROR_DUMP_FH_REGS] = "FH_REGS",
+    [IWL_FW_ERROR_DUMP_MEM] = "MEM",
+    [IWL_FW_ERROR_DUMP_ERROR_INFO] = "ERROR_INFO",
+    [IWL_FW_ERROR_DUMP_RB] = "RB",
+    [IWL_FW_ERROR_DUMP_PAGING] = "PAGING",
+    [IWL_FW_ERROR_DUMP_RADIO_REG] = "RADIO_REG",
+    [IWL_FW_ERROR_DUMP_INTERNAL_TXF] = "INTERNAL_TXF",
+    [IWL_FW_ERROR_DUMP_EXTERNAL] = "EXTERNAL",
+    [IWL_FW_ERROR_DUMP_MEM_CFG] = "MEM_CFG",
+};
+
+static uint32_t get_le32(const uint8_t *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint16_t get_le16(const uint8_t *p) {
+    return (uint16_t)(p[0] | p[1] << 8);
+}
+
+static const char *seg_name(uint32_t type) {
+    if (type < sizeof(seg_names) / sizeof(seg_names[0]) && seg_names[type])
+        return seg_names[type];
+    return "UNKNOWN";
+}
+
+/* registers, four per line, prefixed with the address of the first one */
+static void print_regs(FILE *out, uint32_t base, const uint8_t *data, uint32_t len) {
+    uint32_t i;
+    
+    for (i = 0; i + 4 <= len; i += 4) {
+        if (i % 16 == 0)
+            fprintf(out, "    %08x:", base + i);
+        fprintf(out, " %08x", get_le32(data + i));
+        if (i % 16 == 12 || i + 8 > len)
+            fputc('\n', out);
+    }
+}
+
+/* struct iwl_cmd_header: cmd, group_id, sequence */
+static void print_cmd_hdr(FILE *out, const uint8_t *hdr) {
+    fprintf(out, "cmd 0x%02x group 0x%02x seq 0x%04x", hdr[0], hdr[1], get_le16(hdr + 2));
+}
+
+static int decode_txcmd(FILE *out, const uint8_t *data, uint32_t len) {
+    uint32_t pos = 0;
+    
+    while (pos < len) {
+        uint32_t cmdlen, caplen;
+        
+        if (len - pos < 8)
+            return -1;
+        cmdlen = get_le32(data + pos);
+        caplen = get_le32(data + pos + 4);
+        pos += 8;
+        if (caplen > len - pos)
+            return -1;
+        
+        fprintf(out, "    ");
+        if (caplen >= 4)
+            print_cmd_hdr(out, data + pos);
+        fprintf(out, " len %u captured %u\n", cmdlen, caplen);
+        pos += caplen;
+    }
+    
+    return 0;
+}
+
+static int decode_rb(FILE *out, const uint8_t *data, uint32_t len) {
+    const uint8_t *pkt;
+    
+    /* struct iwl_fw_error_dump_rb: index, rxq, reserved */
+    if (len < 12)
+        return -1;
+    
+    fprintf(out, "    rxq %u index %u", get_le32(data + 4), get_le32(data));
+    
+    /* struct iwl_rx_packet: len_n_flags, then the command header */
+    pkt = data + 12;
+    if (len >= 12 + 8) {
+        fprintf(out, " len_n_flags 0x%08x ", get_le32(pkt));
+        print_cmd_hdr(out, pkt + 4);
+    }
+    fputc('\n', out);
+    
+    return 0;
+}
+
+static int decode_seg(FILE *out, uint32_t type, const uint8_t *data, uint32_t len) {
+    switch (type) {
+        case IWL_FW_ERROR_DUMP_CSR:
+            print_regs(out, 0, data, len);
+            return 0;
+        case IWL_FW_ERROR_DUMP_FH_REGS:
+            /* the kext dumps 0x1000 bytes on older devices, 0x2000 from 22000 on */
+            print_regs(out, len > 0x1000 ? FH_MEM_LOWER_BOUND_GEN2 : FH_MEM_LOWER_BOUND, data, len);
+            return 0;
+        case IWL_FW_ERROR_DUMP_PRPH:
+            /* struct iwl_fw_error_dump_prph: prph_start, then the registers */
+            if (len < 4)
+                return -1;
+            print_regs(out, get_le32(data), data + 4, len - 4);
+            return 0;
+        case IWL_FW_ERROR_DUMP_MEM:
+            /* struct iwl_fw_error_dump_mem: type, offset, then the memory */
+            if (len < 8)
+                return -1;
+            fprintf(out, "    %s\n", get_le32(data) ? "SMEM" : "SRAM");
+            print_regs(out, get_le32(data + 4), data + 8, len - 8);
+            return 0;
+        case IWL_FW_ERROR_DUMP_TXCMD:
+            return decode_txcmd(out, data, len);
+        case IWL_FW_ERROR_DUMP_RB:
+            return decode_rb(out, data, len);
+        default:
+            return 0;
+    }
+}
+
+int iwmc_fwdump_decode(FILE *out, const uint8_t *buf, size_t len) {
+    uint32_t file_len, pos;
+    
+    if (len < DUMP_FILE_HDR_LEN || get_le32(buf) != IWL_FW_ERROR_DUMP_BARKER) {
+        fprintf(out, "not a firmware error dump\n");
+        return -1;
+    }
+    
+    file_len = get_le32(buf + 4);
+    if (file_len < DUMP_FILE_HDR_LEN || file_len > len) {
+        fprintf(out, "bad file length %u (have %zu bytes)\n", file_len, len);
+        return -1;
+    }
+    
+    fprintf(out, "firmware error dump, %u bytes\n", file_len);
+    
+    for (pos = DUMP_FILE_HDR_LEN; pos < file_len; ) {
+        uint32_t type, seg_len;
+        
+        if (file_len - pos < DUMP_DATA_HDR_LEN) {
+            fprintf(out, "truncated segment header at 0x%x\n", pos);
+            return -1;
+        }
+        
+        type = get_le32(buf + pos);
+        seg_len = get_le32(buf + pos + 4);
+        pos += DUMP_DATA_HDR_LEN;
+        
+        if (seg_len > file_len - pos) {
+            fprintf(out, "segment %s at 0x%x runs past the end (%u bytes)\n", seg_name(type),
+                    pos - DUMP_DATA_HDR_LEN, seg_len);
+            return -1;
+        }
+        
+        fprintf(out, "%s (%u), %u bytes\n", seg_name(type), type, seg_len);
+        if (decode_seg(out, type, buf + pos, seg_len)) {
+            fprintf(out, "malformed %s segment\n", seg_name(type));
+            return -1;
+        }
+        
+        pos += seg_len;
+    }
+    
+    return 0;
+}
+
+#ifdef IWMC_FWDUMP_MAIN
+int main(int argc, const char *argv[]) {
+    FILE *f;
+    uint8_t *buf;
+    long len;
+    int ret;
+    
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s <dump file>\n", argv[0]);
+        return 1;
+    }
+    
+    f = fopen(argv[1], "rb");
+    if (!f) {
+        perror(argv[1]);
+        return 1;
+    }
+    
+    if (fseek(f, 0, SEEK_END) || (len = ftell(f)) < 0 || fseek(f, 0, SEEK_SET)) {
+        perror(argv[1]);
+        fclose(f);
+        return 1;
+    }
+    
+    buf = malloc(len ? len : 1);
+    if (!buf || fread(buf, 1, len, f) != (size_t)len) {
+        fprintf(stderr, "failed to read %s\n", argv[1]);
+        free(buf);
+        fclose(f);
+        return 1;
+    }
+    fclose(f);
+    
+    ret = iwmc_fwdump_decode(stdout, buf, len);
+    free(buf);
+    
+    return ret ? 1 : 0;
+}
+#endif
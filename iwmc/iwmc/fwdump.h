@@ -0,0 +1,24 @@
+//
+//  fwdump.h
+//  iwmc
+//
+//  Decoder for the firmware error dumps (struct iwl_fw_error_dump_file) the
+//  kext collects. It only depends on libc, so it also builds on Linux:
+//
+//      cc -DIWMC_FWDUMP_MAIN -o iwl-fwdump fwdump.c
+//
+
+#ifndef fwdump_h
+#define fwdump_h
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Print a human readable description of the dump in @buf to @out.
+ * Returns 0 on success, -1 if the dump is malformed (whatever could be
+ * decoded up to that point is printed).
+ */
+int iwmc_fwdump_decode(FILE *out, const uint8_t *buf, size_t len);
+
+#endif /* fwdump_h */
@@ -12,16 +12,180 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <string.h>
+#include <unistd.h>
+
+#include <mach/mach_time.h>
 
 #include "logging.h"
 #include "constants.h"
 #include "client.h"
+#include "fwdump.h"
+#include "trace.h"
+#include "stats.h"
+
+#define IWMC_TRACE_CHUNK 512
+#define IWMC_TRACE_POLL_US 100000
+
+
+/**
+ * Save the last firmware error dump to @path and print what's in it
+ */
+static int fwdump(struct iwmc_client *client, const char *path) {
+    void *buf;
+    size_t len;
+    uint32_t seq;
+    FILE *f;
+    int ret;
+    
+    ret = iwmc_fw_dump(client, &buf, &len, &seq);
+    if (ret < 0) {
+        error("Failed to fetch firmware error dump\n");
+        return 1;
+    }
+    if (ret > 0) {
+        log("No firmware error dump collected\n");
+        return 0;
+    }
+    
+    f = fopen(path, "wb");
+    if (!f || fwrite(buf, 1, len, f) != len) {
+        error("Failed to write firmware error dump\n");
+        if (f) {
+            fclose(f);
+        }
+        free(buf);
+        return 1;
+    }
+    fclose(f);
+    
+    printf("Firmware error dump #%u (%zu bytes) written to %s\n", seq, len, path);
+    ret = iwmc_fwdump_decode(stdout, buf, len);
+    free(buf);
+    
+    return ret ? 1 : 0;
+}
 
+/**
+ * Print the trace ring, and keep polling it if @follow is set
+ */
+static int trace(struct iwmc_client *client, bool follow) {
+    struct iwl_trace_rec recs[IWMC_TRACE_CHUNK];
+    mach_timebase_info_data_t timebase;
+    double ns_per_tick;
+    uint64_t pos = 0, base = 0;
+    uint32_t lost;
+    int n;
+    
+    mach_timebase_info(&timebase);
+    ns_per_tick = (double)timebase.numer / timebase.denom;
+    
+    for (;;) {
+        n = iwmc_trace_read(client, &pos, recs, IWMC_TRACE_CHUNK, &lost);
+        if (n < 0) {
+            error("Failed to read the trace\n");
+            return 1;
+        }
+        if (lost) {
+            printf("... %u events lost\n", lost);
+        }
+        iwmc_trace_print(stdout, recs, (uint32_t)n, ns_per_tick, &base);
+        
+        if (n == IWMC_TRACE_CHUNK) {
+            continue;
+        }
+        if (!follow) {
+            return 0;
+        }
+        fflush(stdout);
+        usleep(IWMC_TRACE_POLL_US);
+    }
+}
+
+/**
+ * Print the latency histograms, then clear them if @reset is set
+ */
+static int stats(struct iwmc_client *client, bool reset) {
+    struct iwl_lat_stats *lat = malloc(sizeof(*lat));
+    int ret;
+    
+    if (!lat) {
+        error("Out of memory\n");
+        return 1;
+    }
+    
+    ret = iwmc_latency_read(client, lat, reset);
+    if (ret < 0) {
+        error("Failed to read the latency histograms\n");
+    } else if (ret > 0) {
+        log("No latency histograms\n");
+    } else {
+        iwmc_lat_print(stdout, lat);
+    }
+    
+    free(lat);
+    return ret < 0 ? 1 : 0;
+}
+
+/**
+ * Print the @top host commands the most time went to, then clear the
+ * profile if @reset is set
+ */
+static int cmds(struct iwmc_client *client, uint32_t top, bool reset) {
+    struct iwl_cmd_prof_rec *recs = calloc(IWL_CMD_PROF_MAX_RECS, sizeof(*recs));
+    int n;
+    
+    if (!recs) {
+        error("Out of memory\n");
+        return 1;
+    }
+    
+    n = iwmc_cmd_prof_read(client, recs, IWL_CMD_PROF_MAX_RECS, reset);
+    if (n < 0) {
+        error("Failed to read the command profile\n");
+    } else if (!n) {
+        log("No host commands sent\n");
+    } else {
+        iwmc_cmd_prof_print(stdout, recs, (uint32_t)n, top);
+    }
+    
+    free(recs);
+    return n < 0 ? 1 : 0;
+}
+
+/**
+ * Print the RX handler profile, then clear it if @reset is set
+ */
+static int rxprof(struct iwmc_client *client, bool reset) {
+    struct iwl_rx_prof_rec *recs = calloc(IWL_CMD_PROF_MAX_RECS, sizeof(*recs));
+    uint64_t elapsed_ns;
+    uint32_t copy_fails;
+    int n;
+    
+    if (!recs) {
+        error("Out of memory\n");
+        return 1;
+    }
+    
+    n = iwmc_rx_prof_read(client, recs, IWL_CMD_PROF_MAX_RECS, reset, &elapsed_ns, &copy_fails);
+    if (n < 0) {
+        error("Failed to read the RX handler profile, the driver keeps one only if built with CONFIG_IWLWIFI_RX_PROF\n");
+    } else if (!n) {
+        log("No packets handled\n");
+    } else {
+        iwmc_rx_prof_print(stdout, recs, (uint32_t)n, elapsed_ns);
+    }
+    if (n >= 0 && copy_fails) {
+        printf("%u packets dropped, no memory to copy them out of the RX buffer\n", copy_fails);
+    }
+    
+    free(recs);
+    return n < 0 ? 1 : 0;
+}
 
 int main(int argc, const char * argv[]) {
     
     if (argc < 2) {
-        error("Provide command. Available commands: scan\n");
+        error("Provide command. Available commands: scan, fwdump [file], trace [-f], stats [-r], cmds [N] [-r], rxprof [-r]\n");
         return 1;
     }
     
@@ -32,14 +196,35 @@ int main(int argc, const char * argv[]) {
     }
     
     const char *cmd_name = argv[1];
+    int ret = 0;
     
     if (strcmp(cmd_name, IWMC_CMD_SCAN) == 0) {
         iwmc_scan(client);
         log("Scan command sent to client");
+    } else if (strcmp(cmd_name, IWMC_CMD_FWDUMP) == 0) {
+        ret = fwdump(client, argc > 2 ? argv[2] : IWMC_FWDUMP_DEFAULT_FILE);
+    } else if (strcmp(cmd_name, IWMC_CMD_TRACE) == 0) {
+        ret = trace(client, argc > 2 && strcmp(argv[2], "-f") == 0);
+    } else if (strcmp(cmd_name, IWMC_CMD_STATS) == 0) {
+        ret = stats(client, argc > 2 && strcmp(argv[2], "-r") == 0);
+    } else if (strcmp(cmd_name, IWMC_CMD_CMDS) == 0) {
+        uint32_t top = IWMC_CMDS_DEFAULT_TOP;
+        bool reset = false;
+        
+        for (int i = 2; i < argc; i++) {
+            if (strcmp(argv[i], "-r") == 0) {
+                reset = true;
+            } else {
+                top = (uint32_t)strtoul(argv[i], NULL, 10);
+            }
+        }
+        ret = cmds(client, top, reset);
+    } else if (strcmp(cmd_name, IWMC_CMD_RXPROF) == 0) {
+        ret = rxprof(client, argc > 2 && strcmp(argv[2], "-r") == 0);
     }
     
     iwmc_free(client);
     client = NULL;
     
-    return 0;
+    return ret;
 }
@@ -0,0 +1,151 @@
+//
+//  stats.c
+//  iwmc
+//
+
+#include <stdlib.h>
+
+#include "stats.h"
+
+static const char *const lat_names[IWL_LAT_NUM] = {
+    [IWL_LAT_ISR_RX] = "isr -> rx",
+    [IWL_LAT_TX] = "tx -> reclaim",
+    [IWL_LAT_FW_LOAD] = "fw load",
+    [IWL_LAT_FW_ALIVE] = "fw alive",
+    [IWL_LAT_FW_ALIVE_NOTIFY] = "fw alive notify",
+};
+
+uint64_t iwmc_lat_percentile(const struct iwl_lat_hist *h, double q) {
+    uint64_t rank, seen = 0;
+    uint32_t i;
+    
+    if (!h->count) {
+        return 0;
+    }
+    
+    /* nearest rank: the smallest sample at least a fraction @q of them don't exceed */
+    rank = (uint64_t)(q * h->count);
+    if (rank < q * h->count || !rank) {
+        rank++;
+    }
+    
+    for (i = 0; i < IWL_LAT_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= rank) {
+            uint64_t v = iwl_lat_bucket_max(i);
+            
+            return v < h->max ? v : h->max;
+        }
+    }
+    
+    /* the buckets were read while being updated */
+    return h->max;
+}
+
+static void lat_print_hist(FILE *out, const char *name, const struct iwl_lat_hist *h) {
+    if (!h->count) {
+        return;
+    }
+    
+    fprintf(out, "%-20s %10llu %10.1f %10.1f %10.1f %10.1f %10.1f\n", name,
+            (unsigned long long)h->count,
+            (double)h->sum / h->count / 1000.0,
+            iwmc_lat_percentile(h, 0.5) / 1000.0,
+            iwmc_lat_percentile(h, 0.99) / 1000.0,
+            iwmc_lat_percentile(h, 0.999) / 1000.0,
+            h->max / 1000.0);
+}
+
+void iwmc_lat_print(FILE *out, const struct iwl_lat_stats *lat) {
+    char name[32];
+    uint32_t i;
+    
+    fprintf(out, "%-20s %10s %10s %10s %10s %10s %10s\n", "latency (us)",
+            "count", "mean", "p50", "p99", "p999", "max");
+    
+    for (i = 0; i < IWL_LAT_NUM; i++) {
+        lat_print_hist(out, lat_names[i] ? lat_names[i] : "?", &lat->fixed[i]);
+    }
+    
+    for (i = 0; i < IWL_LAT_HCMD_SLOTS; i++) {
+        const struct iwl_lat_hist *h = &lat->hcmd[i];
+        
+        if (h->id == IWL_LAT_HCMD_OTHER) {
+            snprintf(name, sizeof(name), "hcmd other");
+        } else {
+            snprintf(name, sizeof(name), "hcmd 0x%04x", h->id & ~IWL_LAT_HCMD_USED);
+        }
+        lat_print_hist(out, name, h);
+    }
+}
+
+static int cmd_prof_cmp(const void *a, const void *b) {
+    const struct iwl_cmd_prof_rec *ra = a, *rb = b;
+    
+    if (ra->prof.time_ns != rb->prof.time_ns) {
+        return ra->prof.time_ns < rb->prof.time_ns ? 1 : -1;
+    }
+    return ra->prof.count < rb->prof.count ? 1 : ra->prof.count > rb->prof.count ? -1 : 0;
+}
+
+void iwmc_cmd_prof_print(FILE *out, struct iwl_cmd_prof_rec *recs, uint32_t n, uint32_t top) {
+    uint32_t i;
+    
+    qsort(recs, n, sizeof(*recs), cmd_prof_cmp);
+    if (top > n) {
+        top = n;
+    }
+    
+    fprintf(out, "%-6s %-32s %8s %8s %10s %10s %10s %10s %10s\n", "id", "command",
+            "sent", "done", "bytes", "resp", "total ms", "mean us", "max us");
+    
+    for (i = 0; i < top; i++) {
+        const struct iwl_cmd_prof_rec *rec = &recs[i];
+        const struct iwl_cmd_prof *prof = &rec->prof;
+        
+        fprintf(out, "0x%04x %-32.*s %8u %8u %10llu %10llu %10.3f %10.1f %10.1f\n", rec->id,
+                (int)sizeof(rec->name), rec->name, prof->count, prof->done,
+                (unsigned long long)prof->bytes, (unsigned long long)prof->resp_bytes,
+                prof->time_ns / 1e6,
+                prof->done ? (double)prof->time_ns / prof->done / 1000.0 : 0.0,
+                prof->max_ns / 1000.0);
+    }
+}
+
+static int rx_prof_cmp(const void *a, const void *b) {
+    const struct iwl_rx_prof_rec *ra = a, *rb = b;
+    
+    if (ra->prof.time_ns != rb->prof.time_ns) {
+        return ra->prof.time_ns < rb->prof.time_ns ? 1 : -1;
+    }
+    return ra->prof.count < rb->prof.count ? 1 : ra->prof.count > rb->prof.count ? -1 : 0;
+}
+
+void iwmc_rx_prof_print(FILE *out, struct iwl_rx_prof_rec *recs, uint32_t n, uint64_t elapsed_ns) {
+    double secs = elapsed_ns / 1e9;
+    uint64_t count = 0, time_ns = 0;
+    uint32_t i;
+    
+    qsort(recs, n, sizeof(*recs), rx_prof_cmp);
+    
+    fprintf(out, "%-6s %-32s %10s %10s %10s %10s %10s\n", "id", "handler",
+            "packets", "pkts/s", "mean ns", "max ns", "allocs/pkt");
+    
+    for (i = 0; i < n; i++) {
+        const struct iwl_rx_prof_rec *rec = &recs[i];
+        const struct iwl_rx_prof *prof = &rec->prof;
+        
+        fprintf(out, "0x%04x %-32.*s %10u %10.1f %10.0f %10llu %10.2f\n", rec->id,
+                (int)sizeof(rec->name), rec->name, prof->count,
+                secs > 0 ? prof->count / secs : 0.0,
+                (double)prof->time_ns / prof->count,
+                (unsigned long long)prof->max_ns,
+                (double)prof->allocs / prof->count);
+        count += prof->count;
+        time_ns += prof->time_ns;
+    }
+    
+    fprintf(out, "%llu packets in %.3f s, %.1f pkts/s, %.1f%% of the time in handlers\n",
+            (unsigned long long)count, secs, secs > 0 ? count / secs : 0.0,
+            elapsed_ns ? 100.0 * time_ns / elapsed_ns : 0.0);
+}
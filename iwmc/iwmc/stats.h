@@ -0,0 +1,42 @@
+//
+//  stats.h
+//  iwmc
+//
+//  Rendering of the kext's latency histograms.
+//
+
+#ifndef stats_h
+#define stats_h
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "lat_shared.h"
+#include "cmd_prof_shared.h"
+
+/*
+ * Value below which a fraction @q of the samples of @h fall, rounded up to
+ * the end of its bucket. 0 if there are no samples.
+ */
+uint64_t iwmc_lat_percentile(const struct iwl_lat_hist *h, double q);
+
+/*
+ * Print one line per histogram with samples: count, mean, p50, p99, p999
+ * and max in microseconds.
+ */
+void iwmc_lat_print(FILE *out, const struct iwl_lat_stats *lat);
+
+/*
+ * Sort @recs by the total time spent in them and print the first @top:
+ * counts, bytes, and mean and max round trip in microseconds.
+ */
+void iwmc_cmd_prof_print(FILE *out, struct iwl_cmd_prof_rec *recs, uint32_t n, uint32_t top);
+
+/*
+ * Sort @recs by the total time spent in them and print them all: packets
+ * per second over @elapsed_ns, mean and max ns per packet and allocations
+ * per packet.
+ */
+void iwmc_rx_prof_print(FILE *out, struct iwl_rx_prof_rec *recs, uint32_t n, uint64_t elapsed_ns);
+
+#endif /* stats_h */
@@ -0,0 +1,39 @@
+//
+//  trace.c
+//  iwmc
+//
+
+#include "trace.h"
+
+/* every format takes all IWL_TRACE_ARGS arguments, the unused ones are ignored */
+static const char *const trace_fmts[IWL_TRACE_EVENT_MAX] = {
+    [IWL_TRACE_IRQ] = "irq inta 0x%08x mask 0x%08x",
+    [IWL_TRACE_ICT_READ] = "ict_read index %u value 0x%08x",
+    [IWL_TRACE_RX] = "rx q%u cmd 0x%04x seq 0x%04x len %u",
+    [IWL_TRACE_HCMD] = "hcmd cmd 0x%04x seq 0x%04x len %u flags 0x%x",
+    [IWL_TRACE_TX] = "tx q%u idx %u len %u",
+    [IWL_TRACE_TX_RECLAIM] = "reclaim q%u ssn %u freed %u",
+};
+
+void iwmc_trace_print(FILE *out, const struct iwl_trace_rec *recs, uint32_t n,
+                      double ns_per_tick, uint64_t *base) {
+    uint32_t i;
+    
+    for (i = 0; i < n; i++) {
+        const struct iwl_trace_rec *rec = &recs[i];
+        const char *fmt = rec->event < IWL_TRACE_EVENT_MAX ? trace_fmts[rec->event] : NULL;
+        
+        if (!*base) {
+            *base = rec->ts;
+        }
+        
+        fprintf(out, "%12.3f ", rec->ts >= *base ? (rec->ts - *base) * ns_per_tick / 1000.0 : 0.0);
+        if (fmt) {
+            fprintf(out, fmt, rec->args[0], rec->args[1], rec->args[2], rec->args[3]);
+        } else {
+            fprintf(out, "event %u: 0x%08x 0x%08x 0x%08x 0x%08x", rec->event,
+                    rec->args[0], rec->args[1], rec->args[2], rec->args[3]);
+        }
+        fputc('\n', out);
+    }
+}
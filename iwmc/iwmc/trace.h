@@ -0,0 +1,24 @@
+//
+//  trace.h
+//  iwmc
+//
+//  Rendering of the kext's binary trace records.
+//
+
+#ifndef trace_h
+#define trace_h
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "trace_shared.h"
+
+/*
+ * Print @n records, one per line. Timestamps are shown in microseconds
+ * relative to *@base, which is set from the first record if it is 0.
+ * @ns_per_tick converts the kext's mach_absolute_time() units.
+ */
+void iwmc_trace_print(FILE *out, const struct iwl_trace_rec *recs, uint32_t n,
+                      double ns_per_tick, uint64_t *base);
+
+#endif /* trace_h */